@@ -0,0 +1,205 @@
+#include "ibus_busload.h"
+#include <string.h>
+
+#define RING_SLOTS  (IBUS_BUSLOAD_SLOTS + 1u)
+
+/* Time the line needs for `bytes` at 9600 8E1 */
+static uint64_t busload_wire_us(uint64_t bytes)
+{
+    return bytes * IBUS_BUSLOAD_BITS_PER_BYTE * 1000000u / IBUS_BUSLOAD_BAUD;
+}
+
+uint32_t ibus_busload_permille(uint64_t bytes, uint64_t us)
+{
+    if (us == 0)
+        return 0;
+    return (uint32_t)(bytes * IBUS_BUSLOAD_BITS_PER_BYTE * 1000000000u /
+                      ((uint64_t)IBUS_BUSLOAD_BAUD * us));
+}
+
+static int bit_test(const uint8_t *map, uint8_t bit)
+{
+    return (map[bit >> 3] >> (bit & 7)) & 1;
+}
+
+/* Sum of the completed slots (all but the current one; older are zero) */
+static void busload_window(const ibus_busload_t *bl, uint8_t sender,
+                           ibus_busload_count_t *c)
+{
+    c->frames = 0;
+    c->bytes  = 0;
+    for (unsigned i = 0; i < RING_SLOTS; ++i) {
+        if (i == bl->current)
+            continue;
+        c->frames += bl->slot[i].sender[sender].frames;
+        c->bytes  += bl->slot[i].sender[sender].bytes;
+    }
+}
+
+/* Babbling: measured against the whole window, so a short burst while the
+ * window fills is not enough */
+static void busload_babble_check(ibus_busload_t *bl)
+{
+    uint64_t window_us = (uint64_t)IBUS_BUSLOAD_SLOTS * IBUS_BUSLOAD_SLOT_US;
+
+    if (bl->babble_pct == 0)
+        return;
+
+    for (unsigned s = 0; s < 256; ++s) {
+        ibus_busload_count_t c;
+        busload_window(bl, (uint8_t)s, &c);
+
+        int now = c.bytes != 0 &&
+                  ibus_busload_permille(c.bytes, window_us) >= bl->babble_pct * 10u;
+        if (now == bit_test(bl->babbling, (uint8_t)s))
+            continue;
+
+        bl->babbling[s >> 3]       ^= (uint8_t)(1u << (s & 7));
+        bl->babble_changed[s >> 3] ^= (uint8_t)(1u << (s & 7));
+        if (now)
+            bl->babble_events++;
+    }
+}
+
+static void busload_rotate(ibus_busload_t *bl, uint64_t now_us)
+{
+    uint64_t steps;
+
+    if (now_us < bl->slot_start_us + IBUS_BUSLOAD_SLOT_US)
+        return;
+    steps = (now_us - bl->slot_start_us) / IBUS_BUSLOAD_SLOT_US;
+
+    if (bl->slot[bl->current].line_bytes > bl->peak_line_bytes)
+        bl->peak_line_bytes = bl->slot[bl->current].line_bytes;
+
+    /* After a long silence every slot is simply empty */
+    for (uint64_t i = 0; i < steps && i < RING_SLOTS; ++i) {
+        bl->current = (bl->current + 1u) % RING_SLOTS;
+        memset(&bl->slot[bl->current], 0, sizeof(bl->slot[0]));
+    }
+    bl->slot_start_us += steps * IBUS_BUSLOAD_SLOT_US;
+    bl->completed = steps >= IBUS_BUSLOAD_SLOTS - bl->completed ?
+                    IBUS_BUSLOAD_SLOTS : bl->completed + (unsigned)steps;
+
+    busload_babble_check(bl);
+}
+
+void ibus_busload_reset(ibus_busload_t *bl, uint32_t babble_pct, uint64_t now_us)
+{
+    memset(bl, 0, sizeof(*bl));
+    bl->babble_pct    = babble_pct;
+    bl->slot_start_us = now_us;
+    ibus_hist_reset(&bl->gap);
+}
+
+/* A valid frame of `len` bytes from `sender`, whose last byte came at `end` */
+static void busload_frame(ibus_busload_t *bl, uint8_t sender, uint16_t len, uint64_t end)
+{
+    ibus_busload_slot_t *slot = &bl->slot[bl->current];
+
+    bl->frames++;
+    slot->total.frames++;
+    slot->total.bytes += len;
+    slot->sender[sender].frames++;
+    slot->sender[sender].bytes += len;
+
+    /*
+     * Receive timestamps are per read(), not per byte: take the last byte's
+     * and go back the frame's time on the wire to find where it started.
+     */
+    if (bl->last_frame_end_us != 0) {
+        uint64_t wire  = busload_wire_us(len);
+        uint64_t start = end > wire ? end - wire : 0;
+        uint64_t gap   = start > bl->last_frame_end_us ?
+                         start - bl->last_frame_end_us : 0;
+        ibus_hist_record(&bl->gap, gap > UINT32_MAX ? UINT32_MAX : (uint32_t)gap);
+    }
+    if (end > bl->last_frame_end_us)
+        bl->last_frame_end_us = end;
+}
+
+/* Drop `n` bytes from the start of the candidate frame */
+static void busload_line_skip(ibus_busload_t *bl, uint16_t n)
+{
+    bl->line_fill = (uint16_t)(bl->line_fill - n);
+    memmove(bl->line, bl->line + n, bl->line_fill);
+}
+
+void ibus_busload_bytes(ibus_busload_t *bl, const uint8_t *bytes, size_t len,
+                        uint64_t rx_us)
+{
+    busload_rotate(bl, rx_us);
+    bl->slot[bl->current].line_bytes += (uint32_t)len;
+
+    for (size_t i = 0; i < len; ++i) {
+        bl->line[bl->line_fill++] = bytes[i];
+
+        /* Every candidate that is complete now, up to the first that isn't */
+        while (bl->line_fill >= 2) {
+            uint16_t need = (uint16_t)(bl->line[1] + 2u);
+            uint8_t  xor  = 0;
+
+            if (need < IBUS_MIN_MESSAGE_LEN) {
+                bl->unframed_bytes++;
+                busload_line_skip(bl, 1);
+                continue;
+            }
+            if (bl->line_fill < need)
+                break;
+
+            for (uint16_t b = 0; b < need; ++b)
+                xor ^= bl->line[b];
+            if (xor == 0) {
+                busload_frame(bl, bl->line[0], need, rx_us);
+                busload_line_skip(bl, need);
+            } else {
+                bl->unframed_bytes++;
+                busload_line_skip(bl, 1);
+            }
+        }
+    }
+}
+
+unsigned ibus_busload_tick(ibus_busload_t *bl, uint64_t now_us, uint8_t changed[32])
+{
+    unsigned count = 0;
+
+    busload_rotate(bl, now_us);
+    for (unsigned i = 0; i < 32; ++i)
+        count += (unsigned)__builtin_popcount(bl->babble_changed[i]);
+    memcpy(changed, bl->babble_changed, sizeof(bl->babble_changed));
+    memset(bl->babble_changed, 0, sizeof(bl->babble_changed));
+    return count;
+}
+
+void ibus_busload_summary(const ibus_busload_t *bl, ibus_busload_summary_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    for (unsigned i = 0; i < RING_SLOTS; ++i) {
+        if (i == bl->current)
+            continue;
+        s->line_bytes   += bl->slot[i].line_bytes;
+        s->total.frames += bl->slot[i].total.frames;
+        s->total.bytes  += bl->slot[i].total.bytes;
+    }
+    s->window_us     = bl->completed * IBUS_BUSLOAD_SLOT_US;
+    s->load_permille = ibus_busload_permille(s->line_bytes, s->window_us);
+    s->peak_permille = ibus_busload_permille(bl->peak_line_bytes, IBUS_BUSLOAD_SLOT_US);
+}
+
+void ibus_busload_sender(const ibus_busload_t *bl, uint8_t sender,
+                         ibus_busload_count_t *c)
+{
+    busload_window(bl, sender, c);
+}
+
+int ibus_busload_is_babbling(const ibus_busload_t *bl, uint8_t sender)
+{
+    return bit_test(bl->babbling, sender);
+}
+
+void ibus_busload_report_done(ibus_busload_t *bl)
+{
+    bl->peak_line_bytes = 0;
+    ibus_hist_reset(&bl->gap);
+}
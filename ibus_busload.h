@@ -0,0 +1,98 @@
+#ifndef IBUS_BUSLOAD_H
+#define IBUS_BUSLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+#include "ibus_latency.h"
+
+/*
+ * Bus load analyzer.
+ *
+ * Counts every received byte and every valid frame into one-second slots;
+ * the last IBUS_BUSLOAD_SLOTS completed slots form a sliding window for
+ * line utilisation and per-sender traffic.
+ *
+ * Frames are found here, from the raw bytes, not taken from the decoder:
+ * the decoder only frames at char timeout gaps, so on a saturated bus (no
+ * gaps at all) it loses most of them. Each candidate frame's length and
+ * checksum are checked as soon as its last byte arrives; a bad one moves
+ * the start on by one byte, which is counted as unframed. A sender using more than
+ * `babble_pct` of the line over a whole window is flagged as babbling.
+ * Idle time between frames goes into a histogram that, like the peak
+ * slot, covers the time since the last report.
+ *
+ * Memory is fixed (~22 KB), whatever the bus does and however long it runs.
+ * Timestamps are the platform's receive timestamps (ibus_append_byte_ts()).
+ */
+#define IBUS_BUSLOAD_BAUD           9600u
+#define IBUS_BUSLOAD_BITS_PER_BYTE  11u         /* 8E1: start, 8 data, parity, stop */
+#define IBUS_BUSLOAD_SLOT_US        1000000u
+#define IBUS_BUSLOAD_SLOTS          10u         /* window, in slots */
+#define IBUS_BUSLOAD_BABBLE_PCT     25u         /* default babbling threshold */
+
+typedef struct {
+    uint32_t frames;
+    uint32_t bytes;             /* sender..checksum */
+} ibus_busload_count_t;
+
+typedef struct {
+    uint32_t             line_bytes;    /* everything received, framed or not */
+    ibus_busload_count_t total;         /* valid frames */
+    ibus_busload_count_t sender[256];
+} ibus_busload_slot_t;
+
+typedef struct {
+    ibus_busload_slot_t slot[IBUS_BUSLOAD_SLOTS + 1];   /* + the current one */
+    unsigned  current;
+    unsigned  completed;        /* completed slots in the window */
+    uint64_t  slot_start_us;
+    uint32_t  babble_pct;
+    uint8_t   babbling[32];     /* bitmap by sender */
+    uint8_t   babble_changed[32];
+    uint32_t  babble_events;    /* senders that started babbling */
+    uint64_t  last_frame_end_us;
+    uint8_t   line[IBUS_MAX_MESSAGE_LEN];   /* from the candidate frame start */
+    uint16_t  line_fill;
+    uint64_t  frames;           /* since the reset */
+    uint64_t  unframed_bytes;   /* skipped while looking for a frame start */
+    uint32_t  peak_line_bytes;  /* busiest completed slot since the last report */
+    ibus_hist_t gap;            /* idle line between frames (us), since the last report */
+} ibus_busload_t;
+
+/* Figures for the current window */
+typedef struct {
+    uint32_t             window_us;
+    uint32_t             line_bytes;
+    ibus_busload_count_t total;
+    uint32_t             load_permille;     /* of the line rate */
+    uint32_t             peak_permille;     /* busiest slot since the last report */
+} ibus_busload_summary_t;
+
+void ibus_busload_reset(ibus_busload_t *bl, uint32_t babble_pct, uint64_t now_us);
+
+/* Bytes as read from the line, valid or not; `rx_us` is when the read
+ * returned, and the end time of any frame they complete. */
+void ibus_busload_bytes(ibus_busload_t *bl, const uint8_t *bytes, size_t len,
+                        uint64_t rx_us);
+
+/* Move the window up to `now_us`. Returns how many senders started or
+ * stopped babbling since the last call and marks them in `changed`. */
+unsigned ibus_busload_tick(ibus_busload_t *bl, uint64_t now_us, uint8_t changed[32]);
+
+void ibus_busload_summary(const ibus_busload_t *bl, ibus_busload_summary_t *s);
+
+/* One sender's traffic over the window */
+void ibus_busload_sender(const ibus_busload_t *bl, uint8_t sender,
+                         ibus_busload_count_t *c);
+
+int  ibus_busload_is_babbling(const ibus_busload_t *bl, uint8_t sender);
+
+/* Share of the line rate, in permille, that `bytes` take over `us`. */
+uint32_t ibus_busload_permille(uint64_t bytes, uint64_t us);
+
+/* Start the next report period: the peak and the gap histogram restart. */
+void ibus_busload_report_done(ibus_busload_t *bl);
+
+#endif /* IBUS_BUSLOAD_H */
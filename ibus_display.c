@@ -0,0 +1,123 @@
+#include "ibus_display.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Index byte of 0xA5: 0x40 | field, other bits are refresh flags */
+#define IBUS_DISPLAY_INDEX_MASK     0x0F
+
+/* Text of a cleared field; memcmp()/memcpy() need a pointer even for 0 bytes */
+static const uint8_t ibus_display_empty[1];
+
+static uint32_t ibus_display_set(ibus_display_t *d, unsigned field,
+                                 const uint8_t *text, size_t len,
+                                 uint64_t rx_time_us)
+{
+    ibus_display_field_t *f = &d->field[field];
+
+    /* The radio pads with trailing spaces and NULs; they don't draw */
+    while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == 0x00))
+        len--;
+    if (len > IBUS_DISPLAY_TEXT_LEN)
+        len = IBUS_DISPLAY_TEXT_LEN;
+
+    if (f->len == len && memcmp(f->text, text, len) == 0)
+        return 0;
+
+    memcpy(f->text, text, len);
+    f->len        = (uint8_t)len;
+    f->updated_us = rx_time_us;
+    return IBUS_DISPLAY_MASK(field);
+}
+
+void ibus_display_reset(ibus_display_t *d)
+{
+    memset(d, 0, sizeof(*d));
+}
+
+uint32_t ibus_display_update(ibus_display_t *d, const ibus_msg_view_t *msg)
+{
+    uint32_t changed = 0;
+
+    if (msg->sender != IBUS_DEV_RAD || msg->receiver != IBUS_DEV_GT)
+        return 0;
+
+    switch (msg->message) {
+    case IBUS_MSG_UMID:
+        if (msg->data_len < 2 || msg->data[0] != IBUS_DISPLAY_LAYOUT_RADIO)
+            break;
+        changed |= ibus_display_set(d, IBUS_DISPLAY_TITLE, &msg->data[2],
+                                    msg->data_len - 2u, msg->rx_time_us);
+        break;
+
+    case IBUS_MSG_ST: {
+        if (msg->data_len < 3 || msg->data[0] != IBUS_DISPLAY_LAYOUT_RADIO)
+            break;
+        unsigned index = msg->data[2] & IBUS_DISPLAY_INDEX_MASK;
+        if (index >= IBUS_DISPLAY_INDEX_FIELDS)
+            break;
+        changed |= ibus_display_set(d, IBUS_DISPLAY_INDEX(index), &msg->data[3],
+                                    msg->data_len - 3u, msg->rx_time_us);
+        break;
+    }
+
+    case IBUS_MSG_LCDC:
+        if (msg->data_len != 1 || (msg->data[0] != 0x01 && msg->data[0] != 0x02))
+            break;
+        for (unsigned i = 0; i < IBUS_DISPLAY_FIELDS; ++i)
+            changed |= ibus_display_set(d, i, ibus_display_empty, 0, msg->rx_time_us);
+        break;
+
+    default:
+        break;
+    }
+
+    return changed;
+}
+
+const char *ibus_display_field_name(unsigned field, char *buf, size_t len)
+{
+    if (field == IBUS_DISPLAY_TITLE)
+        snprintf(buf, len, "title");
+    else
+        snprintf(buf, len, "index%u", field - IBUS_DISPLAY_INDEX(0));
+    return buf;
+}
+
+/*
+ * The GT font follows ISO-8859-1 for 0x20..0x7E and 0xA0..0xFF. The codes
+ * below 0x20 and 0x7F..0x9F select menu symbols that have no text form;
+ * they are dropped.
+ */
+size_t ibus_display_to_utf8(const uint8_t *text, size_t len,
+                            char *out, size_t out_len)
+{
+    size_t pos = 0;
+
+    if (out_len == 0)
+        return 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = text[i];
+        char enc[2];
+        size_t n;
+
+        if (c >= 0x20 && c < 0x7F) {
+            enc[0] = (char)c;
+            n = 1;
+        } else if (c >= 0xA0) {
+            enc[0] = (char)(0xC0 | (c >> 6));
+            enc[1] = (char)(0x80 | (c & 0x3F));
+            n = 2;
+        } else {
+            continue;
+        }
+
+        if (pos + n >= out_len)
+            break;
+        memcpy(&out[pos], enc, n);
+        pos += n;
+    }
+
+    out[pos] = '\0';
+    return pos;
+}
@@ -0,0 +1,56 @@
+#ifndef IBUS_DISPLAY_H
+#define IBUS_DISPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+
+/*
+ * Model of the radio screen as drawn by the GT (layout 0x62).
+ *
+ *   RAD -> GT 0x23 62 <flags> <text>           title ("FM1 93.5", "TR 05 AUX")
+ *   RAD -> GT 0xA5 62 <flags> <index> <text>   index field 0..9
+ *   RAD -> GT 0x46 01|02                       radio display off: all cleared
+ *
+ * Text is kept in the GT character set as sent (ISO-8859-1 plus menu
+ * symbols); ibus_display_to_utf8() converts it for output. Updates report
+ * only the fields whose content actually changed, so a mirror can redraw
+ * just those.
+ */
+#define IBUS_DISPLAY_LAYOUT_RADIO   0x62
+
+#define IBUS_DISPLAY_INDEX_FIELDS   10u
+#define IBUS_DISPLAY_FIELDS         (1u + IBUS_DISPLAY_INDEX_FIELDS)
+#define IBUS_DISPLAY_TEXT_LEN       32u
+
+/* Field 0 is the title, 1.. are index fields 0.. */
+#define IBUS_DISPLAY_TITLE          0u
+#define IBUS_DISPLAY_INDEX(n)       (1u + (n))
+#define IBUS_DISPLAY_MASK(field)    (1u << (field))
+
+typedef struct {
+    uint8_t  len;
+    uint8_t  text[IBUS_DISPLAY_TEXT_LEN];   /* GT charset, not terminated */
+    uint64_t updated_us;                    /* rx time of the last change */
+} ibus_display_field_t;
+
+typedef struct {
+    ibus_display_field_t field[IBUS_DISPLAY_FIELDS];
+} ibus_display_t;
+
+void ibus_display_reset(ibus_display_t *d);
+
+/* Fold one validated message into the model. Returns the IBUS_DISPLAY_MASK()
+ * of the fields whose text changed (0 for repeats and unrelated traffic). */
+uint32_t ibus_display_update(ibus_display_t *d, const ibus_msg_view_t *msg);
+
+/* "title", "index0".. "index9" */
+const char *ibus_display_field_name(unsigned field, char *buf, size_t len);
+
+/* Convert GT charset text to NUL-terminated UTF-8 (truncated to fit).
+ * Returns the length written, without the NUL. */
+size_t ibus_display_to_utf8(const uint8_t *text, size_t len,
+                            char *out, size_t out_len);
+
+#endif /* IBUS_DISPLAY_H */
@@ -0,0 +1,169 @@
+#include "ibus_input.h"
+#include <string.h>
+
+struct input_button {
+    ibus_timer_t hold;          /* long press escalation, then autorepeat */
+    ibus_timer_t release;       /* auto-release */
+    uint16_t     key;           /* key held down, IBUS_KEY_NONE if none */
+    uint16_t     short_key;     /* tapped on a release before the long key */
+    uint16_t     long_key;      /* waiting for the long press */
+    uint8_t      pressed;
+};
+
+static ibus_timer_wheel_t  *input_wheel;
+static ibus_input_config_t  input_cfg;
+static const ibus_keymap_t *input_map;
+static ibus_input_stats_t   input_stats;
+static struct input_button  input_buttons[IBUS_KEYMAP_CODES];
+
+static void input_key_down(struct input_button *b, uint16_t key, uint64_t now_us)
+{
+    ibus_platform_key_event(key, IBUS_KEY_PRESS);
+    b->key = key;
+    if (input_cfg.repeat_delay_us)
+        ibus_timer_start(input_wheel, &b->hold, now_us + input_cfg.repeat_delay_us);
+}
+
+static unsigned input_release(struct input_button *b)
+{
+    unsigned sent = 0;
+
+    ibus_timer_stop(input_wheel, &b->hold);
+    ibus_timer_stop(input_wheel, &b->release);
+
+    if (b->key != IBUS_KEY_NONE) {
+        ibus_platform_key_event(b->key, IBUS_KEY_RELEASE);
+        sent = 1;
+    } else if (b->pressed && b->short_key != IBUS_KEY_NONE) {
+        ibus_platform_key_event(b->short_key, IBUS_KEY_PRESS);
+        ibus_platform_key_event(b->short_key, IBUS_KEY_RELEASE);
+        sent = 2;
+    }
+
+    b->key = b->short_key = b->long_key = IBUS_KEY_NONE;
+    b->pressed = 0;
+    return sent;
+}
+
+static void input_long_press(struct input_button *b, uint64_t now_us)
+{
+    uint16_t key = b->long_key;
+
+    b->long_key = b->short_key = IBUS_KEY_NONE;
+    input_stats.long_presses++;
+    input_key_down(b, key, now_us);
+}
+
+static void input_hold_expired(ibus_timer_t *timer, uint64_t now_us)
+{
+    struct input_button *b = timer->arg;
+
+    if (b->long_key != IBUS_KEY_NONE) {
+        input_long_press(b, now_us);
+    } else if (b->key != IBUS_KEY_NONE) {
+        ibus_platform_key_event(b->key, IBUS_KEY_REPEAT);
+        input_stats.repeats++;
+        ibus_timer_start(input_wheel, &b->hold, now_us + input_cfg.repeat_period_us);
+    }
+}
+
+static void input_release_expired(ibus_timer_t *timer, uint64_t now_us)
+{
+    (void)now_us;
+    input_stats.auto_releases++;
+    input_release(timer->arg);
+}
+
+void ibus_input_init(ibus_timer_wheel_t *wheel, const ibus_input_config_t *cfg,
+                     const ibus_keymap_t *map)
+{
+    static const ibus_input_config_t defaults = {
+        .repeat_delay_us    = IBUS_INPUT_REPEAT_DELAY_US,
+        .repeat_period_us   = IBUS_INPUT_REPEAT_PERIOD_US,
+        .long_press_us      = IBUS_INPUT_LONG_PRESS_US,
+        .release_timeout_us = IBUS_INPUT_RELEASE_TIMEOUT_US,
+    };
+
+    input_wheel = wheel;
+    input_cfg   = cfg ? *cfg : defaults;
+    input_map   = map;
+    if (input_cfg.repeat_period_us == 0)
+        input_cfg.repeat_delay_us = 0;
+
+    memset(&input_stats, 0, sizeof(input_stats));
+    memset(input_buttons, 0, sizeof(input_buttons));
+    for (unsigned i = 0; i < IBUS_KEYMAP_CODES; ++i) {
+        ibus_timer_init(&input_buttons[i].hold, input_hold_expired, &input_buttons[i]);
+        ibus_timer_init(&input_buttons[i].release, input_release_expired, &input_buttons[i]);
+    }
+}
+
+void ibus_input_set_keymap(const ibus_keymap_t *map)
+{
+    input_map = map;
+}
+
+unsigned ibus_input_button(uint8_t code, uint8_t released, uint8_t long_press,
+                           ibus_state_t layer, int enabled, uint64_t now_us)
+{
+    struct input_button *b;
+    unsigned sent = 0;
+
+    if (code >= IBUS_KEYMAP_CODES)
+        return 0;
+    b = &input_buttons[code];
+
+    /* A held key is always released, even after leaving the hijack state */
+    if (released)
+        return input_release(b);
+
+    if (!b->pressed) {
+        /* A long press report also stands in for a lost press frame */
+        const ibus_keymap_entry_t *e = ibus_keymap_lookup(input_map, layer, code);
+
+        if (!enabled)
+            return 0;
+        if (e->long_key != IBUS_KEY_NONE) {
+            b->short_key = ibus_keymap_sendable(e->key) ? e->key : IBUS_KEY_NONE;
+            b->long_key  = e->long_key;
+            if (input_cfg.long_press_us)
+                ibus_timer_start(input_wheel, &b->hold, now_us + input_cfg.long_press_us);
+        } else if (ibus_keymap_sendable(e->key)) {
+            input_key_down(b, e->key, now_us);
+            sent = 1;
+        } else {
+            return 0;
+        }
+        b->pressed = 1;
+        input_stats.presses++;
+    }
+
+    if (long_press && b->long_key != IBUS_KEY_NONE) {
+        input_long_press(b, now_us);
+        sent++;
+    }
+
+    /* Every frame for the button shows it is still held */
+    if (input_cfg.release_timeout_us)
+        ibus_timer_start(input_wheel, &b->release, now_us + input_cfg.release_timeout_us);
+    return sent;
+}
+
+unsigned ibus_input_release_all(void)
+{
+    unsigned sent = 0;
+
+    for (unsigned i = 0; i < IBUS_KEYMAP_CODES; ++i) {
+        struct input_button *b = &input_buttons[i];
+
+        b->short_key = IBUS_KEY_NONE;
+        if (b->pressed || b->key != IBUS_KEY_NONE)
+            sent += input_release(b);
+    }
+    return sent;
+}
+
+const ibus_input_stats_t *ibus_input_get_stats(void)
+{
+    return &input_stats;
+}
@@ -0,0 +1,77 @@
+#ifndef IBUS_INPUT_H
+#define IBUS_INPUT_H
+
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+#include "ibus_keymap.h"
+#include "ibus_timer.h"
+
+/*
+ * Button events -> key events, through the keymap and a timer wheel:
+ *
+ *   - autorepeat: a held key repeats after repeat_delay_us, then every
+ *     repeat_period_us
+ *   - long press: a button with a long key sends it once held for
+ *     long_press_us, or when the bus reports a long press, whichever is
+ *     first; released earlier, it taps its short key
+ *   - auto-release: a held key is released when release_timeout_us passes
+ *     without a frame for its button, so a lost release frame can't leave
+ *     a key stuck down
+ *
+ * A held BMBT button sends its press frame, a long press report about a
+ * second later, and then nothing until the release frame. The release
+ * timeout is therefore also the longest a button can be held past its
+ * long press report; it is off by default and, when used, must be longer
+ * than any hold that matters (scrolling with autorepeat).
+ *
+ * Key events go to ibus_platform_key_event(); the front end drives the
+ * wheel (ibus_timer_run()) from its own clock.
+ */
+#define IBUS_INPUT_REPEAT_DELAY_US    500000u
+#define IBUS_INPUT_REPEAT_PERIOD_US   100000u
+#define IBUS_INPUT_LONG_PRESS_US      800000u
+#define IBUS_INPUT_RELEASE_TIMEOUT_US 0u       /* off, see above */
+
+/* Key event values (as in Linux evdev) */
+#define IBUS_KEY_RELEASE   0
+#define IBUS_KEY_PRESS     1
+#define IBUS_KEY_REPEAT    2
+
+typedef struct {
+    uint32_t repeat_delay_us;       /* 0 = no autorepeat */
+    uint32_t repeat_period_us;
+    uint32_t long_press_us;         /* 0 = only the bus's long press report */
+    uint32_t release_timeout_us;    /* 0 = wait for the release frame */
+} ibus_input_config_t;
+
+typedef struct {
+    uint32_t presses;
+    uint32_t repeats;
+    uint32_t long_presses;
+    uint32_t auto_releases;         /* release frames that never came */
+} ibus_input_stats_t;
+
+/* `cfg` NULL = the defaults above. Timers are started on `wheel`. */
+void ibus_input_init(ibus_timer_wheel_t *wheel, const ibus_input_config_t *cfg,
+                     const ibus_keymap_t *map);
+
+/* Keys already held keep their key until released. */
+void ibus_input_set_keymap(const ibus_keymap_t *map);
+
+/* Feed a decoded button event. With `enabled` 0 (not in the hijack
+ * state) only releases are processed. Returns the number of key events
+ * sent. */
+unsigned ibus_input_button(uint8_t code, uint8_t released, uint8_t long_press,
+                           ibus_state_t layer, int enabled, uint64_t now_us);
+
+/* Release every held key and stop all timers, without tapping pending
+ * short keys (the front end is going idle). Returns key events sent. */
+unsigned ibus_input_release_all(void);
+
+const ibus_input_stats_t *ibus_input_get_stats(void);
+
+/* Implemented by the front end. */
+void ibus_platform_key_event(uint16_t key, int value);
+
+#endif /* IBUS_INPUT_H */
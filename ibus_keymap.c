@@ -0,0 +1,368 @@
+#include "ibus_keymap.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <linux/input-event-codes.h>
+
+/* ===== Name tables ===== */
+
+static const char *const button_names[IBUS_KEYMAP_CODES] = {
+    [IBUS_BTN_ARROW_RIGHT]       = "ButtonArrowRight",
+    [IBUS_BTN_2]                 = "Button2",
+    [IBUS_BTN_4]                 = "Button4",
+    [IBUS_BTN_6]                 = "Button6",
+    [IBUS_BTN_TONE]              = "ButtonTone",
+    [IBUS_BTN_MENU_KNOB]         = "ButtonMenuKnob",
+    [IBUS_BTN_RADIO_POWER]       = "ButtonRadioPower",
+    [IBUS_BTN_CLOCK]             = "ButtonClock",
+    [IBUS_BTN_TELEPHONE]         = "ButtonTelephone",
+    [IBUS_BTN_ARROW_LEFT]        = "ButtonArrowLeft",
+    [IBUS_BTN_1]                 = "Button1",
+    [IBUS_BTN_3]                 = "Button3",
+    [IBUS_BTN_5]                 = "Button5",
+    [IBUS_BTN_REVERSE_PLAY]      = "ButtonReversePlay",
+    [IBUS_BTN_AM]                = "ButtonAM",
+    [IBUS_BTN_RDS]               = "ButtonRDS",
+    [IBUS_BTN_MODE]              = "ButtonMode",
+    [IBUS_BTN_EJECT]             = "ButtonEject",
+    [IBUS_BTN_SWITCH]            = "ButtonSwitch",
+    [IBUS_BTN_FM]                = "ButtonFM",
+    [IBUS_BTN_TP]                = "ButtonTP",
+    [IBUS_BTN_DOLBY]             = "ButtonDolby",
+    [IBUS_BTN_MENU]              = "ButtonMenu",
+    [IBUS_BTN_IDX_MENUKNOB_CW]   = "MenuKnobClockwise",
+    [IBUS_BTN_IDX_MENUKNOB_CCW]  = "MenuKnobCounterClockwise",
+    [IBUS_BTN_IDX_SELECT_TAPE]   = "SelectInTapeMode",
+    [IBUS_BTN_IDX_MFL2_CH_UP]    = "MFL2ButtonChannelUp",
+    [IBUS_BTN_IDX_MFL2_CH_DOWN]  = "MFL2ButtonChannelDown",
+};
+
+/* Layer sections, indexed by ibus_state_t */
+static const char *const layer_names[IBUS_KEYMAP_LAYERS] = {
+    [IBUS_STATE_UNKNOWN]    = "unknown",
+    [IBUS_STATE_POWER_OFF]  = "off",
+    [IBUS_STATE_MENU]       = "menu",
+    [IBUS_STATE_FM]         = "fm",
+    [IBUS_STATE_TAPE]       = "tape",
+    [IBUS_STATE_AUX]        = "aux",
+    [IBUS_STATE_CD_CHANGER] = "cdc",
+};
+
+/* Keys that make sense on a headunit; others can be given as numbers */
+#define KEYMAP_KEYS(X) \
+    X(KEY_ESC) X(KEY_1) X(KEY_2) X(KEY_3) X(KEY_4) X(KEY_5) X(KEY_6) \
+    X(KEY_7) X(KEY_8) X(KEY_9) X(KEY_0) X(KEY_BACKSPACE) X(KEY_TAB) \
+    X(KEY_Q) X(KEY_W) X(KEY_E) X(KEY_R) X(KEY_T) X(KEY_Y) X(KEY_U) \
+    X(KEY_I) X(KEY_O) X(KEY_P) X(KEY_A) X(KEY_S) X(KEY_D) X(KEY_F) \
+    X(KEY_G) X(KEY_H) X(KEY_J) X(KEY_K) X(KEY_L) X(KEY_Z) X(KEY_X) \
+    X(KEY_C) X(KEY_V) X(KEY_B) X(KEY_N) X(KEY_M) X(KEY_ENTER) \
+    X(KEY_SPACE) X(KEY_F1) X(KEY_F2) X(KEY_F3) X(KEY_F4) X(KEY_F5) \
+    X(KEY_F6) X(KEY_F7) X(KEY_F8) X(KEY_F9) X(KEY_F10) X(KEY_F11) \
+    X(KEY_F12) X(KEY_HOME) X(KEY_UP) X(KEY_PAGEUP) X(KEY_LEFT) \
+    X(KEY_RIGHT) X(KEY_END) X(KEY_DOWN) X(KEY_PAGEDOWN) X(KEY_INSERT) \
+    X(KEY_DELETE) X(KEY_MUTE) X(KEY_VOLUMEDOWN) X(KEY_VOLUMEUP) \
+    X(KEY_POWER) X(KEY_PAUSE) X(KEY_MENU) X(KEY_SETUP) X(KEY_BACK) \
+    X(KEY_FORWARD) X(KEY_EJECTCD) X(KEY_NEXTSONG) X(KEY_PLAYPAUSE) \
+    X(KEY_PREVIOUSSONG) X(KEY_STOPCD) X(KEY_RECORD) X(KEY_REWIND) \
+    X(KEY_PHONE) X(KEY_HOMEPAGE) X(KEY_PLAY) X(KEY_FASTFORWARD) \
+    X(KEY_SEARCH) X(KEY_OK) X(KEY_SELECT) X(KEY_INFO) X(KEY_RADIO) \
+    X(KEY_TAPE) X(KEY_AUX) X(KEY_TV) X(KEY_VIDEO) X(KEY_CD) X(KEY_LIST) \
+    X(KEY_CHANNELUP) X(KEY_CHANNELDOWN) X(KEY_NEXT) X(KEY_PREVIOUS) \
+    X(KEY_EXIT) X(KEY_CONTEXT_MENU)
+
+#define KEYMAP_KEY_NAME(k)  #k,
+#define KEYMAP_KEY_CODE(k)  k,
+
+static const char *const key_names[] = { KEYMAP_KEYS(KEYMAP_KEY_NAME) };
+static const uint16_t    key_codes[] = { KEYMAP_KEYS(KEYMAP_KEY_CODE) };
+
+#define KEYMAP_KEY_COUNT    (sizeof(key_codes) / sizeof(key_codes[0]))
+
+const char *ibus_keymap_button_name(uint8_t code)
+{
+    return code < IBUS_KEYMAP_CODES ? button_names[code] : NULL;
+}
+
+const char *ibus_keymap_key_name(uint16_t key)
+{
+    if (key == IBUS_KEY_NONE)
+        return "none";
+    if (key == IBUS_KEY_STATE)
+        return "state";
+    for (size_t i = 0; i < KEYMAP_KEY_COUNT; ++i)
+        if (key_codes[i] == key)
+            return key_names[i];
+    return NULL;
+}
+
+const char *ibus_keymap_layer_name(ibus_state_t layer)
+{
+    return (unsigned)layer < IBUS_KEYMAP_LAYERS ? layer_names[layer] : NULL;
+}
+
+size_t ibus_keymap_named_keys(const uint16_t **keys)
+{
+    *keys = key_codes;
+    return KEYMAP_KEY_COUNT;
+}
+
+/* ===== Parser ===== */
+
+#define KEYMAP_LAYER_ALL    IBUS_KEYMAP_LAYERS  /* [all] section */
+
+/* Entries as written; [all] is merged into the layers at the end */
+struct keymap_source {
+    ibus_keymap_entry_t entry[IBUS_KEYMAP_LAYERS + 1][IBUS_KEYMAP_CODES];
+    uint8_t             set[IBUS_KEYMAP_LAYERS + 1][IBUS_KEYMAP_CODES];
+};
+
+static int keymap_error(char *err, size_t err_len, unsigned line,
+                        const char *fmt, ...)
+{
+    va_list ap;
+    int n = 0;
+
+    if (err_len > 0) {
+        if (line > 0)
+            n = snprintf(err, err_len, "line %u: ", line);
+        if (n >= 0 && (size_t)n < err_len) {
+            va_start(ap, fmt);
+            vsnprintf(err + n, err_len - (size_t)n, fmt, ap);
+            va_end(ap);
+        }
+    }
+    return -EINVAL;
+}
+
+static int parse_button(const char *tok, uint8_t *code)
+{
+    char *end;
+
+    for (unsigned i = 0; i < IBUS_KEYMAP_CODES; ++i) {
+        if (button_names[i] && strcasecmp(tok, button_names[i]) == 0) {
+            *code = (uint8_t)i;
+            return 0;
+        }
+    }
+
+    unsigned long v = strtoul(tok, &end, 16);
+    if (end == tok || *end != '\0' || v >= IBUS_KEYMAP_CODES)
+        return -EINVAL;
+    *code = (uint8_t)v;
+    return 0;
+}
+
+static int parse_key(const char *tok, uint16_t *key)
+{
+    char *end;
+
+    if (strcasecmp(tok, "none") == 0) {
+        *key = IBUS_KEY_NONE;
+        return 0;
+    }
+    if (strcasecmp(tok, "state") == 0) {
+        *key = IBUS_KEY_STATE;
+        return 0;
+    }
+    for (size_t i = 0; i < KEYMAP_KEY_COUNT; ++i) {
+        if (strcasecmp(tok, key_names[i]) == 0) {
+            *key = key_codes[i];
+            return 0;
+        }
+    }
+
+    unsigned long v = strtoul(tok, &end, 10);
+    if (end == tok || *end != '\0' || v == 0 || v > KEY_MAX)
+        return -EINVAL;
+    *key = (uint16_t)v;
+    return 0;
+}
+
+static int parse_line(struct keymap_source *src, unsigned *layer, char *s,
+                      unsigned line, char *err, size_t err_len)
+{
+    char *save, *tok[4];
+    unsigned ntok = 0;
+    uint8_t code;
+    ibus_keymap_entry_t e = { IBUS_KEY_NONE, IBUS_KEY_NONE };
+
+    char *hash = strchr(s, '#');
+    if (hash)
+        *hash = '\0';
+
+    for (char *t = strtok_r(s, " \t\r", &save); t; t = strtok_r(NULL, " \t\r", &save)) {
+        if (ntok == 4)
+            return keymap_error(err, err_len, line, "too many fields");
+        tok[ntok++] = t;
+    }
+    if (ntok == 0)
+        return 0;
+
+    if (tok[0][0] == '[') {
+        size_t n = strlen(tok[0]);
+        if (ntok != 1 || n < 3 || tok[0][n - 1] != ']')
+            return keymap_error(err, err_len, line, "bad section \"%s\"", tok[0]);
+        tok[0][n - 1] = '\0';
+        if (strcasecmp(&tok[0][1], "all") == 0) {
+            *layer = KEYMAP_LAYER_ALL;
+            return 0;
+        }
+        for (unsigned i = 0; i < IBUS_KEYMAP_LAYERS; ++i) {
+            if (strcasecmp(&tok[0][1], layer_names[i]) == 0) {
+                *layer = i;
+                return 0;
+            }
+        }
+        return keymap_error(err, err_len, line, "unknown layer \"%s\"", &tok[0][1]);
+    }
+
+    if (ntok != 2 && ntok != 4)
+        return keymap_error(err, err_len, line, "expected <button> <key> [long <key>]");
+    if (parse_button(tok[0], &code) < 0)
+        return keymap_error(err, err_len, line, "unknown button \"%s\"", tok[0]);
+    if (parse_key(tok[1], &e.key) < 0)
+        return keymap_error(err, err_len, line, "unknown key \"%s\"", tok[1]);
+    if (ntok == 4) {
+        if (strcasecmp(tok[2], "long") != 0)
+            return keymap_error(err, err_len, line, "expected \"long\", not \"%s\"", tok[2]);
+        if (parse_key(tok[3], &e.long_key) < 0 || !ibus_keymap_sendable(e.long_key))
+            return keymap_error(err, err_len, line, "bad long key \"%s\"", tok[3]);
+        if (e.key == IBUS_KEY_STATE)
+            return keymap_error(err, err_len, line, "a state button has no long key");
+    }
+    if (src->set[*layer][code])
+        return keymap_error(err, err_len, line, "%s mapped twice", tok[0]);
+
+    src->entry[*layer][code] = e;
+    src->set[*layer][code]   = 1;
+    return 0;
+}
+
+int ibus_keymap_parse(const char *text, size_t len, ibus_keymap_t *map,
+                      char *err, size_t err_len)
+{
+    struct keymap_source *src = calloc(1, sizeof(*src));
+    unsigned layer = KEYMAP_LAYER_ALL, line = 0;
+    size_t pos = 0;
+    char buf[256];
+    int res = 0;
+
+    if (!src)
+        return -ENOMEM;
+
+    while (res == 0 && pos < len) {
+        const char *nl = memchr(&text[pos], '\n', len - pos);
+        size_t n = nl ? (size_t)(nl - &text[pos]) : len - pos;
+
+        line++;
+        if (n >= sizeof(buf)) {
+            res = keymap_error(err, err_len, line, "line too long");
+            break;
+        }
+        memcpy(buf, &text[pos], n);
+        buf[n] = '\0';
+        pos += n + 1;
+
+        res = parse_line(src, &layer, buf, line, err, err_len);
+    }
+
+    if (res == 0) {
+        for (unsigned l = 0; l < IBUS_KEYMAP_LAYERS; ++l) {
+            for (unsigned c = 0; c < IBUS_KEYMAP_CODES; ++c) {
+                if (src->set[l][c])
+                    map->entry[l][c] = src->entry[l][c];
+                else
+                    map->entry[l][c] = src->entry[KEYMAP_LAYER_ALL][c];
+            }
+        }
+    }
+
+    free(src);
+    return res;
+}
+
+int ibus_keymap_load(const char *path, ibus_keymap_t *map,
+                     char *err, size_t err_len)
+{
+    FILE *fp = fopen(path, "r");
+    char text[16384];
+    size_t len;
+
+    if (!fp) {
+        int res = -errno;
+        keymap_error(err, err_len, 0, "%s: %s", path, strerror(-res));
+        return res;
+    }
+    len = fread(text, 1, sizeof(text), fp);
+    if (ferror(fp) || len == sizeof(text)) {
+        fclose(fp);
+        return keymap_error(err, err_len, 0, "%s: %s", path,
+                            len == sizeof(text) ? "file too large" : "read error");
+    }
+    fclose(fp);
+
+    return ibus_keymap_parse(text, len, map, err, err_len);
+}
+
+/* ===== C output ===== */
+
+static void write_c_key(FILE *fp, uint16_t key)
+{
+    const char *name = ibus_keymap_key_name(key);
+
+    if (key == IBUS_KEY_NONE)
+        fprintf(fp, "IBUS_KEY_NONE");
+    else if (key == IBUS_KEY_STATE)
+        fprintf(fp, "IBUS_KEY_STATE");
+    else if (name)
+        fprintf(fp, "%3u /* %s */", (unsigned)key, name);
+    else
+        fprintf(fp, "%3u", (unsigned)key);
+}
+
+int ibus_keymap_write_c(FILE *fp, const ibus_keymap_t *map,
+                        const char *symbol, const char *source)
+{
+    static const char *const states[IBUS_KEYMAP_LAYERS] = {
+        "IBUS_STATE_UNKNOWN", "IBUS_STATE_POWER_OFF", "IBUS_STATE_MENU",
+        "IBUS_STATE_FM", "IBUS_STATE_TAPE", "IBUS_STATE_AUX",
+        "IBUS_STATE_CD_CHANGER"
+    };
+
+    fprintf(fp, "/* Generated by ibus_keymapc from %s, do not edit. */\n\n", source);
+    fprintf(fp, "#include \"ibus_keymap.h\"\n\n");
+    fprintf(fp, "const ibus_keymap_t %s = { .entry = {\n", symbol);
+
+    for (unsigned l = 0; l < IBUS_KEYMAP_LAYERS; ++l) {
+        int open = 0;
+
+        for (unsigned c = 0; c < IBUS_KEYMAP_CODES; ++c) {
+            const ibus_keymap_entry_t *e = &map->entry[l][c];
+            const char *button = ibus_keymap_button_name((uint8_t)c);
+
+            if (e->key == IBUS_KEY_NONE && e->long_key == IBUS_KEY_NONE)
+                continue;
+            if (!open) {
+                fprintf(fp, "    [%s] = {\n", states[l]);
+                open = 1;
+            }
+            fprintf(fp, "        [0x%02X] = { ", c);
+            write_c_key(fp, e->key);
+            fprintf(fp, ", ");
+            write_c_key(fp, e->long_key);
+            fprintf(fp, " },");
+            if (button)
+                fprintf(fp, "  /* %s */", button);
+            fprintf(fp, "\n");
+        }
+        if (open)
+            fprintf(fp, "    },\n");
+    }
+
+    fprintf(fp, "} };\n");
+    return ferror(fp) ? -EIO : 0;
+}
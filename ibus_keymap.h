@@ -0,0 +1,91 @@
+#ifndef IBUS_KEYMAP_H
+#define IBUS_KEYMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ibus_protocol.h"
+
+/*
+ * Button -> key mapping, compiled from a keymap file into a dense table.
+ *
+ *   # comment
+ *   [all]                          entries for every layer
+ *   ButtonArrowRight   KEY_UP
+ *   Button1            KEY_MENU   long KEY_HOME
+ *   ButtonMode         state
+ *   [aux]                          overrides while AUX is the hijack state
+ *   0x11               KEY_1
+ *
+ * Buttons are the names of ibus_keymap_button_name() or a hex code (BMBT
+ * codes and the synthetic IBUS_BTN_IDX_* codes). Keys are Linux input key
+ * names (KEY_*) or decimal codes, "none" or "state" (changes the headunit
+ * state, never sent). A button with a long key sends its short key on
+ * release unless the bus reported a long press first, which sends the long
+ * key instead.
+ *
+ * Layers are indexed by ibus_state_t and [all] is merged into each of them
+ * at compile time, so a lookup is one array index. Key codes are the Linux
+ * input ones; the table itself has no platform dependencies (the Pico build
+ * links the generated ibus_keymap_default.c), only the parser does.
+ */
+#define IBUS_KEYMAP_CODES   64u     /* button codes 0x00..0x3F */
+#define IBUS_KEYMAP_LAYERS  (IBUS_STATE_CD_CHANGER + 1)
+
+#define IBUS_KEY_NONE       0x0000u
+#define IBUS_KEY_STATE      0xFFFFu
+
+typedef struct {
+    uint16_t key;           /* short press (or held, without a long key) */
+    uint16_t long_key;      /* after a long press report, IBUS_KEY_NONE = none */
+} ibus_keymap_entry_t;
+
+typedef struct {
+    ibus_keymap_entry_t entry[IBUS_KEYMAP_LAYERS][IBUS_KEYMAP_CODES];
+} ibus_keymap_t;
+
+/* Built-in map (keymaps/default.keymap, generated by ibus_keymapc) */
+extern const ibus_keymap_t ibus_keymap_default;
+
+static inline const ibus_keymap_entry_t *
+ibus_keymap_lookup(const ibus_keymap_t *map, ibus_state_t layer, uint8_t code)
+{
+    static const ibus_keymap_entry_t unmapped = { IBUS_KEY_NONE, IBUS_KEY_NONE };
+
+    if ((unsigned)layer >= IBUS_KEYMAP_LAYERS || code >= IBUS_KEYMAP_CODES)
+        return &unmapped;
+    return &map->entry[layer][code];
+}
+
+/* True for keys that produce an input event */
+static inline int ibus_keymap_sendable(uint16_t key)
+{
+    return key != IBUS_KEY_NONE && key != IBUS_KEY_STATE;
+}
+
+/* ===== Parser / compiler (host only) ===== */
+
+/* Compile keymap text. On error returns -EINVAL and puts "line N: ..."
+ * into err; `map` is only written on success. */
+int ibus_keymap_parse(const char *text, size_t len, ibus_keymap_t *map,
+                      char *err, size_t err_len);
+
+/* Read and compile a keymap file (-errno if it can't be read). */
+int ibus_keymap_load(const char *path, ibus_keymap_t *map,
+                     char *err, size_t err_len);
+
+/* Names for messages and generated code; NULL if there is none. */
+const char *ibus_keymap_button_name(uint8_t code);
+const char *ibus_keymap_key_name(uint16_t key);
+const char *ibus_keymap_layer_name(ibus_state_t layer);
+
+/* Every key a keymap can name, for registering them with an input device
+ * up front. Returns the number of entries in `*keys`. */
+size_t ibus_keymap_named_keys(const uint16_t **keys);
+
+/* Write `map` as a C definition of `const ibus_keymap_t <symbol>`. */
+int ibus_keymap_write_c(FILE *fp, const ibus_keymap_t *map,
+                        const char *symbol, const char *source);
+
+#endif /* IBUS_KEYMAP_H */
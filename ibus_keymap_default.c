@@ -0,0 +1,209 @@
+/* Generated by ibus_keymapc from keymaps/default.keymap, do not edit. */
+
+#include "ibus_keymap.h"
+
+const ibus_keymap_t ibus_keymap_default = { .entry = {
+    [IBUS_STATE_UNKNOWN] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_POWER_OFF] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_MENU] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_FM] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_TAPE] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_AUX] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+    [IBUS_STATE_CD_CHANGER] = {
+        [0x00] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* ButtonArrowRight */
+        [0x01] = {  14 /* KEY_BACKSPACE */, IBUS_KEY_NONE },  /* Button2 */
+        [0x02] = {   5 /* KEY_4 */, IBUS_KEY_NONE },  /* Button4 */
+        [0x03] = {   7 /* KEY_6 */, IBUS_KEY_NONE },  /* Button6 */
+        [0x04] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTone */
+        [0x05] = {  28 /* KEY_ENTER */, IBUS_KEY_NONE },  /* ButtonMenuKnob */
+        [0x06] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRadioPower */
+        [0x07] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonClock */
+        [0x08] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonTelephone */
+        [0x10] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* ButtonArrowLeft */
+        [0x11] = { 139 /* KEY_MENU */, IBUS_KEY_NONE },  /* Button1 */
+        [0x12] = {  57 /* KEY_SPACE */, IBUS_KEY_NONE },  /* Button3 */
+        [0x13] = {   6 /* KEY_5 */, IBUS_KEY_NONE },  /* Button5 */
+        [0x14] = { 141 /* KEY_SETUP */, IBUS_KEY_NONE },  /* ButtonReversePlay */
+        [0x21] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonAM */
+        [0x22] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonRDS */
+        [0x23] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMode */
+        [0x24] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonEject */
+        [0x30] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonSwitch */
+        [0x31] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonFM */
+        [0x32] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonTP */
+        [0x34] = { IBUS_KEY_STATE, IBUS_KEY_NONE },  /* ButtonMenu */
+        [0x35] = { 106 /* KEY_RIGHT */, IBUS_KEY_NONE },  /* MenuKnobClockwise */
+        [0x36] = { 105 /* KEY_LEFT */, IBUS_KEY_NONE },  /* MenuKnobCounterClockwise */
+        [0x37] = {   1 /* KEY_ESC */, IBUS_KEY_NONE },  /* SelectInTapeMode */
+        [0x38] = { 103 /* KEY_UP */, IBUS_KEY_NONE },  /* MFL2ButtonChannelUp */
+        [0x39] = { 108 /* KEY_DOWN */, IBUS_KEY_NONE },  /* MFL2ButtonChannelDown */
+    },
+} };
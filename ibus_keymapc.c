@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ibus_keymap.h"
+
+/*
+ * Keymap compiler: checks a keymap file, prints the compiled table or
+ * writes it as C source. The built-in map (ibus_keymap_default.c, used by
+ * ibus_linux without --keymap and linked into the Pico firmware) is made
+ * this way from keymaps/default.keymap.
+ */
+
+static void print_table(const ibus_keymap_t *map)
+{
+    for (unsigned l = 0; l < IBUS_KEYMAP_LAYERS; ++l) {
+        printf("[%s]\n", ibus_keymap_layer_name((ibus_state_t)l));
+        for (unsigned c = 0; c < IBUS_KEYMAP_CODES; ++c) {
+            const ibus_keymap_entry_t *e = &map->entry[l][c];
+            const char *button = ibus_keymap_button_name((uint8_t)c);
+            const char *key    = ibus_keymap_key_name(e->key);
+
+            if (e->key == IBUS_KEY_NONE && e->long_key == IBUS_KEY_NONE)
+                continue;
+            if (button)
+                printf("  %-26s", button);
+            else
+                printf("  0x%02X%22s", c, "");
+            if (key)
+                printf(" %s", key);
+            else
+                printf(" %u", (unsigned)e->key);
+            if (e->long_key != IBUS_KEY_NONE) {
+                key = ibus_keymap_key_name(e->long_key);
+                if (key)
+                    printf(" long %s", key);
+                else
+                    printf(" long %u", (unsigned)e->long_key);
+            }
+            printf("\n");
+        }
+    }
+}
+
+static void print_help(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <keymap file>\n", name);
+    fprintf(stderr, "  -o <file>         Write the compiled table as C source\n");
+    fprintf(stderr, "  --symbol <name>   Name of the C table (default ibus_keymap_default)\n");
+    fprintf(stderr, "  --print           Print the compiled table, one layer at a time\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Without -o or --print the file is only checked.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out_path = NULL, *symbol = "ibus_keymap_default";
+    ibus_keymap_t map;
+    char err[256];
+    int opt, print = 0, res;
+
+    enum { OPT_SYMBOL = 0x100, OPT_PRINT };
+    static const struct option long_options[] = {
+        { "symbol", required_argument, NULL, OPT_SYMBOL },
+        { "print",  no_argument,       NULL, OPT_PRINT  },
+        { NULL,     0,                 NULL, 0          }
+    };
+
+    while ((opt = getopt_long(argc, argv, "o:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        case OPT_SYMBOL:
+            symbol = optarg;
+            break;
+        case OPT_PRINT:
+            print = 1;
+            break;
+        default:
+            print_help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    res = ibus_keymap_load(argv[optind], &map, err, sizeof(err));
+    if (res < 0) {
+        if (res == -EINVAL)
+            fprintf(stderr, "%s: %s\n", argv[optind], err);
+        else
+            fprintf(stderr, "%s\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if (print)
+        print_table(&map);
+
+    if (out_path) {
+        FILE *fp = fopen(out_path, "w");
+        if (!fp || ibus_keymap_write_c(fp, &map, symbol, argv[optind]) < 0) {
+            perror(out_path);
+            if (fp)
+                fclose(fp);
+            return EXIT_FAILURE;
+        }
+        if (fclose(fp) != 0) {
+            perror(out_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
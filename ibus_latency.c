@@ -0,0 +1,127 @@
+#include "ibus_latency.h"
+#include <stdio.h>
+#include <string.h>
+
+static unsigned ibus_hist_bucket(uint32_t value)
+{
+    if (value < IBUS_HIST_SUB_BUCKETS)
+        return value;
+
+    unsigned msb   = 31u - (unsigned)__builtin_clz(value);
+    unsigned shift = msb - IBUS_HIST_SUB_BITS;
+    unsigned sub   = (value >> shift) - IBUS_HIST_SUB_BUCKETS;
+
+    return IBUS_HIST_SUB_BUCKETS + shift * IBUS_HIST_SUB_BUCKETS + sub;
+}
+
+/* Largest value that falls into the given bucket */
+static uint32_t ibus_hist_bucket_upper(unsigned idx)
+{
+    if (idx < IBUS_HIST_SUB_BUCKETS)
+        return idx;
+
+    unsigned shift = (idx - IBUS_HIST_SUB_BUCKETS) / IBUS_HIST_SUB_BUCKETS;
+    unsigned sub   = (idx - IBUS_HIST_SUB_BUCKETS) % IBUS_HIST_SUB_BUCKETS;
+    uint64_t upper = ((uint64_t)(IBUS_HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void ibus_hist_reset(ibus_hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT32_MAX;
+}
+
+void ibus_hist_record(ibus_hist_t *h, uint32_t value)
+{
+    h->counts[ibus_hist_bucket(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+uint32_t ibus_hist_percentile(const ibus_hist_t *h, unsigned permille)
+{
+    if (h->total == 0)
+        return 0;
+
+    /* Rank of the wanted sample, rounded up, 1-based */
+    uint64_t rank = (h->total * permille + 999u) / 1000u;
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < IBUS_HIST_BUCKETS; ++i) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint32_t upper = ibus_hist_bucket_upper(i);
+            return upper > h->max ? h->max : upper;
+        }
+    }
+    return h->max;
+}
+
+int ibus_hist_format(const ibus_hist_t *h, const char *name,
+                     char *buf, size_t len)
+{
+    if (h->total == 0)
+        return snprintf(buf, len, "%s: n=0", name);
+
+    return snprintf(buf, len,
+                    "%s: n=%llu min=%lu avg=%lu p50=%lu p90=%lu p99=%lu p99.9=%lu max=%lu",
+                    name,
+                    (unsigned long long)h->total,
+                    (unsigned long)h->min,
+                    (unsigned long)(h->sum / h->total),
+                    (unsigned long)ibus_hist_percentile(h, 500),
+                    (unsigned long)ibus_hist_percentile(h, 900),
+                    (unsigned long)ibus_hist_percentile(h, 990),
+                    (unsigned long)ibus_hist_percentile(h, 999),
+                    (unsigned long)h->max);
+}
+
+/* Record b - a, skipping unknown (zero) or out-of-order timestamps */
+static void ibus_latency_span(ibus_hist_t *h, uint64_t a, uint64_t b)
+{
+    if (a == 0 || b == 0 || b < a)
+        return;
+
+    uint64_t d = b - a;
+    ibus_hist_record(h, d > UINT32_MAX ? UINT32_MAX : (uint32_t)d);
+}
+
+void ibus_latency_reset(ibus_latency_t *lat)
+{
+    for (unsigned i = 0; i < IBUS_LAT_STAGES; ++i)
+        ibus_hist_reset(&lat->stage[i]);
+}
+
+void ibus_latency_dispatched(ibus_latency_t *lat, const ibus_msg_view_t *msg,
+                             uint64_t dispatch_us)
+{
+    ibus_latency_span(&lat->stage[IBUS_LAT_RX],
+                      msg->first_rx_time_us, msg->rx_time_us);
+    ibus_latency_span(&lat->stage[IBUS_LAT_DISPATCH],
+                      msg->rx_time_us, dispatch_us);
+}
+
+void ibus_latency_output_done(ibus_latency_t *lat, const ibus_msg_view_t *msg,
+                              uint64_t dispatch_us, uint64_t done_us)
+{
+    ibus_latency_span(&lat->stage[IBUS_LAT_OUTPUT], dispatch_us, done_us);
+    ibus_latency_span(&lat->stage[IBUS_LAT_TOTAL],
+                      msg->first_rx_time_us, done_us);
+}
+
+const char *ibus_latency_stage_name(ibus_lat_stage_t stage)
+{
+    switch (stage) {
+    case IBUS_LAT_RX:       return "rx";
+    case IBUS_LAT_DISPATCH: return "dispatch";
+    case IBUS_LAT_OUTPUT:   return "output";
+    case IBUS_LAT_TOTAL:    return "total";
+    default:                return "?";
+    }
+}
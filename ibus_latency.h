@@ -0,0 +1,79 @@
+#ifndef IBUS_LATENCY_H
+#define IBUS_LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+
+/*
+ * Log-bucketed (HDR-style) latency histogram.
+ *
+ * Values below IBUS_HIST_SUB_BUCKETS are counted exactly; above that every
+ * power of two is split into IBUS_HIST_SUB_BUCKETS linear sub-buckets, so the
+ * relative error stays below 1/16 over the whole 32-bit range at a fixed
+ * ~1.8 KB per histogram. Units are whatever the caller records (we use us).
+ */
+#define IBUS_HIST_SUB_BITS     4u
+#define IBUS_HIST_SUB_BUCKETS  (1u << IBUS_HIST_SUB_BITS)
+#define IBUS_HIST_BUCKETS      (IBUS_HIST_SUB_BUCKETS + \
+                                (32u - IBUS_HIST_SUB_BITS) * IBUS_HIST_SUB_BUCKETS)
+
+typedef struct {
+    uint32_t counts[IBUS_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+} ibus_hist_t;
+
+void ibus_hist_reset(ibus_hist_t *h);
+void ibus_hist_record(ibus_hist_t *h, uint32_t value);
+
+/* Value at the given percentile in permille (500 = median, 999 = p99.9).
+ * Reports the upper edge of the bucket, clamped to the recorded maximum. */
+uint32_t ibus_hist_percentile(const ibus_hist_t *h, unsigned permille);
+
+/* One-line summary "name: n=.. min=.. p50=.. p90=.. p99=.. p99.9=.. max=..".
+ * Returns the snprintf() result. */
+int ibus_hist_format(const ibus_hist_t *h, const char *name,
+                     char *buf, size_t len);
+
+/*
+ * Per-frame latency stages, from the first byte leaving the UART to the
+ * front end's output (key event, video switch) being done:
+ *
+ *   RX       first byte  -> last byte         (frame on the wire)
+ *   DISPATCH last byte   -> decoder dispatch  (char timeout + scheduling)
+ *   OUTPUT   dispatch    -> output done       (platform side)
+ *   TOTAL    first byte  -> output done
+ *
+ * RX and DISPATCH are recorded for every frame, OUTPUT and TOTAL only for
+ * frames that produced output.
+ */
+typedef enum {
+    IBUS_LAT_RX = 0,
+    IBUS_LAT_DISPATCH,
+    IBUS_LAT_OUTPUT,
+    IBUS_LAT_TOTAL,
+    IBUS_LAT_STAGES
+} ibus_lat_stage_t;
+
+typedef struct {
+    ibus_hist_t stage[IBUS_LAT_STAGES];
+} ibus_latency_t;
+
+void ibus_latency_reset(ibus_latency_t *lat);
+
+/* A frame was handed to the platform at `dispatch_us` (same clock as the
+ * timestamps passed to ibus_append_byte_ts()). */
+void ibus_latency_dispatched(ibus_latency_t *lat, const ibus_msg_view_t *msg,
+                             uint64_t dispatch_us);
+
+/* Output caused by that frame completed at `done_us`. */
+void ibus_latency_output_done(ibus_latency_t *lat, const ibus_msg_view_t *msg,
+                              uint64_t dispatch_us, uint64_t done_us);
+
+const char *ibus_latency_stage_name(ibus_lat_stage_t stage);
+
+#endif /* IBUS_LATENCY_H */
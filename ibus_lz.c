@@ -0,0 +1,153 @@
+#include "ibus_lz.h"
+#include <string.h>
+
+#define IBUS_LZ_MIN_MATCH   4u
+#define IBUS_LZ_HASH_BITS   12u
+#define IBUS_LZ_MAX_OFFSET  65535u
+/* Matches must end this far before the end, literals cover the tail */
+#define IBUS_LZ_TAIL        5u
+
+static uint32_t ibus_lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned ibus_lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32u - IBUS_LZ_HASH_BITS);
+}
+
+static uint8_t *ibus_lz_put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255u) {
+        *op++ = 255u;
+        len -= 255u;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t ibus_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    uint32_t table[1u << IBUS_LZ_HASH_BITS];
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dst;
+
+    if (cap < IBUS_LZ_BOUND(len))
+        return 0;
+
+    memset(table, 0, sizeof(table));
+
+    if (len > IBUS_LZ_MIN_MATCH + IBUS_LZ_TAIL) {
+        const uint8_t *match_limit = end - IBUS_LZ_TAIL;
+
+        /* table[] holds position + 1, 0 = empty */
+        while (ip + IBUS_LZ_MIN_MATCH <= match_limit) {
+            uint32_t seq = ibus_lz_read32(ip);
+            unsigned h   = ibus_lz_hash(seq);
+            uint32_t cand = table[h];
+
+            table[h] = (uint32_t)(ip - src) + 1u;
+
+            if (cand == 0 ||
+                (size_t)(ip - src) - (cand - 1u) > IBUS_LZ_MAX_OFFSET ||
+                ibus_lz_read32(src + cand - 1u) != seq) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t *ref = src + cand - 1u;
+            size_t match = IBUS_LZ_MIN_MATCH;
+            while (ip + match < match_limit && ref[match] == ip[match])
+                match++;
+
+            size_t lit = (size_t)(ip - anchor);
+            uint8_t *token = op++;
+            *token = (uint8_t)(((lit < 15u) ? lit : 15u) << 4);
+            if (lit >= 15u)
+                op = ibus_lz_put_length(op, lit - 15u);
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xFFu);
+            *op++ = (uint8_t)(offset >> 8);
+
+            size_t ml = match - IBUS_LZ_MIN_MATCH;
+            *token |= (uint8_t)((ml < 15u) ? ml : 15u);
+            if (ml >= 15u)
+                op = ibus_lz_put_length(op, ml - 15u);
+
+            ip += match;
+            anchor = ip;
+        }
+    }
+
+    /* Trailing literals */
+    size_t lit = (size_t)(end - anchor);
+    *op++ = (uint8_t)(((lit < 15u) ? lit : 15u) << 4);
+    if (lit >= 15u)
+        op = ibus_lz_put_length(op, lit - 15u);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return (size_t)(op - dst);
+}
+
+static int ibus_lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255u);
+    return 0;
+}
+
+long ibus_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    const uint8_t *ip = src, *end = src + len;
+    uint8_t *op = dst, *op_end = dst + cap;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+
+        if (lit == 15u && ibus_lz_get_length(&ip, end, &lit) < 0)
+            return -1;
+        if ((size_t)(end - ip) < lit || (size_t)(op_end - op) < lit)
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == end)
+            break;      /* last sequence: literals only */
+
+        if (end - ip < 2)
+            return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        size_t match = token & 0x0Fu;
+        if (match == 15u && ibus_lz_get_length(&ip, end, &match) < 0)
+            return -1;
+        match += IBUS_LZ_MIN_MATCH;
+        if ((size_t)(op_end - op) < match)
+            return -1;
+
+        /* Byte by byte: overlapping matches repeat the pattern */
+        const uint8_t *ref = op - offset;
+        while (match--)
+            *op++ = *ref++;
+    }
+
+    return (long)(op - dst);
+}
@@ -0,0 +1,28 @@
+#ifndef IBUS_LZ_H
+#define IBUS_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small LZ77 block codec for trace and capture segments.
+ *
+ * The block format follows LZ4: a token byte (literal length << 4 | match
+ * length - 4), 255-continued length bytes, the literals, a 16-bit little
+ * endian offset and more match length bytes. The last sequence only has
+ * literals. Good enough for highly repetitive bus logs (typically 5-10x),
+ * fast, and needs 16 KB of stack and no allocation.
+ */
+#define IBUS_LZ_BLOCK_SIZE  65536u
+
+/* Worst case output size for `len` input bytes */
+#define IBUS_LZ_BOUND(len)  ((len) + (len) / 255u + 16u)
+
+/* Returns the compressed size, or 0 if it doesn't fit in `cap`. */
+size_t ibus_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/* Returns the decompressed size, or -1 for corrupt input or if the output
+ * doesn't fit in `cap`. */
+long ibus_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+#endif /* IBUS_LZ_H */
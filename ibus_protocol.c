@@ -1,46 +1,48 @@
 #include "ibus_protocol.h"
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 /* Internal RX buffer: room for several max-sized messages */
-static uint8_t  ibus_data[IBUS_MAX_MESSAGE_LEN * 8];
+static uint8_t  ibus_data[IBUS_RX_BUFFER_LEN];
 static uint32_t ibus_data_index = 0;
 
+/* Receive time of every byte in ibus_data (same indexing) */
+static uint64_t ibus_rx_time[sizeof(ibus_data)];
+
 /* Current headunit state and hijack mode */
 static ibus_state_t ibus_state        = IBUS_STATE_UNKNOWN;
 static ibus_state_t ibus_hijack_state = IBUS_STATE_UNKNOWN;
 
-static uint8_t ibus_get_message_length(void)
-{
-    return (uint8_t)(ibus_data[IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN);
-}
+/* State hysteresis: a change waiting for confirmation (UNKNOWN = none) */
+static ibus_state_filter_t ibus_state_filter;
+static ibus_state_t ibus_state_pending   = IBUS_STATE_UNKNOWN;
+static uint32_t     ibus_state_confirmed = 0;
+static uint64_t     ibus_state_since_us  = 0;   /* rx time of the last change */
 
-static uint8_t ibus_get_data_length(void)
-{
-    uint8_t len = ibus_get_message_length();
-    if (len <= IBUS_MIN_MESSAGE_LEN) {
-        return 0;
-    }
-    return (uint8_t)(len - IBUS_MIN_MESSAGE_LEN);
-}
+/* A confirmed change held back by the dwell time, with its frame */
+static uint64_t ibus_state_due_us = 0;          /* 0 = none */
+static uint8_t  ibus_state_frame[IBUS_MAX_MESSAGE_LEN];
+static uint16_t ibus_state_frame_len = 0;
 
-static uint8_t ibus_get_sender(void)
-{
-    return ibus_data[IBUS_POS_SENDER];
-}
+/* Health counters */
+static ibus_stats_t ibus_stats;
+static ibus_state_stats_t ibus_state_stats;
 
-static uint8_t ibus_get_receiver(void)
-{
-    return ibus_data[IBUS_POS_RECEIVER];
-}
+/* Output sink for ibus_process_messages_batch(); NULL means platform hooks */
+typedef struct {
+    ibus_event_t *events;
+    size_t        max;
+    size_t        count;
+    uint32_t      mask;
+} ibus_batch_t;
 
-static uint8_t ibus_get_message(void)
-{
-    return ibus_data[IBUS_POS_MESSAGE];
-}
+static ibus_batch_t *ibus_batch = NULL;
 
-static uint8_t ibus_get_data_byte(uint32_t idx)
+static uint16_t ibus_get_message_length(void)
 {
-    return ibus_data[IBUS_POS_DATA_START + idx];
+    return (uint16_t)(ibus_data[IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN);
 }
 
 /* Very simple substring search over the data region.
@@ -61,13 +63,173 @@ static uint8_t ibus_calc_checksum(uint32_t checksum_index)
     return checksum;
 }
 
-static void ibus_change_state(ibus_state_t new_state)
+/* Reserve the next batch slot for an event of the given type.
+ * Returns NULL if that type was not requested. */
+static ibus_event_t *ibus_batch_next(ibus_event_type_t type,
+                                     const ibus_msg_view_t *m)
+{
+    if (!(ibus_batch->mask & IBUS_EVENT_MASK(type)))
+        return NULL;
+
+    ibus_event_t *ev = &ibus_batch->events[ibus_batch->count++];
+    ev->type             = type;
+    ev->first_rx_time_us = m->first_rx_time_us;
+    ev->rx_time_us       = m->rx_time_us;
+    return ev;
+}
+
+/* ===== Output dispatch: platform hooks or batch ===== */
+
+static void ibus_emit_raw(const ibus_msg_view_t *m)
 {
-    if (ibus_state == new_state)
+    if (ibus_batch) {
+        ibus_event_t *ev = ibus_batch_next(IBUS_EVENT_RAW, m);
+        if (ev) {
+            ev->raw.len = m->raw_len;
+            memcpy(ev->raw.frame, m->raw, m->raw_len);
+        }
+        return;
+    }
+#ifndef IBUS_NO_PLATFORM_HOOKS
+    ibus_platform_log_message(m);
+#endif
+}
+
+static void ibus_emit_button(uint8_t code, uint8_t released,
+                             uint8_t long_press, const ibus_msg_view_t *m)
+{
+    if (ibus_batch) {
+        ibus_event_t *ev = ibus_batch_next(IBUS_EVENT_BUTTON, m);
+        if (ev) {
+            ev->button.code       = code;
+            ev->button.released   = released;
+            ev->button.long_press = long_press;
+        }
+        return;
+    }
+#ifndef IBUS_NO_PLATFORM_HOOKS
+    ibus_platform_button_event(code, released, long_press, m);
+#endif
+}
+
+static void ibus_emit_knob(int clockwise, uint8_t steps,
+                           const ibus_msg_view_t *m)
+{
+    if (ibus_batch) {
+        ibus_event_t *ev = ibus_batch_next(IBUS_EVENT_KNOB, m);
+        if (ev) {
+            ev->knob.clockwise = clockwise;
+            ev->knob.steps     = steps;
+        }
         return;
+    }
+#ifndef IBUS_NO_PLATFORM_HOOKS
+    ibus_platform_knob_event(clockwise, steps, m);
+#endif
+}
+
+static void ibus_state_commit(ibus_state_t new_state, const ibus_msg_view_t *m)
+{
+    ibus_state          = new_state;
+    ibus_state_pending  = IBUS_STATE_UNKNOWN;
+    ibus_state_due_us   = 0;
+    ibus_state_since_us = m->rx_time_us;
+    ibus_state_stats.changes++;
+
+    if (ibus_batch) {
+        ibus_event_t *ev = ibus_batch_next(IBUS_EVENT_STATE, m);
+        if (ev) {
+            ev->state.new_state    = ibus_state;
+            ev->state.hijack_state = ibus_hijack_state;
+        }
+        return;
+    }
+#ifndef IBUS_NO_PLATFORM_HOOKS
+    ibus_platform_state_changed(ibus_state, ibus_hijack_state, m);
+#endif
+}
+
+/* The pending change will not happen (counted once, deferred or not) */
+static void ibus_state_drop_pending(void)
+{
+    if (ibus_state_pending == IBUS_STATE_UNKNOWN)
+        return;
+    ibus_state_stats.suppressed++;
+    ibus_state_pending = IBUS_STATE_UNKNOWN;
+    ibus_state_due_us  = 0;
+}
+
+static void ibus_change_state(ibus_state_t new_state,
+                              const ibus_msg_view_t *m)
+{
+    /* A deferred change that was due before this frame came first */
+    if (ibus_state_due_us != 0 && m->rx_time_us >= ibus_state_due_us)
+        ibus_state_poll(ibus_state_due_us);
+
+    if (ibus_state == new_state) {
+        /* Back to the current state: whatever was pending was a glitch */
+        ibus_state_drop_pending();
+        return;
+    }
+
+    if (new_state != ibus_state_pending) {
+        ibus_state_drop_pending();
+        ibus_state_pending   = new_state;
+        ibus_state_confirmed = 0;
+    }
+    ibus_state_confirmed++;
+
+    if (ibus_state_confirmed < ibus_state_filter.confirm[ibus_state][new_state] ||
+        ibus_state_due_us != 0)
+        return;
+
+    /* Held for less than the dwell time: apply it when that is over, with
+     * this frame (without receive times there is no dwell time) */
+    if (m->rx_time_us != 0 && ibus_state_since_us != 0 &&
+        m->rx_time_us >= ibus_state_since_us &&
+        m->rx_time_us - ibus_state_since_us < ibus_state_filter.min_dwell_us) {
+        ibus_state_due_us = ibus_state_since_us + ibus_state_filter.min_dwell_us;
+        ibus_state_frame_len = m->raw_len;
+        memcpy(ibus_state_frame, m->raw, m->raw_len);
+        return;
+    }
+
+    ibus_state_commit(new_state, m);
+}
+
+uint64_t ibus_state_deadline(void)
+{
+    return ibus_state_due_us;
+}
+
+void ibus_state_poll(uint64_t now_us)
+{
+    ibus_msg_view_t view;
+
+    if (ibus_state_due_us == 0 || now_us < ibus_state_due_us)
+        return;
+    ibus_msg_view_init(&view, ibus_state_frame, ibus_state_frame_len, now_us);
+    ibus_state_commit(ibus_state_pending, &view);
+}
+
+size_t ibus_state_poll_batch(uint64_t now_us, ibus_event_t *events,
+                             size_t max_events, uint32_t event_mask)
+{
+    ibus_batch_t batch = {
+        .events = events,
+        .max    = max_events,
+        .count  = 0,
+        .mask   = event_mask
+    };
+
+    if (max_events == 0)
+        return 0;
+
+    ibus_batch = &batch;
+    ibus_state_poll(now_us);
+    ibus_batch = NULL;
 
-    ibus_state = new_state;
-    ibus_platform_state_changed(ibus_state, ibus_hijack_state);
+    return batch.count;
 }
 
 ibus_state_t ibus_get_state(void)
@@ -75,20 +237,116 @@ ibus_state_t ibus_get_state(void)
     return ibus_state;
 }
 
+void ibus_set_state_filter(const ibus_state_filter_t *filter)
+{
+    ibus_state_filter = *filter;
+}
+
+const ibus_state_filter_t *ibus_get_state_filter(void)
+{
+    return &ibus_state_filter;
+}
+
+static const char *const ibus_state_names[IBUS_STATE_COUNT] = {
+    "UNKNOWN", "OFF", "MENU", "FM", "TAPE", "AUX", "CDC"
+};
+
+const char *ibus_state_name(ibus_state_t state)
+{
+    return (unsigned)state < IBUS_STATE_COUNT ? ibus_state_names[state] : "?";
+}
+
+int ibus_state_parse(const char *name)
+{
+    for (int i = 0; i < IBUS_STATE_COUNT; ++i) {
+        if (strcasecmp(name, ibus_state_names[i]) == 0)
+            return i;
+    }
+    return -EINVAL;
+}
+
+/* One side of a filter spec: [*first, *last] */
+static int ibus_state_range(const char *name, size_t len, int *first, int *last)
+{
+    char buf[16];
+
+    if (len == 0 || len >= sizeof(buf))
+        return -EINVAL;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    if (strcmp(buf, "*") == 0) {
+        *first = 0;
+        *last  = IBUS_STATE_COUNT - 1;
+        return 0;
+    }
+    *first = *last = ibus_state_parse(buf);
+    return *first < 0 ? -EINVAL : 0;
+}
+
+int ibus_state_filter_parse(ibus_state_filter_t *filter, const char *spec)
+{
+    const char *colon = strchr(spec, ':');
+    const char *equal = colon ? strchr(colon, '=') : NULL;
+    int from_first, from_last, to_first, to_last;
+    unsigned long n;
+    char *end;
+
+    if (!equal ||
+        ibus_state_range(spec, (size_t)(colon - spec), &from_first, &from_last) < 0 ||
+        ibus_state_range(colon + 1, (size_t)(equal - colon - 1), &to_first, &to_last) < 0)
+        return -EINVAL;
+    n = strtoul(equal + 1, &end, 10);
+    if (end == equal + 1 || *end != '\0' || n > UINT8_MAX)
+        return -EINVAL;
+
+    for (int from = from_first; from <= from_last; ++from) {
+        for (int to = to_first; to <= to_last; ++to)
+            filter->confirm[from][to] = (uint8_t)n;
+    }
+    return 0;
+}
+
+const ibus_state_stats_t *ibus_get_state_stats(void)
+{
+    return &ibus_state_stats;
+}
+
+const ibus_stats_t *ibus_get_stats(void)
+{
+    return &ibus_stats;
+}
+
+void ibus_reset_stats(void)
+{
+    memset(&ibus_stats, 0, sizeof(ibus_stats));
+    memset(&ibus_state_stats, 0, sizeof(ibus_state_stats));
+}
+
 void ibus_reset_buffer(void)
 {
     memset(ibus_data, 0, sizeof(ibus_data));
     ibus_data_index = 0;
 }
 
-void ibus_append_byte(uint8_t byte)
+void ibus_append_byte_ts(uint8_t byte, uint64_t rx_time_us)
 {
+    ibus_stats.bytes++;
+
     if (ibus_data_index >= (uint32_t)sizeof(ibus_data)) {
-        /* Overflow: just reset the buffer */
+        /* Overflow: just reset the buffer (this byte is dropped too) */
+        ibus_stats.overflows++;
+        ibus_stats.resync_bytes += ibus_data_index + 1;
         ibus_reset_buffer();
         return;
     }
-    ibus_data[ibus_data_index++] = byte;
+    ibus_rx_time[ibus_data_index] = rx_time_us;
+    ibus_data[ibus_data_index++]  = byte;
+}
+
+void ibus_append_byte(uint8_t byte)
+{
+    ibus_append_byte_ts(byte, 0);
 }
 
 int ibus_has_pending_data(void)
@@ -99,44 +357,73 @@ int ibus_has_pending_data(void)
 void ibus_init(ibus_state_t hijack_state)
 {
     ibus_reset_buffer();
+    ibus_reset_stats();
     ibus_state        = IBUS_STATE_UNKNOWN;
     ibus_hijack_state = hijack_state;
+    ibus_state_pending  = IBUS_STATE_UNKNOWN;
+    ibus_state_since_us = 0;
+    ibus_state_due_us   = 0;
+}
+
+void ibus_set_hijack_state(ibus_state_t hijack_state)
+{
+    ibus_hijack_state = hijack_state;
+}
+
+ibus_state_t ibus_get_hijack_state(void)
+{
+    return ibus_hijack_state;
+}
+
+void ibus_msg_view_init(ibus_msg_view_t *view, const uint8_t *frame,
+                        uint16_t len, uint64_t rx_time_us)
+{
+    view->raw        = frame;
+    view->raw_len    = len;
+    view->data       = &frame[IBUS_POS_DATA_START];
+    view->data_len   = (len > IBUS_MIN_MESSAGE_LEN)
+                       ? (uint8_t)(len - IBUS_MIN_MESSAGE_LEN) : 0;
+    view->sender     = frame[IBUS_POS_SENDER];
+    view->receiver   = frame[IBUS_POS_RECEIVER];
+    view->message    = frame[IBUS_POS_MESSAGE];
+    view->first_rx_time_us = rx_time_us;
+    view->rx_time_us       = rx_time_us;
 }
 
 /* Headunit state changes based on UMID/ST/LCDC content */
-static void ibus_handle_headunit_state(void)
+static void ibus_handle_headunit_state(const ibus_msg_view_t *m)
 {
-    if (ibus_get_sender() == IBUS_DEV_RAD &&
-        ibus_get_receiver() == IBUS_DEV_GT) {
+    if (m->sender == IBUS_DEV_RAD &&
+        m->receiver == IBUS_DEV_GT) {
 
-        uint8_t msg = ibus_get_message();
+        uint8_t msg = m->message;
 
         if (msg == IBUS_MSG_UMID) {
-            if (ibus_get_data_length() > 0 && ibus_get_data_byte(0) == 0x62) { /* RadioDisplay layout */
+            if (m->data_len > 0 && m->data[0] == 0x62) { /* RadioDisplay layout */
                 if (ibus_data_contains("AUX")) {
-                    ibus_change_state(IBUS_STATE_AUX);
+                    ibus_change_state(IBUS_STATE_AUX, m);
                 } else if (ibus_data_contains("CDC")) {
-                    ibus_change_state(IBUS_STATE_CD_CHANGER);
+                    ibus_change_state(IBUS_STATE_CD_CHANGER, m);
                 } else if (ibus_data_contains("TAPE")) {
-                    ibus_change_state(IBUS_STATE_TAPE);
+                    ibus_change_state(IBUS_STATE_TAPE, m);
                 }
             }
         } else if (msg == IBUS_MSG_ST) {
-            if (ibus_get_data_length() > 0 && ibus_get_data_byte(0) == 0x62) {
+            if (m->data_len > 0 && m->data[0] == 0x62) {
                 if (ibus_data_contains("RDS") ||
                     ibus_data_contains("FM")  ||
                     ibus_data_contains("REG") ||
                     ibus_data_contains("MWA")) {
-                    ibus_change_state(IBUS_STATE_FM);
+                    ibus_change_state(IBUS_STATE_FM, m);
                 }
             }
         } else if (msg == IBUS_MSG_LCDC) {
-            if (ibus_get_data_length() == 1) {
-                uint8_t d0 = ibus_get_data_byte(0);
+            if (m->data_len == 1) {
+                uint8_t d0 = m->data[0];
                 switch (d0) {
                 case 0x01: /* No Display Required */
                 case 0x02: /* Radio Display Off   */
-                    ibus_change_state(IBUS_STATE_MENU);
+                    ibus_change_state(IBUS_STATE_MENU, m);
                     break;
                 default:
                     break;
@@ -148,40 +435,56 @@ static void ibus_handle_headunit_state(void)
 
 /* Process all complete messages currently in the RX buffer.
  * Any invalid message causes the buffer to be reset. */
-void ibus_process_messages(void)
+static void ibus_process_buffer(void)
 {
     while (ibus_data_index > 0) {
+        if (ibus_batch &&
+            ibus_batch->max - ibus_batch->count < IBUS_MAX_EVENTS_PER_MESSAGE) {
+            /* No room for the worst case of this message; keep it buffered */
+            break;
+        }
+
         if (ibus_data_index < IBUS_MIN_MESSAGE_LEN) {
             /* Not enough data for even the shortest message. */
             break;
         }
 
-        uint8_t cur_len = ibus_get_message_length();
+        uint16_t cur_len = ibus_get_message_length();
         if (ibus_data_index < cur_len) {
             /* Wait for more data */
             break;
         }
 
         /* Validate checksum */
-        uint8_t checksum_index = (uint8_t)(cur_len - 1);
+        uint16_t checksum_index = (uint16_t)(cur_len - 1);
         if (ibus_calc_checksum(checksum_index) != ibus_data[checksum_index]) {
             /* Invalid checksum: drop everything */
+            ibus_stats.checksum_errors++;
+            ibus_stats.resync_bytes += ibus_data_index;
             ibus_reset_buffer();
             return;
         }
 
         /* We have a complete valid message */
-        ibus_platform_log_message(ibus_data, cur_len);
+        ibus_msg_view_t view;
+        ibus_msg_view_init(&view, ibus_data, cur_len,
+                           ibus_rx_time[checksum_index]);
+        view.first_rx_time_us = ibus_rx_time[0];
 
-        uint8_t sender   = ibus_get_sender();
-        uint8_t receiver = ibus_get_receiver();
-        uint8_t msg      = ibus_get_message();
-        uint8_t data_len = ibus_get_data_length();
+        ibus_stats.frames++;
+        ibus_stats.frames_by_sender[view.sender]++;
+        ibus_stats.frames_by_message[view.message]++;
+        ibus_emit_raw(&view);
+
+        uint8_t sender   = view.sender;
+        uint8_t receiver = view.receiver;
+        uint8_t msg      = view.message;
+        uint8_t data_len = view.data_len;
 
         /* 1) Handle button-related messages */
         if (sender == IBUS_DEV_BMBT) {
             if (msg == IBUS_MSG_BMBTB1 && data_len >= 1) {
-                uint8_t databyte = ibus_get_data_byte(0);
+                uint8_t databyte = view.data[0];
                 uint8_t longPress = 0;
                 uint8_t released  = 0;
 
@@ -194,14 +497,14 @@ void ibus_process_messages(void)
                 }
 
                 if (databyte == IBUS_BTN_RADIO_POWER) {
-                    ibus_change_state(IBUS_STATE_POWER_OFF);
+                    ibus_change_state(IBUS_STATE_POWER_OFF, &view);
                 }
 
                 /* Pass raw button code to platform (mapping done there) */
-                ibus_platform_button_event(databyte, released, longPress);
+                ibus_emit_button(databyte, released, longPress, &view);
             } else if (msg == IBUS_MSG_BMBTB0 && data_len >= 2) {
                 /* button command for select is in second byte of data */
-                uint8_t databyte = ibus_get_data_byte(1);
+                uint8_t databyte = view.data[1];
                 uint8_t longPress = 0;
                 uint8_t released  = 0;
 
@@ -214,13 +517,13 @@ void ibus_process_messages(void)
                 }
 
                 if (databyte == IBUS_BTN_SELECT_TAPE_MODE) {
-                    ibus_platform_button_event(IBUS_BTN_IDX_SELECT_TAPE,
-                                               released, longPress);
+                    ibus_emit_button(IBUS_BTN_IDX_SELECT_TAPE,
+                                     released, longPress, &view);
                 } else {
                     /* Unknown BMBTB0 button: ignore or log at platform if desired */
                 }
             } else if (msg == IBUS_MSG_KNOB && data_len >= 1) {
-                uint8_t databyte = ibus_get_data_byte(0);
+                uint8_t databyte = view.data[0];
                 int clockwise = 0;
 
                 if (databyte & IBUS_BTN_MENU_KNOB_CW_MASK) {
@@ -230,20 +533,20 @@ void ibus_process_messages(void)
 
                 /* databyte now tells how many steps */
                 if (databyte > 0) {
-                    ibus_platform_knob_event(clockwise, databyte);
+                    ibus_emit_knob(clockwise, databyte, &view);
                 }
             } else if (msg == IBUS_MSG_MFLB && data_len >= 1) {
-                uint8_t databyte = ibus_get_data_byte(0);
+                uint8_t databyte = view.data[0];
                 (void)databyte;
                 /* Currently just informational (volume up/down); no key mapping here. */
             }
         } else if (sender == IBUS_DEV_MFL && receiver == IBUS_DEV_RAD) {
             if (msg == IBUS_MSG_MFLB && data_len >= 1) {
-                uint8_t databyte = ibus_get_data_byte(0);
+                uint8_t databyte = view.data[0];
                 (void)databyte;
                 /* If desired, volume up/down handling could be added here. */
             } else if (msg == IBUS_MSG_MFLB2 && data_len >= 1) {
-                uint8_t databyte = ibus_get_data_byte(0);
+                uint8_t databyte = view.data[0];
                 uint8_t released = 0;
 
                 if (databyte & IBUS_MFL2_BTN_RELEASE) {
@@ -252,11 +555,11 @@ void ibus_process_messages(void)
                 }
 
                 if (databyte & IBUS_MFL2_BTN_CH_UP) {
-                    ibus_platform_button_event(IBUS_BTN_IDX_MFL2_CH_UP,
-                                               released, 0);
+                    ibus_emit_button(IBUS_BTN_IDX_MFL2_CH_UP,
+                                     released, 0, &view);
                 } else if (databyte & IBUS_MFL2_BTN_CH_DOWN) {
-                    ibus_platform_button_event(IBUS_BTN_IDX_MFL2_CH_DOWN,
-                                               released, 0);
+                    ibus_emit_button(IBUS_BTN_IDX_MFL2_CH_DOWN,
+                                     released, 0, &view);
                 }
 
                 /* TODO: handle answer buttons and other MFL buttons if needed */
@@ -265,7 +568,7 @@ void ibus_process_messages(void)
 
         /* 2) Handle headunit state messages (only if hijack mode is set) */
         if (ibus_hijack_state != IBUS_STATE_UNKNOWN) {
-            ibus_handle_headunit_state();
+            ibus_handle_headunit_state(&view);
         }
 
         /* 3) Remove this message from the buffer and continue with next one */
@@ -273,6 +576,9 @@ void ibus_process_messages(void)
             memmove(&ibus_data[0],
                     &ibus_data[cur_len],
                     ibus_data_index - cur_len);
+            memmove(&ibus_rx_time[0],
+                    &ibus_rx_time[cur_len],
+                    (ibus_data_index - cur_len) * sizeof(ibus_rx_time[0]));
             ibus_data_index -= cur_len;
             memset(&ibus_data[ibus_data_index], 0, cur_len);
         } else {
@@ -284,3 +590,27 @@ void ibus_process_messages(void)
 
     /* Done */
 }
+
+#ifndef IBUS_NO_PLATFORM_HOOKS
+void ibus_process_messages(void)
+{
+    ibus_process_buffer();
+}
+#endif
+
+size_t ibus_process_messages_batch(ibus_event_t *events, size_t max_events,
+                                   uint32_t event_mask)
+{
+    ibus_batch_t batch = {
+        .events = events,
+        .max    = max_events,
+        .count  = 0,
+        .mask   = event_mask
+    };
+
+    ibus_batch = &batch;
+    ibus_process_buffer();
+    ibus_batch = NULL;
+
+    return batch.count;
+}
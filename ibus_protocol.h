@@ -1,6 +1,7 @@
 #ifndef IBUS_PROTOCOL_H
 #define IBUS_PROTOCOL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -25,12 +26,16 @@ enum {
 #define IBUS_SENDER_AND_LENGTH_LEN  2u
 #define IBUS_MIN_MESSAGE_LEN        5u      /* sender,len,receiver,message,checksum */
 #define IBUS_MAX_MESSAGE_LEN        257u    /* 0xFF + 2 */
+#define IBUS_RX_BUFFER_LEN          (IBUS_MAX_MESSAGE_LEN * 8u) /* decoder RX buffer */
 
 /* === Device addresses (only the ones we actually use) === */
 #define IBUS_DEV_GM     0x00  /* Body module */
 #define IBUS_DEV_GT     0x3B  /* Graphics driver (nav) */
 #define IBUS_DEV_RAD    0x68  /* Radio */
 #define IBUS_DEV_MFL    0x50  /* Multi-function steering wheel */
+#define IBUS_DEV_IKE    0x80  /* Instrument cluster */
+#define IBUS_DEV_GLO    0xBF  /* Global broadcast */
+#define IBUS_DEV_LCM    0xD0  /* Light control module */
 #define IBUS_DEV_BMBT   0xF0  /* Board monitor buttons */
 
 /* === Message IDs we use === */
@@ -38,6 +43,9 @@ enum {
 #define IBUS_MSG_DSRED   0x02  /* Device status ready */
 #define IBUS_MSG_BSREQ   0x03  /* Bus status request */
 #define IBUS_MSG_BS      0x04  /* Bus status */
+#define IBUS_MSG_IGN     0x11  /* Ignition status */
+#define IBUS_MSG_SPEED   0x18  /* Speed / RPM */
+#define IBUS_MSG_TEMP    0x19  /* Outside / coolant temperature */
 #define IBUS_MSG_UMID    0x23  /* Display Text */
 #define IBUS_MSG_UANZV   0x24  /* Update ANZV */
 #define IBUS_MSG_MFLB    0x32  /* MFL buttons */
@@ -54,6 +62,8 @@ enum {
 #define IBUS_MSG_CC      0x4A  /* Cassette control */
 #define IBUS_MSG_CS      0x4B  /* Cassette Status */
 #define IBUS_MSG_RGBC    0x4F  /* RGB Control */
+#define IBUS_MSG_LAMP    0x5B  /* Lamp status */
+#define IBUS_MSG_DOORS   0x7A  /* Doors / windows / lids status */
 #define IBUS_MSG_ST      0xA5  /* Screen text */
 
 /* === Button flags (from BMBT) === */
@@ -126,6 +136,27 @@ typedef enum {
     IBUS_STATE_CD_CHANGER
 } ibus_state_t;
 
+#define IBUS_STATE_COUNT            (IBUS_STATE_CD_CHANGER + 1)
+
+/*
+ * Headunit state hysteresis. A change to a new state needs confirm[from][to]
+ * frames asking for it without a frame asking for another state in between
+ * (0 or 1 = at once), and the current state must have been held for
+ * min_dwell_us (by frame receive time); a confirmed change that comes
+ * earlier is deferred until then (ibus_state_poll(), or
+ * ibus_state_poll_batch() for batch-only callers). An all-zero filter
+ * changes on every frame.
+ */
+typedef struct {
+    uint8_t  confirm[IBUS_STATE_COUNT][IBUS_STATE_COUNT];
+    uint32_t min_dwell_us;
+} ibus_state_filter_t;
+
+typedef struct {
+    uint32_t changes;           /* state changes reported */
+    uint32_t suppressed;        /* changes given up before being applied */
+} ibus_state_stats_t;
+
 /* How we switch video input (platform-specific meaning) */
 typedef enum {
     IBUS_VID_SWITCH_CTS = 0,
@@ -134,42 +165,191 @@ typedef enum {
     IBUS_VID_SWITCH_UNKNOWN
 } ibus_video_switch_t;
 
+/*
+ * Parsed view of one validated message.
+ *
+ * All pointers refer to the decoder's RX buffer; a view handed to a platform
+ * hook is only valid until that hook returns. Copy what you need to keep.
+ */
+typedef struct {
+    const uint8_t *raw;         /* whole frame: sender..checksum */
+    const uint8_t *data;        /* first data byte (data_len may be 0) */
+    uint16_t       raw_len;     /* sender..checksum, IBUS_MIN_MESSAGE_LEN.. */
+    uint8_t        data_len;
+    uint8_t        sender;
+    uint8_t        receiver;
+    uint8_t        message;
+    uint64_t       first_rx_time_us; /* platform timestamp of the first byte */
+    uint64_t       rx_time_us;       /* platform timestamp of the last byte */
+} ibus_msg_view_t;
+
+/*
+ * Decoded output of the batched API (ibus_process_messages_batch).
+ * Unlike ibus_msg_view_t, events own their data and stay valid after the
+ * call returns, so they can be handed to another thread or core.
+ */
+typedef enum {
+    IBUS_EVENT_RAW = 0,         /* a validated message (copy of the frame) */
+    IBUS_EVENT_STATE,           /* headunit state changed */
+    IBUS_EVENT_BUTTON,          /* logical button decoded */
+    IBUS_EVENT_KNOB             /* menu knob rotated */
+} ibus_event_type_t;
+
+#define IBUS_EVENT_MASK(type)       (1u << (type))
+#define IBUS_EVENT_MASK_ALL         0xFu
+
+/* Most events a single message can produce (raw + a deferred state change
+ * that became due + state + button). */
+#define IBUS_MAX_EVENTS_PER_MESSAGE 4u
+
+typedef struct {
+    ibus_event_type_t type;
+    uint64_t          first_rx_time_us; /* triggering message: first byte */
+    uint64_t          rx_time_us;       /* triggering message: last byte */
+    union {
+        struct {
+            uint16_t len;
+            uint8_t  frame[IBUS_MAX_MESSAGE_LEN];
+        } raw;
+        struct {
+            ibus_state_t new_state;
+            ibus_state_t hijack_state;
+        } state;
+        struct {
+            uint8_t code;
+            uint8_t released;
+            uint8_t long_press;
+        } button;
+        struct {
+            int     clockwise;
+            uint8_t steps;
+        } knob;
+    };
+} ibus_event_t;
+
+/*
+ * Decoder health counters. Always on; every counter is a plain increment on
+ * the receive path. Counters wrap at 2^32, consumers should use deltas.
+ */
+typedef struct {
+    uint32_t bytes;             /* bytes handed to ibus_append_byte*() */
+    uint32_t frames;            /* messages that passed the checksum */
+    uint32_t checksum_errors;   /* messages that failed the checksum */
+    uint32_t overflows;         /* RX buffer overflows */
+    uint32_t resync_bytes;      /* bytes dropped by checksum/overflow resets */
+    uint32_t frames_by_sender[256];
+    uint32_t frames_by_message[256];
+} ibus_stats_t;
+
 /* ===== Core API (platform-independent) ===== */
 
 /* Initialise the core with a desired hijack state (e.g. AUX, TAPE). */
 void ibus_init(ibus_state_t hijack_state);
 
+/* Change the hijack state at runtime; buffer, counters and the current
+ * headunit state are kept. Takes effect with the next decoded frame. */
+void ibus_set_hijack_state(ibus_state_t hijack_state);
+ibus_state_t ibus_get_hijack_state(void);
+
 /* Reset the internal RX buffer. */
 void ibus_reset_buffer(void);
 
-/* Append a single byte received from the IBUS. */
+/* Append a single byte received from the IBUS (receive time unknown). */
 void ibus_append_byte(uint8_t byte);
 
+/* Append a single byte together with its receive time in microseconds
+ * (any monotonic platform clock). */
+void ibus_append_byte_ts(uint8_t byte, uint64_t rx_time_us);
+
 /* Non-zero if there is any data in the buffer. */
 int ibus_has_pending_data(void);
 
-/* Process all complete messages currently in the buffer. */
+/* Process all complete messages currently in the buffer, reporting them
+ * through the platform hooks below. Not available when the core is built
+ * with IBUS_NO_PLATFORM_HOOKS. */
 void ibus_process_messages(void);
 
+/* Batched alternative to ibus_process_messages(): instead of calling the
+ * platform hooks, decoded output is written to `events` in bus order.
+ * Only event types selected in `event_mask` (IBUS_EVENT_MASK...) are
+ * produced. Stops early when fewer than IBUS_MAX_EVENTS_PER_MESSAGE slots
+ * remain; the rest stays buffered for the next call.
+ * Returns the number of events written. */
+size_t ibus_process_messages_batch(ibus_event_t *events, size_t max_events,
+                                   uint32_t event_mask);
+
 /* Get current headunit state. */
 ibus_state_t ibus_get_state(void);
 
+/* State hysteresis, off (all zero) until set; kept by ibus_init(). */
+void ibus_set_state_filter(const ibus_state_filter_t *filter);
+const ibus_state_filter_t *ibus_get_state_filter(void);
+
+/* A confirmed change held back by the dwell time is applied, through the
+ * usual hook, by the first ibus_state_poll() at or after ibus_state_deadline()
+ * (0 = nothing deferred; same clock as the receive timestamps). It is
+ * reported with the frame that confirmed it, timestamped `now_us`. */
+uint64_t ibus_state_deadline(void);
+void ibus_state_poll(uint64_t now_us);
+
+/* Batched alternative to ibus_state_poll(): the change, if due, is written
+ * to `events` as an IBUS_EVENT_STATE (when selected in `event_mask`) instead
+ * of calling the hook. `max_events` must be at least 1; returns the number
+ * of events written. */
+size_t ibus_state_poll_batch(uint64_t now_us, ibus_event_t *events,
+                             size_t max_events, uint32_t event_mask);
+
+/* Apply "<from>:<to>=<n>" to filter->confirm, where each state is a name
+ * from ibus_state_name() or "*" for all. Returns 0 or -EINVAL. */
+int ibus_state_filter_parse(ibus_state_filter_t *filter, const char *spec);
+
+/* Short upper-case name ("OFF", "MENU", "FM", "TAPE", "AUX", "CDC",
+ * "UNKNOWN"), and its case-insensitive inverse (-EINVAL if none). */
+const char *ibus_state_name(ibus_state_t state);
+int ibus_state_parse(const char *name);
+
+/* State change counters (reset by ibus_init() and ibus_reset_stats()). */
+const ibus_state_stats_t *ibus_get_state_stats(void);
+
+/* Decoder health counters (reset by ibus_init() and ibus_reset_stats()). */
+const ibus_stats_t *ibus_get_stats(void);
+void ibus_reset_stats(void);
+
+/* Fill a view for a complete frame stored elsewhere (captures, replays).
+ * `frame` must hold at least IBUS_MIN_MESSAGE_LEN bytes. Both receive
+ * timestamps are set to `rx_time_us`. */
+void ibus_msg_view_init(ibus_msg_view_t *view, const uint8_t *frame,
+                        uint16_t len, uint64_t rx_time_us);
+
 
 /* ===== Platform hooks (must be implemented on Linux / RP2350 etc.) ===== */
 
+/*
+ * Builds that only use ibus_process_messages_batch() (offline tools,
+ * benchmarks) can define IBUS_NO_PLATFORM_HOOKS and link without them.
+ */
+
+/*
+ * Every hook receives the message that triggered it; see ibus_msg_view_t for
+ * its lifetime.
+ */
+
 /* Called whenever the decoded headunit state changes. */
 void ibus_platform_state_changed(ibus_state_t new_state,
-                                 ibus_state_t hijack_state);
+                                 ibus_state_t hijack_state,
+                                 const ibus_msg_view_t *msg);
 
 /* Called when a logical button is decoded. */
 void ibus_platform_button_event(uint8_t button_code,
                                 uint8_t released,
-                                uint8_t long_press);
+                                uint8_t long_press,
+                                const ibus_msg_view_t *msg);
 
 /* Called when the menu knob is rotated. */
-void ibus_platform_knob_event(int clockwise, uint8_t steps);
+void ibus_platform_knob_event(int clockwise, uint8_t steps,
+                              const ibus_msg_view_t *msg);
 
 /* Called for every valid IBUS message (for logging / debugging). */
-void ibus_platform_log_message(const uint8_t *msg, uint8_t len);
+void ibus_platform_log_message(const ibus_msg_view_t *msg);
 
 #endif /* IBUS_PROTOCOL_H */
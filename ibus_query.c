@@ -0,0 +1,1077 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ibus_protocol.h"
+#include "ibus_segment.h"
+#include "ibus_lz.h"
+#include "ibus_validate.h"
+
+/*
+ * Offline queries over --capture segments.
+ *
+ * Each segment gets a sidecar index <segment>.idx, built once by running
+ * the capture through the decoder's framing (in chunks, on all cores) and
+ * rebuilt when the segment changes. The index holds every frame in time
+ * order plus a per-(sender, message) posting list, so time ranges and key
+ * filters are binary searches over mmap()ed arrays, not a rescan.
+ *
+ * --validate checks that framing (ibus_validate.c) against the shared
+ * decoder (ibus_protocol.c, batch API): both must find the same frames and
+ * counters.
+ */
+
+/* ===== Index format ===== */
+
+#define IDX_MAGIC        "IBIDX1\0"
+#define CHAR_TIMEOUT_US  2300u      /* same frame gap as ibus_linux */
+#define RECORD_HISTORY   4096u      /* power of two, > decoder buffer size */
+
+struct idx_header {
+    char     magic[8];
+    uint64_t src_size;              /* segment file the index was built from */
+    int64_t  src_mtime_ns;
+    uint32_t frames;
+    uint32_t keys;
+    uint8_t  reserved[32];
+};
+
+struct idx_frame {
+    uint64_t time_us;               /* wall clock, last byte */
+    uint64_t record_off;            /* capture record holding the first byte */
+    uint16_t skip;                  /* first byte's position in that record */
+    uint16_t len;
+    uint8_t  sender;
+    uint8_t  message;
+    uint8_t  pad[2];
+};
+
+struct idx_key {
+    uint16_t key;                   /* sender << 8 | message */
+    uint16_t pad;
+    uint32_t count;
+    uint32_t first;                 /* into the posting array */
+};
+
+/* One segment with its index, both mapped */
+struct segment {
+    const char              *path;
+    ibus_segment_header_t    header;
+    const uint8_t           *data;  /* whole file, compressed ones expanded */
+    size_t                   size;
+    int                      data_mapped;
+    const struct idx_header *idx;
+    size_t                   idx_size;
+    const struct idx_frame  *frames;
+    const struct idx_key    *keys;
+    const uint32_t          *postings;
+};
+
+/* ===== Query options ===== */
+
+static uint64_t query_from_us = 0;
+static uint64_t query_to_us   = UINT64_MAX;
+static int      query_sender  = -1;
+static int      query_message = -1;
+static int      query_summary = 0;
+static int      query_index_only = 0;
+static int      query_validate = 0;
+static unsigned query_threads  = 1;
+
+/* ===== Capture access ===== */
+
+static uint64_t get_le(const uint8_t *p, unsigned bytes)
+{
+    uint64_t v = 0;
+    for (unsigned i = 0; i < bytes; ++i)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+/* Next capture record at `off`; 0 at the end or on a torn record. */
+static int record_at(const struct segment *s, uint64_t off,
+                     uint64_t *time_us, const uint8_t **bytes, uint16_t *len)
+{
+    if (off + IBUS_SEGMENT_CAPTURE_HDR > s->size)
+        return 0;
+    *time_us = get_le(&s->data[off], 8);
+    *len     = (uint16_t)get_le(&s->data[off + 8], 2);
+    if (off + IBUS_SEGMENT_CAPTURE_HDR + *len > s->size)
+        return 0;
+    *bytes = &s->data[off + IBUS_SEGMENT_CAPTURE_HDR];
+    return 1;
+}
+
+/* .lz segments are expanded into memory; the layout is then the same */
+static int load_compressed(struct segment *s, const uint8_t *file, size_t size)
+{
+    size_t total = IBUS_SEGMENT_HEADER_LEN, pos = IBUS_SEGMENT_HEADER_LEN;
+    uint8_t *out;
+
+    while (pos + 8 <= size) {
+        total += get_le(&file[pos], 4);
+        pos   += 8 + get_le(&file[pos + 4], 4);
+    }
+
+    out = malloc(total);
+    if (!out)
+        return -ENOMEM;
+    memcpy(out, file, IBUS_SEGMENT_HEADER_LEN);
+
+    size_t fill = IBUS_SEGMENT_HEADER_LEN;
+    pos = IBUS_SEGMENT_HEADER_LEN;
+    while (pos + 8 <= size) {
+        size_t raw    = get_le(&file[pos], 4);
+        size_t stored = get_le(&file[pos + 4], 4);
+        pos += 8;
+        if (pos + stored > size || raw > total - fill)
+            break;
+
+        if (stored == raw)
+            memcpy(&out[fill], &file[pos], raw);
+        else if (ibus_lz_decompress(&file[pos], stored, &out[fill], raw) != (long)raw)
+            break;
+        fill += raw;
+        pos  += stored;
+    }
+
+    s->data = out;
+    s->size = fill;
+    return 0;
+}
+
+static int segment_load(struct segment *s, const char *path)
+{
+    struct stat st;
+    const uint8_t *file;
+    size_t len = strlen(path);
+    int fd, res = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->path = path;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        res = -errno;
+        if (fd >= 0)
+            close(fd);
+        return res;
+    }
+    if ((size_t)st.st_size < IBUS_SEGMENT_HEADER_LEN) {
+        close(fd);
+        return -EPROTO;
+    }
+
+    file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return -errno;
+
+    if (ibus_segment_header_parse((const char *)file, (size_t)st.st_size,
+                                  &s->header) < 0 ||
+        s->header.kind != IBUS_SEGMENT_CAPTURE) {
+        munmap((void *)file, (size_t)st.st_size);
+        return -EPROTO;
+    }
+
+    if (len > 3 && strcmp(path + len - 3, ".lz") == 0) {
+        res = load_compressed(s, file, (size_t)st.st_size);
+        munmap((void *)file, (size_t)st.st_size);
+    } else {
+        madvise((void *)file, (size_t)st.st_size, MADV_SEQUENTIAL);
+        s->data        = file;
+        s->size        = (size_t)st.st_size;
+        s->data_mapped = 1;
+    }
+    return res;
+}
+
+static void segment_unload(struct segment *s)
+{
+    if (s->idx)
+        munmap((void *)s->idx, s->idx_size);
+    if (s->data_mapped)
+        munmap((void *)s->data, s->size);
+    else
+        free((void *)s->data);
+    memset(s, 0, sizeof(*s));
+}
+
+/* ===== Index build ===== */
+
+/*
+ * Segments are decoded in chunks on all cores, each chunk with its own copy
+ * of the decoder's framing (ibus_validate.c, checked against the shared
+ * decoder by --validate). A chunk starts at the first record of a burst:
+ * the decoder is normally empty after a frame gap, so decoding from there
+ * gives what a sequential pass gives. Records carry no sync marker; a candidate
+ * offset is taken when a chain of records follows it (lengths that fit,
+ * timestamps in the segment's range and in order) and the burst then
+ * starts with a frame whose length and checksum check out.
+ *
+ * Each chunk is decoded until it reaches a later chunk's start right after
+ * a frame gap that left the decoder empty. Normally that is the next
+ * chunk; a start that was a false match, or that a partial frame runs
+ * into, is decoded through and the chunk behind it dropped. Concatenating
+ * the chunks gives the frames in capture (time) order.
+ */
+
+#define CHUNK_MIN_BYTES  (256u * 1024u)  /* per thread */
+#define CHAIN_RECORDS    16u            /* records that must follow a chunk start */
+#define TIME_SLACK_US    1000000u       /* records vs. the segment's header times */
+#define MAX_THREADS      64u
+
+struct record_pos {
+    uint64_t stream_start;          /* stream index of the record's first byte */
+    uint64_t off;
+    uint64_t time_us;
+};
+
+struct chunk_search {
+    const struct segment *s;
+    uint64_t              from, to; /* candidate offsets */
+    uint64_t              start;    /* 0 if none */
+};
+
+struct index_chunk {
+    const struct segment  *s;
+    const uint64_t        *starts;  /* every chunk's first record, ascending */
+    unsigned               index, nchunks;
+    unsigned               next;    /* chunk whose start this one ran up to */
+    int                    res;
+    struct idx_frame      *frames;
+    size_t                 count, cap;
+    struct record_pos      history[RECORD_HISTORY];
+    uint64_t               records;
+    ibus_validator_t       v;
+    ibus_validate_frame_t  found[IBUS_VALIDATE_MAX_FRAMES];
+};
+
+static int record_time_ok(const struct segment *s, uint64_t time_us)
+{
+    return time_us + TIME_SLACK_US >= s->header.start_us &&
+           (s->header.end_us == 0 || time_us <= s->header.end_us + TIME_SLACK_US);
+}
+
+/* Whether the first frame of the burst at `off` checks out */
+static int burst_frame_ok(const struct segment *s, uint64_t off)
+{
+    uint8_t frame[IBUS_MAX_MESSAGE_LEN];
+    uint64_t time_us, prev_time = 0;
+    const uint8_t *bytes;
+    uint16_t len;
+    unsigned fill = 0, need = IBUS_MIN_MESSAGE_LEN;
+    uint8_t x = 0;
+
+    while (fill < need && record_at(s, off, &time_us, &bytes, &len)) {
+        if (fill > 0 && time_us - prev_time >= CHAR_TIMEOUT_US)
+            break;
+        for (uint16_t i = 0; i < len && fill < need; ++i) {
+            frame[fill++] = bytes[i];
+            if (fill == IBUS_POS_LENGTH + 1u &&
+                frame[IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN > need)
+                need = frame[IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN;
+        }
+        prev_time = time_us;
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+    }
+    if (fill < need)
+        return 0;
+    for (unsigned i = 0; i < frame[IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN; ++i)
+        x ^= frame[i];
+    return x == 0;
+}
+
+static void *chunk_find_start(void *arg)
+{
+    struct chunk_search *cs = arg;
+    const struct segment *s = cs->s;
+    uint64_t time_us, prev_time, off;
+    const uint8_t *bytes;
+    uint16_t len;
+    unsigned n;
+
+    for (uint64_t cand = cs->from; cand < cs->to; ++cand) {
+        /* Length chain: CHAIN_RECORDS sane records, or exactly to the end */
+        off = cand;
+        prev_time = 0;
+        for (n = 0; n < CHAIN_RECORDS && record_at(s, off, &time_us, &bytes, &len); ++n) {
+            if (!record_time_ok(s, time_us) || time_us < prev_time)
+                break;
+            prev_time = time_us;
+            off += IBUS_SEGMENT_CAPTURE_HDR + len;
+        }
+        if (n < CHAIN_RECORDS && off != s->size)
+            continue;
+
+        /* Then the first burst in range that starts with a good frame */
+        off = cand;
+        record_at(s, off, &prev_time, &bytes, &len);
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+        while (off < cs->to && record_at(s, off, &time_us, &bytes, &len)) {
+            if (time_us - prev_time >= CHAR_TIMEOUT_US && burst_frame_ok(s, off)) {
+                cs->start = off;
+                return NULL;
+            }
+            prev_time = time_us;
+            off += IBUS_SEGMENT_CAPTURE_HDR + len;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+/* Record holding stream byte `pos`; it is one of the last RECORD_HISTORY */
+static const struct record_pos *chunk_find_record(const struct index_chunk *c,
+                                                  uint64_t pos)
+{
+    uint64_t oldest = c->records > RECORD_HISTORY ? c->records - RECORD_HISTORY : 0;
+
+    for (uint64_t r = c->records; r-- > oldest; ) {
+        const struct record_pos *rp = &c->history[r & (RECORD_HISTORY - 1)];
+        if (rp->stream_start <= pos)
+            return rp;
+    }
+    return NULL;
+}
+
+/* Frame gap: validate the burst and index its frames */
+static int chunk_drain(struct index_chunk *c)
+{
+    size_t n = ibus_validate_flush(&c->v, c->found);
+
+    for (size_t i = 0; i < n; ++i) {
+        const ibus_validate_frame_t *fr = &c->found[i];
+        const struct record_pos *first = chunk_find_record(c, fr->pos);
+        const struct record_pos *last  = chunk_find_record(c, fr->pos + fr->len - 1);
+
+        if (!first || !last)
+            continue;
+        if (c->count == c->cap) {
+            size_t cap = c->cap ? c->cap * 2 : 65536;
+            struct idx_frame *f = realloc(c->frames, cap * sizeof(*f));
+            if (!f)
+                return -ENOMEM;
+            c->frames = f;
+            c->cap    = cap;
+        }
+
+        struct idx_frame *f = &c->frames[c->count++];
+        memset(f, 0, sizeof(*f));
+        f->time_us    = last->time_us;
+        f->record_off = first->off;
+        f->skip       = (uint16_t)(fr->pos - first->stream_start);
+        f->len        = fr->len;
+        f->sender     = fr->sender;
+        f->message    = fr->message;
+    }
+    return 0;
+}
+
+static void *chunk_decode(void *arg)
+{
+    struct index_chunk *c = arg;
+    uint64_t off = c->starts[c->index], stream = 0, prev_time = 0;
+    uint64_t time_us;
+    const uint8_t *bytes;
+    uint16_t len;
+    unsigned next = c->index + 1;
+
+    c->res  = ibus_validate_init(&c->v, ibus_validate_best());
+    c->next = c->nchunks;
+    while (c->res == 0 && record_at(c->s, off, &time_us, &bytes, &len)) {
+        /* A gap of a char timeout ends the frame, as it does live */
+        int gap = c->records > 0 && time_us - prev_time >= CHAR_TIMEOUT_US;
+
+        if (gap && (c->res = chunk_drain(c)) != 0)
+            break;
+
+        while (next < c->nchunks && c->starts[next] < off)
+            next++;
+        if (next < c->nchunks && c->starts[next] == off) {
+            if (gap && c->v.fill == 0) {
+                c->next = next;
+                break;
+            }
+            next++;
+        }
+
+        struct record_pos *rp = &c->history[c->records++ & (RECORD_HISTORY - 1)];
+        rp->stream_start = stream;
+        rp->off          = off;
+        rp->time_us      = time_us;
+
+        ibus_validate_append(&c->v, bytes, len);
+        stream += len;
+
+        prev_time = time_us;
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+    }
+    if (c->res == 0)
+        c->res = chunk_drain(c);
+    return NULL;
+}
+
+/* Run fn() on each of the n elements of `args`, on threads where possible */
+static void run_parallel(void *(*fn)(void *), void *args, size_t size, unsigned n)
+{
+    pthread_t tid[MAX_THREADS];
+    int started[MAX_THREADS];
+
+    for (unsigned i = 1; i < n; ++i)
+        started[i] = pthread_create(&tid[i], NULL, fn, (char *)args + i * size) == 0;
+    fn(args);
+    for (unsigned i = 1; i < n; ++i) {
+        if (started[i])
+            pthread_join(tid[i], NULL);
+        else
+            fn((char *)args + i * size);
+    }
+}
+
+static int index_write(const char *idx_path, const struct idx_frame *frames,
+                       size_t count, const struct stat *src)
+{
+    static uint32_t key_count[65536], key_slot[65536];
+    struct idx_header h;
+    struct idx_key *keys;
+    uint32_t *postings, nkeys = 0;
+    char tmp_path[520];
+    FILE *fp;
+    int res = 0;
+
+    memset(key_count, 0, sizeof(key_count));
+    for (size_t i = 0; i < count; ++i)
+        key_count[frames[i].sender << 8 | frames[i].message]++;
+    for (unsigned k = 0; k < 65536; ++k)
+        nkeys += key_count[k] != 0;
+
+    keys     = calloc(nkeys ? nkeys : 1, sizeof(*keys));
+    postings = malloc((count ? count : 1) * sizeof(*postings));
+    if (!keys || !postings) {
+        free(keys);
+        free(postings);
+        return -ENOMEM;
+    }
+
+    /* Counting sort by key; frames stay in time order within a key */
+    uint32_t first = 0, ki = 0;
+    for (unsigned k = 0; k < 65536; ++k) {
+        if (key_count[k] == 0)
+            continue;
+        keys[ki].key   = (uint16_t)k;
+        keys[ki].count = key_count[k];
+        keys[ki].first = first;
+        key_slot[k]    = first;
+        first += key_count[k];
+        ki++;
+    }
+    for (size_t i = 0; i < count; ++i)
+        postings[key_slot[frames[i].sender << 8 | frames[i].message]++] = (uint32_t)i;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IDX_MAGIC, sizeof(h.magic));
+    h.src_size     = (uint64_t)src->st_size;
+    h.src_mtime_ns = (int64_t)src->st_mtim.tv_sec * 1000000000 + src->st_mtim.tv_nsec;
+    h.frames       = (uint32_t)count;
+    h.keys         = nkeys;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", idx_path);
+    fp = fopen(tmp_path, "we");
+    if (!fp) {
+        res = -errno;
+    } else {
+        if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+            fwrite(frames, sizeof(*frames), count, fp) != count ||
+            fwrite(keys, sizeof(*keys), nkeys, fp) != nkeys ||
+            fwrite(postings, sizeof(*postings), count, fp) != count)
+            res = -EIO;
+        if (fclose(fp) != 0 && res == 0)
+            res = -errno;
+        if (res == 0 && rename(tmp_path, idx_path) < 0)
+            res = -errno;
+        if (res < 0)
+            unlink(tmp_path);
+    }
+
+    free(keys);
+    free(postings);
+    return res;
+}
+
+static int index_build(const struct segment *s, const char *idx_path,
+                       const struct stat *src)
+{
+    struct chunk_search search[MAX_THREADS];
+    struct index_chunk *chunks;
+    struct idx_frame *frames;
+    uint64_t starts[MAX_THREADS];
+    uint64_t body = s->size - IBUS_SEGMENT_HEADER_LEN;
+    unsigned n = query_threads, nchunks = 1;
+    size_t total = 0;
+    int res = 0;
+
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+    if (n > body / CHUNK_MIN_BYTES)
+        n = (unsigned)(body / CHUNK_MIN_BYTES);
+    if (n == 0)
+        n = 1;
+
+    /* Chunk 0 starts at the first record, the others where they can */
+    memset(search, 0, sizeof(search));
+    for (unsigned i = 0; i < n; ++i) {
+        search[i].s    = s;
+        search[i].from = IBUS_SEGMENT_HEADER_LEN + body * i / n;
+        search[i].to   = IBUS_SEGMENT_HEADER_LEN + body * (i + 1) / n;
+    }
+    search[0].from = search[0].to;
+    run_parallel(chunk_find_start, search, sizeof(search[0]), n);
+
+    starts[0] = IBUS_SEGMENT_HEADER_LEN;
+    for (unsigned i = 1; i < n; ++i) {
+        if (search[i].start)
+            starts[nchunks++] = search[i].start;
+    }
+
+    chunks = calloc(nchunks, sizeof(*chunks));
+    if (!chunks)
+        return -ENOMEM;
+    for (unsigned i = 0; i < nchunks; ++i) {
+        chunks[i].s       = s;
+        chunks[i].starts  = starts;
+        chunks[i].index   = i;
+        chunks[i].nchunks = nchunks;
+    }
+    run_parallel(chunk_decode, chunks, sizeof(chunks[0]), nchunks);
+
+    /* Chunks skipped by a neighbour that decoded through them are dropped */
+    for (unsigned i = 0; i < nchunks; i = chunks[i].next) {
+        if (chunks[i].res < 0 && res == 0)
+            res = chunks[i].res;
+        total += chunks[i].count;
+    }
+
+    frames = malloc((total ? total : 1) * sizeof(*frames));
+    if (!frames && res == 0)
+        res = -ENOMEM;
+    if (res == 0) {
+        size_t fill = 0;
+        for (unsigned i = 0; i < nchunks; i = chunks[i].next) {
+            if (chunks[i].count)
+                memcpy(&frames[fill], chunks[i].frames, chunks[i].count * sizeof(*frames));
+            fill += chunks[i].count;
+        }
+        res = index_write(idx_path, frames, total, src);
+    }
+
+    for (unsigned i = 0; i < nchunks; ++i)
+        free(chunks[i].frames);
+    free(chunks);
+    free(frames);
+    return res;
+}
+
+/* Map <segment>.idx, (re)building it if it is missing or stale */
+static int segment_index(struct segment *s)
+{
+    char idx_path[512];
+    struct stat src, st;
+    int64_t mtime_ns;
+
+    if (stat(s->path, &src) < 0)
+        return -errno;
+    mtime_ns = (int64_t)src.st_mtim.tv_sec * 1000000000 + src.st_mtim.tv_nsec;
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", s->path);
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+
+        if (fd >= 0 && fstat(fd, &st) == 0 &&
+            (size_t)st.st_size >= sizeof(struct idx_header)) {
+            const struct idx_header *h =
+                mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            fd = -1;
+
+            if (h != MAP_FAILED) {
+                size_t need = sizeof(*h) + (size_t)h->frames * sizeof(struct idx_frame) +
+                              (size_t)h->keys * sizeof(struct idx_key) +
+                              (size_t)h->frames * sizeof(uint32_t);
+                if (memcmp(h->magic, IDX_MAGIC, sizeof(h->magic)) == 0 &&
+                    h->src_size == (uint64_t)src.st_size &&
+                    h->src_mtime_ns == mtime_ns && (size_t)st.st_size >= need) {
+                    s->idx      = h;
+                    s->idx_size = (size_t)st.st_size;
+                    s->frames   = (const struct idx_frame *)(h + 1);
+                    s->keys     = (const struct idx_key *)(s->frames + h->frames);
+                    s->postings = (const uint32_t *)(s->keys + h->keys);
+                    return 0;
+                }
+                munmap((void *)h, (size_t)st.st_size);
+            }
+        }
+        if (fd >= 0)
+            close(fd);
+
+        if (attempt == 0) {
+            int res = index_build(s, idx_path, &src);
+            if (res < 0)
+                return res;
+        }
+    }
+    return -EPROTO;
+}
+
+/* ===== Queries ===== */
+
+/* First position in [lo, hi) whose frame time is >= t */
+static uint32_t lower_bound_frames(const struct segment *s, uint32_t lo,
+                                   uint32_t hi, uint64_t t)
+{
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->frames[mid].time_us < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static uint32_t lower_bound_postings(const struct segment *s, uint32_t lo,
+                                     uint32_t hi, uint64_t t)
+{
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->frames[s->postings[mid]].time_us < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void print_frame(const struct segment *s, const struct idx_frame *f)
+{
+    uint64_t off = f->record_off, time_us;
+    const uint8_t *bytes;
+    uint16_t len, skip = f->skip, left = f->len;
+
+    printf("%" PRIu64 ".%06" PRIu64 " ", f->time_us / 1000000u, f->time_us % 1000000u);
+
+    /* A frame can span several serial reads */
+    while (left > 0 && record_at(s, off, &time_us, &bytes, &len)) {
+        for (uint16_t i = skip; i < len && left > 0; ++i, --left)
+            printf("%02x", bytes[i]);
+        skip = 0;
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+    }
+    putchar('\n');
+}
+
+static int key_matches(uint16_t key)
+{
+    return (query_sender < 0 || (key >> 8) == query_sender) &&
+           (query_message < 0 || (key & 0xFF) == query_message);
+}
+
+static void query_segment(const struct segment *s, uint64_t *summary)
+{
+    const struct idx_header *h = s->idx;
+
+    if (query_summary) {
+        for (uint32_t k = 0; k < h->keys; ++k) {
+            const struct idx_key *key = &s->keys[k];
+            if (!key_matches(key->key))
+                continue;
+            uint32_t end = key->first + key->count;
+            uint32_t lo  = lower_bound_postings(s, key->first, end, query_from_us);
+            uint32_t hi  = (query_to_us == UINT64_MAX) ? end :
+                           lower_bound_postings(s, lo, end, query_to_us);
+            summary[key->key] += hi - lo;
+        }
+        return;
+    }
+
+    if (query_sender >= 0 && query_message >= 0) {
+        /* Exact key: walk its posting list only */
+        for (uint32_t k = 0; k < h->keys; ++k) {
+            const struct idx_key *key = &s->keys[k];
+            if (!key_matches(key->key))
+                continue;
+            uint32_t end = key->first + key->count;
+            uint32_t lo  = lower_bound_postings(s, key->first, end, query_from_us);
+            for (uint32_t p = lo; p < end; ++p) {
+                const struct idx_frame *f = &s->frames[s->postings[p]];
+                if (f->time_us >= query_to_us)
+                    break;
+                print_frame(s, f);
+            }
+        }
+        return;
+    }
+
+    for (uint32_t i = lower_bound_frames(s, 0, h->frames, query_from_us);
+         i < h->frames && s->frames[i].time_us < query_to_us; ++i) {
+        const struct idx_frame *f = &s->frames[i];
+        if (key_matches((uint16_t)(f->sender << 8 | f->message)))
+            print_frame(s, f);
+    }
+}
+
+/* ===== Validation ===== */
+
+struct frame_list {
+    ibus_validate_frame_t *frames;
+    size_t                 count, cap;
+};
+
+/* Totals over all validated segments; [0] is the decoder */
+static uint64_t validate_frames;
+static uint64_t validate_ns[1 + IBUS_VALIDATE_IMPL_COUNT];
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int frame_list_add(struct frame_list *l, const ibus_validate_frame_t *frame)
+{
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 65536;
+        ibus_validate_frame_t *f = realloc(l->frames, cap * sizeof(*f));
+        if (!f)
+            return -ENOMEM;
+        l->frames = f;
+        l->cap    = cap;
+    }
+    l->frames[l->count++] = *frame;
+    return 0;
+}
+
+static int frame_lists_equal(const struct frame_list *a, const struct frame_list *b)
+{
+    if (a->count != b->count)
+        return 0;
+    for (size_t i = 0; i < a->count; ++i) {
+        const ibus_validate_frame_t *fa = &a->frames[i], *fb = &b->frames[i];
+        if (fa->pos != fb->pos || fa->len != fb->len ||
+            fa->sender != fb->sender || fa->message != fb->message)
+            return 0;
+    }
+    return 1;
+}
+
+static int decoder_drain(struct frame_list *l)
+{
+    static ibus_event_t events[64];
+    size_t n;
+
+    while ((n = ibus_process_messages_batch(events, 64,
+                                            IBUS_EVENT_MASK(IBUS_EVENT_RAW))) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            const ibus_event_t *ev = &events[i];
+            ibus_validate_frame_t f = {
+                .pos     = ev->first_rx_time_us,
+                .len     = ev->raw.len,
+                .sender  = ev->raw.frame[IBUS_POS_SENDER],
+                .message = ev->raw.len > IBUS_POS_MESSAGE ?
+                           ev->raw.frame[IBUS_POS_MESSAGE] : 0
+            };
+            if (frame_list_add(l, &f) < 0)
+                return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/* Reference pass: the shared decoder, drained at every frame gap */
+static int validate_decoder(const struct segment *s, struct frame_list *l,
+                            ibus_stats_t *stats)
+{
+    uint64_t off = IBUS_SEGMENT_HEADER_LEN, stream = 0, prev_time = 0;
+    uint64_t time_us;
+    const uint8_t *bytes;
+    uint16_t len;
+    int first = 1, res = 0;
+
+    ibus_init(IBUS_STATE_UNKNOWN);
+    while (res == 0 && record_at(s, off, &time_us, &bytes, &len)) {
+        if (!first && time_us - prev_time >= CHAR_TIMEOUT_US)
+            res = decoder_drain(l);
+        for (uint16_t i = 0; i < len; ++i)
+            ibus_append_byte_ts(bytes[i], stream++);
+        first     = 0;
+        prev_time = time_us;
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+    }
+    if (res == 0)
+        res = decoder_drain(l);
+    *stats = *ibus_get_stats();
+    return res;
+}
+
+static int validate_engine(const struct segment *s, ibus_validate_impl_t impl,
+                           struct frame_list *l, ibus_stats_t *stats)
+{
+    static ibus_validator_t v;
+    static ibus_validate_frame_t found[IBUS_VALIDATE_MAX_FRAMES];
+    uint64_t off = IBUS_SEGMENT_HEADER_LEN, prev_time = 0;
+    uint64_t time_us;
+    const uint8_t *bytes;
+    uint16_t len;
+    size_t n;
+    int first = 1, res;
+
+    res = ibus_validate_init(&v, impl);
+    while (res == 0 && record_at(s, off, &time_us, &bytes, &len)) {
+        if (!first && time_us - prev_time >= CHAR_TIMEOUT_US) {
+            n = ibus_validate_flush(&v, found);
+            for (size_t i = 0; i < n && res == 0; ++i)
+                res = frame_list_add(l, &found[i]);
+        }
+        ibus_validate_append(&v, bytes, len);
+        first     = 0;
+        prev_time = time_us;
+        off += IBUS_SEGMENT_CAPTURE_HDR + len;
+    }
+    if (res == 0) {
+        n = ibus_validate_flush(&v, found);
+        for (size_t i = 0; i < n && res == 0; ++i)
+            res = frame_list_add(l, &found[i]);
+    }
+    *stats = v.stats;
+    return res;
+}
+
+static double frames_per_s(uint64_t frames, uint64_t ns)
+{
+    return ns ? (double)frames * 1e9 / (double)ns : 0.0;
+}
+
+/* Decoder, then every supported engine; -EPROTO if any of them differs */
+static int validate_segment(const struct segment *s)
+{
+    struct frame_list ref = { 0 }, got = { 0 };
+    ibus_stats_t ref_stats, stats;
+    uint64_t t0, ref_ns;
+    int res, mismatch = 0;
+
+    t0  = mono_ns();
+    res = validate_decoder(s, &ref, &ref_stats);
+    ref_ns = mono_ns() - t0;
+    if (res < 0)
+        goto out;
+
+    printf("%s: %u frames, %u checksum errors, %u overflows, %u resync bytes\n",
+           s->path, ref_stats.frames, ref_stats.checksum_errors,
+           ref_stats.overflows, ref_stats.resync_bytes);
+    printf("  %-8s %12.0f frames/s\n", "decoder", frames_per_s(ref.count, ref_ns));
+    validate_frames += ref.count;
+    validate_ns[0]  += ref_ns;
+
+    for (int impl = 0; impl < IBUS_VALIDATE_IMPL_COUNT; ++impl) {
+        uint64_t ns;
+        int same;
+
+        if (!ibus_validate_supported((ibus_validate_impl_t)impl))
+            continue;
+        got.count = 0;
+        t0  = mono_ns();
+        res = validate_engine(s, (ibus_validate_impl_t)impl, &got, &stats);
+        ns  = mono_ns() - t0;
+        if (res < 0)
+            goto out;
+
+        same = memcmp(&stats, &ref_stats, sizeof(stats)) == 0 &&
+               frame_lists_equal(&got, &ref);
+        mismatch |= !same;
+        printf("  %-8s %12.0f frames/s  %5.1fx  %s\n",
+               ibus_validate_impl_name((ibus_validate_impl_t)impl),
+               frames_per_s(got.count, ns), ns ? (double)ref_ns / (double)ns : 0.0,
+               same ? "match" : "MISMATCH");
+        validate_ns[1 + impl] += ns;
+    }
+    res = mismatch ? -EPROTO : 0;
+
+out:
+    free(ref.frames);
+    free(got.frames);
+    return res;
+}
+
+static void validate_summary(void)
+{
+    printf("total: %" PRIu64 " frames\n", validate_frames);
+    printf("  %-8s %12.0f frames/s\n", "decoder",
+           frames_per_s(validate_frames, validate_ns[0]));
+    for (int impl = 0; impl < IBUS_VALIDATE_IMPL_COUNT; ++impl) {
+        uint64_t ns = validate_ns[1 + impl];
+
+        if (!ibus_validate_supported((ibus_validate_impl_t)impl))
+            continue;
+        printf("  %-8s %12.0f frames/s  %5.1fx\n",
+               ibus_validate_impl_name((ibus_validate_impl_t)impl),
+               frames_per_s(validate_frames, ns),
+               ns ? (double)validate_ns[0] / (double)ns : 0.0);
+    }
+}
+
+/* ===== main() ===== */
+
+static uint64_t parse_time(const char *arg)
+{
+    return (uint64_t)(strtod(arg, NULL) * 1e6 + 0.5);
+}
+
+static void print_help(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <capture segment>...\n", name);
+    fprintf(stderr, "  --from <t>        Only frames at or after <t> (Unix time, s)\n");
+    fprintf(stderr, "  --to <t>          Only frames before <t>\n");
+    fprintf(stderr, "  --sender <hex>    Only frames from this device\n");
+    fprintf(stderr, "  --message <hex>   Only this message ID\n");
+    fprintf(stderr, "  --summary         Frame counts per sender/message instead of frames\n");
+    fprintf(stderr, "  --index           Only build missing or stale indexes\n");
+    fprintf(stderr, "  --threads <n>     Threads per index build (default: all cores)\n");
+    fprintf(stderr, "  --validate        Check the frame validation engines against the\n");
+    fprintf(stderr, "                    decoder and compare their speed (frames/s)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s --sender f0 --message 48 --from 1792318093 --to 1792318150 cap.*\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint64_t summary[65536];
+    unsigned validated = 0;
+    int opt, ret = EXIT_SUCCESS;
+
+    enum { OPT_FROM = 0x100, OPT_TO, OPT_SENDER, OPT_MESSAGE, OPT_SUMMARY, OPT_INDEX,
+           OPT_VALIDATE, OPT_THREADS };
+    static const struct option long_options[] = {
+        { "from",    required_argument, NULL, OPT_FROM    },
+        { "to",      required_argument, NULL, OPT_TO      },
+        { "sender",  required_argument, NULL, OPT_SENDER  },
+        { "message", required_argument, NULL, OPT_MESSAGE },
+        { "summary", no_argument,       NULL, OPT_SUMMARY },
+        { "index",   no_argument,       NULL, OPT_INDEX   },
+        { "validate", no_argument,      NULL, OPT_VALIDATE },
+        { "threads", required_argument, NULL, OPT_THREADS },
+        { NULL,      0,                 NULL, 0           }
+    };
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1)
+        query_threads = (unsigned)cpus;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_FROM:
+            query_from_us = parse_time(optarg);
+            break;
+        case OPT_TO:
+            query_to_us = parse_time(optarg);
+            break;
+        case OPT_SENDER:
+            query_sender = (int)(strtoul(optarg, NULL, 16) & 0xFF);
+            break;
+        case OPT_MESSAGE:
+            query_message = (int)(strtoul(optarg, NULL, 16) & 0xFF);
+            break;
+        case OPT_SUMMARY:
+            query_summary = 1;
+            break;
+        case OPT_INDEX:
+            query_index_only = 1;
+            break;
+        case OPT_VALIDATE:
+            query_validate = 1;
+            break;
+        case OPT_THREADS:
+            query_threads = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        struct segment s;
+        char hdr[IBUS_SEGMENT_HEADER_LEN];
+        ibus_segment_header_t h;
+        FILE *fp;
+        size_t len = strlen(argv[i]);
+        int res;
+
+        if (len > 4 && strcmp(argv[i] + len - 4, ".idx") == 0)
+            continue;   /* so "cap.*" globs just work */
+
+        /* The header alone tells whether the segment can match */
+        fp = fopen(argv[i], "re");
+        if (!fp || fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+            ibus_segment_header_parse(hdr, sizeof(hdr), &h) < 0 ||
+            h.kind != IBUS_SEGMENT_CAPTURE) {
+            fprintf(stderr, "%s: not a capture segment\n", argv[i]);
+            if (fp)
+                fclose(fp);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        fclose(fp);
+
+        if (!query_index_only && !query_validate &&
+            (h.start_us >= query_to_us || (h.end_us != 0 && h.end_us < query_from_us)))
+            continue;
+
+        res = segment_load(&s, argv[i]);
+        if (res == 0 && query_validate) {
+            res = validate_segment(&s);
+            validated++;
+        } else if (res == 0) {
+            res = segment_index(&s);
+        }
+        if (res < 0) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(-res));
+            segment_unload(&s);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        if (!query_index_only && !query_validate)
+            query_segment(&s, summary);
+        segment_unload(&s);
+    }
+
+    if (validated > 1)
+        validate_summary();
+
+    if (query_summary) {
+        for (unsigned k = 0; k < 65536; ++k) {
+            if (summary[k])
+                printf("%02x %02x %" PRIu64 "\n", k >> 8, k & 0xFF, summary[k]);
+        }
+    }
+
+    return ret;
+}
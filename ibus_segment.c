@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+#include "ibus_segment.h"
+#include "ibus_lz.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t ibus_segment_clock_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static const char *ibus_segment_kind_name(ibus_segment_kind_t kind)
+{
+    return kind == IBUS_SEGMENT_CAPTURE ? "capture" : "trace";
+}
+
+/* ===== Header ===== */
+
+void ibus_segment_header_format(const ibus_segment_header_t *h,
+                                char buf[IBUS_SEGMENT_HEADER_LEN])
+{
+    char line[IBUS_SEGMENT_HEADER_LEN + 1];
+    int n = snprintf(line, sizeof(line),
+                     "IBSEG1 %-7s %06" PRIu32 " %010" PRIu64 ".%06" PRIu64
+                     " %010" PRIu64 ".%06" PRIu64,
+                     ibus_segment_kind_name(h->kind), h->seq,
+                     h->start_us / 1000000u, h->start_us % 1000000u,
+                     h->end_us / 1000000u, h->end_us % 1000000u);
+    if (n < 0 || n > (int)IBUS_SEGMENT_HEADER_LEN - 1)
+        n = (int)IBUS_SEGMENT_HEADER_LEN - 1;
+
+    memset(buf, ' ', IBUS_SEGMENT_HEADER_LEN);
+    memcpy(buf, line, (size_t)n);
+    buf[IBUS_SEGMENT_HEADER_LEN - 1] = '\n';
+}
+
+int ibus_segment_header_parse(const char *buf, size_t len, ibus_segment_header_t *h)
+{
+    char line[IBUS_SEGMENT_HEADER_LEN + 1], kind[8];
+    uint64_t start_s, start_frac, end_s, end_frac;
+
+    if (len < IBUS_SEGMENT_HEADER_LEN || memcmp(buf, "IBSEG1 ", 7) != 0 ||
+        buf[IBUS_SEGMENT_HEADER_LEN - 1] != '\n')
+        return -EPROTO;
+
+    memcpy(line, buf, IBUS_SEGMENT_HEADER_LEN);
+    line[IBUS_SEGMENT_HEADER_LEN] = '\0';
+    if (sscanf(line, "IBSEG1 %7s %" SCNu32 " %" SCNu64 ".%" SCNu64
+               " %" SCNu64 ".%" SCNu64,
+               kind, &h->seq, &start_s, &start_frac, &end_s, &end_frac) != 6)
+        return -EPROTO;
+
+    if (strcmp(kind, "capture") == 0)
+        h->kind = IBUS_SEGMENT_CAPTURE;
+    else if (strcmp(kind, "trace") == 0)
+        h->kind = IBUS_SEGMENT_TRACE;
+    else
+        return -EPROTO;
+
+    h->start_us = start_s * 1000000u + start_frac;
+    h->end_us   = end_s * 1000000u + end_frac;
+    return 0;
+}
+
+/* ===== Background compression ===== */
+
+#define IBUS_SEGMENT_QUEUE  16u
+
+static pthread_mutex_t ibus_compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ibus_compress_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       ibus_compress_thread;
+static int             ibus_compress_running = 0;
+static int             ibus_compress_stop    = 0;
+static char            ibus_compress_queue[IBUS_SEGMENT_QUEUE][256];
+static unsigned        ibus_compress_head  = 0;
+static unsigned        ibus_compress_count = 0;
+/* Segment the worker is compressing ("" = none), and whether rotation
+ * dropped it meanwhile: the worker deletes it then, not the scan */
+static char            ibus_compress_active[256];
+static int             ibus_compress_expired = 0;
+
+static int ibus_write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p   += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void ibus_put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+int ibus_segment_compress_file(const char *path)
+{
+    static uint8_t raw[IBUS_LZ_BLOCK_SIZE];
+    static uint8_t packed[8 + IBUS_LZ_BOUND(IBUS_LZ_BLOCK_SIZE)];
+    char tmp_path[280], lz_path[280];
+    int in, out, res = 0;
+
+    snprintf(lz_path, sizeof(lz_path), "%s.lz", path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.lz.tmp", path);
+
+    in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return -errno;
+    out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        res = -errno;
+        close(in);
+        return res;
+    }
+
+    /* The header is copied as is: tools read it without decompressing */
+    ssize_t n = read(in, raw, IBUS_SEGMENT_HEADER_LEN);
+    if (n != (ssize_t)IBUS_SEGMENT_HEADER_LEN)
+        res = (n < 0) ? -errno : -EPROTO;
+    else
+        res = ibus_write_all(out, raw, IBUS_SEGMENT_HEADER_LEN);
+
+    while (res == 0) {
+        size_t fill = 0;
+        while (fill < sizeof(raw)) {
+            n = read(in, raw + fill, sizeof(raw) - fill);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            fill += (size_t)n;
+        }
+        if (n < 0) {
+            res = -errno;
+            break;
+        }
+        if (fill == 0)
+            break;
+
+        size_t stored = ibus_lz_compress(raw, fill, packed + 8, sizeof(packed) - 8);
+        if (stored == 0 || stored >= fill) {
+            memcpy(packed + 8, raw, fill);
+            stored = fill;
+        }
+        ibus_put_le32(packed, (uint32_t)fill);
+        ibus_put_le32(packed + 4, (uint32_t)stored);
+        res = ibus_write_all(out, packed, 8 + stored);
+    }
+
+    close(in);
+    if (close(out) < 0 && res == 0)
+        res = -errno;
+
+    if (res == 0 && rename(tmp_path, lz_path) < 0)
+        res = -errno;
+    if (res == 0)
+        unlink(path);
+    else
+        unlink(tmp_path);
+    return res;
+}
+
+static void *ibus_compress_main(void *arg)
+{
+    char path[256];
+    (void)arg;
+
+    pthread_mutex_lock(&ibus_compress_lock);
+    for (;;) {
+        while (ibus_compress_count == 0 && !ibus_compress_stop)
+            pthread_cond_wait(&ibus_compress_cond, &ibus_compress_lock);
+        if (ibus_compress_count == 0)
+            break;  /* stop requested and queue drained */
+
+        memcpy(path, ibus_compress_queue[ibus_compress_head], sizeof(path));
+        ibus_compress_head = (ibus_compress_head + 1) % IBUS_SEGMENT_QUEUE;
+        ibus_compress_count--;
+        memcpy(ibus_compress_active, path, sizeof(path));
+        ibus_compress_expired = 0;
+
+        pthread_mutex_unlock(&ibus_compress_lock);
+        ibus_segment_compress_file(path);   /* failure leaves it uncompressed */
+        pthread_mutex_lock(&ibus_compress_lock);
+
+        if (ibus_compress_expired) {
+            char lz_path[280];
+
+            snprintf(lz_path, sizeof(lz_path), "%s.lz", path);
+            unlink(lz_path);
+            unlink(path);
+        }
+        ibus_compress_active[0] = '\0';
+    }
+    pthread_mutex_unlock(&ibus_compress_lock);
+    return NULL;
+}
+
+/* The worker must never compete with the decoder: idle policy, no signals */
+static int ibus_compress_start(void)
+{
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = 0 };
+    sigset_t all, old;
+    int res;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &param);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    res = pthread_create(&ibus_compress_thread, &attr, ibus_compress_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (res != 0)
+        return -res;
+    ibus_compress_running = 1;
+    return 0;
+}
+
+static void ibus_compress_enqueue(const char *path)
+{
+    pthread_mutex_lock(&ibus_compress_lock);
+    if (!ibus_compress_running && ibus_compress_start() < 0) {
+        pthread_mutex_unlock(&ibus_compress_lock);
+        return;
+    }
+    if (ibus_compress_count < IBUS_SEGMENT_QUEUE) {
+        unsigned tail = (ibus_compress_head + ibus_compress_count) % IBUS_SEGMENT_QUEUE;
+        snprintf(ibus_compress_queue[tail], sizeof(ibus_compress_queue[tail]),
+                 "%s", path);
+        ibus_compress_count++;
+        pthread_cond_signal(&ibus_compress_cond);
+    }
+    /* else: the worker is far behind; leave this segment uncompressed */
+    pthread_mutex_unlock(&ibus_compress_lock);
+}
+
+/* If the worker is compressing the segment at `path`, leave deleting it to
+ * the worker and return 1; 0 if the caller may delete it. */
+static int ibus_compress_expire(const char *path)
+{
+    int active;
+
+    pthread_mutex_lock(&ibus_compress_lock);
+    active = strcmp(ibus_compress_active, path) == 0;
+    if (active)
+        ibus_compress_expired = 1;
+    pthread_mutex_unlock(&ibus_compress_lock);
+    return active;
+}
+
+void ibus_segment_shutdown(void)
+{
+    pthread_mutex_lock(&ibus_compress_lock);
+    if (!ibus_compress_running) {
+        pthread_mutex_unlock(&ibus_compress_lock);
+        return;
+    }
+    ibus_compress_stop = 1;
+    pthread_cond_signal(&ibus_compress_cond);
+    pthread_mutex_unlock(&ibus_compress_lock);
+
+    pthread_join(ibus_compress_thread, NULL);
+    ibus_compress_running = 0;
+    ibus_compress_stop    = 0;
+}
+
+/* ===== Writer ===== */
+
+/* Sequence number of a "<name>.NNNNNN[.lz[.tmp]]" entry, 0 if it isn't one */
+static uint32_t ibus_segment_entry_seq(const char *entry, const char *name)
+{
+    size_t name_len = strlen(name);
+    char *end;
+
+    if (strncmp(entry, name, name_len) != 0 || entry[name_len] != '.')
+        return 0;
+
+    entry += name_len + 1;
+    if (*entry < '0' || *entry > '9')
+        return 0;
+
+    unsigned long seq = strtoul(entry, &end, 10);
+    if (*end != '\0' && strcmp(end, ".lz") != 0 && strcmp(end, ".lz.tmp") != 0)
+        return 0;
+    return (seq > UINT32_MAX) ? 0 : (uint32_t)seq;
+}
+
+/* Return the highest existing sequence number. With `keep_from` != 0,
+ * delete every segment numbered below it (one being compressed is deleted
+ * by the worker when it is done). */
+static uint32_t ibus_segment_scan(const char *base, uint32_t keep_from)
+{
+    char dir[256], full[512];
+    const char *name = strrchr(base, '/');
+    uint32_t highest = 0;
+    struct dirent *de;
+    DIR *d;
+
+    if (name) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(name - base), base);
+        if (dir[0] == '\0')
+            snprintf(dir, sizeof(dir), "/");
+        name++;
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        name = base;
+    }
+
+    d = opendir(dir);
+    if (!d)
+        return 0;
+
+    while ((de = readdir(d)) != NULL) {
+        uint32_t seq = ibus_segment_entry_seq(de->d_name, name);
+        if (seq == 0)
+            continue;
+        if (keep_from != 0 && seq < keep_from) {
+            snprintf(full, sizeof(full), "%s.%06" PRIu32, base, seq);
+            if (ibus_compress_expire(full))
+                continue;
+            snprintf(full, sizeof(full), "%s/%s", dir, de->d_name);
+            unlink(full);
+        } else if (seq > highest) {
+            highest = seq;
+        }
+    }
+
+    closedir(d);
+    return highest;
+}
+
+static void ibus_segment_write_header(ibus_segment_writer_t *w, uint64_t end_us)
+{
+    char buf[IBUS_SEGMENT_HEADER_LEN];
+    ibus_segment_header_t h = {
+        .kind = w->kind, .seq = w->seq, .start_us = w->start_us, .end_us = end_us
+    };
+
+    ibus_segment_header_format(&h, buf);
+    if (end_us == 0) {
+        fwrite(buf, 1, sizeof(buf), w->fp);
+    } else {
+        /* A failed rewrite only loses the end time */
+        ssize_t n = pwrite(fileno(w->fp), buf, sizeof(buf), 0);
+        (void)n;
+    }
+}
+
+static int ibus_segment_start(ibus_segment_writer_t *w)
+{
+    snprintf(w->path, sizeof(w->path), "%s.%06" PRIu32, w->base, w->seq);
+
+    w->fp = fopen(w->path, "we");
+    if (!w->fp)
+        return -errno;
+
+    w->start_us      = ibus_segment_clock_us(CLOCK_REALTIME);
+    w->start_mono_us = ibus_segment_clock_us(CLOCK_MONOTONIC);
+    ibus_segment_write_header(w, 0);
+    fflush(w->fp);
+
+    if (w->max_segments != 0 && w->seq > w->max_segments)
+        ibus_segment_scan(w->base, w->seq - w->max_segments + 1u);
+    return 0;
+}
+
+int ibus_segment_open(ibus_segment_writer_t *w, const char *base,
+                      ibus_segment_kind_t kind, uint64_t max_bytes,
+                      unsigned max_seconds, unsigned max_segments,
+                      int compress)
+{
+    memset(w, 0, sizeof(*w));
+    if (strlen(base) >= sizeof(w->base))
+        return -ENAMETOOLONG;
+
+    snprintf(w->base, sizeof(w->base), "%s", base);
+    w->kind         = kind;
+    w->max_bytes    = max_bytes;
+    w->max_us       = (uint64_t)max_seconds * 1000000u;
+    w->max_segments = max_segments;
+    w->compress     = compress;
+    w->seq          = ibus_segment_scan(base, 0) + 1u;
+
+    return ibus_segment_start(w);
+}
+
+void ibus_segment_close(ibus_segment_writer_t *w)
+{
+    if (!w->fp)
+        return;
+
+    fflush(w->fp);
+    ibus_segment_write_header(w, ibus_segment_clock_us(CLOCK_REALTIME));
+    fclose(w->fp);
+    w->fp = NULL;
+
+    if (w->compress)
+        ibus_compress_enqueue(w->path);
+}
+
+int ibus_segment_check(ibus_segment_writer_t *w, uint64_t now_mono_us)
+{
+    int res;
+
+    if (!w->fp)
+        return 0;
+
+    if (!(w->max_us != 0 && now_mono_us - w->start_mono_us >= w->max_us) &&
+        !(w->max_bytes != 0 && (uint64_t)ftello(w->fp) >= w->max_bytes))
+        return 0;
+
+    ibus_segment_close(w);
+    w->seq++;
+    res = ibus_segment_start(w);
+    return res < 0 ? res : 1;
+}
+
+uint64_t ibus_segment_deadline(const ibus_segment_writer_t *w)
+{
+    if (!w->fp || w->max_us == 0)
+        return 0;
+    return w->start_mono_us + w->max_us;
+}
+
+int ibus_segment_write_capture(ibus_segment_writer_t *w, const uint8_t *bytes,
+                               uint16_t len, uint64_t rx_mono_us)
+{
+    uint8_t hdr[IBUS_SEGMENT_CAPTURE_HDR];
+    uint64_t t = w->start_us + (rx_mono_us - w->start_mono_us);  /* wraps right */
+
+    for (unsigned i = 0; i < 8; ++i)
+        hdr[i] = (uint8_t)(t >> (8 * i));
+    hdr[8] = (uint8_t)len;
+    hdr[9] = (uint8_t)(len >> 8);
+
+    if (fwrite(hdr, 1, sizeof(hdr), w->fp) != sizeof(hdr) ||
+        fwrite(bytes, 1, len, w->fp) != len)
+        return -EIO;
+    return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef IBUS_SEGMENT_H
+#define IBUS_SEGMENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Rotating trace / capture files (Linux only).
+ *
+ * Output goes to numbered segments <base>.000001, <base>.000002, ... A new
+ * segment is started when the current one exceeds max_bytes or is older than
+ * max_seconds; only the newest max_segments are kept. Closed segments can be
+ * compressed by a background thread (idle priority) into <name>.lz.
+ *
+ * Every segment starts with a 64-byte ASCII header line:
+ *
+ *   IBSEG1 trace 000012 1792318093.741375 1792318095.000000
+ *
+ * kind ("trace" or "capture"), sequence number, wall-clock start and end
+ * times (the end is all zeros while the segment is being written). It is
+ * rewritten in place on close and copied as is to the front of .lz files,
+ * so tools can find a time range from the first 64 bytes of each file.
+ *
+ * Capture segments contain raw serial bursts after the header:
+ *
+ *   u64 time_us (wall clock, little endian) | u16 len | len bytes
+ *
+ * .lz files continue after the header with blocks of
+ *   u32 raw_len | u32 stored_len | stored_len bytes
+ * where stored_len == raw_len means the block is stored uncompressed
+ * (ibus_lz.h block format otherwise).
+ */
+#define IBUS_SEGMENT_HEADER_LEN   64u
+#define IBUS_SEGMENT_CAPTURE_HDR  10u   /* time_us + len */
+
+typedef enum {
+    IBUS_SEGMENT_TRACE = 0,
+    IBUS_SEGMENT_CAPTURE
+} ibus_segment_kind_t;
+
+typedef struct {
+    ibus_segment_kind_t kind;
+    uint32_t            seq;
+    uint64_t            start_us;   /* CLOCK_REALTIME */
+    uint64_t            end_us;     /* 0 = still open */
+} ibus_segment_header_t;
+
+void ibus_segment_header_format(const ibus_segment_header_t *h,
+                                char buf[IBUS_SEGMENT_HEADER_LEN]);
+/* Returns 0 or -EPROTO if `buf` doesn't start with a segment header. */
+int  ibus_segment_header_parse(const char *buf, size_t len,
+                               ibus_segment_header_t *h);
+
+typedef struct {
+    char                base[240];
+    char                path[256];      /* current segment */
+    ibus_segment_kind_t kind;
+    uint64_t            max_bytes;      /* 0 = no size limit */
+    uint64_t            max_us;         /* 0 = no time limit */
+    unsigned            max_segments;   /* 0 = keep all */
+    int                 compress;
+    FILE               *fp;             /* current segment, NULL if closed */
+    uint32_t            seq;
+    uint64_t            start_us;       /* CLOCK_REALTIME of the current segment */
+    uint64_t            start_mono_us;  /* CLOCK_MONOTONIC of the same instant */
+} ibus_segment_writer_t;
+
+/* Open the first segment, numbered after any existing <base>.NNNNNN.
+ * Returns 0 or -errno. */
+int  ibus_segment_open(ibus_segment_writer_t *w, const char *base,
+                       ibus_segment_kind_t kind, uint64_t max_bytes,
+                       unsigned max_seconds, unsigned max_segments,
+                       int compress);
+
+/* Start a new segment if the current one is over its size or age limit.
+ * Returns 1 if it rotated (w->fp changed), 0 if not, -errno on failure. */
+int  ibus_segment_check(ibus_segment_writer_t *w, uint64_t now_mono_us);
+
+/* CLOCK_MONOTONIC time the current segment reaches its age limit, or 0 if
+ * it has none (or no segment is open). */
+uint64_t ibus_segment_deadline(const ibus_segment_writer_t *w);
+
+/* Append one capture record; `rx_mono_us` is converted to wall clock. */
+int  ibus_segment_write_capture(ibus_segment_writer_t *w, const uint8_t *bytes,
+                                uint16_t len, uint64_t rx_mono_us);
+
+/* Finish the current segment (and queue it for compression). */
+void ibus_segment_close(ibus_segment_writer_t *w);
+
+/* Wait for queued compressions and stop the background thread. */
+void ibus_segment_shutdown(void);
+
+/* Compress the segment at `path` into `path`.lz and remove the original.
+ * Returns 0 or -errno. */
+int  ibus_segment_compress_file(const char *path);
+
+#endif /* IBUS_SEGMENT_H */
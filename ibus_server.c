@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include "ibus_server.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int bitmap_test(const uint8_t *map, uint8_t bit)
+{
+    return (map[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static void bitmap_set(uint8_t *map, uint8_t bit)
+{
+    map[bit >> 3] |= (uint8_t)(1U << (bit & 7));
+}
+
+static int server_epoll_ctl(ibus_server_t *s, int op, ibus_server_client_t *c,
+                            uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.u64 = s->client_tag + (uint64_t)(c - s->client);
+    if (epoll_ctl(s->epoll_fd, op, c->fd, &ev) < 0)
+        return -errno;
+    return 0;
+}
+
+void ibus_server_open(ibus_server_t *s, int listen_fd, int epoll_fd,
+                      uint64_t client_tag, const ibus_display_t *display)
+{
+    memset(s, 0, sizeof(*s));
+    s->listen_fd  = listen_fd;
+    s->epoll_fd   = epoll_fd;
+    s->client_tag = client_tag;
+    s->display    = display;
+    for (unsigned i = 0; i < IBUS_SERVER_MAX_CLIENTS; ++i)
+        s->client[i].fd = -1;
+}
+
+static void server_client_close(ibus_server_t *s, ibus_server_client_t *c)
+{
+    close(c->fd);   /* also removes it from the epoll set */
+    free(c->queue);
+    c->fd    = -1;
+    c->queue = NULL;
+    s->clients--;
+}
+
+void ibus_server_close(ibus_server_t *s)
+{
+    if (s->listen_fd < 0)
+        return;
+
+    for (unsigned i = 0; i < IBUS_SERVER_MAX_CLIENTS; ++i) {
+        if (s->client[i].fd >= 0)
+            server_client_close(s, &s->client[i]);
+    }
+    close(s->listen_fd);
+    s->listen_fd = -1;
+}
+
+/* Write as much of the queue as the socket takes; returns -1 if the client
+ * is gone (and was closed). */
+static int server_client_flush(ibus_server_t *s, ibus_server_client_t *c)
+{
+    while (c->queue_len > 0) {
+        ssize_t n = send(c->fd, c->queue + c->queue_off, c->queue_len,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            server_client_close(s, c);
+            return -1;
+        }
+        c->queue_off += (size_t)n;
+        c->queue_len -= (size_t)n;
+    }
+    if (c->queue_len == 0)
+        c->queue_off = 0;
+
+    /* Only wait for writability while something is pending */
+    int want_write = c->queue_len > 0;
+    if (want_write != c->want_write) {
+        uint32_t events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+        server_epoll_ctl(s, EPOLL_CTL_MOD, c, events);
+        c->want_write = want_write;
+    }
+    return 0;
+}
+
+/* Queue a line for one client; drop the client if its queue is full. */
+static void server_client_send(ibus_server_t *s, ibus_server_client_t *c,
+                               const char *line, size_t len)
+{
+    if (len > IBUS_SERVER_QUEUE_SIZE - c->queue_len) {
+        s->dropped++;
+        server_client_close(s, c);
+        return;
+    }
+
+    if (c->queue_off + c->queue_len + len > IBUS_SERVER_QUEUE_SIZE) {
+        memmove(c->queue, c->queue + c->queue_off, c->queue_len);
+        c->queue_off = 0;
+    }
+    memcpy(c->queue + c->queue_off + c->queue_len, line, len);
+    c->queue_len += len;
+
+    server_client_flush(s, c);
+}
+
+int ibus_server_accept(ibus_server_t *s)
+{
+    for (;;) {
+        int fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return -errno;
+            return 0;
+        }
+
+        ibus_server_client_t *c = NULL;
+        for (unsigned i = 0; i < IBUS_SERVER_MAX_CLIENTS; ++i) {
+            if (s->client[i].fd < 0) {
+                c = &s->client[i];
+                break;
+            }
+        }
+
+        char *queue = c ? malloc(IBUS_SERVER_QUEUE_SIZE) : NULL;
+        if (!queue) {
+            s->rejected++;
+            close(fd);
+            continue;
+        }
+
+        memset(c, 0, sizeof(*c));
+        c->fd            = fd;
+        c->queue         = queue;
+        c->subscriptions = IBUS_SERVER_SUB_ALL;
+        memset(c->senders, 0xFF, sizeof(c->senders));
+        memset(c->messages, 0xFF, sizeof(c->messages));
+
+        if (server_epoll_ctl(s, EPOLL_CTL_ADD, c, EPOLLIN) < 0) {
+            close(fd);
+            free(queue);
+            c->fd    = -1;
+            c->queue = NULL;
+            continue;
+        }
+
+        s->clients++;
+        s->accepted++;
+    }
+}
+
+/* Parse "all" or a list of hex bytes into a bitmap */
+static int server_parse_filter(char *args, uint8_t *map)
+{
+    uint8_t parsed[256 / 8];
+    char *save = NULL;
+    int count = 0;
+
+    memset(parsed, 0, sizeof(parsed));
+    for (char *tok = strtok_r(args, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        if (strcmp(tok, "all") == 0) {
+            memset(parsed, 0xFF, sizeof(parsed));
+        } else {
+            char *end;
+            unsigned long v = strtoul(tok, &end, 16);
+            if (*end != '\0' || v > 0xFF)
+                return -1;
+            bitmap_set(parsed, (uint8_t)v);
+        }
+        ++count;
+    }
+    if (count == 0)
+        return -1;
+
+    memcpy(map, parsed, sizeof(parsed));
+    return 0;
+}
+
+static int server_parse_subscriptions(char *args, uint32_t *subscriptions)
+{
+    static const struct { const char *name; uint32_t mask; } names[] = {
+        { "frame",   IBUS_SERVER_SUB_FRAME   },
+        { "button",  IBUS_SERVER_SUB_BUTTON  },
+        { "knob",    IBUS_SERVER_SUB_KNOB    },
+        { "state",   IBUS_SERVER_SUB_STATE   },
+        { "display", IBUS_SERVER_SUB_DISPLAY },
+        { "all",     IBUS_SERVER_SUB_ALL     },
+    };
+    uint32_t mask = 0;
+    char *save = NULL;
+
+    for (char *tok = strtok_r(args, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        unsigned i;
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+            if (strcmp(tok, names[i].name) == 0)
+                break;
+        }
+        if (i == sizeof(names) / sizeof(names[0]))
+            return -1;
+        mask |= names[i].mask;
+    }
+
+    *subscriptions = mask;
+    return 0;
+}
+
+static int server_format_display(const ibus_server_t *s, unsigned field,
+                                 char *line, size_t len)
+{
+    const ibus_display_field_t *f = &s->display->field[field];
+    char name[16], text[IBUS_DISPLAY_TEXT_LEN * 2 + 1];
+
+    ibus_display_field_name(field, name, sizeof(name));
+    ibus_display_to_utf8(f->text, f->len, text, sizeof(text));
+    return snprintf(line, len, "display %llu %s %s\n",
+                    (unsigned long long)f->updated_us, name, text);
+}
+
+/* Current screen, every field, so a mirror can start from a full picture */
+static void server_send_display(ibus_server_t *s, ibus_server_client_t *c)
+{
+    char line[128];
+
+    for (unsigned i = 0; i < IBUS_DISPLAY_FIELDS && c->fd >= 0; ++i) {
+        int len = server_format_display(s, i, line, sizeof(line));
+        server_client_send(s, c, line, (size_t)len);
+    }
+}
+
+static void server_client_command(ibus_server_t *s, ibus_server_client_t *c,
+                                  char *line)
+{
+    char *args = strchr(line, ' ');
+    int res = -1;
+
+    if (args)
+        *args++ = '\0';
+    else
+        args = line + strlen(line);
+
+    if (strcmp(line, "subscribe") == 0)
+        res = server_parse_subscriptions(args, &c->subscriptions);
+    else if (strcmp(line, "sender") == 0)
+        res = server_parse_filter(args, c->senders);
+    else if (strcmp(line, "message") == 0)
+        res = server_parse_filter(args, c->messages);
+    else if (strcmp(line, "display") == 0 && *args == '\0') {
+        server_send_display(s, c);
+        res = 0;
+    } else if (line[0] == '\0')
+        return;
+
+    if (c->fd < 0)
+        return;     /* dropped while sending the snapshot */
+    if (res == 0)
+        server_client_send(s, c, "ok\n", 3);
+    else
+        server_client_send(s, c, "error\n", 6);
+}
+
+static void server_client_readable(ibus_server_t *s, ibus_server_client_t *c)
+{
+    char buf[512];
+
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                       errno != EINTR)) {
+            server_client_close(s, c);
+            return;
+        }
+        if (n < 0)
+            return;
+
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] == '\n' || buf[i] == '\r') {
+                c->cmd[c->cmd_len] = '\0';
+                c->cmd_len = 0;
+                server_client_command(s, c, c->cmd);
+                if (c->fd < 0)
+                    return;
+            } else if (c->cmd_len < sizeof(c->cmd) - 1) {
+                c->cmd[c->cmd_len++] = buf[i];
+            }
+        }
+    }
+}
+
+void ibus_server_client_event(ibus_server_t *s, uint32_t slot, uint32_t events)
+{
+    ibus_server_client_t *c;
+
+    if (slot >= IBUS_SERVER_MAX_CLIENTS || s->client[slot].fd < 0)
+        return;
+    c = &s->client[slot];
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        server_client_close(s, c);
+        return;
+    }
+    if ((events & EPOLLOUT) && server_client_flush(s, c) < 0)
+        return;
+    if (events & EPOLLIN)
+        server_client_readable(s, c);
+}
+
+/* Deliver one line to every client whose subscription and filters match */
+static void server_publish(ibus_server_t *s, uint32_t sub,
+                           const ibus_msg_view_t *msg, const char *line, size_t len)
+{
+    for (unsigned i = 0; i < IBUS_SERVER_MAX_CLIENTS; ++i) {
+        ibus_server_client_t *c = &s->client[i];
+
+        if (c->fd < 0 || !(c->subscriptions & sub))
+            continue;
+        if (!bitmap_test(c->senders, msg->sender) ||
+            !bitmap_test(c->messages, msg->message))
+            continue;
+
+        server_client_send(s, c, line, len);
+    }
+}
+
+void ibus_server_publish_frame(ibus_server_t *s, const ibus_msg_view_t *msg)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[2 * IBUS_MAX_MESSAGE_LEN + 48];
+    int pos;
+
+    if (s->clients == 0)
+        return;
+
+    pos = snprintf(line, sizeof(line), "frame %llu ",
+                   (unsigned long long)msg->rx_time_us);
+    for (uint16_t i = 0; i < msg->raw_len; ++i) {
+        line[pos++] = hex[msg->raw[i] >> 4];
+        line[pos++] = hex[msg->raw[i] & 0x0F];
+    }
+    line[pos++] = '\n';
+
+    server_publish(s, IBUS_SERVER_SUB_FRAME, msg, line, (size_t)pos);
+}
+
+void ibus_server_publish_button(ibus_server_t *s, uint8_t code, uint8_t released,
+                                uint8_t long_press, const ibus_msg_view_t *msg)
+{
+    char line[96];
+    int len;
+
+    if (s->clients == 0)
+        return;
+
+    len = snprintf(line, sizeof(line), "button %llu %u %s %s\n",
+                   (unsigned long long)msg->rx_time_us, code,
+                   released ? "release" : "press",
+                   long_press ? "long" : "short");
+    server_publish(s, IBUS_SERVER_SUB_BUTTON, msg, line, (size_t)len);
+}
+
+void ibus_server_publish_knob(ibus_server_t *s, int clockwise, uint8_t steps,
+                              const ibus_msg_view_t *msg)
+{
+    char line[96];
+    int len;
+
+    if (s->clients == 0)
+        return;
+
+    len = snprintf(line, sizeof(line), "knob %llu %s %u\n",
+                   (unsigned long long)msg->rx_time_us,
+                   clockwise ? "cw" : "ccw", steps);
+    server_publish(s, IBUS_SERVER_SUB_KNOB, msg, line, (size_t)len);
+}
+
+void ibus_server_publish_display(ibus_server_t *s, uint32_t changed,
+                                 const ibus_msg_view_t *msg)
+{
+    char line[128];
+
+    if (s->clients == 0)
+        return;
+
+    for (unsigned i = 0; i < IBUS_DISPLAY_FIELDS; ++i) {
+        if (!(changed & IBUS_DISPLAY_MASK(i)))
+            continue;
+        int len = server_format_display(s, i, line, sizeof(line));
+        server_publish(s, IBUS_SERVER_SUB_DISPLAY, msg, line, (size_t)len);
+    }
+}
+
+void ibus_server_publish_state(ibus_server_t *s, ibus_state_t new_state,
+                               ibus_state_t hijack_state, const ibus_msg_view_t *msg)
+{
+    char line[96];
+    int len;
+
+    if (s->clients == 0)
+        return;
+
+    len = snprintf(line, sizeof(line), "state %llu %d %d\n",
+                   (unsigned long long)msg->rx_time_us,
+                   (int)new_state, (int)hijack_state);
+    server_publish(s, IBUS_SERVER_SUB_STATE, msg, line, (size_t)len);
+}
@@ -0,0 +1,99 @@
+#ifndef IBUS_SERVER_H
+#define IBUS_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+#include "ibus_display.h"
+
+/*
+ * Fan-out server for decoded traffic.
+ *
+ * Local clients connect to a Unix stream socket and receive one text line
+ * per decoded frame/event they subscribed to:
+ *
+ *   frame   <rx_us> <raw frame in hex>
+ *   button  <rx_us> <code> press|release short|long
+ *   knob    <rx_us> cw|ccw <steps>
+ *   state   <rx_us> <state> <hijack state>
+ *   display <rx_us> title|index0..index9 <text>
+ *
+ * rx_us is the CLOCK_MONOTONIC receive time of the frame's last byte.
+ * Clients may send commands (one per line, answered with "ok" / "error"):
+ *
+ *   subscribe frame|button|knob|state|display|all ...
+ *   sender all|<hex> ...       only traffic from these senders
+ *   message all|<hex> ...      only these message IDs
+ *   display                    the whole screen, one line per field
+ *
+ * Every client has a bounded output queue; a client that can't keep up is
+ * disconnected and counted instead of ever blocking the decoder.
+ *
+ * The caller owns the listening socket and the epoll set: it adds the
+ * listening fd itself and calls ibus_server_accept() when it is readable;
+ * client fds are added here, tagged `client_tag + slot`, and their events
+ * go to ibus_server_client_event().
+ */
+#define IBUS_SERVER_MAX_CLIENTS  32
+#define IBUS_SERVER_QUEUE_SIZE   (64 * 1024)
+#define IBUS_SERVER_CMD_MAX      256
+
+#define IBUS_SERVER_SUB_FRAME    (1U<<0)
+#define IBUS_SERVER_SUB_BUTTON   (1U<<1)
+#define IBUS_SERVER_SUB_KNOB     (1U<<2)
+#define IBUS_SERVER_SUB_STATE    (1U<<3)
+#define IBUS_SERVER_SUB_DISPLAY  (1U<<4)
+#define IBUS_SERVER_SUB_ALL      (IBUS_SERVER_SUB_FRAME|IBUS_SERVER_SUB_BUTTON| \
+                                  IBUS_SERVER_SUB_KNOB|IBUS_SERVER_SUB_STATE| \
+                                  IBUS_SERVER_SUB_DISPLAY)
+
+typedef struct {
+    int      fd;                        /* -1 = free slot */
+    uint32_t subscriptions;             /* IBUS_SERVER_SUB_* */
+    uint8_t  senders[256 / 8];          /* bitmap of accepted senders */
+    uint8_t  messages[256 / 8];         /* bitmap of accepted message IDs */
+    char     cmd[IBUS_SERVER_CMD_MAX];  /* partial command line */
+    size_t   cmd_len;
+    char    *queue;                     /* pending output: queue[off..off+len) */
+    size_t   queue_off;
+    size_t   queue_len;
+    int      want_write;                /* EPOLLOUT currently requested */
+} ibus_server_client_t;
+
+typedef struct {
+    int                   listen_fd;    /* -1 = server off */
+    int                   epoll_fd;
+    uint64_t              client_tag;
+    const ibus_display_t *display;      /* screen model for display lines */
+    ibus_server_client_t  client[IBUS_SERVER_MAX_CLIENTS];
+    uint32_t              clients;      /* connected now */
+    uint32_t              accepted;
+    uint32_t              rejected;     /* no free slot */
+    uint32_t              dropped;      /* too slow, queue overflowed */
+} ibus_server_t;
+
+/* Start serving on a listening, non-blocking socket; the server takes
+ * ownership of `listen_fd`. */
+void ibus_server_open(ibus_server_t *s, int listen_fd, int epoll_fd,
+                      uint64_t client_tag, const ibus_display_t *display);
+/* Disconnect every client and close the listening socket */
+void ibus_server_close(ibus_server_t *s);
+
+/* Accept all pending connections. Returns 0, or -errno if accept() failed. */
+int  ibus_server_accept(ibus_server_t *s);
+/* epoll events for client `slot` (the low bits of its tag) */
+void ibus_server_client_event(ibus_server_t *s, uint32_t slot, uint32_t events);
+
+void ibus_server_publish_frame(ibus_server_t *s, const ibus_msg_view_t *msg);
+void ibus_server_publish_button(ibus_server_t *s, uint8_t code, uint8_t released,
+                                uint8_t long_press, const ibus_msg_view_t *msg);
+void ibus_server_publish_knob(ibus_server_t *s, int clockwise, uint8_t steps,
+                              const ibus_msg_view_t *msg);
+void ibus_server_publish_state(ibus_server_t *s, ibus_state_t new_state,
+                               ibus_state_t hijack_state, const ibus_msg_view_t *msg);
+/* `changed` is an IBUS_DISPLAY_MASK() set from ibus_display_update() */
+void ibus_server_publish_display(ibus_server_t *s, uint32_t changed,
+                                 const ibus_msg_view_t *msg);
+
+#endif /* IBUS_SERVER_H */
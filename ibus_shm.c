@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+#include "ibus_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IBUS_SHM_MAX_FDS 4
+
+static size_t ibus_shm_ring_size(uint32_t slot_count)
+{
+    return sizeof(ibus_shm_ring_t) + (size_t)slot_count * sizeof(ibus_shm_slot_t);
+}
+
+static long ibus_futex(uint32_t *uaddr, int op, uint32_t val,
+                       const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+/*
+ * Sealed, zero-filled memfd of `size` bytes, mapped read-write. With
+ * `readers_write` clear, the mapping returned here is the only writable
+ * one there will ever be: whoever gets the fd can map it read-only only.
+ */
+static void *ibus_shm_memfd_create(const char *name, size_t size,
+                                   int readers_write, int *fd_out)
+{
+    void *map;
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return NULL;
+
+    /* Readers trust the size they map, so it can never change */
+    if (ftruncate(fd, (off_t)size) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    /* F_SEAL_FUTURE_WRITE leaves the mapping above alone */
+    if (fcntl(fd, F_ADD_SEALS,
+              (readers_write ? 0 : F_SEAL_FUTURE_WRITE) | F_SEAL_SEAL) < 0) {
+        int err = errno;
+        munmap(map, size);
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    *fd_out = fd;
+    return map;
+}
+
+/* Map a whole memfd read-only; its size must be at least `min_size` */
+static const void *ibus_shm_map_readonly(int fd, size_t min_size, size_t *size_out)
+{
+    struct stat st;
+    const void *map;
+
+    if (fstat(fd, &st) < 0)
+        return NULL;
+    if ((size_t)st.st_size < min_size) {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *size_out = (size_t)st.st_size;
+    return map;
+}
+
+/* Fetch all of the daemon's fds; an older daemon sending fewer is -EPROTO */
+static int ibus_shm_connect_fds(const char *socket_path, int fds[IBUS_SHM_FDS])
+{
+    int count = ibus_shm_receive_fds(socket_path, fds, IBUS_SHM_FDS);
+
+    if (count < 0)
+        return count;
+    if (count < IBUS_SHM_FDS) {
+        for (int i = 0; i < count; ++i)
+            close(fds[i]);
+        return -EPROTO;
+    }
+    return 0;
+}
+
+static void ibus_shm_close_fds(const int fds[IBUS_SHM_FDS])
+{
+    for (int i = 0; i < IBUS_SHM_FDS; ++i)
+        close(fds[i]);
+}
+
+static uint64_t ibus_shm_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* ===== Writer ===== */
+
+int ibus_shm_writer_create(ibus_shm_writer_t *w, uint32_t slot_count)
+{
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0)
+        return -EINVAL;
+
+    memset(w, 0, sizeof(*w));
+    w->fd         = -1;
+    w->waiters_fd = -1;
+    w->map_size   = ibus_shm_ring_size(slot_count);
+    w->ring       = ibus_shm_memfd_create("ibus-ring", w->map_size, 0, &w->fd);
+    if (!w->ring)
+        return -errno;
+
+    w->waiters = ibus_shm_memfd_create("ibus-waiters", sizeof(ibus_shm_waiters_t),
+                                       1, &w->waiters_fd);
+    if (!w->waiters) {
+        int err = -errno;
+        ibus_shm_writer_destroy(w);
+        return err;
+    }
+
+    /* ftruncate() zero-filled everything: no slot holds a frame yet */
+    w->ring->slot_count = slot_count;
+    w->ring->slot_size  = (uint32_t)sizeof(ibus_shm_slot_t);
+    w->ring->version    = IBUS_SHM_VERSION;
+    __atomic_store_n(&w->ring->magic, IBUS_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ibus_shm_writer_publish(ibus_shm_writer_t *w, const ibus_msg_view_t *msg)
+{
+    ibus_shm_ring_t *ring = w->ring;
+    uint64_t seq = ring->write_seq;
+    ibus_shm_slot_t *slot = &ring->slots[seq & (ring->slot_count - 1)];
+
+    /* Open the slot's seqlock, fill it, close it with the new sequence */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->first_rx_time_us = msg->first_rx_time_us;
+    slot->rx_time_us       = msg->rx_time_us;
+    slot->len              = msg->raw_len;
+    memcpy(slot->frame, msg->raw, msg->raw_len);
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->write_seq, seq + 1, __ATOMIC_RELEASE);
+
+    /*
+     * Pairs with the reader registering before it compares the futex word:
+     * either we see its count here, or it sees the new value and won't sleep.
+     */
+    __atomic_add_fetch(&ring->futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->waiters->waiters, __ATOMIC_SEQ_CST) != 0)
+        ibus_futex(&ring->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void ibus_shm_writer_destroy(ibus_shm_writer_t *w)
+{
+    if (w->ring)
+        munmap(w->ring, w->map_size);
+    if (w->fd >= 0)
+        close(w->fd);
+    if (w->waiters)
+        munmap(w->waiters, sizeof(*w->waiters));
+    if (w->waiters_fd >= 0)
+        close(w->waiters_fd);
+    w->ring       = NULL;
+    w->fd         = -1;
+    w->waiters    = NULL;
+    w->waiters_fd = -1;
+}
+
+int ibus_shm_vehicle_writer_create(ibus_shm_vehicle_writer_t *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd       = -1;
+    w->map_size = sizeof(ibus_shm_vehicle_t);
+    w->page     = ibus_shm_memfd_create("ibus-vehicle", w->map_size, 0, &w->fd);
+    if (!w->page)
+        return -errno;
+
+    w->page->state_size = (uint32_t)sizeof(ibus_vehicle_state_t);
+    w->page->version    = IBUS_SHM_VERSION;
+    __atomic_store_n(&w->page->magic, IBUS_SHM_VEHICLE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ibus_shm_vehicle_publish(ibus_shm_vehicle_writer_t *w,
+                              const ibus_vehicle_state_t *state)
+{
+    ibus_shm_vehicle_t *page = w->page;
+    uint64_t seq = page->seq;
+
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&page->state, state, sizeof(*state));
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void ibus_shm_vehicle_writer_destroy(ibus_shm_vehicle_writer_t *w)
+{
+    if (w->page)
+        munmap(w->page, w->map_size);
+    if (w->fd >= 0)
+        close(w->fd);
+    w->page = NULL;
+    w->fd   = -1;
+}
+
+int ibus_shm_send_fds(int sock, const char *tag, const int *fds, int count)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * IBUS_SHM_MAX_FDS)];
+    } control;
+    struct iovec iov = { .iov_base = (void *)tag, .iov_len = strlen(tag) };
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+
+    if (count <= 0 || count > IBUS_SHM_MAX_FDS)
+        return -EINVAL;
+
+    memset(&control, 0, sizeof(control));
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = control.buf;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)count);
+
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * (size_t)count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)count);
+
+    if (sendmsg(sock, &mh, MSG_NOSIGNAL) < 0)
+        return -errno;
+    return 0;
+}
+
+/* ===== Reader ===== */
+
+int ibus_shm_receive_fds(const char *socket_path, int *fds, int max)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * IBUS_SHM_MAX_FDS)];
+    } control;
+    struct sockaddr_un addr;
+    char tag[64];
+    struct iovec iov = { .iov_base = tag, .iov_len = sizeof(tag) };
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    int sock, count = 0;
+
+    if (max > IBUS_SHM_MAX_FDS)
+        max = IBUS_SHM_MAX_FDS;
+
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -errno;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = -errno;
+        close(sock);
+        return err;
+    }
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) < 0) {
+        int err = -errno;
+        close(sock);
+        return err;
+    }
+    close(sock);
+
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int received[IBUS_SHM_MAX_FDS];
+        memcpy(received, CMSG_DATA(cmsg), sizeof(int) * (size_t)n);
+        for (int i = 0; i < n; ++i) {
+            if (count < max)
+                fds[count++] = received[i];
+            else
+                close(received[i]);
+        }
+    }
+
+    return count > 0 ? count : -EPROTO;
+}
+
+int ibus_shm_reader_open(ibus_shm_reader_t *r, int ring_fd, int waiters_fd)
+{
+    const ibus_shm_ring_t *ring;
+    ibus_shm_waiters_t *waiters;
+    struct stat st;
+    size_t size;
+
+    memset(r, 0, sizeof(*r));
+
+    if (fstat(waiters_fd, &st) < 0)
+        return -errno;
+    if ((size_t)st.st_size < sizeof(ibus_shm_waiters_t))
+        return -EPROTO;
+    waiters = mmap(NULL, sizeof(*waiters), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   waiters_fd, 0);
+    if (waiters == MAP_FAILED)
+        return -errno;
+
+    ring = ibus_shm_map_readonly(ring_fd, sizeof(ibus_shm_ring_t), &size);
+    if (!ring) {
+        int err = -errno;
+        munmap(waiters, sizeof(*waiters));
+        return err;
+    }
+
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != IBUS_SHM_MAGIC ||
+        ring->version != IBUS_SHM_VERSION ||
+        ring->slot_size != sizeof(ibus_shm_slot_t) ||
+        ibus_shm_ring_size(ring->slot_count) > size) {
+        munmap((void *)ring, size);
+        munmap(waiters, sizeof(*waiters));
+        return -EPROTO;
+    }
+
+    r->ring     = ring;
+    r->map_size = size;
+    r->waiters  = waiters;
+    r->next_seq = __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+int ibus_shm_reader_connect(ibus_shm_reader_t *r, const char *socket_path)
+{
+    int fds[IBUS_SHM_FDS];
+    int res = ibus_shm_connect_fds(socket_path, fds);
+
+    if (res < 0)
+        return res;
+
+    res = ibus_shm_reader_open(r, fds[IBUS_SHM_FD_RING], fds[IBUS_SHM_FD_WAITERS]);
+    ibus_shm_close_fds(fds);    /* the mappings keep the memfds alive */
+    return res;
+}
+
+void ibus_shm_reader_close(ibus_shm_reader_t *r)
+{
+    if (r->ring)
+        munmap((void *)r->ring, r->map_size);
+    if (r->waiters)
+        munmap(r->waiters, sizeof(*r->waiters));
+    r->ring    = NULL;
+    r->waiters = NULL;
+}
+
+int ibus_shm_reader_next(ibus_shm_reader_t *r, ibus_shm_frame_t *out)
+{
+    const ibus_shm_ring_t *ring = r->ring;
+    uint64_t slots = ring->slot_count;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE);
+
+        if (r->next_seq >= head)
+            return 0;
+
+        /* Writer lapped us: skip to the oldest frame still in the ring */
+        if (head - r->next_seq > slots) {
+            r->lost    += head - slots - r->next_seq;
+            r->next_seq = head - slots;
+        }
+
+        const ibus_shm_slot_t *slot = &ring->slots[r->next_seq & (slots - 1)];
+        uint64_t s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (s1 == r->next_seq + 1) {
+            uint16_t len = slot->len;
+            if (len > IBUS_MAX_MESSAGE_LEN)
+                len = IBUS_MAX_MESSAGE_LEN;
+
+            out->first_rx_time_us = slot->first_rx_time_us;
+            out->rx_time_us       = slot->rx_time_us;
+            out->len              = len;
+            memcpy(out->frame, slot->frame, len);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == s1) {
+                out->seq = r->next_seq++;
+                return 1;
+            }
+        }
+
+        /* Slot was (being) overwritten by a newer frame: we were overrun.
+         * Re-read the head and skip ahead. */
+        r->lost++;
+        r->next_seq++;
+    }
+}
+
+int ibus_shm_reader_wait(ibus_shm_reader_t *r, int timeout_ms)
+{
+    const ibus_shm_ring_t *ring = r->ring;
+    uint64_t deadline = timeout_ms >= 0 ? ibus_shm_now_ms() + (uint64_t)timeout_ms : 0;
+
+    for (;;) {
+        uint64_t now = ibus_shm_now_ms();
+        int slice = IBUS_SHM_WAIT_SLICE_MS;
+        struct timespec ts;
+
+        if (timeout_ms >= 0) {
+            if (now >= deadline)
+                return __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE) > r->next_seq;
+            if (deadline - now < (uint64_t)slice)
+                slice = (int)(deadline - now);
+        }
+        ts.tv_sec  = slice / 1000;
+        ts.tv_nsec = (long)(slice % 1000) * 1000000L;
+
+        /*
+         * Register before looking at the ring, so the writer either sees us
+         * and wakes, or publishes before we compare the futex word. Another
+         * reader can scribble over the count; the slice bounds what that
+         * costs us.
+         */
+        __atomic_add_fetch(&r->waiters->waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t seen = __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE) > r->next_seq) {
+            __atomic_sub_fetch(&r->waiters->waiters, 1, __ATOMIC_RELEASE);
+            return 1;
+        }
+
+        ibus_futex((uint32_t *)&ring->futex, FUTEX_WAIT, seen, &ts);
+        __atomic_sub_fetch(&r->waiters->waiters, 1, __ATOMIC_RELEASE);
+        /* woken, EAGAIN (value changed), EINTR or slice over: check again */
+    }
+}
+
+int ibus_shm_vehicle_open(ibus_shm_vehicle_reader_t *r, int fd)
+{
+    const ibus_shm_vehicle_t *page;
+    size_t size;
+
+    memset(r, 0, sizeof(*r));
+    page = ibus_shm_map_readonly(fd, sizeof(ibus_shm_vehicle_t), &size);
+    if (!page)
+        return -errno;
+
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != IBUS_SHM_VEHICLE_MAGIC ||
+        page->version != IBUS_SHM_VERSION ||
+        page->state_size != sizeof(ibus_vehicle_state_t)) {
+        munmap((void *)page, size);
+        return -EPROTO;
+    }
+
+    r->page     = page;
+    r->map_size = size;
+    return 0;
+}
+
+int ibus_shm_vehicle_connect(ibus_shm_vehicle_reader_t *r, const char *socket_path)
+{
+    int fds[IBUS_SHM_FDS];
+    int res = ibus_shm_connect_fds(socket_path, fds);
+
+    if (res < 0)
+        return res;
+
+    res = ibus_shm_vehicle_open(r, fds[IBUS_SHM_FD_VEHICLE]);
+    ibus_shm_close_fds(fds);
+    return res;
+}
+
+void ibus_shm_vehicle_close(ibus_shm_vehicle_reader_t *r)
+{
+    if (r->page)
+        munmap((void *)r->page, r->map_size);
+    r->page = NULL;
+}
+
+uint64_t ibus_shm_vehicle_read(const ibus_shm_vehicle_reader_t *r,
+                               ibus_vehicle_state_t *out)
+{
+    const ibus_shm_vehicle_t *page = r->page;
+
+    for (;;) {
+        uint64_t s1 = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1u)
+            continue;   /* mid-update; signals are blocked while publishing */
+
+        memcpy(out, &page->state, sizeof(*out));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == s1)
+            return s1 / 2u;
+    }
+}
@@ -0,0 +1,163 @@
+#ifndef IBUS_SHM_H
+#define IBUS_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+#include "ibus_vehicle.h"
+
+/*
+ * Shared-memory distribution of validated IBUS frames (Linux only).
+ *
+ * ibus_linux publishes every frame into a memfd-backed ring with one
+ * writer and any number of readers. Readers get the memfd over a Unix
+ * socket (SCM_RIGHTS), map it read-only and then consume frames without
+ * any syscalls: they poll write_seq, or sleep on the futex word.
+ *
+ * The ring and the vehicle page are sealed against writes (other than the
+ * daemon's own mapping), so no reader can corrupt them for the others.
+ * The only memory readers write is a third memfd counting the readers
+ * asleep on the futex; the daemon makes the wake-up syscall only when
+ * that count is not zero. Readers don't trust it with their sleep either:
+ * they recheck the ring every IBUS_SHM_WAIT_SLICE_MS.
+ *
+ * Every slot is a small seqlock: `seq` is 0 while the writer fills it and
+ * (frame sequence number + 1) once it is complete. A reader that finds a
+ * newer sequence in its slot, before or after copying, has been overrun.
+ *
+ * The decoded vehicle state (ibus_vehicle.h) sits in a second memfd that
+ * holds one snapshot behind a seqlock. The socket hands out all three fds:
+ * fds[0] is the frame ring, fds[1] the vehicle state, fds[2] the waiters.
+ */
+
+#define IBUS_SHM_MAGIC          0x49425553u     /* "IBUS" */
+#define IBUS_SHM_VERSION        2u
+#define IBUS_SHM_DEFAULT_SLOTS  1024u           /* must be a power of two */
+#define IBUS_SHM_VEHICLE_MAGIC  0x49425653u     /* "IBVS" */
+#define IBUS_SHM_WAIT_SLICE_MS  1000
+
+enum {
+    IBUS_SHM_FD_RING = 0,
+    IBUS_SHM_FD_VEHICLE,
+    IBUS_SHM_FD_WAITERS,
+    IBUS_SHM_FDS
+};
+
+typedef struct {
+    uint64_t seq;               /* frame sequence + 1, 0 = being written */
+    uint64_t first_rx_time_us;  /* CLOCK_MONOTONIC, first byte */
+    uint64_t rx_time_us;        /* CLOCK_MONOTONIC, last byte */
+    uint16_t len;
+    uint8_t  frame[IBUS_MAX_MESSAGE_LEN];
+} __attribute__((aligned(8))) ibus_shm_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;         /* sizeof(ibus_shm_slot_t) of the writer */
+    /* Written by the daemon only, on their own cache line */
+    uint64_t write_seq __attribute__((aligned(64)));  /* frames published */
+    uint32_t futex;             /* bumped on every publish, woken if waiters */
+    uint32_t reserved;
+    ibus_shm_slot_t slots[] __attribute__((aligned(64)));
+} ibus_shm_ring_t;
+
+/* Shared read-write between all readers, so nothing in it is trusted */
+typedef struct {
+    uint32_t waiters __attribute__((aligned(64)));  /* readers in FUTEX_WAIT */
+} ibus_shm_waiters_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state_size;        /* sizeof(ibus_vehicle_state_t) of the writer */
+    uint32_t reserved;
+    uint64_t seq __attribute__((aligned(64)));  /* odd while being written */
+    ibus_vehicle_state_t state;
+} ibus_shm_vehicle_t;
+
+/* ===== Writer (ibus_linux) ===== */
+
+typedef struct {
+    ibus_shm_ring_t    *ring;
+    size_t              map_size;
+    int                 fd;         /* sealed memfd, handed to readers */
+    ibus_shm_waiters_t *waiters;
+    int                 waiters_fd;
+} ibus_shm_writer_t;
+
+/* Create the memfd ring and its waiters page. Returns 0 or -errno. */
+int  ibus_shm_writer_create(ibus_shm_writer_t *w, uint32_t slot_count);
+void ibus_shm_writer_publish(ibus_shm_writer_t *w, const ibus_msg_view_t *msg);
+void ibus_shm_writer_destroy(ibus_shm_writer_t *w);
+
+typedef struct {
+    ibus_shm_vehicle_t *page;
+    size_t              map_size;
+    int                 fd;
+} ibus_shm_vehicle_writer_t;
+
+int  ibus_shm_vehicle_writer_create(ibus_shm_vehicle_writer_t *w);
+void ibus_shm_vehicle_publish(ibus_shm_vehicle_writer_t *w,
+                              const ibus_vehicle_state_t *state);
+void ibus_shm_vehicle_writer_destroy(ibus_shm_vehicle_writer_t *w);
+
+/* Send `count` fds plus a short tag over a connected Unix socket. */
+int  ibus_shm_send_fds(int sock, const char *tag, const int *fds, int count);
+
+/* ===== Reader library ===== */
+
+typedef struct {
+    uint64_t seq;               /* sequence number of this frame */
+    uint64_t first_rx_time_us;
+    uint64_t rx_time_us;
+    uint16_t len;
+    uint8_t  frame[IBUS_MAX_MESSAGE_LEN];
+} ibus_shm_frame_t;
+
+typedef struct {
+    const ibus_shm_ring_t *ring;
+    size_t                 map_size;
+    ibus_shm_waiters_t    *waiters;
+    uint64_t               next_seq;  /* next frame to read */
+    uint64_t               lost;      /* frames skipped due to overruns */
+} ibus_shm_reader_t;
+
+/* Receive up to `max` fds from the daemon's --shm-socket.
+ * Returns the number of fds received or -errno. */
+int  ibus_shm_receive_fds(const char *socket_path, int *fds, int max);
+
+/* Map a ring memfd read-only and its waiters memfd; reading starts at the
+ * newest frame. Returns 0 or -errno (bad magic/version/size gives -EPROTO). */
+int  ibus_shm_reader_open(ibus_shm_reader_t *r, int ring_fd, int waiters_fd);
+
+/* Connect to the daemon's --shm-socket and open its ring. */
+int  ibus_shm_reader_connect(ibus_shm_reader_t *r, const char *socket_path);
+void ibus_shm_reader_close(ibus_shm_reader_t *r);
+
+/* Copy the next frame. Returns 1 if a frame was copied, 0 if the reader is
+ * up to date. Overruns skip ahead and are added to r->lost. */
+int  ibus_shm_reader_next(ibus_shm_reader_t *r, ibus_shm_frame_t *out);
+
+/* Sleep until a frame newer than the last one read is published or
+ * timeout_ms passes (-1 = forever). Returns 1 if data is available. */
+int  ibus_shm_reader_wait(ibus_shm_reader_t *r, int timeout_ms);
+
+typedef struct {
+    const ibus_shm_vehicle_t *page;
+    size_t                    map_size;
+} ibus_shm_vehicle_reader_t;
+
+/* Map a vehicle state memfd read-only. Returns 0 or -errno. */
+int  ibus_shm_vehicle_open(ibus_shm_vehicle_reader_t *r, int fd);
+int  ibus_shm_vehicle_connect(ibus_shm_vehicle_reader_t *r, const char *socket_path);
+void ibus_shm_vehicle_close(ibus_shm_vehicle_reader_t *r);
+
+/* Copy a consistent snapshot. Returns its sequence number: equal numbers
+ * mean nothing changed in between. */
+uint64_t ibus_shm_vehicle_read(const ibus_shm_vehicle_reader_t *r,
+                               ibus_vehicle_state_t *out);
+
+#endif /* IBUS_SHM_H */
@@ -0,0 +1,780 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ibus_protocol.h"
+#include "ibus_segment.h"
+
+/*
+ * Virtual I-Bus on a pseudo-terminal.
+ *
+ * Plays a scenario file into the master side of a pty at 9600 8E1 byte
+ * timing (11 bits = 1145.8 us per byte), scaled by --speed (0 = as fast as
+ * possible). Point ibus_linux at the slave, or let ibus_sim start it:
+ *
+ *   ibus_sim scenarios/radio_modes.ibs -- ./ibus_linux -d {} -h AUX -t 15
+ *
+ * With --capture the scenario is written as an ibus_linux capture segment
+ * instead, in virtual time, one record per burst (for ibus_query and the
+ * host build of the Pico firmware, pico/host).
+ *
+ * Scenario files, one statement per line, '#' starts a comment:
+ *
+ *   frame <sender> <receiver> <message> [data...]
+ *                        length and checksum are filled in (ibus_protocol.h
+ *                        layout); bytes are hex, IBUS_DEV_ / IBUS_MSG_ names
+ *                        without prefix (RAD, GT, ST...) or "quoted text".
+ *                        CC is always hex, not IBUS_MSG_CC
+ *   raw <bytes...>       sent exactly as given (broken frames, noise)
+ *   wait <ms>            idle bus
+ *   gap <ms>             idle time after every frame from now on (default 5,
+ *                        0 = back to back: bus saturation)
+ *   errors <rate> [flip|drop]
+ *                        from now on corrupt each byte with probability
+ *                        <rate>: flip one bit or drop it (a parity error
+ *                        dropped by the UART, IGNPAR)
+ *   repeat <n> ... end   repeat a block (nests)
+ *   seed <n>             seed the error generator
+ *   expect <stat> <n>|<min>..[<max>]
+ *                        with --check: what the daemon's stats file must
+ *                        say once it has exited (any line "<stat> <value>")
+ */
+
+#define SIM_BYTE_NS       1145833u      /* 11 bits at 9600 baud */
+#define SIM_MAX_OPS       4096u
+#define SIM_MAX_DEPTH     16u
+#define SIM_MAX_EXPECT    64u
+
+typedef enum {
+    OP_FRAME = 0,
+    OP_WAIT,
+    OP_GAP,
+    OP_ERRORS,
+    OP_REPEAT,
+    OP_END,
+    OP_SEED
+} sim_op_type_t;
+
+typedef struct {
+    sim_op_type_t type;
+    uint16_t      len;                  /* OP_FRAME */
+    uint8_t       bytes[IBUS_MAX_MESSAGE_LEN];
+    uint64_t      value;                /* ms, count, seed; OP_END: its OP_REPEAT */
+    double        rate;                 /* OP_ERRORS */
+    int           drop;                 /* OP_ERRORS */
+} sim_op_t;
+
+static sim_op_t sim_ops[SIM_MAX_OPS];
+static unsigned sim_op_count = 0;
+
+typedef struct {
+    char               stat[64];
+    unsigned long long min, max;
+} sim_expect_t;
+
+static sim_expect_t sim_expects[SIM_MAX_EXPECT];
+static unsigned sim_expect_count = 0;
+
+/* ===== Scenario parser ===== */
+
+static const struct {
+    const char *name;
+    uint8_t     value;
+} sim_names[] = {
+    /* devices */
+    { "GM",     IBUS_DEV_GM     }, { "GT",     IBUS_DEV_GT     },
+    { "RAD",    IBUS_DEV_RAD    }, { "MFL",    IBUS_DEV_MFL    },
+    { "IKE",    IBUS_DEV_IKE    }, { "GLO",    IBUS_DEV_GLO    },
+    { "LCM",    IBUS_DEV_LCM    }, { "BMBT",   IBUS_DEV_BMBT   },
+    /* messages */
+    { "DSREQ",  IBUS_MSG_DSREQ  }, { "DSRED",  IBUS_MSG_DSRED  },
+    { "BSREQ",  IBUS_MSG_BSREQ  }, { "BS",     IBUS_MSG_BS     },
+    { "IGN",    IBUS_MSG_IGN    }, { "SPEED",  IBUS_MSG_SPEED  },
+    { "TEMP",   IBUS_MSG_TEMP   }, { "UMID",   IBUS_MSG_UMID   },
+    { "UANZV",  IBUS_MSG_UANZV  }, { "MFLB",   IBUS_MSG_MFLB   },
+    { "DSPEB",  IBUS_MSG_DSPEB  }, { "CDSREQ", IBUS_MSG_CDSREQ },
+    { "CDS",    IBUS_MSG_CDS    }, { "MFLB2",  IBUS_MSG_MFLB2  },
+    { "SOBCD",  IBUS_MSG_SOBCD  }, { "OBCDR",  IBUS_MSG_OBCDR  },
+    { "LCDC",   IBUS_MSG_LCDC   }, { "BMBTB0", IBUS_MSG_BMBTB0 },
+    { "BMBTB1", IBUS_MSG_BMBTB1 }, { "KNOB",   IBUS_MSG_KNOB   },
+    { "CS",     IBUS_MSG_CS     }, { "RGBC",   IBUS_MSG_RGBC   },
+    { "LAMP",   IBUS_MSG_LAMP   },
+    { "DOORS",  IBUS_MSG_DOORS  }, { "ST",     IBUS_MSG_ST     },
+};
+
+static int sim_parse_byte(const char *tok, uint8_t *out)
+{
+    char *end;
+    unsigned long v;
+
+    for (unsigned i = 0; i < sizeof(sim_names) / sizeof(sim_names[0]); ++i) {
+        if (strcasecmp(tok, sim_names[i].name) == 0) {
+            *out = sim_names[i].value;
+            return 0;
+        }
+    }
+
+    v = strtoul(tok, &end, 16);
+    if (*tok == '\0' || *end != '\0' || v > 0xFF)
+        return -1;
+    *out = (uint8_t)v;
+    return 0;
+}
+
+/* Split the rest of a line into bytes; "quoted text" adds its characters */
+static int sim_parse_bytes(char *p, uint8_t *bytes, unsigned max, unsigned *count)
+{
+    *count = 0;
+
+    for (;;) {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            return 0;
+
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*count == max)
+                    return -1;
+                bytes[(*count)++] = (uint8_t)*p;
+            }
+            if (*p != '"')
+                return -1;
+            p++;
+            continue;
+        }
+
+        char *tok = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        if (*p)
+            *p++ = '\0';
+        if (*count == max || sim_parse_byte(tok, &bytes[*count]) < 0)
+            return -1;
+        (*count)++;
+    }
+}
+
+static int sim_parse_file(const char *path)
+{
+    unsigned stack[SIM_MAX_DEPTH], depth = 0, line_no = 0;
+    char line[1024];
+    FILE *fp = fopen(path, "re");
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *p = line, *word;
+        sim_op_t *op;
+
+        line_no++;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        word = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        if (*p)
+            *p++ = '\0';
+
+        if (strcmp(word, "expect") == 0) {
+            sim_expect_t *e = &sim_expects[sim_expect_count];
+            char range[64], *dots, *end;
+
+            if (sim_expect_count == SIM_MAX_EXPECT ||
+                sscanf(p, "%63s %63s", e->stat, range) != 2) {
+                fprintf(stderr, "%s:%u: expect <stat> <n>|<min>..[<max>]\n", path, line_no);
+                goto fail;
+            }
+            dots = strstr(range, "..");
+            e->min = strtoull(range, &end, 10);
+            if (end == range || (dots ? end != dots : *end != '\0')) {
+                fprintf(stderr, "%s:%u: bad range '%s'\n", path, line_no, range);
+                goto fail;
+            }
+            e->max = !dots ? e->min :
+                     dots[2] == '\0' ? ULLONG_MAX : strtoull(dots + 2, NULL, 10);
+            sim_expect_count++;
+            continue;
+        }
+
+        if (sim_op_count == SIM_MAX_OPS) {
+            fprintf(stderr, "%s:%u: scenario too long\n", path, line_no);
+            goto fail;
+        }
+        op = &sim_ops[sim_op_count];
+        memset(op, 0, sizeof(*op));
+
+        if (strcmp(word, "frame") == 0 || strcmp(word, "raw") == 0) {
+            uint8_t bytes[IBUS_MAX_MESSAGE_LEN];
+            unsigned count;
+
+            if (sim_parse_bytes(p, bytes, sizeof(bytes) - 2, &count) < 0) {
+                fprintf(stderr, "%s:%u: bad bytes\n", path, line_no);
+                goto fail;
+            }
+            op->type = OP_FRAME;
+
+            if (word[0] == 'r') {
+                memcpy(op->bytes, bytes, count);
+                op->len = (uint16_t)count;
+            } else {
+                /* sender receiver message data... -> full frame */
+                uint8_t checksum = 0;
+                if (count < 3) {
+                    fprintf(stderr, "%s:%u: frame needs sender, receiver, message\n",
+                            path, line_no);
+                    goto fail;
+                }
+                op->bytes[IBUS_POS_SENDER] = bytes[0];
+                op->bytes[IBUS_POS_LENGTH] = (uint8_t)count;   /* receiver..checksum */
+                memcpy(&op->bytes[IBUS_POS_RECEIVER], &bytes[1], count - 1);
+                op->len = (uint16_t)(count + 2);
+                for (uint16_t i = 0; i < op->len - 1; ++i)
+                    checksum ^= op->bytes[i];
+                op->bytes[op->len - 1] = checksum;
+            }
+        } else if (strcmp(word, "wait") == 0 || strcmp(word, "gap") == 0 ||
+                   strcmp(word, "seed") == 0) {
+            op->type  = word[0] == 'w' ? OP_WAIT : word[0] == 'g' ? OP_GAP : OP_SEED;
+            op->value = strtoull(p, NULL, 10);
+        } else if (strcmp(word, "errors") == 0) {
+            char mode[16] = "flip";
+            op->type = OP_ERRORS;
+            if (sscanf(p, "%lf %15s", &op->rate, mode) < 1 ||
+                (strcmp(mode, "flip") != 0 && strcmp(mode, "drop") != 0)) {
+                fprintf(stderr, "%s:%u: errors <rate> [flip|drop]\n", path, line_no);
+                goto fail;
+            }
+            op->drop = strcmp(mode, "drop") == 0;
+        } else if (strcmp(word, "repeat") == 0) {
+            if (depth == SIM_MAX_DEPTH) {
+                fprintf(stderr, "%s:%u: repeat nested too deep\n", path, line_no);
+                goto fail;
+            }
+            op->type  = OP_REPEAT;
+            op->value = strtoull(p, NULL, 10);
+            stack[depth++] = sim_op_count;
+        } else if (strcmp(word, "end") == 0) {
+            if (depth == 0) {
+                fprintf(stderr, "%s:%u: end without repeat\n", path, line_no);
+                goto fail;
+            }
+            op->type  = OP_END;
+            op->value = stack[--depth];
+        } else {
+            fprintf(stderr, "%s:%u: unknown statement '%s'\n", path, line_no, word);
+            goto fail;
+        }
+        sim_op_count++;
+    }
+
+    fclose(fp);
+    if (depth != 0) {
+        fprintf(stderr, "%s: repeat without end\n", path);
+        return -1;
+    }
+    return 0;
+
+fail:
+    fclose(fp);
+    return -1;
+}
+
+/* ===== Player ===== */
+
+static volatile sig_atomic_t sim_exit_request = 0;
+
+static double   sim_speed = 1.0;            /* 0 = no pacing */
+static uint64_t sim_clock_ns;               /* when the next byte is done */
+static uint64_t sim_frames, sim_bytes, sim_flipped, sim_dropped;
+
+static uint8_t  sim_buf[4096];
+static size_t   sim_buf_len = 0;
+
+static FILE    *sim_capture = NULL;         /* --capture: no pty, no pacing */
+static uint64_t sim_capture_start_us;       /* wall clock of virtual time 0 */
+
+static void sim_signal_handler(int sig)
+{
+    (void)sig;
+    sim_exit_request = 1;
+}
+
+static uint64_t sim_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sim_sleep_until(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec  = (time_t)(ns / 1000000000u),
+        .tv_nsec = (long)(ns % 1000000000u)
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+           !sim_exit_request)
+        ;
+}
+
+static int sim_flush_capture(void)
+{
+    uint64_t t = sim_capture_start_us + sim_clock_ns / 1000u;
+    uint8_t rec[IBUS_SEGMENT_CAPTURE_HDR];
+
+    for (unsigned i = 0; i < 8; ++i)
+        rec[i] = (uint8_t)(t >> (8 * i));
+    rec[8] = (uint8_t)sim_buf_len;
+    rec[9] = (uint8_t)(sim_buf_len >> 8);
+
+    if (fwrite(rec, 1, sizeof(rec), sim_capture) != sizeof(rec) ||
+        fwrite(sim_buf, 1, sim_buf_len, sim_capture) != sim_buf_len)
+        return -1;
+    sim_buf_len = 0;
+    return 0;
+}
+
+static int sim_flush(int fd)
+{
+    size_t done = 0;
+
+    if (sim_buf_len == 0)
+        return 0;
+    if (sim_capture)
+        return sim_flush_capture();
+
+    while (done < sim_buf_len) {
+        ssize_t n = write(fd, sim_buf + done, sim_buf_len - done);
+        if (n < 0) {
+            if (errno == EINTR && !sim_exit_request)
+                continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    sim_buf_len = 0;
+    return 0;
+}
+
+/* Advance the virtual clock; bytes due by now go out together */
+static int sim_advance(int fd, uint64_t ns)
+{
+    if (sim_capture) {
+        /* A burst ends where the bus goes idle */
+        if (ns > SIM_BYTE_NS && sim_flush(fd) < 0)
+            return -1;
+        sim_clock_ns += ns;
+        return 0;
+    }
+    if (sim_speed <= 0.0)
+        return 0;
+
+    sim_clock_ns += (uint64_t)((double)ns / sim_speed);
+    if (sim_clock_ns > sim_now_ns()) {
+        if (sim_flush(fd) < 0)
+            return -1;
+        sim_sleep_until(sim_clock_ns);
+    }
+    return 0;
+}
+
+static int sim_send_byte(int fd, uint8_t b, double rate, int drop)
+{
+    if (rate > 0.0 && (double)rand() / ((double)RAND_MAX + 1.0) < rate) {
+        if (drop) {
+            sim_dropped++;
+            return sim_advance(fd, SIM_BYTE_NS);    /* still took its time */
+        }
+        b ^= (uint8_t)(1u << (rand() % 8));
+        sim_flipped++;
+    }
+
+    if (sim_buf_len == sizeof(sim_buf) && sim_flush(fd) < 0)
+        return -1;
+    sim_buf[sim_buf_len++] = b;
+    sim_bytes++;
+    return sim_advance(fd, SIM_BYTE_NS);
+}
+
+static int sim_play(int fd)
+{
+    uint64_t remaining[SIM_MAX_OPS];
+    uint64_t gap_ns = 5000000u;
+    double rate = 0.0;
+    int drop = 0;
+
+    if (!sim_capture)
+        sim_clock_ns = sim_now_ns();
+
+    for (unsigned pc = 0; pc < sim_op_count && !sim_exit_request; ++pc) {
+        const sim_op_t *op = &sim_ops[pc];
+
+        switch (op->type) {
+        case OP_FRAME:
+            for (uint16_t i = 0; i < op->len; ++i) {
+                if (sim_send_byte(fd, op->bytes[i], rate, drop) < 0)
+                    return -1;
+            }
+            sim_frames++;
+            if (sim_advance(fd, gap_ns) < 0)
+                return -1;
+            break;
+        case OP_WAIT:
+            if (sim_advance(fd, op->value * 1000000u) < 0)
+                return -1;
+            break;
+        case OP_GAP:
+            gap_ns = op->value * 1000000u;
+            break;
+        case OP_ERRORS:
+            rate = op->rate;
+            drop = op->drop;
+            break;
+        case OP_SEED:
+            srand((unsigned)op->value);
+            break;
+        case OP_REPEAT:
+            remaining[pc] = op->value;
+            if (remaining[pc] == 0) {
+                /* skip to the matching end */
+                while (!(sim_ops[pc].type == OP_END &&
+                         sim_ops[pc].value == (uint64_t)(op - sim_ops)))
+                    pc++;
+            }
+            break;
+        case OP_END:
+            if (--remaining[op->value] > 0)
+                pc = (unsigned)op->value;
+            break;
+        }
+    }
+
+    return sim_flush(fd);
+}
+
+/* ===== Capture output ===== */
+
+static int sim_write_capture(const char *path, unsigned long loops)
+{
+    ibus_segment_header_t h = { .kind = IBUS_SEGMENT_CAPTURE, .seq = 1 };
+    char head[IBUS_SEGMENT_HEADER_LEN];
+    struct timespec ts;
+    int ret = EXIT_SUCCESS;
+
+    if (loops == 0) {
+        fprintf(stderr, "ibus_sim: --capture needs a finite --loop\n");
+        return EXIT_FAILURE;
+    }
+
+    sim_capture = fopen(path, "wb");
+    if (!sim_capture) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    sim_capture_start_us = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    sim_clock_ns = 0;
+
+    h.start_us = sim_capture_start_us;
+    ibus_segment_header_format(&h, head);
+    if (fwrite(head, 1, sizeof(head), sim_capture) != sizeof(head))
+        ret = EXIT_FAILURE;
+
+    for (unsigned long i = 0; i < loops && ret == EXIT_SUCCESS; ++i) {
+        if (sim_play(-1) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+    h.end_us = sim_capture_start_us + sim_clock_ns / 1000u;
+    ibus_segment_header_format(&h, head);
+    if (fseek(sim_capture, 0, SEEK_SET) < 0 ||
+        fwrite(head, 1, sizeof(head), sim_capture) != sizeof(head))
+        ret = EXIT_FAILURE;
+    if (fclose(sim_capture) != 0)
+        ret = EXIT_FAILURE;
+    sim_capture = NULL;
+
+    if (ret != EXIT_SUCCESS)
+        perror(path);
+    fprintf(stderr, "ibus_sim: %llu frames, %llu bytes, %.2f s of bus time, "
+            "%llu bits flipped, %llu bytes dropped\n",
+            (unsigned long long)sim_frames, (unsigned long long)sim_bytes,
+            (double)sim_clock_ns / 1e9,
+            (unsigned long long)sim_flipped, (unsigned long long)sim_dropped);
+    return ret;
+}
+
+/* ===== pty / daemon ===== */
+
+static int sim_open_pty(char *slave_name, size_t len)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 ||
+        ptsname_r(fd, slave_name, len) != 0) {
+        perror("pty");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    /* Bytes must pass through untouched */
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static pid_t sim_spawn(char **argv, const char *slave_name)
+{
+    pid_t pid;
+
+    for (char **a = argv; *a; ++a) {
+        if (strcmp(*a, "{}") == 0)
+            *a = (char *)slave_name;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    if (pid < 0)
+        perror("fork");
+    return pid;
+}
+
+/* ===== Stats check ===== */
+
+/* Compare the daemon's stats file with the scenario's expect lines */
+static int sim_check(const char *path)
+{
+    char line[256], stat[64];
+    unsigned long long value;
+    int failed = 0;
+    FILE *fp;
+
+    for (unsigned i = 0; i < sim_expect_count; ++i) {
+        const sim_expect_t *e = &sim_expects[i];
+        int found = 0;
+
+        fp = fopen(path, "re");
+        if (!fp) {
+            perror(path);
+            return -1;
+        }
+        while (!found && fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "%63s %llu", stat, &value) == 2 &&
+                strcmp(stat, e->stat) == 0)
+                found = 1;
+        }
+        fclose(fp);
+
+        if (!found) {
+            fprintf(stderr, "ibus_sim: FAIL %s: not in %s\n", e->stat, path);
+            failed++;
+        } else if (value < e->min || value > e->max) {
+            if (e->min == e->max)
+                fprintf(stderr, "ibus_sim: FAIL %s = %llu, expected %llu\n",
+                        e->stat, value, e->min);
+            else if (e->max == ULLONG_MAX)
+                fprintf(stderr, "ibus_sim: FAIL %s = %llu, expected at least %llu\n",
+                        e->stat, value, e->min);
+            else
+                fprintf(stderr, "ibus_sim: FAIL %s = %llu, expected %llu..%llu\n",
+                        e->stat, value, e->min, e->max);
+            failed++;
+        }
+    }
+
+    fprintf(stderr, "ibus_sim: %u of %u checks passed\n",
+            sim_expect_count - (unsigned)failed, sim_expect_count);
+    return failed ? -1 : 0;
+}
+
+static void print_help(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <scenario> [-- <command with {} for the tty>]\n", name);
+    fprintf(stderr, "  --speed <x>        Time scale: 1 = real 9600 baud (default), 0 = unpaced\n");
+    fprintf(stderr, "  --loop <n>         Play the scenario n times (default 1, 0 = forever)\n");
+    fprintf(stderr, "  --link <path>      Symlink <path> to the pty slave\n");
+    fprintf(stderr, "  --start-delay <ms> Wait before playing (default 500 with a command)\n");
+    fprintf(stderr, "  --linger <ms>      Keep the pty open after playing (default 1000)\n");
+    fprintf(stderr, "  --capture <path>   Write a capture segment instead of using a pty\n");
+    fprintf(stderr, "  --check <path>     After the command, check its stats file against the\n");
+    fprintf(stderr, "                     scenario's expect lines\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "With a command, it is started on the pty, stopped with SIGTERM after\n");
+    fprintf(stderr, "the scenario and its exit status is returned.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s --speed 10 scenarios/radio_modes.ibs -- ./ibus_linux -d {} -h AUX -t 15\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    char slave_name[128], link_path[256] = {0};
+    long start_delay_ms = -1, linger_ms = 1000;
+    unsigned long loops = 1;
+    struct sigaction act;
+    pid_t child = -1;
+    int opt, fd, ret = EXIT_SUCCESS;
+    uint64_t started;
+
+    char capture_path[256] = {0};
+    char check_path[256] = {0};
+
+    enum { OPT_SPEED = 0x100, OPT_LOOP, OPT_LINK, OPT_START_DELAY, OPT_LINGER,
+           OPT_CAPTURE, OPT_CHECK };
+    static const struct option long_options[] = {
+        { "speed",       required_argument, NULL, OPT_SPEED       },
+        { "loop",        required_argument, NULL, OPT_LOOP        },
+        { "link",        required_argument, NULL, OPT_LINK        },
+        { "start-delay", required_argument, NULL, OPT_START_DELAY },
+        { "linger",      required_argument, NULL, OPT_LINGER      },
+        { "capture",     required_argument, NULL, OPT_CAPTURE     },
+        { "check",       required_argument, NULL, OPT_CHECK       },
+        { NULL,          0,                 NULL, 0               }
+    };
+
+    while ((opt = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_SPEED:
+            sim_speed = strtod(optarg, NULL);
+            break;
+        case OPT_LOOP:
+            loops = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_LINK:
+            strncpy(link_path, optarg, sizeof(link_path) - 1);
+            break;
+        case OPT_START_DELAY:
+            start_delay_ms = atol(optarg);
+            break;
+        case OPT_LINGER:
+            linger_ms = atol(optarg);
+            break;
+        case OPT_CAPTURE:
+            strncpy(capture_path, optarg, sizeof(capture_path) - 1);
+            break;
+        case OPT_CHECK:
+            strncpy(check_path, optarg, sizeof(check_path) - 1);
+            break;
+        default:
+            print_help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (sim_parse_file(argv[optind]) < 0)
+        return EXIT_FAILURE;
+    if (check_path[0] != '\0') {
+        if (optind + 2 >= argc || strcmp(argv[optind + 1], "--") != 0) {
+            fprintf(stderr, "--check needs a command\n");
+            return EXIT_FAILURE;
+        }
+        unlink(check_path);     /* a stale file must not pass */
+    }
+    if (capture_path[0] != '\0')
+        return sim_write_capture(capture_path, loops);
+
+    fd = sim_open_pty(slave_name, sizeof(slave_name));
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    if (link_path[0] != '\0') {
+        unlink(link_path);
+        if (symlink(slave_name, link_path) < 0)
+            perror("symlink");
+    }
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sim_signal_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "ibus_sim: %s\n", slave_name);
+
+    /* The daemon flushes the tty when it starts; give it time */
+    if (optind + 1 < argc && strcmp(argv[optind + 1], "--") == 0 && optind + 2 < argc) {
+        child = sim_spawn(&argv[optind + 2], slave_name);
+        if (child < 0) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        if (start_delay_ms < 0)
+            start_delay_ms = 500;
+    }
+    if (start_delay_ms > 0)
+        sim_sleep_until(sim_now_ns() + (uint64_t)start_delay_ms * 1000000u);
+
+    started = sim_now_ns();
+    for (unsigned long i = 0; (loops == 0 || i < loops) && !sim_exit_request; ++i) {
+        if (sim_play(fd) < 0) {
+            perror("write pty");
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    double secs = (double)(sim_now_ns() - started) / 1e9;
+    fprintf(stderr, "ibus_sim: %llu frames, %llu bytes in %.2f s (%.0f B/s), "
+            "%llu bits flipped, %llu bytes dropped\n",
+            (unsigned long long)sim_frames, (unsigned long long)sim_bytes, secs,
+            secs > 0 ? (double)sim_bytes / secs : 0.0,
+            (unsigned long long)sim_flipped, (unsigned long long)sim_dropped);
+
+    if (linger_ms > 0 && !sim_exit_request)
+        sim_sleep_until(sim_now_ns() + (uint64_t)linger_ms * 1000000u);
+
+    if (child > 0) {
+        int status = 0;
+        kill(child, SIGTERM);
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFEXITED(status)) {
+            if (WEXITSTATUS(status) != 0)
+                ret = WEXITSTATUS(status);
+        } else {
+            fprintf(stderr, "ibus_sim: command killed by signal %d\n", WTERMSIG(status));
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (check_path[0] != '\0' && ret == EXIT_SUCCESS && sim_check(check_path) < 0)
+        ret = EXIT_FAILURE;
+
+    if (link_path[0] != '\0')
+        unlink(link_path);
+    close(fd);
+    return ret;
+}
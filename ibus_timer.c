@@ -0,0 +1,115 @@
+#include "ibus_timer.h"
+#include <stddef.h>
+
+#define SLOT_MASK   (IBUS_TIMER_SLOTS - 1u)
+
+static void link_insert_tail(ibus_timer_link_t *head, ibus_timer_link_t *l)
+{
+    l->prev          = head->prev;
+    l->next          = head;
+    head->prev->next = l;
+    head->prev       = l;
+}
+
+static void link_remove(ibus_timer_link_t *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->next = l->prev = NULL;
+}
+
+void ibus_timer_wheel_init(ibus_timer_wheel_t *wheel, uint64_t now_us)
+{
+    for (unsigned i = 0; i < IBUS_TIMER_SLOTS; ++i)
+        wheel->slot[i].next = wheel->slot[i].prev = &wheel->slot[i];
+    wheel->tick    = now_us / IBUS_TIMER_TICK_US;
+    wheel->next_us = 0;
+    wheel->pending = 0;
+    wheel->fired   = 0;
+}
+
+void ibus_timer_init(ibus_timer_t *timer, ibus_timer_fn fn, void *arg)
+{
+    timer->link.next  = timer->link.prev = NULL;
+    timer->expires_us = 0;
+    timer->fn         = fn;
+    timer->arg        = arg;
+}
+
+void ibus_timer_start(ibus_timer_wheel_t *wheel, ibus_timer_t *timer,
+                      uint64_t expires_us)
+{
+    uint64_t tick = expires_us / IBUS_TIMER_TICK_US;
+
+    if (ibus_timer_pending(timer))
+        ibus_timer_stop(wheel, timer);
+
+    /* Already due: the next run visits the current tick first */
+    if (tick < wheel->tick)
+        tick = wheel->tick;
+
+    timer->expires_us = expires_us;
+    link_insert_tail(&wheel->slot[tick & SLOT_MASK], &timer->link);
+    wheel->pending++;
+
+    if (wheel->next_us == 0 || expires_us < wheel->next_us)
+        wheel->next_us = expires_us ? expires_us : 1u;
+}
+
+void ibus_timer_stop(ibus_timer_wheel_t *wheel, ibus_timer_t *timer)
+{
+    if (!ibus_timer_pending(timer))
+        return;
+    link_remove(&timer->link);
+    wheel->pending--;
+}
+
+void ibus_timer_run(ibus_timer_wheel_t *wheel, uint64_t now_us)
+{
+    uint64_t now_tick = now_us / IBUS_TIMER_TICK_US;
+    uint64_t ticks    = now_tick >= wheel->tick ? now_tick - wheel->tick + 1u : 0u;
+    ibus_timer_link_t due;
+
+    if (ticks > IBUS_TIMER_SLOTS)
+        ticks = IBUS_TIMER_SLOTS;
+
+    /* Collect first, so callbacks can restart timers into visited slots */
+    due.next = due.prev = &due;
+    for (uint64_t t = 0; t < ticks; ++t) {
+        ibus_timer_link_t *head = &wheel->slot[(wheel->tick + t) & SLOT_MASK];
+        ibus_timer_link_t *l = head->next;
+
+        while (l != head) {
+            ibus_timer_link_t *next = l->next;
+            if (((ibus_timer_t *)l)->expires_us <= now_us) {
+                link_remove(l);
+                link_insert_tail(&due, l);
+            }
+            l = next;
+        }
+    }
+    if (now_tick > wheel->tick)
+        wheel->tick = now_tick;
+
+    while (due.next != &due) {
+        ibus_timer_t *timer = (ibus_timer_t *)due.next;
+
+        link_remove(&timer->link);
+        wheel->pending--;
+        wheel->fired++;
+        timer->fn(timer, now_us);
+    }
+
+    /* Exact next expiry (forgets stopped timers). Front ends only call
+     * this once ibus_timer_next() has passed, so the scan is rare. */
+    wheel->next_us = 0;
+    if (wheel->pending == 0)
+        return;
+    for (unsigned i = 0; i < IBUS_TIMER_SLOTS; ++i) {
+        for (ibus_timer_link_t *l = wheel->slot[i].next; l != &wheel->slot[i]; l = l->next) {
+            uint64_t e = ((ibus_timer_t *)l)->expires_us;
+            if (wheel->next_us == 0 || e < wheel->next_us)
+                wheel->next_us = e ? e : 1u;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef IBUS_TIMER_H
+#define IBUS_TIMER_H
+
+#include <stdint.h>
+
+/*
+ * Hashed timer wheel.
+ *
+ * A timer lives in slot (expires / tick) % slots, in an intrusive list, so
+ * starting, stopping and expiring one is O(1) however many are pending;
+ * timers further out than one revolution stay in their slot until a pass
+ * finds them due. There is no clock of its own: the front end calls
+ * ibus_timer_run() with its time (same clock as the expiry times) whenever
+ * ibus_timer_next() has passed, from its timerfd or alarm.
+ *
+ * Callbacks run from ibus_timer_run() and may start or stop any timer,
+ * including their own.
+ */
+#define IBUS_TIMER_TICK_US  1000u
+#define IBUS_TIMER_SLOTS    256u    /* power of two */
+
+typedef struct ibus_timer_link {
+    struct ibus_timer_link *next, *prev;
+} ibus_timer_link_t;
+
+typedef struct ibus_timer ibus_timer_t;
+typedef void (*ibus_timer_fn)(ibus_timer_t *timer, uint64_t now_us);
+
+struct ibus_timer {
+    ibus_timer_link_t link;     /* first member; next == NULL when idle */
+    uint64_t          expires_us;
+    ibus_timer_fn     fn;
+    void             *arg;
+};
+
+typedef struct {
+    ibus_timer_link_t slot[IBUS_TIMER_SLOTS];
+    uint64_t          tick;         /* last tick processed */
+    uint64_t          next_us;      /* no timer is due before this, 0 = none */
+    uint32_t          pending;
+    uint32_t          fired;
+} ibus_timer_wheel_t;
+
+void ibus_timer_wheel_init(ibus_timer_wheel_t *wheel, uint64_t now_us);
+
+void ibus_timer_init(ibus_timer_t *timer, ibus_timer_fn fn, void *arg);
+
+/* (Re)start a timer; an expiry in the past fires on the next run. */
+void ibus_timer_start(ibus_timer_wheel_t *wheel, ibus_timer_t *timer,
+                      uint64_t expires_us);
+void ibus_timer_stop(ibus_timer_wheel_t *wheel, ibus_timer_t *timer);
+
+static inline int ibus_timer_pending(const ibus_timer_t *timer)
+{
+    return timer->link.next != 0;
+}
+
+/* Fire every timer due at `now_us`. */
+void ibus_timer_run(ibus_timer_wheel_t *wheel, uint64_t now_us);
+
+/* When the wheel next needs to run, 0 if no timer is pending. May be early
+ * (a stopped timer is only forgotten by the next run), never late. */
+static inline uint64_t ibus_timer_next(const ibus_timer_wheel_t *wheel)
+{
+    return wheel->next_us;
+}
+
+#endif /* IBUS_TIMER_H */
@@ -0,0 +1,259 @@
+#include "ibus_validate.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IBUS_VALIDATE_HAVE_AVX2 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* ===== Running XOR kernels ===== */
+
+/*
+ * out[i] = in[0] ^ ... ^ in[i]. The vector versions work in whole vectors
+ * and may read and write up to IBUS_VALIDATE_PAD - 1 bytes past `len`.
+ */
+
+static void scan_scalar(const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t x = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        x ^= in[i];
+        out[i] = x;
+    }
+}
+
+#if defined(__SSE2__)
+static void scan_sse2(const uint8_t *in, uint8_t *out, size_t len)
+{
+    __m128i carry = _mm_setzero_si128();
+
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+
+        /* Log-step scan within the vector, then add what came before */
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 1));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 2));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+        v = _mm_xor_si128(v, carry);
+        _mm_storeu_si128((__m128i *)&out[i], v);
+
+        /* Broadcast the last byte (no pshufb in SSE2) */
+        carry = _mm_srli_si128(v, 15);
+        carry = _mm_unpacklo_epi8(carry, carry);
+        carry = _mm_unpacklo_epi16(carry, carry);
+        carry = _mm_shuffle_epi32(carry, 0);
+    }
+}
+#endif
+
+#if defined(IBUS_VALIDATE_HAVE_AVX2)
+__attribute__((target("avx2")))
+static void scan_avx2(const uint8_t *in, uint8_t *out, size_t len)
+{
+    const __m256i last = _mm256_set1_epi8(15);
+    __m256i carry = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&in[i]);
+        __m256i t;
+
+        /* Byte shifts stay within each 128-bit lane... */
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 1));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 2));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 4));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 8));
+
+        /* ...so carry the low lane's total into the high lane */
+        t = _mm256_shuffle_epi8(v, last);
+        v = _mm256_xor_si256(v, _mm256_permute2x128_si256(t, t, 0x08));
+        v = _mm256_xor_si256(v, carry);
+        _mm256_storeu_si256((__m256i *)&out[i], v);
+
+        t = _mm256_shuffle_epi8(v, last);
+        carry = _mm256_permute2x128_si256(t, t, 0x11);
+    }
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void scan_neon(const uint8_t *in, uint8_t *out, size_t len)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uint8x16_t carry = zero;
+
+    for (size_t i = 0; i < len; i += 16) {
+        uint8x16_t v = vld1q_u8(&in[i]);
+
+        v = veorq_u8(v, vextq_u8(zero, v, 15));
+        v = veorq_u8(v, vextq_u8(zero, v, 14));
+        v = veorq_u8(v, vextq_u8(zero, v, 12));
+        v = veorq_u8(v, vextq_u8(zero, v, 8));
+        v = veorq_u8(v, carry);
+        vst1q_u8(&out[i], v);
+
+        carry = vdupq_n_u8(vgetq_lane_u8(v, 15));
+    }
+}
+#endif
+
+/* ===== Implementation selection ===== */
+
+int ibus_validate_supported(ibus_validate_impl_t impl)
+{
+    switch (impl) {
+    case IBUS_VALIDATE_SCALAR:
+        return 1;
+#if defined(__SSE2__)
+    case IBUS_VALIDATE_SSE2:
+        return 1;
+#endif
+#if defined(IBUS_VALIDATE_HAVE_AVX2)
+    case IBUS_VALIDATE_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#if defined(__ARM_NEON)
+    case IBUS_VALIDATE_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+ibus_validate_impl_t ibus_validate_best(void)
+{
+    static const ibus_validate_impl_t order[] = {
+        IBUS_VALIDATE_AVX2, IBUS_VALIDATE_NEON, IBUS_VALIDATE_SSE2
+    };
+
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        if (ibus_validate_supported(order[i]))
+            return order[i];
+    }
+    return IBUS_VALIDATE_SCALAR;
+}
+
+const char *ibus_validate_impl_name(ibus_validate_impl_t impl)
+{
+    static const char *const names[IBUS_VALIDATE_IMPL_COUNT] = {
+        "scalar", "sse2", "avx2", "neon"
+    };
+
+    return (unsigned)impl < IBUS_VALIDATE_IMPL_COUNT ? names[impl] : "?";
+}
+
+int ibus_validate_init(ibus_validator_t *v, ibus_validate_impl_t impl)
+{
+    if (!ibus_validate_supported(impl))
+        return -ENOTSUP;
+
+    memset(v, 0, sizeof(*v));
+    v->impl = impl;
+    switch (impl) {
+#if defined(__SSE2__)
+    case IBUS_VALIDATE_SSE2:
+        v->scan = scan_sse2;
+        break;
+#endif
+#if defined(IBUS_VALIDATE_HAVE_AVX2)
+    case IBUS_VALIDATE_AVX2:
+        v->scan = scan_avx2;
+        break;
+#endif
+#if defined(__ARM_NEON)
+    case IBUS_VALIDATE_NEON:
+        v->scan = scan_neon;
+        break;
+#endif
+    default:
+        v->scan = scan_scalar;
+        break;
+    }
+    return 0;
+}
+
+/* ===== Decoder model ===== */
+
+void ibus_validate_append(ibus_validator_t *v, const uint8_t *bytes, size_t len)
+{
+    v->stats.bytes += (uint32_t)len;
+
+    while (len > 0) {
+        if (v->fill == IBUS_RX_BUFFER_LEN) {
+            /* Overflow: the decoder drops the buffer and this byte */
+            v->stats.overflows++;
+            v->stats.resync_bytes += IBUS_RX_BUFFER_LEN + 1;
+            v->pos  += IBUS_RX_BUFFER_LEN + 1;
+            v->fill  = 0;
+            bytes++;
+            len--;
+            continue;
+        }
+
+        size_t n = IBUS_RX_BUFFER_LEN - v->fill;
+        if (n > len)
+            n = len;
+        memcpy(&v->buf[v->fill], bytes, n);
+        v->fill += (uint32_t)n;
+        bytes   += n;
+        len     -= n;
+    }
+}
+
+size_t ibus_validate_flush(ibus_validator_t *v, ibus_validate_frame_t *frames)
+{
+    const uint8_t *b = v->buf;
+    const uint8_t *x = v->running;
+    uint32_t n = v->fill, s = 0;
+    size_t count = 0;
+    int bad = 0;
+
+    v->running[0] = 0;
+    v->scan(b, &v->running[1], n);
+
+    /* Same order of checks as ibus_process_buffer() */
+    while (n - s >= IBUS_MIN_MESSAGE_LEN) {
+        uint32_t len = b[s + IBUS_POS_LENGTH] + IBUS_SENDER_AND_LENGTH_LEN;
+
+        if (n - s < len)
+            break;
+        if (x[s + len] != x[s]) {
+            /* The decoder drops everything buffered */
+            v->stats.checksum_errors++;
+            bad = 1;
+            break;
+        }
+
+        ibus_validate_frame_t *f = &frames[count++];
+        f->pos     = v->pos + s;
+        f->len     = (uint16_t)len;
+        f->sender  = b[s + IBUS_POS_SENDER];
+        f->message = len > IBUS_POS_MESSAGE ? b[s + IBUS_POS_MESSAGE] : 0;
+        v->stats.frames++;
+        v->stats.frames_by_sender[f->sender]++;
+        /* Like the decoder, even if the frame is too short to have one */
+        v->stats.frames_by_message[b[s + IBUS_POS_MESSAGE]]++;
+        s += len;
+    }
+
+    if (bad) {
+        v->stats.resync_bytes += n - s;
+        s = n;
+    }
+
+    /* An incomplete frame stays buffered for the bytes still to come */
+    memmove(v->buf, &v->buf[s], n - s);
+    v->pos  += s;
+    v->fill  = n - s;
+    return count;
+}
@@ -0,0 +1,79 @@
+#ifndef IBUS_VALIDATE_H
+#define IBUS_VALIDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+
+/*
+ * Frame validation for offline captures (Linux tools only).
+ *
+ * Finds the same frames and counts the same ibus_stats_t as feeding the
+ * bytes through the shared decoder (ibus_append_byte_ts(), then
+ * ibus_process_messages_batch() at every frame gap),
+ * without copying frames or dispatching events.
+ *
+ * Instead of XORing every frame on its own, each burst is turned into a
+ * running XOR of its bytes (SIMD where available); a frame at `s` of length
+ * `len` then has a good checksum iff prefix[s + len] == prefix[s], so
+ * walking the length chain costs one compare per frame.
+ */
+
+typedef enum {
+    IBUS_VALIDATE_SCALAR = 0,
+    IBUS_VALIDATE_SSE2,
+    IBUS_VALIDATE_AVX2,
+    IBUS_VALIDATE_NEON,
+    IBUS_VALIDATE_IMPL_COUNT
+} ibus_validate_impl_t;
+
+/* Most frames one burst can hold (what is left of it after overflows) */
+#define IBUS_VALIDATE_MAX_FRAMES    (IBUS_RX_BUFFER_LEN / IBUS_MIN_MESSAGE_LEN)
+
+/* Room past the end of the buffers for whole-vector loads and stores */
+#define IBUS_VALIDATE_PAD           32u
+
+typedef struct {
+    uint64_t pos;               /* stream position of the first byte */
+    uint16_t len;               /* sender..checksum */
+    uint8_t  sender;
+    uint8_t  message;           /* 0 if the frame is too short to have one */
+} ibus_validate_frame_t;
+
+/* One decoder's worth of state; validators are independent of each other
+ * and of the shared decoder. */
+typedef struct {
+    void       (*scan)(const uint8_t *in, uint8_t *out, size_t len);
+    ibus_validate_impl_t impl;
+    uint64_t     pos;           /* stream position of buf[0] */
+    uint32_t     fill;
+    ibus_stats_t stats;
+    uint8_t      buf[IBUS_RX_BUFFER_LEN + IBUS_VALIDATE_PAD];
+    uint8_t      running[IBUS_RX_BUFFER_LEN + 1 + IBUS_VALIDATE_PAD]; /* XOR of buf[0..i) */
+} ibus_validator_t;
+
+/* Whether `impl` was built in and the CPU supports it. */
+int  ibus_validate_supported(ibus_validate_impl_t impl);
+
+/* Fastest supported implementation. */
+ibus_validate_impl_t ibus_validate_best(void);
+
+const char *ibus_validate_impl_name(ibus_validate_impl_t impl);
+
+/* Reset `v` to an empty buffer and zero counters at stream position 0.
+ * Returns 0 or -ENOTSUP if `impl` is not supported. */
+int  ibus_validate_init(ibus_validator_t *v, ibus_validate_impl_t impl);
+
+/* Append received bytes, as ibus_append_byte_ts() does one at a time
+ * (including overflows of the decoder's RX buffer). */
+void ibus_validate_append(ibus_validator_t *v, const uint8_t *bytes, size_t len);
+
+/* Frame gap: validate everything appended since the last gap. After a bad
+ * checksum the rest is dropped; an incomplete frame at the end is kept, as
+ * the decoder keeps it, and completed by the next append. Frames found are
+ * written to `frames` (IBUS_VALIDATE_MAX_FRAMES entries) in bus order;
+ * returns how many. */
+size_t ibus_validate_flush(ibus_validator_t *v, ibus_validate_frame_t *frames);
+
+#endif /* IBUS_VALIDATE_H */
@@ -0,0 +1,74 @@
+#include "ibus_vehicle.h"
+#include <string.h>
+
+static uint32_t ibus_vehicle_touch(ibus_vehicle_state_t *v,
+                                   ibus_vehicle_field_t field,
+                                   const ibus_msg_view_t *msg)
+{
+    v->updated_us[field] = msg->rx_time_us;
+    return IBUS_VEH_MASK(field);
+}
+
+void ibus_vehicle_reset(ibus_vehicle_state_t *v)
+{
+    memset(v, 0, sizeof(*v));
+}
+
+uint32_t ibus_vehicle_update(ibus_vehicle_state_t *v, const ibus_msg_view_t *msg)
+{
+    uint32_t updated = 0;
+
+    switch (msg->message) {
+    case IBUS_MSG_IGN:
+        if (msg->sender != IBUS_DEV_IKE || msg->data_len < 1)
+            break;
+        v->ignition = msg->data[0] & (IBUS_IGN_KL_R | IBUS_IGN_KL_15 | IBUS_IGN_KL_50);
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_IGNITION, msg);
+        break;
+
+    case IBUS_MSG_SPEED:
+        /* km/h in steps of 2, RPM in steps of 100 */
+        if (msg->sender != IBUS_DEV_IKE || msg->data_len < 2)
+            break;
+        v->speed_kmh = (uint16_t)(msg->data[0] * 2u);
+        v->rpm       = (uint16_t)(msg->data[1] * 100u);
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_SPEED, msg);
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_RPM, msg);
+        break;
+
+    case IBUS_MSG_TEMP:
+        /* Outside temperature is signed, coolant isn't */
+        if (msg->sender != IBUS_DEV_IKE || msg->data_len < 2)
+            break;
+        v->outside_temp_c = (int8_t)msg->data[0];
+        v->coolant_temp_c = msg->data[1];
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_OUTSIDE_TEMP, msg);
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_COOLANT_TEMP, msg);
+        break;
+
+    case IBUS_MSG_DOORS:
+        if (msg->sender != IBUS_DEV_GM || msg->data_len < 1)
+            break;
+        v->doors = msg->data[0] & 0x7F;
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_DOORS, msg);
+        if (msg->data_len >= 2) {
+            v->lids = msg->data[1] & 0x7F;
+            updated |= ibus_vehicle_touch(v, IBUS_VEH_LIDS, msg);
+        }
+        break;
+
+    case IBUS_MSG_LAMP:
+        if (msg->sender != IBUS_DEV_LCM || msg->data_len < 1)
+            break;
+        v->lamps = msg->data[0];
+        for (unsigned i = 0; i < sizeof(v->lamp_faults); ++i)
+            v->lamp_faults[i] = (i + 1u < msg->data_len) ? msg->data[i + 1] : 0;
+        updated |= ibus_vehicle_touch(v, IBUS_VEH_LAMPS, msg);
+        break;
+
+    default:
+        break;
+    }
+
+    return updated;
+}
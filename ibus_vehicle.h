@@ -0,0 +1,89 @@
+#ifndef IBUS_VEHICLE_H
+#define IBUS_VEHICLE_H
+
+#include <stdint.h>
+
+#include "ibus_protocol.h"
+
+/*
+ * Vehicle state cache, decoded from broadcasts the headunit logic ignores:
+ *
+ *   IKE 0x11  ignition (KL-R / KL-15 / KL-50)
+ *   IKE 0x18  speed and RPM
+ *   IKE 0x19  outside and coolant temperature
+ *   GM  0x7A  doors, central locking, windows, sunroof, trunk, hood
+ *   LCM 0x5B  lamps and lamp faults
+ *
+ * The struct is plain data (no pointers) so it can be copied into shared
+ * memory as is. Each field group has the rx timestamp of the frame that
+ * last updated it; 0 means it hasn't been seen yet.
+ */
+
+/* ignition */
+#define IBUS_IGN_KL_R            0x01
+#define IBUS_IGN_KL_15           0x02
+#define IBUS_IGN_KL_50           0x04
+
+/* doors (0x7A data[0]) */
+#define IBUS_DOOR_FRONT_LEFT     0x01
+#define IBUS_DOOR_FRONT_RIGHT    0x02
+#define IBUS_DOOR_REAR_LEFT      0x04
+#define IBUS_DOOR_REAR_RIGHT     0x08
+#define IBUS_DOOR_UNLOCKED       0x10
+#define IBUS_DOOR_LOCKED         0x20
+#define IBUS_DOOR_INTERIOR_LAMP  0x40
+
+/* windows and lids (0x7A data[1]) */
+#define IBUS_LID_WINDOW_FL       0x01
+#define IBUS_LID_WINDOW_FR       0x02
+#define IBUS_LID_WINDOW_RL       0x04
+#define IBUS_LID_WINDOW_RR       0x08
+#define IBUS_LID_SUNROOF         0x10
+#define IBUS_LID_TRUNK           0x20
+#define IBUS_LID_HOOD            0x40
+
+/* lamps (0x5B data[0]) */
+#define IBUS_LAMP_PARKING        0x01
+#define IBUS_LAMP_LOW_BEAM       0x02
+#define IBUS_LAMP_HIGH_BEAM      0x04
+#define IBUS_LAMP_FOG_FRONT      0x08
+#define IBUS_LAMP_FOG_REAR       0x10
+#define IBUS_LAMP_TURN_LEFT      0x20
+#define IBUS_LAMP_TURN_RIGHT     0x40
+#define IBUS_LAMP_TURN_FAST      0x80
+
+typedef enum {
+    IBUS_VEH_IGNITION = 0,
+    IBUS_VEH_SPEED,
+    IBUS_VEH_RPM,
+    IBUS_VEH_OUTSIDE_TEMP,
+    IBUS_VEH_COOLANT_TEMP,
+    IBUS_VEH_DOORS,
+    IBUS_VEH_LIDS,
+    IBUS_VEH_LAMPS,
+    IBUS_VEH_FIELDS
+} ibus_vehicle_field_t;
+
+#define IBUS_VEH_MASK(field)     (1u << (field))
+
+typedef struct {
+    uint16_t speed_kmh;
+    uint16_t rpm;
+    int16_t  outside_temp_c;
+    int16_t  coolant_temp_c;
+    uint8_t  ignition;          /* IBUS_IGN_* */
+    uint8_t  doors;             /* IBUS_DOOR_* */
+    uint8_t  lids;              /* IBUS_LID_* */
+    uint8_t  lamps;             /* IBUS_LAMP_* */
+    uint8_t  lamp_faults[3];    /* 0x5B data[1..3] as sent by the LCM */
+    uint8_t  reserved;
+    uint64_t updated_us[IBUS_VEH_FIELDS];
+} ibus_vehicle_state_t;
+
+void ibus_vehicle_reset(ibus_vehicle_state_t *v);
+
+/* Fold one validated message into the cache. Returns the IBUS_VEH_MASK()
+ * of the field groups it refreshed (0 for unrelated traffic). */
+uint32_t ibus_vehicle_update(ibus_vehicle_state_t *v, const ibus_msg_view_t *msg);
+
+#endif /* IBUS_VEHICLE_H */
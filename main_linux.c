@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <netinet/in.h>
@@ -14,11 +16,27 @@
 #include <errno.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <getopt.h>
+#include <sched.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
 #include <time.h>
 
 #include "ibus_protocol.h"
+#include "ibus_latency.h"
+#include "ibus_shm.h"
+#include "ibus_vehicle.h"
+#include "ibus_display.h"
+#include "ibus_segment.h"
+#include "ibus_keymap.h"
+#include "ibus_input.h"
+#include "ibus_timer.h"
+#include "ibus_busload.h"
+#include "ibus_server.h"
 
 /* ===== Tracing ===== */
 
@@ -33,6 +51,14 @@ static FILE *stdout_fp = NULL;
 
 #define CHECK_TRACELEVEL(level)  ((level) & trace_level)
 
+/* Monotonic clock in microseconds, used to stamp received bytes. */
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
 static void trace_timestamp_prefix(void)
 {
     struct timeval now;
@@ -67,15 +93,7 @@ static void trace_timestamp_prefix(void)
         if (stdout_fp) fflush(stdout_fp); \
     } while (0)
 
-/* ===== Button mapping & device/message name tables ===== */
-
-struct ibus_buttons {
-    const char   *name;
-    uint16_t      key_code;
-};
-
-/* used for the buttons that change the BM state (no uinput event) */
-#define RESERVED_BUTTON 0xFFFF
+/* ===== Device/message name tables ===== */
 
 /* IBUS device and message name tables (copied from original code) */
 static const char *IBUSDevices[256] = {
@@ -193,97 +211,134 @@ static const char *IBUSMessages[256] = {
     "0xF8", "0xF9", "0xFA", "0xFB", "0xFC", "0xFD", "0xFE", "0xFF"
 };
 
-/*
- * This is the key mapping from BMW IBUS to Linux key codes.
- * Do not map buttons that change the state like power, fm, mode etc.
- */
-static const struct ibus_buttons headunit_buttons[] = {
-    { "ButtonArrowRight",  KEY_UP         },   /*0x00*/
-    { "Button2",           KEY_BACKSPACE  },   /*0x01*/
-    { "Button4",           KEY_4          },   /*0x02*/
-    { "Button6",           KEY_6          },   /*0x03*/
-    { "ButtonTone",        RESERVED_BUTTON},   /*0x04*/
-    { "ButtonMenuKnob",    KEY_ENTER      },   /*0x05*/
-    { "ButtonRadioPower",  RESERVED_BUTTON},   /*0x06*/
-    { "ButtonClock",       KEY_SETUP      },   /*0x07*/
-    { "ButtonTelephone",   KEY_SETUP      },   /*0x08*/
-    { "0x09",              KEY_UNKNOWN    },   /*0x09*/
-    { "0x0A",              KEY_UNKNOWN    },   /*0x0A*/
-    { "0x0B",              KEY_UNKNOWN    },   /*0x0B*/
-    { "0x0C",              KEY_UNKNOWN    },   /*0x0C*/
-    { "0x0D",              KEY_UNKNOWN    },   /*0x0D*/
-    { "0x0E",              KEY_UNKNOWN    },   /*0x0E*/
-    { "0x0F",              KEY_UNKNOWN    },   /*0x0F*/
-    { "ButtonArrowLeft",   KEY_DOWN       },   /*0x10*/
-    { "Button1",           KEY_MENU       },   /*0x11*/
-    { "Button3",           KEY_SPACE      },   /*0x12*/
-    { "Button5",           KEY_5          },   /*0x13*/
-    { "ButtonReversePlay", KEY_SETUP      },   /*0x14*/
-    { "0x15",              KEY_UNKNOWN    },   /*0x15*/
-    { "0x16",              KEY_UNKNOWN    },   /*0x16*/
-    { "0x17",              KEY_UNKNOWN    },   /*0x17*/
-    { "0x18",              KEY_UNKNOWN    },   /*0x18*/
-    { "0x19",              KEY_UNKNOWN    },   /*0x19*/
-    { "0x1A",              KEY_UNKNOWN    },   /*0x1A*/
-    { "0x1B",              KEY_UNKNOWN    },   /*0x1B*/
-    { "0x1C",              KEY_UNKNOWN    },   /*0x1C*/
-    { "0x1D",              KEY_UNKNOWN    },   /*0x1D*/
-    { "0x1E",              KEY_UNKNOWN    },   /*0x1E*/
-    { "0x1F",              KEY_UNKNOWN    },   /*0x1F*/
-    { "0x20",              KEY_UNKNOWN    },   /*0x20*/
-    { "ButtonAM",          RESERVED_BUTTON},   /*0x21*/
-    { "ButtonRDS",         RESERVED_BUTTON},   /*0x22*/
-    { "ButtonMode",        RESERVED_BUTTON},   /*0x23*/
-    { "ButtonEject",       RESERVED_BUTTON},   /*0x24*/
-    { "0x25",              KEY_UNKNOWN    },   /*0x25*/
-    { "0x26",              KEY_UNKNOWN    },   /*0x26*/
-    { "0x27",              KEY_UNKNOWN    },   /*0x27*/
-    { "0x28",              KEY_UNKNOWN    },   /*0x28*/
-    { "0x29",              KEY_UNKNOWN    },   /*0x29*/
-    { "0x2A",              KEY_UNKNOWN    },   /*0x2A*/
-    { "0x2B",              KEY_UNKNOWN    },   /*0x2B*/
-    { "0x2C",              KEY_UNKNOWN    },   /*0x2C*/
-    { "0x2D",              KEY_UNKNOWN    },   /*0x2D*/
-    { "0x2E",              KEY_UNKNOWN    },   /*0x2E*/
-    { "0x2F",              KEY_UNKNOWN    },   /*0x2F*/
-    { "ButtonSwitch",      RESERVED_BUTTON},   /*0x30*/
-    { "ButtonFM",          RESERVED_BUTTON},   /*0x31*/
-    { "ButtonTP",          RESERVED_BUTTON},   /*0x32*/
-    { "ButtonDolby",       KEY_UNKNOWN    },   /*0x33*/
-    { "ButtonMenu",        RESERVED_BUTTON},   /*0x34*/
-    { "MenuKnobClockwise", KEY_RIGHT      },   /*0x35*/
-    { "MenuKnobCounterClockwise", KEY_LEFT},   /*0x36*/
-    { "SelectInTapeMode",  KEY_ESC        },   /*0x37*/
-    { "MFL2ButtonChannelUp", KEY_UP       },   /*0x38*/
-    { "MFL2ButtonChannelDown", KEY_DOWN   }    /*0x39*/
-};
-
 /* ===== Global state for Linux platform ===== */
 
 static volatile sig_atomic_t exit_request = 0;
+static volatile sig_atomic_t latency_dump_request = 0;
 
 static int uinput_device_fd = -1;
+static int uinput_enabled   = 1;      /* 0: --no-uinput, key events are only counted */
+static uint32_t key_event_count = 0;
 static int ibus_device_fd   = -1;
 
 static unsigned char send_key_events = 0;
 static ibus_video_switch_t VideoInputSwitch = IBUS_VID_SWITCH_UNKNOWN;
 static ibus_state_t g_hijack_state = IBUS_STATE_UNKNOWN;
+static ibus_state_filter_t state_filter;     /* --state-confirm, --state-dwell */
+static ibus_vehicle_state_t vehicle_state;
+static ibus_display_t radio_display;
+
+/* Button -> key mapping: built in, or --keymap (reloaded when it changes) */
+static const ibus_keymap_t *keymap = &ibus_keymap_default;
+static ibus_keymap_t keymap_file;
+static char keymap_path[240];
+static int keymap_watch_fd = -1;
+static uint32_t keymap_reload_count = 0;
+static uint32_t keymap_error_count  = 0;
+
+/* Autorepeat, long press and auto-release timers (ibus_input.c) */
+static ibus_timer_wheel_t timer_wheel;
+static ibus_input_config_t input_config = {
+    .repeat_delay_us    = IBUS_INPUT_REPEAT_DELAY_US,
+    .repeat_period_us   = IBUS_INPUT_REPEAT_PERIOD_US,
+    .long_press_us      = IBUS_INPUT_LONG_PRESS_US,
+    .release_timeout_us = IBUS_INPUT_RELEASE_TIMEOUT_US,
+};
+
+/* Idle suspend: the bus has been silent for idle_timeout_us, or the IKE
+ * reported the ignition off (0x11). uinput and the tty stay open. */
+enum { IDLE_ACTIVE = 0, IDLE_SILENT, IDLE_IGNITION_OFF };
+static int idle_state = IDLE_ACTIVE;
+static uint64_t idle_timeout_us = 600u * 1000000u;  /* 0 = never */
+static uint64_t idle_since_us = 0;
+static uint32_t idle_suspend_count = 0;
+static uint32_t idle_resume_count  = 0;
+
+/* Keys the uinput device was created with */
+static uint8_t uinput_keybits[(KEY_MAX + 1) / 8];
+
+/* Per-frame latency histograms (dumped on SIGUSR1) */
+static ibus_latency_t frame_latency;
+static uint64_t frame_dispatch_us = 0;   /* dispatch time of current frame */
+
+/* Bus load analyzer (--busload): reports every busload_interval seconds,
+ * babbling senders are traced as soon as they start or stop */
+static ibus_busload_t bus_load;
+static unsigned int busload_interval = 0;     /* 0 = off */
+static uint32_t busload_babble_pct = IBUS_BUSLOAD_BABBLE_PCT;
+
+/* Health counters: Unix-socket query and periodically replaced file */
+static char stats_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char stats_file_path[256];
+static unsigned int stats_interval = 10;  /* seconds between file updates */
+static int stats_listen_fd = -1;
+static uint32_t read_eagain_count = 0;
+static uint32_t read_error_count  = 0;
+
+/* Fan-out server for decoded traffic (--server) */
+static char server_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ibus_server_t server = { .listen_fd = -1 };
+
+/* Rotating trace / capture files */
+static char trace_file_path[240];
+static char capture_base[240];
+static ibus_segment_writer_t trace_segment;
+static ibus_segment_writer_t capture_segment;
+static uint64_t rotate_bytes   = 0;   /* 0 = no size limit */
+static unsigned rotate_seconds = 0;   /* 0 = no time limit */
+static unsigned rotate_count   = 10;  /* segments kept */
+static int      rotate_compress = 0;
+
+/* Shared-memory frame ring */
+static char shm_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int shm_listen_fd = -1;
+static ibus_shm_writer_t shm_writer = { .ring = NULL, .fd = -1, .waiters_fd = -1 };
+static ibus_shm_vehicle_writer_t shm_vehicle = { .page = NULL, .fd = -1 };
+static uint32_t shm_handout_count = 0;    /* fds handed to readers */
+
+/* Real-time mode (--rt) */
+static int rt_enabled  = 0;
+static int rt_priority = 50;      /* SCHED_FIFO priority */
+static int rt_cpu      = -1;      /* CPU to pin to, -1 = don't pin */
+static unsigned int jitter_test_seconds = 0;
+
+/* Stack we touch up front so page faults never hit the receive path */
+#define RT_STACK_PREFAULT_SIZE  (64 * 1024)
 
 /* ===== Signal handling ===== */
 
 static void signal_handler(int sig)
 {
-    (void)sig;
-    exit_request = 1;
+    if (sig == SIGUSR1)
+        latency_dump_request = 1;
+    else
+        exit_request = 1;
 }
 
 /* ===== uinput helpers ===== */
 
+static int uinput_set_key(int fd, uint16_t key)
+{
+    if (!ibus_keymap_sendable(key) || key > KEY_MAX ||
+        (uinput_keybits[key / 8] & (1u << (key % 8))))
+        return 0;
+    if (ioctl(fd, UI_SET_KEYBIT, key) < 0)
+        return -errno;
+    uinput_keybits[key / 8] |= (uint8_t)(1u << (key % 8));
+    return 0;
+}
+
+static int uinput_key_registered(uint16_t key)
+{
+    return key <= KEY_MAX && (uinput_keybits[key / 8] & (1u << (key % 8)));
+}
+
 static int uinput_create(void)
 {
     struct uinput_user_dev dev;
+    const uint16_t *named;
+    size_t named_count;
     int fd;
-    unsigned int i;
 
     TRACE(TRACE_INPUT | TRACE_FUNCTION, "Creating uinput device\n");
 
@@ -318,9 +373,21 @@ static int uinput_create(void)
         return -errno;
     }
 
-    for (i = 0; i < sizeof(headunit_buttons) / sizeof(headunit_buttons[0]); ++i) {
-        if (headunit_buttons[i].key_code != KEY_UNKNOWN) {
-            if (ioctl(fd, UI_SET_KEYBIT, headunit_buttons[i].key_code) < 0) {
+    /* Every key a keymap can name, so a reloaded map needs no new device */
+    memset(uinput_keybits, 0, sizeof(uinput_keybits));
+    named_count = ibus_keymap_named_keys(&named);
+    for (size_t i = 0; i < named_count; ++i) {
+        if (uinput_set_key(fd, named[i]) < 0) {
+            TRACE_ERROR("Can't set key bit");
+            close(fd);
+            return -errno;
+        }
+    }
+    for (unsigned l = 0; l < IBUS_KEYMAP_LAYERS; ++l) {
+        for (unsigned c = 0; c < IBUS_KEYMAP_CODES; ++c) {
+            const ibus_keymap_entry_t *e = &keymap->entry[l][c];
+            if (uinput_set_key(fd, e->key) < 0 ||
+                uinput_set_key(fd, e->long_key) < 0) {
                 TRACE_ERROR("Can't set key bit");
                 close(fd);
                 return -errno;
@@ -350,6 +417,9 @@ static int send_key_event(uint16_t key, uint16_t value)
 {
     struct input_event ev;
 
+    key_event_count++;
+    if (!uinput_enabled)
+        return 0;
     if (uinput_device_fd < 0)
         return -ENODEV;
 
@@ -432,20 +502,14 @@ static void enable_video_input(int enable)
 
 /* ===== Pretty-print IBUS messages (for logging) ===== */
 
-static void print_ibus_message(const uint8_t *msg, uint8_t len)
+static void print_ibus_frame(const ibus_msg_view_t *m)
 {
-    if (len < IBUS_MIN_MESSAGE_LEN)
-        return;
-
-    uint8_t sender   = msg[IBUS_POS_SENDER];
-    uint8_t length   = msg[IBUS_POS_LENGTH];
-    uint8_t receiver = msg[IBUS_POS_RECEIVER];
-    uint8_t message  = msg[IBUS_POS_MESSAGE];
-    uint8_t data_len = (len > IBUS_MIN_MESSAGE_LEN) ? (len - IBUS_MIN_MESSAGE_LEN) : 0;
+    const uint8_t *msg = m->raw;
+    uint16_t len       = m->raw_len;
 
     /* 1. Hex dump */
     trace_timestamp_prefix();
-    for (uint8_t i = 0; i < len; ++i) {
+    for (uint16_t i = 0; i < len; ++i) {
         if (i < 4 || i == len - 1)
             fprintf(stdout_fp ? stdout_fp : stdout, " %02x", msg[i]);
         else
@@ -454,13 +518,19 @@ static void print_ibus_message(const uint8_t *msg, uint8_t len)
 
     /* 2. Device / message decoding */
     fprintf(stdout_fp ? stdout_fp : stdout, " = %s SENT %s TO %s",
-            IBUSDevices[sender], IBUSMessages[message], IBUSDevices[receiver]);
+            IBUSDevices[m->sender], IBUSMessages[m->message],
+            IBUSDevices[m->receiver]);
+}
+
+static void print_ibus_message(const ibus_msg_view_t *m)
+{
+    print_ibus_frame(m);
 
     /* 3. Optional data printout */
-    if (data_len > 0) {
+    if (m->data_len > 0) {
         fprintf(stdout_fp ? stdout_fp : stdout, " DATA:");
-        for (uint8_t i = 0; i < data_len; ++i) {
-            uint8_t b = msg[IBUS_POS_DATA_START + i];
+        for (uint8_t i = 0; i < m->data_len; ++i) {
+            uint8_t b = m->data[i];
             if (b < 0x20 || b > 0x7F)
                 fprintf(stdout_fp ? stdout_fp : stdout, "0x%02x ", b);
             else
@@ -472,14 +542,204 @@ static void print_ibus_message(const uint8_t *msg, uint8_t len)
     if (stdout_fp) fflush(stdout_fp);
 }
 
+/* ===== Trace coalescing ===== */
+
+/*
+ * Most IBUS traffic is periodic and identical (IKE speed/RPM, temperature,
+ * lamp status...). With --trace-coalesce the last frame of every
+ * (sender, message) pair is remembered; exact repeats are only counted and
+ * summarised as "repeated N times over T s" when the frame changes or every
+ * flush interval. Changed frames are still printed in full.
+ */
+#define TRACE_COALESCE_SLOTS  256   /* power of two; full table => no coalescing */
+
+struct trace_coalesce_slot {
+    uint16_t key;                   /* sender << 8 | message */
+    uint16_t len;                   /* 0 = slot unused */
+    uint32_t repeats;               /* since the last line printed for it */
+    uint64_t since_us;              /* rx time of that line */
+    uint64_t last_us;               /* rx time of the last repeat */
+    uint8_t  frame[IBUS_MAX_MESSAGE_LEN];
+};
+
+static struct trace_coalesce_slot trace_coalesce_table[TRACE_COALESCE_SLOTS];
+static uint64_t trace_coalesce_us = 0;      /* flush interval, 0 = off */
+
+static struct trace_coalesce_slot *trace_coalesce_lookup(uint16_t key)
+{
+    unsigned idx = (unsigned)((key * 40503u) >> 8) & (TRACE_COALESCE_SLOTS - 1);
+
+    for (unsigned probe = 0; probe < TRACE_COALESCE_SLOTS; ++probe) {
+        struct trace_coalesce_slot *slot =
+            &trace_coalesce_table[(idx + probe) & (TRACE_COALESCE_SLOTS - 1)];
+        if (slot->len == 0 || slot->key == key)
+            return slot;
+    }
+    return NULL;
+}
+
+static void trace_coalesce_summary(struct trace_coalesce_slot *slot)
+{
+    ibus_msg_view_t view;
+
+    if (slot->repeats == 0)
+        return;
+
+    ibus_msg_view_init(&view, slot->frame, slot->len, slot->last_us);
+    print_ibus_frame(&view);
+    fprintf(stdout_fp ? stdout_fp : stdout,
+            " repeated %lu times over %.1f s\n", (unsigned long)slot->repeats,
+            (double)(slot->last_us - slot->since_us) / 1e6);
+
+    slot->repeats  = 0;
+    slot->since_us = slot->last_us;
+}
+
+static void trace_coalesce_flush(void)
+{
+    for (unsigned i = 0; i < TRACE_COALESCE_SLOTS; ++i)
+        trace_coalesce_summary(&trace_coalesce_table[i]);
+    if (stdout_fp) fflush(stdout_fp);
+}
+
+static void trace_ibus_message(const ibus_msg_view_t *m)
+{
+    struct trace_coalesce_slot *slot;
+
+    if (trace_coalesce_us == 0) {
+        print_ibus_message(m);
+        return;
+    }
+
+    slot = trace_coalesce_lookup((uint16_t)(m->sender << 8 | m->message));
+    if (!slot) {
+        print_ibus_message(m);
+        return;
+    }
+
+    if (slot->len == m->raw_len && memcmp(slot->frame, m->raw, m->raw_len) == 0) {
+        slot->repeats++;
+        slot->last_us = m->rx_time_us;
+        return;
+    }
+
+    trace_coalesce_summary(slot);
+    print_ibus_message(m);
+
+    slot->key      = (uint16_t)(m->sender << 8 | m->message);
+    slot->len      = m->raw_len;
+    slot->repeats  = 0;
+    slot->since_us = m->rx_time_us;
+    slot->last_us  = m->rx_time_us;
+    memcpy(slot->frame, m->raw, m->raw_len);
+}
+
+/* Idle suspend (see below) */
+static void idle_ignition(uint8_t ignition);
+
+/* ===== Rotating trace / capture files ===== */
+
+/* Without --rotate-size/--rotate-time, -f keeps appending to one file */
+static int trace_file_open(void)
+{
+    int res;
+
+    if (rotate_bytes == 0 && rotate_seconds == 0) {
+        stdout_fp = fopen(trace_file_path, "a+");
+        if (!stdout_fp) {
+            perror("fopen trace file");
+            return -errno;
+        }
+        return 0;
+    }
+
+    res = ibus_segment_open(&trace_segment, trace_file_path, IBUS_SEGMENT_TRACE,
+                            rotate_bytes, rotate_seconds, rotate_count,
+                            rotate_compress);
+    if (res < 0) {
+        errno = -res;
+        perror("open trace segment");
+        return res;
+    }
+    stdout_fp = trace_segment.fp;
+    return 0;
+}
+
+static int capture_open(void)
+{
+    int res = ibus_segment_open(&capture_segment, capture_base,
+                                IBUS_SEGMENT_CAPTURE, rotate_bytes,
+                                rotate_seconds, rotate_count, rotate_compress);
+    if (res < 0) {
+        errno = -res;
+        TRACE_ERROR("Can't open capture %s", capture_base);
+    }
+    return res;
+}
+
+static void capture_write(const uint8_t *bytes, size_t len, uint64_t rx_us)
+{
+    if (capture_segment.fp &&
+        ibus_segment_write_capture(&capture_segment, bytes, (uint16_t)len, rx_us) < 0)
+        TRACE_ERROR("Can't write capture");
+}
+
+/* Start new segments where the current ones are over their limits */
+static void segments_check(uint64_t now)
+{
+    int res;
+
+    if (trace_segment.fp) {
+        res = ibus_segment_check(&trace_segment, now);
+        if (res != 0)
+            stdout_fp = trace_segment.fp;   /* NULL (stdout) if that failed */
+        if (res < 0) {
+            errno = -res;
+            TRACE_ERROR("Can't rotate trace file");
+        }
+    }
+
+    if (capture_segment.fp) {
+        res = ibus_segment_check(&capture_segment, now);
+        if (res < 0) {
+            errno = -res;
+            TRACE_ERROR("Can't rotate capture");
+        }
+    }
+}
+
+/* Earliest --rotate-time deadline of the open segments, 0 = none */
+static uint64_t segments_deadline(void)
+{
+    uint64_t t = ibus_segment_deadline(&trace_segment);
+    uint64_t c = ibus_segment_deadline(&capture_segment);
+
+    if (t == 0 || (c != 0 && c < t))
+        return c;
+    return t;
+}
+
+static void segments_close(void)
+{
+    if (trace_segment.fp) {
+        ibus_segment_close(&trace_segment);
+        stdout_fp = NULL;
+    }
+    ibus_segment_close(&capture_segment);
+    ibus_segment_shutdown();    /* finish compressing closed segments */
+}
+
 /* ===== Platform hook implementations ===== */
 
 void ibus_platform_state_changed(ibus_state_t new_state,
-                                 ibus_state_t hijack_state)
+                                 ibus_state_t hijack_state,
+                                 const ibus_msg_view_t *msg)
 {
     TRACE_WARGS(TRACE_STATE, "IBUS state changed to %d (hijack=%d)\n",
                 new_state, hijack_state);
 
+    ibus_server_publish_state(&server, new_state, hijack_state, msg);
+
     /* Enable key events & video only when we are in the hijack state */
     if (new_state == hijack_state && hijack_state != IBUS_STATE_UNKNOWN) {
         send_key_events = 1;
@@ -488,63 +748,840 @@ void ibus_platform_state_changed(ibus_state_t new_state,
         send_key_events = 0;
         enable_video_input(0);
     }
+
+    ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us,
+                             monotonic_us());
 }
 
 void ibus_platform_button_event(uint8_t button_code,
                                 uint8_t released,
-                                uint8_t long_press)
+                                uint8_t long_press,
+                                const ibus_msg_view_t *msg)
 {
-    (void)long_press; /* currently not used for anything special */
-
     TRACE_WARGS(TRACE_INPUT, "Button event code=%u released=%u long=%u\n",
                 button_code, released, long_press);
 
-    if (!send_key_events)
-        return;
+    ibus_server_publish_button(&server, button_code, released, long_press, msg);
 
-    size_t count = sizeof(headunit_buttons) / sizeof(headunit_buttons[0]);
-    if (button_code >= count) {
+    if (button_code >= IBUS_KEYMAP_CODES) {
         TRACE_WARGS(TRACE_INPUT, "Invalid button index %u\n", button_code);
         return;
     }
 
-    uint16_t key = headunit_buttons[button_code].key_code;
+    if (ibus_input_button(button_code, released, long_press, g_hijack_state,
+                          send_key_events, monotonic_us()) > 0)
+        ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us,
+                                 monotonic_us());
+}
 
-    if (key != KEY_UNKNOWN && key != RESERVED_BUTTON) {
-        if (send_key_event(key, released ? 0 : 1) < 0) {
-            TRACE_ERROR("Can't send key event");
-        }
-    }
+void ibus_platform_key_event(uint16_t key, int value)
+{
+    TRACE_WARGS(TRACE_INPUT, "Key %u %s\n", key,
+                value == IBUS_KEY_PRESS ? "press" :
+                value == IBUS_KEY_REPEAT ? "repeat" : "release");
+    send_key_event(key, (uint16_t)value);
 }
 
-void ibus_platform_knob_event(int clockwise, uint8_t steps)
+void ibus_platform_knob_event(int clockwise, uint8_t steps,
+                              const ibus_msg_view_t *msg)
 {
     TRACE_WARGS(TRACE_INPUT, "Knob event clockwise=%d steps=%u\n",
                 clockwise, steps);
 
+    ibus_server_publish_knob(&server, clockwise, steps, msg);
+
     uint8_t idx = clockwise ? IBUS_BTN_IDX_MENUKNOB_CW
                             : IBUS_BTN_IDX_MENUKNOB_CCW;
 
-    size_t count = sizeof(headunit_buttons) / sizeof(headunit_buttons[0]);
-    if (idx >= count)
-        return;
-
-    uint16_t key = headunit_buttons[idx].key_code;
-    if (key == KEY_UNKNOWN || key == RESERVED_BUTTON)
+    uint16_t key = ibus_keymap_lookup(keymap, g_hijack_state, idx)->key;
+    if (!ibus_keymap_sendable(key))
         return;
 
     while (steps-- > 0) {
-        if (send_key_event(key, 1) < 0) break;
-        if (send_key_event(key, 0) < 0) break;
+        if (send_key_event(key, 1) < 0) return;
+        if (send_key_event(key, 0) < 0) return;
     }
+    ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us,
+                             monotonic_us());
 }
 
-void ibus_platform_log_message(const uint8_t *msg, uint8_t len)
+void ibus_platform_log_message(const ibus_msg_view_t *msg)
 {
+    /* First hook for every frame: this is its dispatch time */
+    frame_dispatch_us = monotonic_us();
+    ibus_latency_dispatched(&frame_latency, msg, frame_dispatch_us);
+
+    if (shm_writer.ring)
+        ibus_shm_writer_publish(&shm_writer, msg);
+    uint32_t vehicle_updated = ibus_vehicle_update(&vehicle_state, msg);
+    if (vehicle_updated && shm_vehicle.page)
+        ibus_shm_vehicle_publish(&shm_vehicle, &vehicle_state);
+    if (vehicle_updated & IBUS_VEH_MASK(IBUS_VEH_IGNITION))
+        idle_ignition(vehicle_state.ignition);
+
+    uint32_t display_changed = ibus_display_update(&radio_display, msg);
+    if (display_changed)
+        ibus_server_publish_display(&server, display_changed, msg);
+    ibus_server_publish_frame(&server, msg);
+
     if (!CHECK_TRACELEVEL(TRACE_IBUS))
         return;
 
-    print_ibus_message(msg, len);
+    trace_ibus_message(msg);
+}
+
+/* ===== Latency histograms ===== */
+
+static void latency_dump(void)
+{
+    FILE *out = stdout_fp ? stdout_fp : stdout;
+    char line[192];
+
+    trace_timestamp_prefix();
+    fprintf(out, "Frame latency (us):\n");
+    for (unsigned i = 0; i < IBUS_LAT_STAGES; ++i) {
+        ibus_hist_format(&frame_latency.stage[i],
+                         ibus_latency_stage_name((ibus_lat_stage_t)i),
+                         line, sizeof(line));
+        fprintf(out, "  %s\n", line);
+    }
+    fflush(out);
+}
+
+/* ===== Bus load ===== */
+
+static int busload_sender_cmp(const void *a, const void *b)
+{
+    const uint8_t sa = *(const uint8_t *)a, sb = *(const uint8_t *)b;
+    ibus_busload_count_t ca, cb;
+
+    ibus_busload_sender(&bus_load, sa, &ca);
+    ibus_busload_sender(&bus_load, sb, &cb);
+    if (ca.bytes != cb.bytes)
+        return ca.bytes < cb.bytes ? 1 : -1;
+    return (int)sa - (int)sb;
+}
+
+/* "xx.x%" of the line rate */
+#define PERMILLE_ARGS(p)    (unsigned)((p) / 10u), (unsigned)((p) % 10u)
+
+static void busload_report(void)
+{
+    FILE *out = stdout_fp ? stdout_fp : stdout;
+    ibus_busload_summary_t sum;
+    uint8_t senders[256];
+    unsigned count = 0;
+    double secs;
+    char line[192];
+
+    ibus_busload_summary(&bus_load, &sum);
+    if (sum.window_us == 0)
+        return;
+    secs = (double)sum.window_us / 1e6;
+
+    trace_timestamp_prefix();
+    fprintf(out, "Bus load over %.0f s: %u.%u%% (peak %u.%u%%), %.0f B/s, %.1f frames/s, "
+            "%.1f%% outside valid frames\n",
+            secs, PERMILLE_ARGS(sum.load_permille), PERMILLE_ARGS(sum.peak_permille),
+            (double)sum.line_bytes / secs, (double)sum.total.frames / secs,
+            sum.line_bytes ? 100.0 * (sum.line_bytes - sum.total.bytes) / sum.line_bytes : 0.0);
+    ibus_hist_format(&bus_load.gap, "gap (us)", line, sizeof(line));
+    fprintf(out, "  %s\n", line);
+
+    for (unsigned s = 0; s < 256; ++s) {
+        ibus_busload_count_t c;
+        ibus_busload_sender(&bus_load, (uint8_t)s, &c);
+        if (c.frames != 0)
+            senders[count++] = (uint8_t)s;
+    }
+    qsort(senders, count, 1, busload_sender_cmp);
+
+    for (unsigned i = 0; i < count; ++i) {
+        ibus_busload_count_t c;
+        uint32_t p;
+
+        ibus_busload_sender(&bus_load, senders[i], &c);
+        p = ibus_busload_permille(c.bytes, sum.window_us);
+        fprintf(out, "  %02x %-22s %3u.%u%% %6.0f B/s %6.1f frames/s%s\n",
+                senders[i], IBUSDevices[senders[i]], PERMILLE_ARGS(p),
+                (double)c.bytes / secs, (double)c.frames / secs,
+                ibus_busload_is_babbling(&bus_load, senders[i]) ? "  BABBLING" : "");
+    }
+    fflush(out);
+
+    ibus_busload_report_done(&bus_load);
+}
+
+/* Trace senders that started or stopped babbling */
+static void busload_tick(uint64_t now)
+{
+    uint8_t changed[32];
+
+    if (ibus_busload_tick(&bus_load, now, changed) == 0)
+        return;
+
+    for (unsigned s = 0; s < 256; ++s) {
+        ibus_busload_count_t c;
+        uint32_t p;
+
+        if (!(changed[s >> 3] & (1u << (s & 7))))
+            continue;
+        ibus_busload_sender(&bus_load, (uint8_t)s, &c);
+        p = ibus_busload_permille(c.bytes,
+                                  (uint64_t)IBUS_BUSLOAD_SLOTS * IBUS_BUSLOAD_SLOT_US);
+        if (ibus_busload_is_babbling(&bus_load, (uint8_t)s))
+            TRACE_WARGS(TRACE_ALL, "Sender %02x (%s) babbling: %u.%u%% of the bus over %u s\n",
+                        s, IBUSDevices[s], PERMILLE_ARGS(p), IBUS_BUSLOAD_SLOTS);
+        else
+            TRACE_WARGS(TRACE_ALL, "Sender %02x (%s) no longer babbling (%u.%u%%)\n",
+                        s, IBUSDevices[s], PERMILLE_ARGS(p));
+    }
+}
+
+/* ===== Health counters / stats endpoint ===== */
+
+/* "name value" per line; per-sender/message counters only when non-zero */
+static size_t stats_format(char *buf, size_t len)
+{
+    const ibus_stats_t *st = ibus_get_stats();
+    const ibus_input_stats_t *input_stats = ibus_input_get_stats();
+    size_t pos = 0;
+    int n;
+
+#define STATS_APPEND(...) \
+    do { \
+        n = snprintf(buf + pos, len - pos, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - pos) return pos; \
+        pos += (size_t)n; \
+    } while (0)
+
+    STATS_APPEND("bytes %lu\n",           (unsigned long)st->bytes);
+    STATS_APPEND("frames %lu\n",          (unsigned long)st->frames);
+    STATS_APPEND("checksum_errors %lu\n", (unsigned long)st->checksum_errors);
+    STATS_APPEND("overflows %lu\n",       (unsigned long)st->overflows);
+    STATS_APPEND("resync_bytes %lu\n",    (unsigned long)st->resync_bytes);
+    STATS_APPEND("read_eagain %lu\n",     (unsigned long)read_eagain_count);
+    STATS_APPEND("read_errors %lu\n",     (unsigned long)read_error_count);
+    STATS_APPEND("state %d\n",            (int)ibus_get_state());
+    STATS_APPEND("state_changes %lu\n",    (unsigned long)ibus_get_state_stats()->changes);
+    STATS_APPEND("state_suppressed %lu\n", (unsigned long)ibus_get_state_stats()->suppressed);
+    STATS_APPEND("idle %d\n",             idle_state);
+    STATS_APPEND("idle_suspends %lu\n",   (unsigned long)idle_suspend_count);
+    STATS_APPEND("idle_resumes %lu\n",    (unsigned long)idle_resume_count);
+    if (busload_interval != 0) {
+        ibus_busload_summary_t sum;
+        unsigned babbling = 0;
+
+        ibus_busload_summary(&bus_load, &sum);
+        for (unsigned i = 0; i < 256; ++i)
+            babbling += (unsigned)ibus_busload_is_babbling(&bus_load, (uint8_t)i);
+        STATS_APPEND("bus_load_permille %lu\n", (unsigned long)sum.load_permille);
+        STATS_APPEND("bus_frames %llu\n",      (unsigned long long)bus_load.frames);
+        STATS_APPEND("bus_unframed_bytes %llu\n", (unsigned long long)bus_load.unframed_bytes);
+        STATS_APPEND("bus_babbling %u\n",       babbling);
+        STATS_APPEND("bus_babble_events %lu\n", (unsigned long)bus_load.babble_events);
+    }
+
+    if (server.listen_fd >= 0) {
+        STATS_APPEND("server_clients %lu\n",  (unsigned long)server.clients);
+        STATS_APPEND("server_accepted %lu\n", (unsigned long)server.accepted);
+        STATS_APPEND("server_rejected %lu\n", (unsigned long)server.rejected);
+        STATS_APPEND("server_dropped %lu\n",  (unsigned long)server.dropped);
+    }
+    if (shm_writer.ring) {
+        STATS_APPEND("shm_frames %llu\n",
+                     (unsigned long long)shm_writer.ring->write_seq);
+        STATS_APPEND("shm_handouts %lu\n", (unsigned long)shm_handout_count);
+    }
+    STATS_APPEND("key_events %lu\n",        (unsigned long)key_event_count);
+    STATS_APPEND("key_presses %lu\n",       (unsigned long)input_stats->presses);
+    STATS_APPEND("key_repeats %lu\n",       (unsigned long)input_stats->repeats);
+    STATS_APPEND("key_long_presses %lu\n",  (unsigned long)input_stats->long_presses);
+    STATS_APPEND("key_auto_releases %lu\n", (unsigned long)input_stats->auto_releases);
+    if (keymap_path[0] != '\0') {
+        STATS_APPEND("keymap_reloads %lu\n", (unsigned long)keymap_reload_count);
+        STATS_APPEND("keymap_errors %lu\n",  (unsigned long)keymap_error_count);
+    }
+
+    for (unsigned i = 0; i < 256; ++i) {
+        if (st->frames_by_sender[i])
+            STATS_APPEND("sender_%02x %lu\n", i,
+                         (unsigned long)st->frames_by_sender[i]);
+    }
+    for (unsigned i = 0; i < 256; ++i) {
+        if (st->frames_by_message[i])
+            STATS_APPEND("message_%02x %lu\n", i,
+                         (unsigned long)st->frames_by_message[i]);
+    }
+
+#undef STATS_APPEND
+    return pos;
+}
+
+/* Non-blocking listening Unix stream socket at `path` (replaced if stale) */
+static int unix_socket_listen(const char *path, int backlog)
+{
+    struct sockaddr_un addr;
+    size_t path_len = strlen(path);
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    if (path_len >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        TRACE_ERROR("Socket path too long: %s", path);
+        return -errno;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, path_len);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        TRACE_ERROR("Can't create socket %s", path);
+        return -errno;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, backlog) < 0) {
+        TRACE_ERROR("Can't listen on socket %s", path);
+        close(fd);
+        return -errno;
+    }
+
+    return fd;
+}
+
+/* Answer every pending connection with one stats snapshot and close it. */
+static void stats_socket_serve(void)
+{
+    static char buf[16384];
+
+    for (;;) {
+        int fd = accept4(stats_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                TRACE_ERROR("accept stats client");
+            return;
+        }
+
+        size_t len = stats_format(buf, sizeof(buf));
+        if (send(fd, buf, len, MSG_NOSIGNAL) < 0)
+            TRACE_ERROR("Can't write stats");
+        close(fd);
+    }
+}
+
+/* Replace the stats file atomically: readers see the old or new version. */
+static void stats_file_write(void)
+{
+    static char buf[16384];
+    char tmp_path[sizeof(stats_file_path) + 8];
+    size_t len = stats_format(buf, sizeof(buf));
+    int fd;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats_file_path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        TRACE_ERROR("Can't open %s", tmp_path);
+        return;
+    }
+
+    if (write(fd, buf, len) != (ssize_t)len) {
+        TRACE_ERROR("Can't write %s", tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+    close(fd);
+
+    if (rename(tmp_path, stats_file_path) < 0) {
+        TRACE_ERROR("Can't rename %s", tmp_path);
+        unlink(tmp_path);
+    }
+}
+
+/* ===== Event loop (epoll + timerfd) ===== */
+
+/*
+ * Every fd in the loop carries a tag in epoll_event.data.u64:
+ * source kind in the upper 32 bits, index (e.g. client slot) in the lower.
+ */
+enum {
+    LOOP_SRC_IBUS = 1,
+    LOOP_SRC_TIMER,
+    LOOP_SRC_STATS,
+    LOOP_SRC_SERVER,
+    LOOP_SRC_CLIENT,
+    LOOP_SRC_SHM,
+    LOOP_SRC_KEYMAP
+};
+
+#define LOOP_TAG(src, idx)  (((uint64_t)(src) << 32) | (uint32_t)(idx))
+#define LOOP_TAG_SRC(tag)   ((uint32_t)((tag) >> 32))
+#define LOOP_TAG_IDX(tag)   ((uint32_t)(tag))
+
+#define LOOP_MAX_EVENTS     16
+
+static int loop_epoll_fd = -1;
+static int loop_timer_fd = -1;                /* one-shot, absolute deadline */
+static uint64_t loop_timer_deadline_us = 0;   /* currently armed, 0 = off */
+
+static int loop_ctl(int op, int fd, uint32_t events, uint64_t tag)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.u64 = tag;
+    if (epoll_ctl(loop_epoll_fd, op, fd, &ev) < 0) {
+        TRACE_ERROR("epoll_ctl(%d, fd %d)", op, fd);
+        return -errno;
+    }
+    return 0;
+}
+
+static int loop_init(void)
+{
+    loop_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop_epoll_fd < 0) {
+        TRACE_ERROR("epoll_create1");
+        return -errno;
+    }
+
+    loop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop_timer_fd < 0) {
+        TRACE_ERROR("timerfd_create");
+        return -errno;
+    }
+
+    return loop_ctl(EPOLL_CTL_ADD, loop_timer_fd, EPOLLIN,
+                    LOOP_TAG(LOOP_SRC_TIMER, 0));
+}
+
+static void loop_close(void)
+{
+    if (loop_timer_fd >= 0)
+        close(loop_timer_fd);
+    if (loop_epoll_fd >= 0)
+        close(loop_epoll_fd);
+    loop_timer_fd = loop_epoll_fd = -1;
+}
+
+/* Arm the loop timer for an absolute monotonic_us() deadline (0 = disarm).
+ * Re-arming to the same deadline costs nothing. */
+static void loop_arm_timer(uint64_t deadline_us)
+{
+    struct itimerspec its;
+
+    if (deadline_us == loop_timer_deadline_us)
+        return;
+
+    memset(&its, 0, sizeof(its));
+    if (deadline_us != 0) {
+        its.it_value.tv_sec  = (time_t)(deadline_us / 1000000u);
+        its.it_value.tv_nsec = (long)(deadline_us % 1000000u) * 1000L;
+    }
+    if (timerfd_settime(loop_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        TRACE_ERROR("timerfd_settime");
+        return;
+    }
+    loop_timer_deadline_us = deadline_us;
+}
+
+/* Acknowledge an expired loop timer */
+static void loop_timer_expired(void)
+{
+    uint64_t expirations;
+
+    if (read(loop_timer_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        TRACE_ERROR("read timerfd");
+    loop_timer_deadline_us = 0;
+}
+
+/* ===== Keymap file (--keymap) ===== */
+
+/*
+ * The file's directory is watched with inotify, so edits in place and
+ * editors that write a new file and rename it over the old one both
+ * trigger a reload. A map that doesn't compile is reported and the
+ * previous one stays active; the uinput device is never recreated.
+ */
+
+static int keymap_reload(void)
+{
+    ibus_keymap_t map;
+    char err[256];
+    int res = ibus_keymap_load(keymap_path, &map, err, sizeof(err));
+
+    if (res < 0) {
+        keymap_error_count++;
+        TRACE_WARGS(TRACE_ALL, "Keymap %s not loaded: %s\n", keymap_path, err);
+        fprintf(stderr, "Keymap %s: %s\n", keymap_path, err);
+        return res;
+    }
+
+    for (unsigned l = 0; l < IBUS_KEYMAP_LAYERS; ++l) {
+        for (unsigned c = 0; c < IBUS_KEYMAP_CODES; ++c) {
+            const ibus_keymap_entry_t *e = &map.entry[l][c];
+            if (uinput_device_fd >= 0 &&
+                ((ibus_keymap_sendable(e->key) && !uinput_key_registered(e->key)) ||
+                 (e->long_key != IBUS_KEY_NONE && !uinput_key_registered(e->long_key))))
+                TRACE_WARGS(TRACE_ALL, "Keymap: key for button 0x%02X in [%s] "
+                            "needs a restart to be sent\n",
+                            c, ibus_keymap_layer_name((ibus_state_t)l));
+        }
+    }
+
+    memcpy(&keymap_file, &map, sizeof(keymap_file));
+    keymap = &keymap_file;
+    ibus_input_set_keymap(keymap);
+    keymap_reload_count++;
+    TRACE_WARGS(TRACE_ALL, "Keymap %s loaded\n", keymap_path);
+    return 0;
+}
+
+static int keymap_watch_open(void)
+{
+    char dir[sizeof(keymap_path)];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", keymap_path);
+    slash = strrchr(dir, '/');
+    if (!slash)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+
+    keymap_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (keymap_watch_fd < 0) {
+        TRACE_ERROR("inotify_init1");
+        return -errno;
+    }
+    if (inotify_add_watch(keymap_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        TRACE_ERROR("inotify_add_watch(%s)", dir);
+        return -errno;
+    }
+    return loop_ctl(EPOLL_CTL_ADD, keymap_watch_fd, EPOLLIN,
+                    LOOP_TAG(LOOP_SRC_KEYMAP, 0));
+}
+
+static void keymap_watch_close(void)
+{
+    if (keymap_watch_fd >= 0)
+        close(keymap_watch_fd);
+    keymap_watch_fd = -1;
+}
+
+static void keymap_watch_event(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *base = strrchr(keymap_path, '/');
+    int changed = 0;
+    ssize_t len;
+
+    base = base ? base + 1 : keymap_path;
+
+    while ((len = read(keymap_watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, base) == 0)
+                changed = 1;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    if (len < 0 && errno != EAGAIN)
+        TRACE_ERROR("read inotify");
+
+    if (changed)
+        keymap_reload();
+}
+
+/* ===== Idle suspend / resume ===== */
+
+/*
+ * Instead of exiting when the car is parked, the daemon goes idle: held
+ * keys are released, trace/capture/stats output is flushed and the loop
+ * sleeps in epoll with no timer armed. The uinput device, the tty and the
+ * headunit state are kept, so the next ignition costs nothing. A silent
+ * bus resumes on its first byte; ignition off resumes on ignition on
+ * (frames are still decoded to see it). With the ignition off the other
+ * modules keep talking for a while, so stats, trace coalescing and bus
+ * load reports carry on until the bus goes silent as well.
+ */
+static void idle_suspend(int reason, uint64_t now)
+{
+    if (idle_state == reason)
+        return;
+
+    if (idle_state == IDLE_ACTIVE) {
+        ibus_input_release_all();
+        ibus_timer_run(&timer_wheel, now);  /* forget the stopped timers */
+        idle_since_us = now;
+        idle_suspend_count++;
+    }
+
+    idle_state = reason;
+    if (reason == IDLE_SILENT)
+        TRACE_WARGS(TRACE_ALL, "%llu s without messages on the bus => idle\n",
+                    (unsigned long long)(idle_timeout_us / 1000000u));
+    else
+        TRACE(TRACE_ALL, "Ignition off => idle\n");
+
+    if (trace_coalesce_us != 0)
+        trace_coalesce_flush();
+    if (stats_file_path[0] != '\0')
+        stats_file_write();
+    if (capture_segment.fp)
+        fflush(capture_segment.fp);
+    if (stdout_fp)
+        fflush(stdout_fp);
+}
+
+static void idle_resume(uint64_t now, const char *why)
+{
+    if (idle_state == IDLE_ACTIVE)
+        return;
+
+    /* Traffic again, but the last word from the IKE was still ignition off */
+    if (idle_state == IDLE_SILENT && vehicle_state.updated_us[IBUS_VEH_IGNITION] != 0 &&
+        vehicle_state.ignition == 0) {
+        idle_state = IDLE_IGNITION_OFF;
+        TRACE_WARGS(TRACE_ALL, "%s with ignition off => staying idle\n", why);
+        return;
+    }
+
+    idle_state = IDLE_ACTIVE;
+    idle_resume_count++;
+    TRACE_WARGS(TRACE_ALL, "%s => resuming after %.1f s idle\n", why,
+                (double)(now - idle_since_us) / 1e6);
+}
+
+static void idle_ignition(uint8_t ignition)
+{
+    if (ignition == 0)
+        idle_suspend(IDLE_IGNITION_OFF, monotonic_us());
+    else if (idle_state == IDLE_IGNITION_OFF)
+        idle_resume(monotonic_us(), "Ignition on");
+}
+
+/* ===== Fan-out server for decoded traffic (ibus_server.c) ===== */
+
+static int server_open(const char *path)
+{
+    int fd = unix_socket_listen(path, IBUS_SERVER_MAX_CLIENTS);
+    if (fd < 0)
+        return fd;
+
+    ibus_server_open(&server, fd, loop_epoll_fd, LOOP_TAG(LOOP_SRC_CLIENT, 0),
+                     &radio_display);
+    return loop_ctl(EPOLL_CTL_ADD, fd, EPOLLIN, LOOP_TAG(LOOP_SRC_SERVER, 0));
+}
+
+static void server_close(void)
+{
+    if (server.listen_fd < 0)
+        return;
+
+    ibus_server_close(&server);
+    unlink(server_socket_path);
+}
+
+static void server_accept(void)
+{
+    uint32_t accepted = server.accepted;
+    int res = ibus_server_accept(&server);
+
+    if (res < 0) {
+        errno = -res;
+        TRACE_ERROR("accept server client");
+    }
+    if (server.accepted != accepted)
+        TRACE_WARGS(TRACE_FUNCTION, "Server client connected (%lu now)\n",
+                    (unsigned long)server.clients);
+}
+
+static void server_client_event(uint32_t slot, uint32_t events)
+{
+    uint32_t clients = server.clients;
+
+    ibus_server_client_event(&server, slot, events);
+    if (server.clients != clients)
+        TRACE_WARGS(TRACE_FUNCTION, "Server client gone (%lu left)\n",
+                    (unsigned long)server.clients);
+}
+
+/* ===== Shared-memory frame ring ===== */
+
+/* Frames go into a sealed memfd ring, the vehicle state into a seqlocked
+ * page (see ibus_shm.h). The Unix socket only hands out both fds: each
+ * connection gets them once and is closed. */
+static int shm_open_ring(const char *path)
+{
+    int res = ibus_shm_writer_create(&shm_writer, IBUS_SHM_DEFAULT_SLOTS);
+    if (res < 0) {
+        errno = -res;
+        TRACE_ERROR("Can't create shared-memory ring");
+        return res;
+    }
+
+    res = ibus_shm_vehicle_writer_create(&shm_vehicle);
+    if (res < 0) {
+        errno = -res;
+        TRACE_ERROR("Can't create shared vehicle state");
+        return res;
+    }
+    ibus_shm_vehicle_publish(&shm_vehicle, &vehicle_state);
+
+    shm_listen_fd = unix_socket_listen(path, 4);
+    if (shm_listen_fd < 0)
+        return shm_listen_fd;
+
+    return loop_ctl(EPOLL_CTL_ADD, shm_listen_fd, EPOLLIN,
+                    LOOP_TAG(LOOP_SRC_SHM, 0));
+}
+
+static void shm_close_ring(void)
+{
+    if (shm_listen_fd >= 0) {
+        close(shm_listen_fd);
+        shm_listen_fd = -1;
+        unlink(shm_socket_path);
+    }
+    if (shm_writer.ring)
+        ibus_shm_writer_destroy(&shm_writer);
+    if (shm_vehicle.page)
+        ibus_shm_vehicle_writer_destroy(&shm_vehicle);
+}
+
+static void shm_serve(void)
+{
+    for (;;) {
+        int fd = accept4(shm_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                TRACE_ERROR("accept shm reader");
+            return;
+        }
+
+        int fds[IBUS_SHM_FDS];
+        fds[IBUS_SHM_FD_RING]    = shm_writer.fd;
+        fds[IBUS_SHM_FD_VEHICLE] = shm_vehicle.fd;
+        fds[IBUS_SHM_FD_WAITERS] = shm_writer.waiters_fd;
+
+        int res = ibus_shm_send_fds(fd, "ibus-ring ibus-vehicle ibus-waiters",
+                                    fds, IBUS_SHM_FDS);
+        if (res < 0) {
+            errno = -res;
+            TRACE_ERROR("Can't send shared-memory fds");
+        } else {
+            shm_handout_count++;
+        }
+        close(fd);
+    }
+}
+
+/* ===== Real-time mode ===== */
+
+static void rt_prefault_stack(void)
+{
+    volatile unsigned char stack[RT_STACK_PREFAULT_SIZE];
+    memset((void *)stack, 0, sizeof(stack));
+}
+
+/* Pin to a CPU, lock and prefault memory and switch to SCHED_FIFO. */
+static int rt_setup(void)
+{
+    struct sched_param sp;
+
+    if (rt_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(rt_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            TRACE_ERROR("Can't pin to CPU %d", rt_cpu);
+            return -errno;
+        }
+    }
+
+    /* Locks everything mapped so far (decoder buffers, stdio) into RAM
+     * and makes future mappings resident as well. */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        TRACE_ERROR("mlockall");
+        return -errno;
+    }
+    rt_prefault_stack();
+
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = rt_priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+        TRACE_ERROR("Can't set SCHED_FIFO priority %d", rt_priority);
+        return -errno;
+    }
+
+    TRACE_WARGS(TRACE_FUNCTION, "Real-time mode: SCHED_FIFO prio=%d cpu=%d\n",
+                rt_priority, rt_cpu);
+    return 0;
+}
+
+/*
+ * Measure how late the event loop wakes up from a char_timeout sized wait
+ * with the serial fd armed. The worst case plus char_timeout is the frame
+ * completion latency we can actually promise. Bytes arriving during the
+ * test are drained and not counted.
+ */
+static void rt_jitter_test(uint64_t timeout_us, const sigset_t *orig_mask)
+{
+    uint64_t end = monotonic_us() + (uint64_t)jitter_test_seconds * 1000000u;
+    uint64_t wakeups = 0, sum_us = 0, max_us = 0;
+    uint64_t over_100us = 0, over_1ms = 0;
+
+    while (!exit_request && monotonic_us() < end) {
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        uint64_t deadline = monotonic_us() + timeout_us;
+        int timer_fired = 0;
+
+        loop_arm_timer(deadline);
+        int n = epoll_pwait(loop_epoll_fd, events, LOOP_MAX_EVENTS, -1,
+                            orig_mask);
+        uint64_t woke = monotonic_us();
+
+        for (int i = 0; i < n; ++i) {
+            if (LOOP_TAG_SRC(events[i].data.u64) == LOOP_SRC_TIMER) {
+                loop_timer_expired();
+                timer_fired = 1;
+            } else if (LOOP_TAG_SRC(events[i].data.u64) == LOOP_SRC_IBUS) {
+                unsigned char buf[64];
+                while (read(ibus_device_fd, buf, sizeof(buf)) > 0)
+                    ;
+            }
+        }
+        if (!timer_fired)
+            continue;
+
+        uint64_t late = woke > deadline ? woke - deadline : 0;
+        ++wakeups;
+        sum_us += late;
+        if (late > max_us)  max_us = late;
+        if (late > 100)     ++over_100us;
+        if (late > 1000)    ++over_1ms;
+    }
+    loop_arm_timer(0);
+
+    printf("Jitter test: %llu wakeups, timeout %llu us, %s\n",
+           (unsigned long long)wakeups, (unsigned long long)timeout_us,
+           rt_enabled ? "real-time mode" : "normal scheduling");
+    if (wakeups == 0)
+        return;
+    printf("  wakeup latency avg %llu us, worst %llu us\n",
+           (unsigned long long)(sum_us / wakeups),
+           (unsigned long long)max_us);
+    printf("  late by >100 us: %llu, >1 ms: %llu\n",
+           (unsigned long long)over_100us, (unsigned long long)over_1ms);
+    printf("  guaranteed frame completion: %llu us after the last byte\n",
+           (unsigned long long)(timeout_us + max_us));
 }
 
 /* ===== CLI helper ===== */
@@ -557,9 +1594,58 @@ static void print_help(const char *name)
     fprintf(stderr, "  -v <switch>   Video input switch: CTS/RTS/GPIO\n");
     fprintf(stderr, "  -t <mask>     Trace level mask (1=function,2=ibus,4=input,8=state)\n");
     fprintf(stderr, "  -f <file>     Trace output file\n");
+    fprintf(stderr, "  --state-confirm <from>:<to>=<n>\n");
+    fprintf(stderr, "                Frames needed for a state change (states OFF/MENU/FM/TAPE/AUX/CDC or *;\n");
+    fprintf(stderr, "                default 1; may be repeated)\n");
+    fprintf(stderr, "  --state-dwell <ms>\n");
+    fprintf(stderr, "                Time a state is kept at least (default 0)\n");
+    fprintf(stderr, "  --no-uinput   Don't create a uinput device; key events are only traced (-t 4)\n");
+    fprintf(stderr, "                and counted (for tests without /dev/uinput)\n");
+    fprintf(stderr, "  --keymap <file>\n");
+    fprintf(stderr, "                Button to key mapping (reloaded when the file changes)\n");
+    fprintf(stderr, "  --autorepeat <delay>:<period>\n");
+    fprintf(stderr, "                Repeat held keys, in ms (default 500:100, 0 = off)\n");
+    fprintf(stderr, "  --long-press <ms>\n");
+    fprintf(stderr, "                Hold time for a button's long key (default 800)\n");
+    fprintf(stderr, "  --release-timeout <ms>\n");
+    fprintf(stderr, "                Release a key when its button goes quiet this long, also the longest\n");
+    fprintf(stderr, "                hold past its long press report (default 0 = off)\n");
+    fprintf(stderr, "  --idle-timeout <sec>\n");
+    fprintf(stderr, "                Go idle after <sec> without messages (default 600, 0 = never)\n");
+    fprintf(stderr, "  --busload <sec>\n");
+    fprintf(stderr, "                Report bus load and per-sender traffic every <sec>\n");
+    fprintf(stderr, "  --babble <percent>\n");
+    fprintf(stderr, "                Flag senders above <percent> of the bus over %u s (default %u, 0 = off)\n",
+            IBUS_BUSLOAD_SLOTS, IBUS_BUSLOAD_BABBLE_PCT);
+    fprintf(stderr, "  --capture <base>\n");
+    fprintf(stderr, "                Record raw serial bytes to <base>.NNNNNN capture segments\n");
+    fprintf(stderr, "  --rotate-size <KB>, --rotate-time <sec>\n");
+    fprintf(stderr, "                Start a new trace/capture segment after <KB> or <sec>\n");
+    fprintf(stderr, "  --rotate-count <n>\n");
+    fprintf(stderr, "                Segments kept per file (default 10)\n");
+    fprintf(stderr, "  --compress    Compress closed segments in the background\n");
+    fprintf(stderr, "  --trace-coalesce <sec>\n");
+    fprintf(stderr, "                Summarise repeated identical frames in the trace every <sec>\n");
+    fprintf(stderr, "  --stats-socket <path>\n");
+    fprintf(stderr, "                Serve decoder health counters on a Unix socket\n");
+    fprintf(stderr, "  --stats-file <path>\n");
+    fprintf(stderr, "                Atomically rewrite health counters to <path>\n");
+    fprintf(stderr, "  --stats-interval <sec>\n");
+    fprintf(stderr, "                Stats file update period (default 10)\n");
+    fprintf(stderr, "  --server <path>\n");
+    fprintf(stderr, "                Serve decoded frames/events to local clients on a Unix socket\n");
+    fprintf(stderr, "  --shm-socket <path>\n");
+    fprintf(stderr, "                Publish frames and vehicle state in shared memory; hand out the fds on <path>\n");
+    fprintf(stderr, "  --rt[=<prio>] Real-time mode: SCHED_FIFO (default prio 50), mlockall\n");
+    fprintf(stderr, "  --rt-cpu <n>  Pin to CPU <n> (with --rt)\n");
+    fprintf(stderr, "  --jitter-test <sec>\n");
+    fprintf(stderr, "                Measure worst-case wakeup latency on the serial fd and exit\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Send SIGUSR1 to dump per-frame latency histograms to the trace output.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Example:\n");
     fprintf(stderr, "  %s -d /dev/ttyUSB0 -h AUX -v CTS -t 15 -f /tmp/ibus.log\n", name);
+    fprintf(stderr, "  %s -d /dev/ttyUSB0 --rt=80 --rt-cpu 3 --jitter-test 30\n", name);
 }
 
 /* ===== main() ===== */
@@ -575,11 +1661,50 @@ int main(int argc, char *argv[])
     sigset_t mask, orig_mask;
     struct sigaction act;
 
-    struct timespec char_timeout;
-    struct timespec shutdown_timeout;
+    uint64_t char_timeout_us;
+    uint64_t last_rx_us, next_stats_us, next_trace_flush_us, next_busload_us;
+    int gap_handled = 1;    /* bytes since the last frame gap were processed */
+    int ret = EXIT_SUCCESS;
+
+    enum {
+        OPT_RT = 0x100, OPT_RT_CPU, OPT_JITTER_TEST,
+        OPT_STATS_SOCKET, OPT_STATS_FILE, OPT_STATS_INTERVAL, OPT_SERVER,
+        OPT_SHM_SOCKET, OPT_TRACE_COALESCE, OPT_CAPTURE, OPT_ROTATE_SIZE,
+        OPT_ROTATE_TIME, OPT_ROTATE_COUNT, OPT_COMPRESS, OPT_KEYMAP,
+        OPT_AUTOREPEAT, OPT_LONG_PRESS, OPT_RELEASE_TIMEOUT, OPT_IDLE_TIMEOUT,
+        OPT_BUSLOAD, OPT_BABBLE, OPT_STATE_CONFIRM, OPT_STATE_DWELL, OPT_NO_UINPUT
+    };
+    static const struct option long_options[] = {
+        { "rt",             optional_argument, NULL, OPT_RT             },
+        { "rt-cpu",         required_argument, NULL, OPT_RT_CPU         },
+        { "jitter-test",    required_argument, NULL, OPT_JITTER_TEST    },
+        { "stats-socket",   required_argument, NULL, OPT_STATS_SOCKET   },
+        { "stats-file",     required_argument, NULL, OPT_STATS_FILE     },
+        { "stats-interval", required_argument, NULL, OPT_STATS_INTERVAL },
+        { "server",         required_argument, NULL, OPT_SERVER         },
+        { "shm-socket",     required_argument, NULL, OPT_SHM_SOCKET     },
+        { "trace-coalesce", required_argument, NULL, OPT_TRACE_COALESCE },
+        { "capture",        required_argument, NULL, OPT_CAPTURE        },
+        { "rotate-size",    required_argument, NULL, OPT_ROTATE_SIZE    },
+        { "rotate-time",    required_argument, NULL, OPT_ROTATE_TIME    },
+        { "rotate-count",   required_argument, NULL, OPT_ROTATE_COUNT   },
+        { "compress",       no_argument,       NULL, OPT_COMPRESS       },
+        { "keymap",         required_argument, NULL, OPT_KEYMAP         },
+        { "autorepeat",     required_argument, NULL, OPT_AUTOREPEAT     },
+        { "long-press",     required_argument, NULL, OPT_LONG_PRESS     },
+        { "release-timeout", required_argument, NULL, OPT_RELEASE_TIMEOUT },
+        { "idle-timeout",   required_argument, NULL, OPT_IDLE_TIMEOUT   },
+        { "busload",        required_argument, NULL, OPT_BUSLOAD        },
+        { "babble",         required_argument, NULL, OPT_BABBLE         },
+        { "state-confirm",  required_argument, NULL, OPT_STATE_CONFIRM  },
+        { "state-dwell",    required_argument, NULL, OPT_STATE_DWELL    },
+        { "no-uinput",      no_argument,       NULL, OPT_NO_UINPUT      },
+        { NULL,             0,                 NULL, 0                  }
+    };
 
     /* Parse CLI options */
-    while ((opt = getopt(argc, argv, "d:h:v:t:f:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:h:v:t:f:",
+                              long_options, NULL)) != -1) {
         switch (opt) {
         case 'd':
             strncpy(device_name, optarg, sizeof(device_name) - 1);
@@ -610,11 +1735,91 @@ int main(int argc, char *argv[])
             trace_level = (unsigned int)atoi(optarg);
             break;
         case 'f':
-            stdout_fp = fopen(optarg, "a+");
-            if (!stdout_fp) {
-                perror("fopen trace file");
+            strncpy(trace_file_path, optarg, sizeof(trace_file_path) - 1);
+            break;
+        case OPT_CAPTURE:
+            strncpy(capture_base, optarg, sizeof(capture_base) - 1);
+            break;
+        case OPT_ROTATE_SIZE:
+            rotate_bytes = (uint64_t)strtoull(optarg, NULL, 10) * 1024u;
+            break;
+        case OPT_ROTATE_TIME:
+            rotate_seconds = (unsigned int)atoi(optarg);
+            break;
+        case OPT_ROTATE_COUNT:
+            rotate_count = (unsigned int)atoi(optarg);
+            break;
+        case OPT_COMPRESS:
+            rotate_compress = 1;
+            break;
+        case OPT_KEYMAP:
+            strncpy(keymap_path, optarg, sizeof(keymap_path) - 1);
+            break;
+        case OPT_AUTOREPEAT: {
+            char *end;
+            input_config.repeat_delay_us = (uint32_t)strtoul(optarg, &end, 10) * 1000u;
+            input_config.repeat_period_us = *end == ':' ?
+                (uint32_t)strtoul(end + 1, NULL, 10) * 1000u : 0;
+            break;
+        }
+        case OPT_LONG_PRESS:
+            input_config.long_press_us = (uint32_t)atoi(optarg) * 1000u;
+            break;
+        case OPT_RELEASE_TIMEOUT:
+            input_config.release_timeout_us = (uint32_t)atoi(optarg) * 1000u;
+            break;
+        case OPT_IDLE_TIMEOUT:
+            idle_timeout_us = (uint64_t)strtoull(optarg, NULL, 10) * 1000000u;
+            break;
+        case OPT_BUSLOAD:
+            busload_interval = (unsigned int)atoi(optarg);
+            break;
+        case OPT_BABBLE:
+            busload_babble_pct = (uint32_t)atoi(optarg);
+            break;
+        case OPT_STATE_CONFIRM:
+            if (ibus_state_filter_parse(&state_filter, optarg) < 0) {
+                fprintf(stderr, "Bad --state-confirm '%s'\n", optarg);
+                return EXIT_FAILURE;
             }
             break;
+        case OPT_STATE_DWELL:
+            state_filter.min_dwell_us = (uint32_t)atoi(optarg) * 1000u;
+            break;
+        case OPT_NO_UINPUT:
+            uinput_enabled = 0;
+            break;
+        case OPT_RT:
+            rt_enabled = 1;
+            if (optarg)
+                rt_priority = atoi(optarg);
+            break;
+        case OPT_RT_CPU:
+            rt_cpu = atoi(optarg);
+            break;
+        case OPT_JITTER_TEST:
+            jitter_test_seconds = (unsigned int)atoi(optarg);
+            break;
+        case OPT_STATS_SOCKET:
+            strncpy(stats_socket_path, optarg, sizeof(stats_socket_path) - 1);
+            break;
+        case OPT_STATS_FILE:
+            strncpy(stats_file_path, optarg, sizeof(stats_file_path) - 1);
+            break;
+        case OPT_SERVER:
+            strncpy(server_socket_path, optarg, sizeof(server_socket_path) - 1);
+            break;
+        case OPT_TRACE_COALESCE:
+            trace_coalesce_us = (uint64_t)atoi(optarg) * 1000000u;
+            break;
+        case OPT_SHM_SOCKET:
+            strncpy(shm_socket_path, optarg, sizeof(shm_socket_path) - 1);
+            break;
+        case OPT_STATS_INTERVAL:
+            stats_interval = (unsigned int)atoi(optarg);
+            if (stats_interval == 0)
+                stats_interval = 1;
+            break;
         default:
             print_help(argv[0]);
             return EXIT_FAILURE;
@@ -626,14 +1831,30 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (trace_file_path[0] != '\0')
+        trace_file_open();      /* falls back to stdout */
+
     /* Initialise IBUS core */
     ibus_init(g_hijack_state);
-
-    /* Create uinput device */
-    uinput_device_fd = uinput_create();
-    if (uinput_device_fd < 0) {
-        fprintf(stderr, "Failed to create uinput device (%d)\n", uinput_device_fd);
+    ibus_set_state_filter(&state_filter);
+    ibus_latency_reset(&frame_latency);
+    ibus_vehicle_reset(&vehicle_state);
+    ibus_display_reset(&radio_display);
+    ibus_busload_reset(&bus_load, busload_babble_pct, monotonic_us());
+    ibus_timer_wheel_init(&timer_wheel, monotonic_us());
+    ibus_input_init(&timer_wheel, &input_config, keymap);
+
+    /* Load the keymap before creating the device that needs its keys */
+    if (keymap_path[0] != '\0' && keymap_reload() < 0)
         return EXIT_FAILURE;
+
+    /* Create uinput device (the jitter self-test doesn't need one) */
+    if (jitter_test_seconds == 0 && uinput_enabled) {
+        uinput_device_fd = uinput_create();
+        if (uinput_device_fd < 0) {
+            fprintf(stderr, "Failed to create uinput device (%d)\n", uinput_device_fd);
+            return EXIT_FAILURE;
+        }
     }
 
     /* Setup signal handling */
@@ -649,6 +1870,11 @@ int main(int argc, char *argv[])
     sigaction(SIGINT, &act, NULL);
     sigaddset(&mask, SIGINT);
 
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = signal_handler;
+    sigaction(SIGUSR1, &act, NULL);
+    sigaddset(&mask, SIGUSR1);
+
     if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
         TRACE_ERROR("sigprocmask");
         uinput_close();
@@ -690,67 +1916,234 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    /* Timeouts: character timeout and idle shutdown timeout */
     /* 9600 baud 8E1 => ~1.15ms/char; we use ~2.3ms char timeout */
-    char_timeout.tv_sec  = 0;
-    char_timeout.tv_nsec = 2300000L;
+    char_timeout_us = 2300u;
 
-    shutdown_timeout.tv_sec  = 60 * 10;  /* 10 minutes */
-    shutdown_timeout.tv_nsec = 0;
+    if (loop_init() < 0 ||
+        loop_ctl(EPOLL_CTL_ADD, ibus_device_fd, EPOLLIN,
+                 LOOP_TAG(LOOP_SRC_IBUS, 0)) < 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
 
-    /* Main loop */
-    while (!exit_request) {
-        fd_set fds;
-        int res;
+    if (stats_socket_path[0] != '\0') {
+        stats_listen_fd = unix_socket_listen(stats_socket_path, 4);
+        if (stats_listen_fd < 0 ||
+            loop_ctl(EPOLL_CTL_ADD, stats_listen_fd, EPOLLIN,
+                     LOOP_TAG(LOOP_SRC_STATS, 0)) < 0) {
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+    }
 
-        FD_ZERO(&fds);
-        FD_SET(ibus_device_fd, &fds);
+    if (server_socket_path[0] != '\0' && server_open(server_socket_path) < 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
 
-        if (ibus_has_pending_data())
-            res = pselect(ibus_device_fd + 1, &fds, NULL, NULL,
-                          &char_timeout, &orig_mask);
-        else
-            res = pselect(ibus_device_fd + 1, &fds, NULL, NULL,
-                          &shutdown_timeout, &orig_mask);
+    if (keymap_path[0] != '\0' && keymap_watch_open() < 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (capture_base[0] != '\0' && capture_open() < 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (shm_socket_path[0] != '\0' && shm_open_ring(shm_socket_path) < 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (rt_enabled && rt_setup() < 0) {
+        fprintf(stderr, "Failed to enter real-time mode\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (jitter_test_seconds > 0) {
+        rt_jitter_test(char_timeout_us, &orig_mask);
+        exit_request = 1;
+    }
 
-        if (res < 0 && errno != EINTR) {
-            TRACE_ERROR("pselect");
+    last_rx_us    = monotonic_us();
+    next_stats_us = last_rx_us;
+    next_trace_flush_us = last_rx_us + trace_coalesce_us;
+    next_busload_us = last_rx_us + (uint64_t)busload_interval * 1000000u;
+
+    /* Main loop */
+    while (!exit_request) {
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        uint64_t deadline, now;
+        int n;
+
+        /*
+         * A partial frame can stay buffered after its gap was handled (the
+         * adapter may deliver the rest later); waiting on its gap again would
+         * arm a deadline in the past and spin.
+         */
+        if (ibus_has_pending_data() && !gap_handled) {
+            deadline = last_rx_us + char_timeout_us;
+        } else if (idle_state == IDLE_SILENT) {
+            deadline = 0;       /* nothing to do until the bus talks */
+        } else {
+            /* Sleep until the bus goes silent or the next periodic output */
+            deadline = idle_timeout_us != 0 ? last_rx_us + idle_timeout_us : UINT64_MAX;
+            if (stats_file_path[0] != '\0' && next_stats_us < deadline)
+                deadline = next_stats_us;
+            if (trace_coalesce_us != 0 && next_trace_flush_us < deadline)
+                deadline = next_trace_flush_us;
+            if (busload_interval != 0 && next_busload_us < deadline)
+                deadline = next_busload_us;
+            if (segments_deadline() != 0 && segments_deadline() < deadline)
+                deadline = segments_deadline();
+            if (deadline == UINT64_MAX)
+                deadline = 0;
+        }
+        if (ibus_timer_next(&timer_wheel) != 0 &&
+            ibus_timer_next(&timer_wheel) < deadline)
+            deadline = ibus_timer_next(&timer_wheel);
+        if (ibus_state_deadline() != 0 &&
+            (deadline == 0 || ibus_state_deadline() < deadline))
+            deadline = ibus_state_deadline();
+        loop_arm_timer(deadline);
+
+        n = epoll_pwait(loop_epoll_fd, events, LOOP_MAX_EVENTS, -1, &orig_mask);
+
+        if (n < 0 && errno != EINTR) {
+            TRACE_ERROR("epoll_pwait");
             break;
         } else if (exit_request) {
             TRACE(TRACE_ALL, "Exit requested\n");
             break;
-        } else if (res == 0) {
-            if (ibus_has_pending_data()) {
-                /* Timeout => we assume current IBUS frame is complete */
-                ibus_process_messages();
-                continue;
-            } else {
-                TRACE(TRACE_ALL,
-                      "10 minutes without messages on the bus => exiting\n");
+        }
+
+        if (latency_dump_request) {
+            latency_dump_request = 0;
+            latency_dump();
+        }
+
+        for (int i = 0; i < n; ++i) {
+            uint64_t tag = events[i].data.u64;
+
+            switch (LOOP_TAG_SRC(tag)) {
+            case LOOP_SRC_IBUS: {
+                unsigned char buf[64];
+                ssize_t res = read(ibus_device_fd, buf, sizeof(buf));
+                if (res > 0) {
+                    last_rx_us  = monotonic_us();
+                    gap_handled = 0;
+                    if (idle_state == IDLE_SILENT)
+                        idle_resume(last_rx_us, "Bus activity");
+                    capture_write(buf, (size_t)res, last_rx_us);
+                    if (busload_interval != 0)
+                        ibus_busload_bytes(&bus_load, buf, (size_t)res, last_rx_us);
+                    for (ssize_t b = 0; b < res; ++b)
+                        ibus_append_byte_ts(buf[b], last_rx_us);
+                } else if (res < 0 && errno == EAGAIN) {
+                    read_eagain_count++;
+                } else if (res < 0) {
+                    read_error_count++;
+                    TRACE_ERROR("read");
+                }
+                break;
+            }
+            case LOOP_SRC_TIMER:
+                loop_timer_expired();
+                break;
+            case LOOP_SRC_STATS:
+                stats_socket_serve();
+                break;
+            case LOOP_SRC_SERVER:
+                server_accept();
+                break;
+            case LOOP_SRC_CLIENT:
+                server_client_event(LOOP_TAG_IDX(tag), events[i].events);
+                break;
+            case LOOP_SRC_SHM:
+                shm_serve();
+                break;
+            case LOOP_SRC_KEYMAP:
+                keymap_watch_event();
+                break;
+            default:
                 break;
             }
         }
 
-        if (FD_ISSET(ibus_device_fd, &fds)) {
-            unsigned char byte;
-            res = (int)read(ibus_device_fd, &byte, 1);
-            if (res == 1) {
-                ibus_append_byte(byte);
-            } else if (res < 0 && errno != EAGAIN) {
-                TRACE_ERROR("read");
+        now = monotonic_us();
+
+        if (ibus_timer_next(&timer_wheel) != 0 && now >= ibus_timer_next(&timer_wheel))
+            ibus_timer_run(&timer_wheel, now);
+
+        /* A state change deferred by --state-dwell */
+        if (ibus_state_deadline() != 0 && now >= ibus_state_deadline()) {
+            frame_dispatch_us = now;
+            ibus_state_poll(now);
+        }
+
+        if (ibus_has_pending_data() && !gap_handled) {
+            /* No byte for a char timeout => current IBUS frame is complete */
+            if (now - last_rx_us >= char_timeout_us) {
+                ibus_process_messages();
+                gap_handled = 1;
             }
+        } else if (idle_state != IDLE_SILENT && idle_timeout_us != 0 &&
+                   now - last_rx_us >= idle_timeout_us) {
+            idle_suspend(IDLE_SILENT, now);
+        }
+
+        if (busload_interval != 0)
+            busload_tick(now);
+
+        if (idle_state == IDLE_SILENT) {
+            segments_check(now);
+            continue;
         }
+
+        if (stats_file_path[0] != '\0' && now >= next_stats_us) {
+            stats_file_write();
+            next_stats_us = now + (uint64_t)stats_interval * 1000000u;
+        }
+
+        if (trace_coalesce_us != 0 && now >= next_trace_flush_us) {
+            trace_coalesce_flush();
+            next_trace_flush_us = now + trace_coalesce_us;
+        }
+
+        if (busload_interval != 0 && now >= next_busload_us) {
+            busload_report();
+            next_busload_us = now + (uint64_t)busload_interval * 1000000u;
+        }
+
+        segments_check(now);
+    }
+
+out:
+    if (trace_coalesce_us != 0)
+        trace_coalesce_flush();
+    server_close();
+    shm_close_ring();
+    keymap_watch_close();
+    if (stats_listen_fd >= 0) {
+        close(stats_listen_fd);
+        unlink(stats_socket_path);
     }
+    if (stats_file_path[0] != '\0')
+        stats_file_write();
+    loop_close();
 
     /* Restore serial settings */
     tcsetattr(ibus_device_fd, TCSANOW, &oldtio);
     close(ibus_device_fd);
     uinput_close();
 
+    segments_close();
     if (stdout_fp) {
         fflush(stdout_fp);
         fclose(stdout_fp);
     }
 
-    return EXIT_SUCCESS;
+    return ret;
 }
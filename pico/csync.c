@@ -20,13 +20,22 @@
  */
 
 // csync.c — Pico PIO CSYNC module (to be run on a core via csync_init/csync_run)
+//
+// Core1 measures HSYNC and VSYNC with a small PIO counter program, picks the
+// mode (csync_timing.c) and loads the matching CSYNC program: the RP1 one
+// for progressive modes, a half-line one for interlaced modes. It then keeps
+// measuring and reloads when the source changes mode.
 
 #include <stdio.h>
 #include "pico/stdlib.h"
+#include "hardware/sync.h"
 #include "hardware/pio.h"
+#include "hardware/pio_instructions.h"
 #include "hardware/clocks.h"
 #include "hardware/gpio.h"
 
+#include "csync.h"
+
 // ---------------- GPIOs (change to suit your wiring) ----------------
 #ifndef PIN_HSYNC
 #define PIN_HSYNC 2   // HSYNC input
@@ -39,19 +48,26 @@
 #endif
 // --------------------------------------------------------------------
 
-// ---------------- Display timing (your dtparams) ---------------------
-// Pixel clock = 8.056 MHz, H: active=400, fp=10, sync=40, bp=62
-static const uint32_t PIXEL_CLK_HZ = 8056000u; // dpi pixel clock (Hz)
-static const uint16_t H_TOTAL      = 512;      // 400+10+40+62
-static const uint16_t H_SYNC_START = 410;      // 400+10
-static const uint16_t H_SYNC_END   = 450;      // +40
+// ---------------- Supervision ---------------------------------------
+// Steady lines needed to lock; a new mode also waits for a whole field
+#ifndef CSYNC_LOCK_LINES
+#define CSYNC_LOCK_LINES        16u
+#endif
+// Consecutive lines / fields out of the locked mode that drop the lock
+#ifndef CSYNC_BAD_LINES
+#define CSYNC_BAD_LINES         4u
+#endif
+#ifndef CSYNC_BAD_FIELDS
+#define CSYNC_BAD_FIELDS        2u
+#endif
+// Periods without an input edge that drop the lock
+#define CSYNC_LOSS_LINES        8u
+#define CSYNC_LOSS_FIELDS       2u
 // --------------------------------------------------------------------
 
-// ------------ Polarity flags (mirror RP1’s DRM flags) ----------------
-// Set these to match your source (your captures looked active-low HS & VS).
-#define NHSYNC  1   // “Negative HSYNC” (HSYNC active-low)
-#define NVSYNC  1   // “Negative VSYNC” (VSYNC active-low)
-#define PCSYNC  0   // Invert CSYNC polarity (XOR sideset bit on all instrs)
+// ------------ Output polarity (mirrors RP1's DRM flags) --------------
+// HSYNC/VSYNC polarity is measured; only the CSYNC output is configured.
+#define PCSYNC  0   // Positive CSYNC (XOR sideset bit on all instrs)
 // --------------------------------------------------------------------
 
 typedef struct {
@@ -59,11 +75,27 @@ typedef struct {
     uint wrap;
     int  offset;
     uint sm;
+    uint16_t instr[19];
+    struct pio_program prog;
 } pio_prog_handle_t;
 
 // Module-local state for multicore usage
 static PIO csync_pio = pio0;
 static pio_prog_handle_t csync_handle;
+static pio_prog_handle_t measure_handle;
+
+// Supervisor state (core1), published to csync_status for core0: odd
+// sequence numbers mark an update in progress, 0 = not loaded yet
+static csync_status_t csync_state;
+static csync_status_t csync_status;
+static volatile uint32_t csync_status_seq = 0;
+
+static uint32_t bad_lines, bad_fields;              // while locked
+static uint32_t lock_line_us, lock_field_us;
+static csync_measurement_t search_ref;              // while searching
+static uint64_t search_low, search_high;
+static uint32_t search_lines, search_fields;
+static bool     search_need_field;                  // lost on VSYNC: reselect
 
 // Patch the pin field (low 5 bits) of a wait gpio instruction
 static inline void patch_wait_gpio_pin(uint16_t *instr, uint gpio_pin) {
@@ -86,8 +118,10 @@ static void build_rp1_csync_prog(uint16_t instr[9]) {
     instr[8] = 0x1002; // 8: jmp    2          side 1
 }
 
-static bool load_rp1_csync(PIO pio, pio_prog_handle_t *h) {
-    uint16_t instr[9];
+// Progressive: the RP1 program with the measured polarities
+static void build_csync_prog(pio_prog_handle_t *h, const csync_mode_t *mode) {
+    uint16_t *instr = h->instr;
+
     build_rp1_csync_prog(instr);
 
     // Patch HS pin into the two wait instructions (#3 and #5)
@@ -95,12 +129,12 @@ static bool load_rp1_csync(PIO pio, pio_prog_handle_t *h) {
     patch_wait_gpio_pin(&instr[5], PIN_HSYNC);
 
     // Apply polarity like the RP1 driver (DRM_MODE_FLAG_* equivalents)
-    if (NVSYNC) {
+    if (mode->vsync_negative) {
         // VSYNC active-low: VS=1 (idle) -> mirror (jmp pin,2), VS=0 -> extend
         instr[6] = 0x00C2; // jmp pin,2 side 0
     } // else leave as 0x00C7 (VS active-high → VS=1 -> extend)
 
-    if (NHSYNC) {
+    if (mode->hsync_negative) {
         // Flip sense of the two HS waits: toggle bit7 (wait 1 <-> wait 0)
         instr[3] ^= 0x0080;
         instr[5] ^= 0x0080;
@@ -111,38 +145,89 @@ static bool load_rp1_csync(PIO pio, pio_prog_handle_t *h) {
             instr[i] ^= 0x1000; // flip sideset bit12 on all instructions
     }
 
-    struct pio_program prog = {
-        .instructions = instr,
-        .length       = 9,
-        .origin       = -1
-    };
+    // Wrap target is always #2. Wrap matches RP1 logic:
+    //   if NVSYNC => wrap at 7, else wrap at 6.
+    h->prog.length = 9;
+    h->wrap_target = 2;
+    h->wrap        = mode->vsync_negative ? 7u : 6u;
+}
 
-    h->sm = pio_claim_unused_sm(pio, true);
-    if ((int)h->sm < 0)
-        return false;
+// Interlaced: VSYNC starts and ends on a line or half a line, so it is
+// checked at the end of HSYNC and again mid-line. While it is active each
+// half line is a broad pulse followed by an HSYNC-wide serration. Expects
+// y = tc_half and osr = hsw (see csync_load()); the overheads are
+// ILACE_BROAD_OVERHEAD/ILACE_SERR_OVERHEAD in csync_timing.c.
+static void build_csync_ilace(pio_prog_handle_t *h, const csync_mode_t *mode) {
+    enum { TOP = 0, N1 = 4, MID = 8, B1 = 10, B2 = 15 };
+    uint16_t *instr = h->instr;
+    uint act  = PCSYNC ? 1u : 0u;
+    uint idle = act ^ 1u;
+    bool hs_act = !mode->hsync_negative;
+    bool vs_act = !mode->vsync_negative;
+#define SIDE(v) pio_encode_sideset(1, (v))
 
-    h->offset = pio_add_program(pio, &prog);
-    if (h->offset < 0)
-        return false;
+    // .wrap_target = 0: normal line, CSYNC follows HSYNC
+    instr[0]  = pio_encode_wait_gpio(hs_act, PIN_HSYNC)  | SIDE(idle);
+    instr[1]  = pio_encode_wait_gpio(!hs_act, PIN_HSYNC) | SIDE(act);
+    // VSYNC at the end of HSYNC: jmp pin is VS high
+    instr[2]  = pio_encode_jmp_pin(vs_act ? B1 : N1)     | SIDE(act);
+    instr[3]  = pio_encode_jmp(vs_act ? N1 : B1)         | SIDE(act);
+    // First half of a normal line
+    instr[4]  = pio_encode_mov(pio_x, pio_y)             | SIDE(idle);
+    instr[5]  = pio_encode_jmp_x_dec(5)                  | SIDE(idle);
+    instr[6]  = pio_encode_mov(pio_x, pio_osr)           | SIDE(idle) | pio_encode_delay(4);
+    instr[7]  = pio_encode_jmp_x_dec(7)                  | SIDE(idle);
+    // VSYNC mid-line
+    instr[8]  = pio_encode_jmp_pin(vs_act ? B2 : TOP)    | SIDE(idle);
+    instr[9]  = pio_encode_jmp(vs_act ? TOP : B2)        | SIDE(idle);
+    // First half of a VSYNC line: broad pulse from HSYNC, serration
+    instr[10] = pio_encode_mov(pio_x, pio_y)             | SIDE(act);
+    instr[11] = pio_encode_jmp_x_dec(11)                 | SIDE(act);
+    instr[12] = pio_encode_mov(pio_x, pio_osr)           | SIDE(idle);
+    instr[13] = pio_encode_jmp_x_dec(13)                 | SIDE(idle);
+    instr[14] = pio_encode_jmp(MID)                      | SIDE(idle);
+    // Second half: broad pulse up to one HSYNC width before the next line
+    instr[15] = pio_encode_mov(pio_x, pio_y)             | SIDE(act);
+    instr[16] = pio_encode_jmp_x_dec(16)                 | SIDE(act);
+    instr[17] = pio_encode_mov(pio_x, pio_osr)           | SIDE(act) | pio_encode_delay(4);
+    instr[18] = pio_encode_jmp_x_dec(18)                 | SIDE(act);
+    // .wrap = 18
+#undef SIDE
 
-    // Wrap target is always #2. Wrap matches RP1 logic:
-    //   if NVSYNC => wrap at 7, else wrap at 6.
-    h->wrap_target = h->offset + 2;
-    h->wrap        = h->offset + (NVSYNC ? 7u : 6u);
+    h->prog.length = 19;
+    h->wrap_target = 0;
+    h->wrap        = 18;
+}
 
-    // Configure SM
-    pio_sm_config c = pio_get_default_sm_config();
-    sm_config_set_wrap(&c, h->wrap_target, h->wrap);
+// Counts the low and high time of the jmp pin, in pairs, 2 cycles per count
+static void build_measure_prog(pio_prog_handle_t *h) {
+    uint16_t *instr = h->instr;
 
-    // 1-bit sideset on CSYNC pin
-    sm_config_set_sideset(&c, 1, false, false);
-    sm_config_set_sideset_pins(&c, PIN_CSYNC);
-    pio_gpio_init(pio, PIN_CSYNC);
-    pio_sm_set_consecutive_pindirs(pio, h->sm, PIN_CSYNC, 1, true);
+    // .wrap_target = 0
+    instr[0]  = pio_encode_mov_not(pio_x, pio_null);    // x = ~0
+    instr[1]  = pio_encode_jmp_pin(3);                  // low:
+    instr[2]  = pio_encode_jmp_x_dec(1);
+    instr[3]  = pio_encode_mov_not(pio_isr, pio_x);     // low count
+    instr[4]  = pio_encode_push(false, true);
+    instr[5]  = pio_encode_mov_not(pio_x, pio_null);
+    instr[6]  = pio_encode_jmp_pin(8);                  // high:
+    instr[7]  = pio_encode_jmp(9);
+    instr[8]  = pio_encode_jmp_x_dec(6);
+    instr[9]  = pio_encode_mov_not(pio_isr, pio_x);     // high count
+    instr[10] = pio_encode_push(false, true);
+    // .wrap = 10
 
-    // VSYNC drives the jmp pin
-    sm_config_set_jmp_pin(&c, PIN_VSYNC);
+    h->prog.length = 11;
+    h->wrap_target = 0;
+    h->wrap        = 10;
+}
 
+// Loop cycles per count, and the cycles of one low + high pass outside the
+// loops (split evenly between the two)
+#define MEASURE_CYCLES_PER_COUNT  2u
+#define MEASURE_OVERHEAD          4u
+
+static void csync_inputs_init(void) {
     // Inputs: leave pulls disabled to avoid biasing your source
     gpio_init(PIN_HSYNC);
     gpio_disable_pulls(PIN_HSYNC);
@@ -151,41 +236,300 @@ static bool load_rp1_csync(PIO pio, pio_prog_handle_t *h) {
     gpio_init(PIN_VSYNC);
     gpio_disable_pulls(PIN_VSYNC);
     gpio_set_dir(PIN_VSYNC, GPIO_IN);
+}
+
+static bool load_measure(PIO pio, pio_prog_handle_t *h) {
+    build_measure_prog(h);
+    h->prog.instructions = h->instr;
+    h->prog.origin       = -1;
+
+    h->offset = pio_add_program(pio, &h->prog);
+    return h->offset >= 0;
+}
+
+// Free-running counter on one input; its FIFO holds (low, high) pairs
+typedef struct {
+    uint     sm;
+    uint32_t count[2];
+    uint     n;             // counts received, pairs start at even n
+    uint32_t low, high;     // last complete pair, in sys clocks
+    uint64_t last_us;       // when it completed
+} csync_monitor_t;
+
+static csync_monitor_t hs_monitor;
+static csync_monitor_t vs_monitor;
+
+static bool monitor_start(PIO pio, const pio_prog_handle_t *h, csync_monitor_t *mon, uint pin) {
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0)
+        return false;
+    mon->sm = (uint)sm;
+
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, h->offset + h->wrap_target, h->offset + h->wrap);
+    sm_config_set_jmp_pin(&c, pin);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    pio_sm_init(pio, mon->sm, h->offset, &c);
+    pio_sm_set_enabled(pio, mon->sm, true);
+    return true;
+}
+
+// Take one pair from the FIFO if there is one. The push blocks, so a full
+// FIFO (core1 paused for a flash write) costs a wrong pair, never the
+// low/high order.
+static bool monitor_poll(PIO pio, csync_monitor_t *mon) {
+    while (!pio_sm_is_rx_fifo_empty(pio, mon->sm)) {
+        mon->count[mon->n & 1u] = pio_sm_get(pio, mon->sm);
+        if ((mon->n++ & 1u) == 0)
+            continue;
+        mon->low     = mon->count[0] * MEASURE_CYCLES_PER_COUNT + MEASURE_OVERHEAD;
+        mon->high    = mon->count[1] * MEASURE_CYCLES_PER_COUNT + MEASURE_OVERHEAD;
+        mon->last_us = time_us_64();
+        return true;
+    }
+    return false;
+}
+
+// (Re)load the CSYNC program for `mode` and start it
+static bool csync_load(PIO pio, pio_prog_handle_t *h, const csync_mode_t *mode) {
+    uint idle = PCSYNC ? 0u : 1u;
+
+    if (h->offset >= 0) {
+        pio_sm_set_enabled(pio, h->sm, false);
+        pio_remove_program(pio, &h->prog, (uint)h->offset);
+        h->offset = -1;
+    }
+
+    if (mode->interlaced)
+        build_csync_ilace(h, mode);
+    else
+        build_csync_prog(h, mode);
+    h->prog.instructions = h->instr;
+    h->prog.origin       = -1;
+
+    h->offset = pio_add_program(pio, &h->prog);
+    if (h->offset < 0)
+        return false;
+
+    // Configure SM
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, h->offset + h->wrap_target, h->offset + h->wrap);
+
+    // 1-bit sideset on CSYNC pin
+    sm_config_set_sideset(&c, 1, false, false);
+    sm_config_set_sideset_pins(&c, PIN_CSYNC);
+
+    // VSYNC drives the jmp pin
+    sm_config_set_jmp_pin(&c, PIN_VSYNC);
 
     pio_sm_init(pio, h->sm, h->offset, &c);
+    pio_sm_exec(pio, h->sm, pio_encode_nop() | pio_encode_sideset(1, idle));
+
+    if (mode->interlaced) {
+        // Loop counts go straight into y and osr
+        pio_sm_put(pio, h->sm, mode->tc_half);
+        pio_sm_exec(pio, h->sm, pio_encode_pull(false, true) | pio_encode_sideset(1, idle));
+        pio_sm_exec(pio, h->sm, pio_encode_out(pio_y, 32) | pio_encode_sideset(1, idle));
+        pio_sm_put(pio, h->sm, mode->hsw);
+        pio_sm_exec(pio, h->sm, pio_encode_pull(false, true) | pio_encode_sideset(1, idle));
+    } else {
+        // The program pulls its time constant itself
+        pio_sm_put(pio, h->sm, mode->tc);
+    }
+    pio_sm_set_enabled(pio, h->sm, true);
     return true;
 }
 
+static void csync_status_publish(void) {
+    csync_status_seq++;
+    __dmb();
+    csync_status = csync_state;
+    __dmb();
+    csync_status_seq++;
+}
+
+static void csync_search_reset(void) {
+    search_lines  = 0;
+    search_fields = 0;
+}
+
+// Inputs gone or out of the mode: hold CSYNC idle rather than pass garbage
+// on, and look for a mode again
+static void csync_lose(bool need_field) {
+    uint idle = PCSYNC ? 0u : 1u;
+
+    pio_sm_set_enabled(csync_pio, csync_handle.sm, false);
+    pio_sm_exec(csync_pio, csync_handle.sm, pio_encode_nop() | pio_encode_sideset(1, idle));
+
+    csync_state.locked = false;
+    csync_state.losses++;
+    search_need_field = need_field;
+    csync_search_reset();
+    csync_status_publish();
+}
+
+static void csync_lock(const csync_measurement_t *m, const csync_mode_t *mode, bool relock) {
+    uint64_t now = time_us_64();
+    uint32_t cycles_per_us = m->sys_hz / 1000000u;
+
+    if (!csync_load(csync_pio, &csync_handle, mode)) {
+        // If something goes badly wrong, just hang this core
+        while (1) {
+            tight_loop_contents();
+        }
+    }
+
+    csync_state.mode     = *mode;
+    csync_state.measured = *m;
+    csync_state.detected = true;
+    csync_state.locked   = true;
+    csync_state.reloads++;
+    if (relock)
+        csync_state.relocks++;
+    else
+        csync_state.locks++;
+
+    lock_line_us  = mode->line_ns / 1000u + 1u;
+    lock_field_us = (m->vs_low + m->vs_high) / (cycles_per_us ? cycles_per_us : 1u) + 1u;
+    bad_lines  = 0;
+    bad_fields = 0;
+    hs_monitor.last_us = now;
+    vs_monitor.last_us = now;
+    csync_status_publish();
+}
+
+// Enough steady lines: restart the state machine if the lines still fit
+// the last mode, otherwise select one once a whole field has been seen
+static void csync_try_lock(void) {
+    csync_measurement_t m = csync_state.measured;
+    csync_mode_t mode;
+    bool relock;
+
+    m.hs_low  = (uint32_t)(search_low / search_lines);
+    m.hs_high = (uint32_t)(search_high / search_lines);
+
+    if (csync_state.detected && !search_need_field &&
+        csync_timing_line_ok(&csync_state.measured, m.hs_low, m.hs_high)) {
+        csync_lock(&csync_state.measured, &csync_state.mode, true);
+        return;
+    }
+
+    // The first field after the loss is partial
+    if (search_fields < 2u)
+        return;
+    m.sys_hz  = clock_get_hz(clk_sys);
+    m.vs_low  = vs_monitor.low;
+    m.vs_high = vs_monitor.high;
+    if (csync_timing_select(&m, &mode) != 0) {
+        search_lines = 0;
+        return;
+    }
+    relock = csync_state.detected &&
+             csync_timing_line_ok(&csync_state.measured, m.hs_low, m.hs_high) &&
+             csync_timing_field_ok(&csync_state.measured, m.vs_low, m.vs_high);
+    csync_lock(&m, &mode, relock);
+}
+
+static void csync_line(uint32_t low, uint32_t high) {
+    if (csync_state.locked) {
+        if (csync_timing_line_ok(&csync_state.measured, low, high))
+            bad_lines = 0;
+        else if (++bad_lines >= CSYNC_BAD_LINES)
+            csync_lose(false);
+        return;
+    }
+
+    if (search_lines == 0 || !csync_timing_line_ok(&search_ref, low, high)) {
+        search_ref.hs_low  = low;
+        search_ref.hs_high = high;
+        search_low   = 0;
+        search_high  = 0;
+        search_lines = 0;
+    }
+    search_low  += low;
+    search_high += high;
+    if (++search_lines >= CSYNC_LOCK_LINES)
+        csync_try_lock();
+}
+
+static void csync_field(uint32_t low, uint32_t high) {
+    if (csync_state.locked) {
+        if (csync_timing_field_ok(&csync_state.measured, low, high))
+            bad_fields = 0;
+        else if (++bad_fields >= CSYNC_BAD_FIELDS)
+            csync_lose(true);
+        return;
+    }
+    search_fields++;
+}
+
 // ------------- Public API for multicore launcher -----------------
 
 // Called from core1: sets up PIO and starts CSYNC state machine
 void csync_init(void) {
-    // Load program
-    if (!load_rp1_csync(csync_pio, &csync_handle)) {
+    csync_handle.offset   = -1;
+    measure_handle.offset = -1;
+    csync_inputs_init();
+
+    // Load programs
+    if (!load_measure(csync_pio, &measure_handle) ||
+        !monitor_start(csync_pio, &measure_handle, &hs_monitor, PIN_HSYNC) ||
+        !monitor_start(csync_pio, &measure_handle, &vs_monitor, PIN_VSYNC)) {
         // If something goes badly wrong, just hang this core
         while (1) {
             tight_loop_contents();
         }
     }
+    csync_handle.sm = pio_claim_unused_sm(csync_pio, true);
+    pio_gpio_init(csync_pio, PIN_CSYNC);
+    pio_sm_set_consecutive_pindirs(csync_pio, csync_handle.sm, PIN_CSYNC, 1, true);
 
-    // Compute RP1 time constant:
-    // tc = ((htotal - 2*hsw) * clk_sys) / pixel_clk
-    // Then push (tc - 2)
-    uint32_t sys_hz   = clock_get_hz(clk_sys);
-    uint16_t hsw      = (uint16_t)(H_SYNC_END - H_SYNC_START);
-    uint32_t lhs      = (uint32_t)(H_TOTAL - 2u * hsw);
-    uint32_t tc       = (uint32_t)((uint64_t)lhs * (uint64_t)sys_hz / (uint64_t)PIXEL_CLK_HZ);
-    uint32_t push_val = (tc >= 2) ? (tc - 2) : 0;
-
-    // Place time constant into FIFO; start the SM
-    pio_sm_put_blocking(csync_pio, csync_handle.sm, push_val);
-    pio_sm_set_enabled(csync_pio, csync_handle.sm, true);
+    // Until the supervisor locks, generate the built-in mode (it follows
+    // HSYNC, so a matching source works from the start)
+    csync_timing_default(clock_get_hz(clk_sys), &csync_state.mode);
+    if (!csync_load(csync_pio, &csync_handle, &csync_state.mode)) {
+        while (1) {
+            tight_loop_contents();
+        }
+    }
+    csync_state.reloads = 1;
+    csync_status_publish();
 }
 
+// Supervisor: checks every input period against the locked mode, drops
+// the lock when the inputs stop or leave it, and locks again
 void csync_run(void)
 {
     while (true)
     {
-        tight_loop_contents();  // optional
+        while (monitor_poll(csync_pio, &hs_monitor))
+            csync_line(hs_monitor.low, hs_monitor.high);
+        while (monitor_poll(csync_pio, &vs_monitor))
+            csync_field(vs_monitor.low, vs_monitor.high);
+
+        // Drained first: after a pause the FIFOs are full, not late
+        if (csync_state.locked) {
+            uint64_t now = time_us_64();
+
+            if (now - hs_monitor.last_us > CSYNC_LOSS_LINES * lock_line_us ||
+                now - vs_monitor.last_us > CSYNC_LOSS_FIELDS * lock_field_us)
+                csync_lose(false);
+        }
+        tight_loop_contents();
     }
 }
+
+bool csync_get_status(csync_status_t *status)
+{
+    uint32_t seq;
+
+    do {
+        seq = csync_status_seq;
+        if (seq == 0)
+            return false;
+        __dmb();
+        *status = csync_status;
+        __dmb();
+    } while ((seq & 1u) || seq != csync_status_seq);
+    return true;
+}
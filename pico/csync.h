@@ -0,0 +1,28 @@
+// csync.h — PIO CSYNC generator on core1 (csync.c)
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "csync_timing.h"
+
+typedef struct {
+    csync_mode_t        mode;       // mode being generated
+    csync_measurement_t measured;   // what the mode was selected from, zero if none
+    bool                detected;   // mode came from the measurement
+    bool                locked;     // inputs present and still in that mode
+    uint32_t            locks;      // locked to a newly selected mode
+    uint32_t            losses;     // inputs stopped or left the mode
+    uint32_t            relocks;    // back in the same mode after a loss
+    uint32_t            reloads;    // CSYNC program (re)loads
+} csync_status_t;
+
+// Core1 entry points: start the generator in the built-in mode, then
+// supervise the inputs, locking to the source's mode and re-locking after
+// a loss.
+void csync_init(void);
+void csync_run(void);
+
+// Safe to call from core0. Returns false until core1 has loaded a mode.
+bool csync_get_status(csync_status_t *status);
@@ -0,0 +1,151 @@
+// csync_timing.c — video mode selection for the CSYNC generator
+
+#include "csync_timing.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+// Built-in mode (the original dtparams): 8.056 MHz pixel clock,
+// H: active=400, fp=10, sync=40, bp=62
+#define DEFAULT_PIXEL_CLK_HZ    8056000u
+#define DEFAULT_H_TOTAL         512u
+#define DEFAULT_H_SYNC          40u
+
+// Cycles the interlaced program spends outside its two counting loops per
+// half line (see build_csync_ilace() in csync.c)
+#define ILACE_BROAD_OVERHEAD    4u
+#define ILACE_SERR_OVERHEAD     4u
+
+static uint32_t cycles_to_ns(uint64_t cycles, uint32_t sys_hz)
+{
+    return (uint32_t)((cycles * 1000000000u + sys_hz / 2u) / sys_hz);
+}
+
+static uint32_t sub_floor(uint32_t a, uint32_t b)
+{
+    return a > b ? a - b : 0u;
+}
+
+static uint32_t abs_diff(uint32_t a, uint32_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static void timing_constants(uint32_t line, uint32_t hsw, csync_mode_t *mode)
+{
+    // RP1: the broad pulse lasts htotal - 2 * hsync after the HSYNC pulse,
+    // and the program's own loop adds two cycles
+    mode->tc      = sub_floor(line, 2u * hsw + 2u);
+    mode->tc_half = sub_floor(line / 2u, 2u * hsw + ILACE_BROAD_OVERHEAD);
+    mode->hsw     = sub_floor(hsw, ILACE_SERR_OVERHEAD);
+}
+
+int csync_timing_select(const csync_measurement_t *m, csync_mode_t *mode)
+{
+    uint32_t line  = m->hs_low + m->hs_high;
+    uint32_t field = m->vs_low + m->vs_high;
+    uint32_t hsw   = m->hs_low < m->hs_high ? m->hs_low : m->hs_high;
+    uint32_t vsw   = m->vs_low < m->vs_high ? m->vs_low : m->vs_high;
+    csync_mode_t out = {0};
+
+    if (m->sys_hz == 0 || line == 0 || field == 0)
+        return -ERANGE;
+
+    out.line_ns  = cycles_to_ns(line, m->sys_hz);
+    out.hsync_ns = cycles_to_ns(hsw, m->sys_hz);
+    if (out.line_ns < CSYNC_LINE_NS_MIN || out.line_ns > CSYNC_LINE_NS_MAX)
+        return -ERANGE;
+    if (hsw == 0 || hsw >= line / 4u)
+        return -ERANGE;
+
+    // Lines per field, to the nearest half line
+    out.lines_x2 = (uint32_t)(((uint64_t)field * 4u + line) / (2u * (uint64_t)line));
+    if (out.lines_x2 < 2u * CSYNC_LINES_MIN || out.lines_x2 > 2u * CSYNC_LINES_MAX)
+        return -ERANGE;
+    // VSYNC lasts a few lines
+    if (vsw < line || vsw >= field / 8u)
+        return -ERANGE;
+
+    // 262.5 or 312.5 lines: each field starts half a line after the last
+    out.interlaced = (out.lines_x2 & 1u) != 0;
+
+    // Two fields make 525 or 625 lines, give or take a progressive line
+    if (out.lines_x2 >= 522u && out.lines_x2 <= 528u)
+        out.standard = CSYNC_STD_NTSC;
+    else if (out.lines_x2 >= 622u && out.lines_x2 <= 628u)
+        out.standard = CSYNC_STD_PAL;
+    else
+        out.standard = CSYNC_STD_OTHER;
+
+    // The pulse is the shorter level
+    out.hsync_negative = m->hs_low < m->hs_high;
+    out.vsync_negative = m->vs_low < m->vs_high;
+    out.field_mhz = (uint32_t)(((uint64_t)m->sys_hz * 1000u + field / 2u) / field);
+
+    timing_constants(line, hsw, &out);
+    *mode = out;
+    return 0;
+}
+
+bool csync_timing_line_ok(const csync_measurement_t *ref, uint32_t low, uint32_t high)
+{
+    uint32_t ref_line = ref->hs_low + ref->hs_high;
+    uint32_t slack    = ref_line / CSYNC_LINE_SLACK_DIV;
+    bool     ref_neg  = ref->hs_low < ref->hs_high;
+
+    if ((low < high) != ref_neg)
+        return false;
+    return abs_diff(low + high, ref_line) <= slack &&
+           abs_diff(ref_neg ? low : high, ref_neg ? ref->hs_low : ref->hs_high) <= slack;
+}
+
+bool csync_timing_field_ok(const csync_measurement_t *ref, uint32_t low, uint32_t high)
+{
+    uint32_t slack   = (ref->hs_low + ref->hs_high) / CSYNC_FIELD_SLACK_DIV;
+    bool     ref_neg = ref->vs_low < ref->vs_high;
+
+    if ((low < high) != ref_neg)
+        return false;
+    return abs_diff(low + high, ref->vs_low + ref->vs_high) <= slack;
+}
+
+void csync_timing_default(uint32_t sys_hz, csync_mode_t *mode)
+{
+    uint32_t line = (uint32_t)((uint64_t)DEFAULT_H_TOTAL * sys_hz / DEFAULT_PIXEL_CLK_HZ);
+    uint32_t hsw  = (uint32_t)((uint64_t)DEFAULT_H_SYNC * sys_hz / DEFAULT_PIXEL_CLK_HZ);
+    csync_mode_t out = {0};
+
+    out.standard       = CSYNC_STD_OTHER;
+    out.hsync_negative = true;
+    out.vsync_negative = true;
+    if (sys_hz) {
+        out.line_ns  = cycles_to_ns(line, sys_hz);
+        out.hsync_ns = cycles_to_ns(hsw, sys_hz);
+    }
+    timing_constants(line, hsw, &out);
+    *mode = out;
+}
+
+int csync_timing_format(const csync_mode_t *mode, char *buf, size_t len)
+{
+    static const char *const std_names[] = { "other", "NTSC", "PAL" };
+    char field[48] = "";
+
+    // Unknown for the built-in mode
+    if (mode->lines_x2)
+        snprintf(field, sizeof(field), " %lu%s lines%s %lu.%02luHz",
+                 (unsigned long)(mode->lines_x2 / 2u),
+                 (mode->lines_x2 & 1u) ? ".5" : "",
+                 mode->interlaced ? " interlaced" : "",
+                 (unsigned long)(mode->field_mhz / 1000u),
+                 (unsigned long)(mode->field_mhz % 1000u / 10u));
+
+    return snprintf(buf, len, "%s%s %lu.%02luus hsync %lu.%02luus %ch %cv",
+                    std_names[mode->standard], field,
+                    (unsigned long)(mode->line_ns / 1000u),
+                    (unsigned long)(mode->line_ns % 1000u / 10u),
+                    (unsigned long)(mode->hsync_ns / 1000u),
+                    (unsigned long)(mode->hsync_ns % 1000u / 10u),
+                    mode->hsync_negative ? '-' : '+',
+                    mode->vsync_negative ? '-' : '+');
+}
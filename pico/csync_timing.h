@@ -0,0 +1,70 @@
+// csync_timing.h — video mode selection for the CSYNC generator
+//
+// Pure computation (no SDK), so it builds and can be exercised on a host:
+// core1 measures the HSYNC and VSYNC inputs in system clock cycles (csync.c)
+// and this turns one measurement into the timing constants of the PIO
+// CSYNC program.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Accepted input range; anything else is treated as "no sync"
+#define CSYNC_LINE_NS_MIN       20000u      // 50 kHz
+#define CSYNC_LINE_NS_MAX       100000u     // 10 kHz
+#define CSYNC_LINES_MIN         200u        // per field
+#define CSYNC_LINES_MAX         700u
+
+// How far a locked source may drift: line period and HSYNC width by a
+// 256th of a line (NTSC and PAL lines differ by 0.7%), the field period by
+// a quarter line. Measurement noise is a few cycles.
+#define CSYNC_LINE_SLACK_DIV    256u
+#define CSYNC_FIELD_SLACK_DIV   4u
+
+// One line and one field, as time spent at each input level
+typedef struct {
+    uint32_t sys_hz;
+    uint32_t hs_low, hs_high;       // cycles
+    uint32_t vs_low, vs_high;       // cycles
+} csync_measurement_t;
+
+typedef enum {
+    CSYNC_STD_OTHER = 0,
+    CSYNC_STD_NTSC,                 // 525 lines per frame
+    CSYNC_STD_PAL,                  // 625 lines per frame
+} csync_standard_t;
+
+typedef struct {
+    csync_standard_t standard;
+    bool     interlaced;            // half a line left over per field
+    bool     hsync_negative;        // active low (the shorter level)
+    bool     vsync_negative;
+    uint32_t line_ns;
+    uint32_t hsync_ns;
+    uint32_t lines_x2;              // lines per field, times two
+    uint32_t field_mhz;             // field rate in mHz
+
+    // Loop counts for the PIO CSYNC programs (csync.c), in sys clocks
+    uint32_t tc;                    // progressive: broad pulse after HSYNC
+    uint32_t tc_half;               // interlaced: half line less two HSYNCs
+    uint32_t hsw;                   // interlaced: HSYNC width
+} csync_mode_t;
+
+// Fill `mode` from a measurement. Returns 0, or -ERANGE if the input is out
+// of range (no signal, noise, an unsupported mode); `mode` is then untouched.
+int csync_timing_select(const csync_measurement_t *m, csync_mode_t *mode);
+
+// Whether one line (HSYNC low and high time) or one field (VSYNC) still
+// fits the measurement a mode was selected from: same polarity, period
+// and pulse width within the slack above.
+bool csync_timing_line_ok(const csync_measurement_t *ref, uint32_t low, uint32_t high);
+bool csync_timing_field_ok(const csync_measurement_t *ref, uint32_t low, uint32_t high);
+
+// The original fixed mode (400x240 at 8.056 MHz, negative syncs), used
+// when there is nothing to measure.
+void csync_timing_default(uint32_t sys_hz, csync_mode_t *mode);
+
+// One line summary, e.g. "NTSC 262 lines 60.05Hz 63.55us hsync 4.70us -h -v"
+int csync_timing_format(const csync_mode_t *mode, char *buf, size_t len);
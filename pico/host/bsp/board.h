@@ -0,0 +1,7 @@
+// bsp/board.h (host shim)
+#pragma once
+
+#include <stdint.h>
+
+void     board_init(void);
+uint32_t board_millis(void);
@@ -0,0 +1,134 @@
+// csync_timing_test.c
+// Host checks for csync_timing.c: known NTSC/PAL measurements, progressive
+// and interlaced, both sync polarities, and input that must be rejected.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csync_timing.h"
+
+#define SYS_HZ      150000000u  // RP2350 default clk_sys
+#define NTSC_LINE   9533u       // 63.556 us
+#define PAL_LINE    9600u       // 64 us
+#define HSYNC       705u        // 4.7 us
+
+static unsigned failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, name, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// Measurement of `lines_x2` half lines per field with a 3 line VSYNC;
+// `negative` puts both pulses on the low level
+static csync_measurement_t measure(uint32_t line, uint32_t lines_x2, bool negative)
+{
+    uint32_t field = line * (lines_x2 / 2u) + (lines_x2 & 1u) * (line / 2u);
+    csync_measurement_t m = { .sys_hz = SYS_HZ };
+
+    m.hs_low  = negative ? HSYNC : line - HSYNC;
+    m.hs_high = negative ? line - HSYNC : HSYNC;
+    m.vs_low  = negative ? 3u * line : field - 3u * line;
+    m.vs_high = negative ? field - 3u * line : 3u * line;
+    return m;
+}
+
+static void check_mode(const char *name, csync_measurement_t m,
+                       csync_standard_t standard, uint32_t lines_x2,
+                       bool negative, const char *summary)
+{
+    csync_mode_t mode;
+    char buf[96];
+
+    CHECK(csync_timing_select(&m, &mode) == 0);
+    CHECK(mode.standard == standard);
+    CHECK(mode.lines_x2 == lines_x2);
+    CHECK(mode.interlaced == ((lines_x2 & 1u) != 0));
+    CHECK(mode.hsync_negative == negative);
+    CHECK(mode.vsync_negative == negative);
+    CHECK(mode.hsync_ns == 4700u);
+    CHECK(mode.tc == m.hs_low + m.hs_high - 2u * HSYNC - 2u);
+
+    csync_timing_format(&mode, buf, sizeof(buf));
+    if (strcmp(buf, summary) != 0) {
+        fprintf(stderr, "%s: \"%s\", expected \"%s\"\n", name, buf, summary);
+        failures++;
+    }
+
+    // The lock holds for the same input and drops for the other standard
+    CHECK(csync_timing_line_ok(&m, m.hs_low, m.hs_high));
+    CHECK(csync_timing_field_ok(&m, m.vs_low, m.vs_high));
+    CHECK(!csync_timing_line_ok(&m, m.hs_high, m.hs_low));
+}
+
+static void check_rejected(const char *name, csync_measurement_t m)
+{
+    csync_mode_t mode, before;
+
+    memset(&mode, 0xA5, sizeof(mode));
+    before = mode;
+    CHECK(csync_timing_select(&m, &mode) == -ERANGE);
+    CHECK(memcmp(&mode, &before, sizeof(mode)) == 0);
+}
+
+int main(void)
+{
+    const char *name;
+    csync_measurement_t m;
+
+    name = "NTSC progressive";
+    check_mode(name, measure(NTSC_LINE, 524u, true), CSYNC_STD_NTSC, 524u, true,
+               "NTSC 262 lines 60.05Hz 63.55us hsync 4.70us -h -v");
+    name = "NTSC interlaced";
+    check_mode(name, measure(NTSC_LINE, 525u, true), CSYNC_STD_NTSC, 525u, true,
+               "NTSC 262.5 lines interlaced 59.94Hz 63.55us hsync 4.70us -h -v");
+    name = "PAL progressive";
+    check_mode(name, measure(PAL_LINE, 624u, true), CSYNC_STD_PAL, 624u, true,
+               "PAL 312 lines 50.08Hz 64.00us hsync 4.70us -h -v");
+    name = "PAL interlaced";
+    check_mode(name, measure(PAL_LINE, 625u, true), CSYNC_STD_PAL, 625u, true,
+               "PAL 312.5 lines interlaced 50.00Hz 64.00us hsync 4.70us -h -v");
+    name = "PAL inverted";
+    check_mode(name, measure(PAL_LINE, 625u, false), CSYNC_STD_PAL, 625u, false,
+               "PAL 312.5 lines interlaced 50.00Hz 64.00us hsync 4.70us +h +v");
+    name = "other";
+    check_mode(name, measure(PAL_LINE, 480u, true), CSYNC_STD_OTHER, 480u, true,
+               "other 240 lines 65.10Hz 64.00us hsync 4.70us -h -v");
+
+    name = "no signal";
+    check_rejected(name, (csync_measurement_t){ .sys_hz = SYS_HZ });
+    name = "no clock";
+    m = measure(PAL_LINE, 625u, true);
+    m.sys_hz = 0;
+    check_rejected(name, m);
+    name = "line too short";
+    check_rejected(name, measure(2000u, 625u, true));
+    name = "line too long";
+    check_rejected(name, measure(16000u, 625u, true));
+    name = "too few lines";
+    check_rejected(name, measure(PAL_LINE, 300u, true));
+    name = "too many lines";
+    check_rejected(name, measure(PAL_LINE, 1500u, true));
+    name = "hsync too wide";
+    m = measure(PAL_LINE, 625u, true);
+    m.hs_low  = PAL_LINE / 2u - 10u;
+    m.hs_high = PAL_LINE / 2u + 10u;
+    check_rejected(name, m);
+    name = "vsync under a line";
+    m = measure(PAL_LINE, 625u, true);
+    m.vs_high += m.vs_low - 100u;
+    m.vs_low   = 100u;
+    check_rejected(name, m);
+
+    if (failures) {
+        fprintf(stderr, "csync_timing_test: %u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("csync_timing_test: all checks passed\n");
+    return EXIT_SUCCESS;
+}
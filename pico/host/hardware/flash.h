@@ -0,0 +1,13 @@
+// hardware/flash.h (host shim)
+// Flash is a RAM array, mapped where the firmware expects XIP.
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE         256u
+#define FLASH_SECTOR_SIZE       4096u
+#define PICO_FLASH_SIZE_BYTES   PICO_HOST_FLASH_SIZE
+#define XIP_BASE                ((uintptr_t)pico_host_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
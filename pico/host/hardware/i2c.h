@@ -0,0 +1,18 @@
+// hardware/i2c.h (host shim)
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct i2c_inst i2c_inst_t;
+
+extern i2c_inst_t *const pico_host_i2c0;
+extern i2c_inst_t *const pico_host_i2c1;
+#define i2c0 pico_host_i2c0
+#define i2c1 pico_host_i2c1
+
+// Blocks on the virtual clock for the time the transfer takes on the wire.
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+int  i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                        size_t len, bool nostop);
+int  i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                          size_t len, bool nostop, uint timeout_us);
@@ -0,0 +1,25 @@
+// hardware/uart.h (host shim)
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t *const pico_host_uart0;
+extern uart_inst_t *const pico_host_uart1;
+#define uart0 pico_host_uart0
+#define uart1 pico_host_uart1
+
+typedef enum {
+    UART_PARITY_NONE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD
+} uart_parity_t;
+
+uint    uart_init(uart_inst_t *uart, uint baudrate);
+void    uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits,
+                        uart_parity_t parity);
+void    uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void    uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+bool    uart_is_readable(uart_inst_t *uart);
+uint8_t uart_getc(uart_inst_t *uart);
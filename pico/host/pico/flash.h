@@ -0,0 +1,7 @@
+// pico/flash.h (host shim)
+#pragma once
+
+#include "pico/stdlib.h"
+
+// Nothing else runs on the host, so the function is simply called.
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms);
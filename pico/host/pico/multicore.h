@@ -0,0 +1,6 @@
+// pico/multicore.h (host shim)
+#pragma once
+
+// Core 1 is not run on the host; the entry point is only recorded.
+void multicore_launch_core1(void (*entry)(void));
+void multicore_lockout_victim_init(void);
@@ -0,0 +1,36 @@
+// pico/stdlib.h (host shim)
+// Just enough of the Pico SDK for pico/main_pico.c to build and run on a
+// PC; see pico_hal_host.h for how time and I/O are simulated.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico_hal_host.h"
+
+#define PICO_OK 0
+#define PICO_ERROR_GENERIC (-1)
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+uint64_t        time_us_64(void);
+absolute_time_t get_absolute_time(void);
+int64_t         absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+void            sleep_ms(uint32_t ms);
+void            sleep_us(uint64_t us);
+void            tight_loop_contents(void);
+
+// pico/time.h alarms (default alarm pool), fired from tight_loop_contents()
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past);
+bool       cancel_alarm(alarm_id_t id);
+
+// The firmware's main() becomes pico_main(), driven by pico/host/pico_host.c
+#define main pico_main
+int pico_main(void);
@@ -0,0 +1,444 @@
+// pico_hal_host.c
+// Pico SDK / TinyUSB shim for the host build, see pico_hal_host.h.
+
+#include <setjmp.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/i2c.h"
+#include "hardware/uart.h"
+#include "bsp/board.h"
+#include "tusb.h"
+
+#include "csync.h"
+#include "pico_hal_host.h"
+
+struct uart_inst { int index; };
+struct i2c_inst  { int index; uint baudrate; };
+
+static struct uart_inst host_uart[2] = { { 0 }, { 1 } };
+static struct i2c_inst  host_i2c[2]  = { { 0, 100000u }, { 1, 100000u } };
+
+uart_inst_t *const pico_host_uart0 = &host_uart[0];
+uart_inst_t *const pico_host_uart1 = &host_uart[1];
+i2c_inst_t  *const pico_host_i2c0  = &host_i2c[0];
+i2c_inst_t  *const pico_host_i2c1  = &host_i2c[1];
+
+static pico_host_config_t host_cfg;
+static pico_host_stats_t  host_stats;
+static jmp_buf            host_exit;
+
+// =========================
+// Virtual clock
+// =========================
+
+uint64_t time_us_64(void)
+{
+    return host_stats.now_us;
+}
+
+absolute_time_t get_absolute_time(void)
+{
+    return host_stats.now_us;
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+    return (int64_t)(to - from);
+}
+
+void sleep_us(uint64_t us)
+{
+    host_stats.now_us   += us;
+    host_stats.sleep_us += us;
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t)ms * 1000u);
+}
+
+// Alarm slots; id = slot + 1, callback NULL = free
+static struct {
+    uint64_t         time_us;
+    alarm_callback_t callback;
+    void            *user_data;
+} host_alarm[PICO_HOST_ALARMS];
+
+static void alarms_fire(void)
+{
+    for (unsigned i = 0; i < PICO_HOST_ALARMS; ++i) {
+        if (host_alarm[i].callback && host_alarm[i].time_us <= host_stats.now_us) {
+            alarm_callback_t cb = host_alarm[i].callback;
+            host_alarm[i].callback = NULL;
+            host_stats.alarms_fired++;
+            // Rescheduling (non-zero return) isn't used by the firmware
+            cb((alarm_id_t)(i + 1), host_alarm[i].user_data);
+        }
+    }
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past)
+{
+    if (time <= host_stats.now_us) {
+        if (fire_if_past) {
+            host_stats.alarms_fired++;
+            callback(0, user_data);
+        }
+        return 0;
+    }
+    for (unsigned i = 0; i < PICO_HOST_ALARMS; ++i) {
+        if (!host_alarm[i].callback) {
+            host_alarm[i].time_us   = time;
+            host_alarm[i].callback  = callback;
+            host_alarm[i].user_data = user_data;
+            return (alarm_id_t)(i + 1);
+        }
+    }
+    return -1;
+}
+
+bool cancel_alarm(alarm_id_t id)
+{
+    if (id <= 0 || (unsigned)id > PICO_HOST_ALARMS || !host_alarm[id - 1].callback)
+        return false;
+    host_alarm[id - 1].callback = NULL;
+    return true;
+}
+
+// Called once per main loop iteration: charge its time, fire alarms and
+// stop the run when the input is done.
+void tight_loop_contents(void)
+{
+    if (host_stats.loop_iterations++ == 0)
+        host_stats.first_loop_us = host_stats.now_us;
+    host_stats.now_us += host_cfg.loop_us;
+    alarms_fire();
+
+    uint64_t last = host_cfg.rx_len ? host_cfg.rx_time_us[host_cfg.rx_len - 1] : 0;
+    if (host_stats.now_us >= last + host_cfg.linger_us)
+        longjmp(host_exit, 1);
+}
+
+uint32_t board_millis(void)
+{
+    return (uint32_t)(host_stats.now_us / 1000u);
+}
+
+void board_init(void)
+{
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    (void)entry;
+    host_stats.core1_launched = true;
+}
+
+void multicore_lockout_victim_init(void)
+{
+}
+
+// core1_main() in main_pico.c refers to these; core 1 never runs here.
+void csync_init(void)
+{
+}
+
+void csync_run(void)
+{
+}
+
+bool csync_get_status(csync_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    if (host_cfg.csync && csync_timing_select(host_cfg.csync, &status->mode) == 0) {
+        status->measured = *host_cfg.csync;
+        status->detected = true;
+        status->locked   = true;
+        status->locks    = 1;
+    } else {
+        csync_timing_default(PICO_HOST_SYS_HZ, &status->mode);
+    }
+    status->reloads = 1;
+    return true;
+}
+
+// =========================
+// GPIO
+// =========================
+
+void gpio_init(uint gpio)                                   { (void)gpio; }
+void gpio_set_dir(uint gpio, bool out)                      { (void)gpio; (void)out; }
+void gpio_put(uint gpio, bool value)                        { (void)gpio; (void)value; }
+bool gpio_get(uint gpio)                                    { (void)gpio; return false; }
+void gpio_set_function(uint gpio, enum gpio_function fn)    { (void)gpio; (void)fn; }
+void gpio_pull_up(uint gpio)                                { (void)gpio; }
+void gpio_disable_pulls(uint gpio)                          { (void)gpio; }
+
+// =========================
+// UART RX
+// =========================
+
+static size_t uart_next;        // next byte of the stream to arrive
+static size_t uart_fifo_head;   // oldest byte in the FIFO (index into rx)
+static size_t uart_fifo[PICO_HOST_UART_FIFO];
+static unsigned uart_fifo_count;
+
+// Move bytes that have arrived by now into the FIFO
+static void uart_receive(void)
+{
+    while (uart_next < host_cfg.rx_len &&
+           host_cfg.rx_time_us[uart_next] <= host_stats.now_us) {
+        if (uart_fifo_count == PICO_HOST_UART_FIFO) {
+            host_stats.uart_overruns++;
+        } else {
+            uart_fifo[(uart_fifo_head + uart_fifo_count) % PICO_HOST_UART_FIFO] = uart_next;
+            uart_fifo_count++;
+        }
+        uart_next++;
+    }
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate)
+{
+    (void)uart;
+    return baudrate;
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits,
+                     uart_parity_t parity)
+{
+    (void)uart; (void)data_bits; (void)stop_bits; (void)parity;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts)
+{
+    (void)uart; (void)cts; (void)rts;
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled)
+{
+    (void)uart; (void)enabled;
+}
+
+bool uart_is_readable(uart_inst_t *uart)
+{
+    if (uart != uart0)
+        return false;
+    uart_receive();
+    return uart_fifo_count > 0;
+}
+
+uint8_t uart_getc(uart_inst_t *uart)
+{
+    // Blocks until a byte arrives, like the SDK
+    while (!uart_is_readable(uart)) {
+        if (uart_next >= host_cfg.rx_len)
+            longjmp(host_exit, 1);
+        host_stats.now_us = host_cfg.rx_time_us[uart_next];
+    }
+
+    uint8_t b = host_cfg.rx[uart_fifo[uart_fifo_head]];
+    uart_fifo_head = (uart_fifo_head + 1) % PICO_HOST_UART_FIFO;
+    uart_fifo_count--;
+    host_stats.uart_bytes++;
+    return b;
+}
+
+// =========================
+// I2C
+// =========================
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                       size_t len, bool nostop)
+{
+    (void)addr; (void)src;
+
+    // Start + address byte + data bytes (9 bits each with ACK) + stop
+    uint64_t bits = 1u + 9u * (len + 1u) + (nostop ? 0u : 1u);
+    uint64_t us   = (bits * 1000000u + i2c->baudrate - 1u) / i2c->baudrate;
+
+    host_stats.now_us      += us;
+    host_stats.i2c_busy_us += us;
+    host_stats.i2c_transfers++;
+    host_stats.i2c_bytes   += len;
+    return (int)len;
+}
+
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                         size_t len, bool nostop, uint timeout_us)
+{
+    // The simulated device always ACKs, so this never runs into the timeout
+    (void)timeout_us;
+    return i2c_write_blocking(i2c, addr, src, len, nostop);
+}
+
+// =========================
+// TinyUSB CDC TX
+// =========================
+
+static uint8_t  cdc_fifo[CFG_TUD_CDC_TX_BUFSIZE];
+static uint32_t cdc_fifo_head, cdc_fifo_count;
+static bool     cdc_busy;           // a packet is in flight
+static uint64_t cdc_busy_until_us;  // ... until this USB frame starts
+
+static void cdc_start_packet(void)
+{
+    uint32_t n = cdc_fifo_count < PICO_HOST_CDC_PACKET ? cdc_fifo_count
+                                                       : PICO_HOST_CDC_PACKET;
+
+    if (cdc_busy || n == 0)
+        return;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint8_t c = cdc_fifo[(cdc_fifo_head + i) % sizeof(cdc_fifo)];
+        if (host_cfg.cdc_out)
+            fputc(c, host_cfg.cdc_out);
+    }
+    cdc_fifo_head   = (cdc_fifo_head + n) % sizeof(cdc_fifo);
+    cdc_fifo_count -= n;
+
+    // The host picks up one packet per frame
+    cdc_busy          = true;
+    cdc_busy_until_us = (host_stats.now_us / PICO_HOST_USB_FRAME_US + 1u) *
+                        PICO_HOST_USB_FRAME_US;
+    host_stats.cdc_packets++;
+}
+
+bool tusb_init(void)
+{
+    return true;
+}
+
+void tud_task(void)
+{
+    if (cdc_busy && host_stats.now_us >= cdc_busy_until_us) {
+        cdc_busy = false;
+        // TinyUSB's transfer-complete callback flushes what is left
+        cdc_start_packet();
+    }
+}
+
+bool tud_cdc_connected(void)
+{
+    return host_stats.now_us >= host_cfg.cdc_connect_us;
+}
+
+uint32_t tud_cdc_write(const void *buffer, uint32_t bufsize)
+{
+    const uint8_t *p = buffer;
+    uint32_t room = (uint32_t)sizeof(cdc_fifo) - cdc_fifo_count;
+    uint32_t n    = bufsize < room ? bufsize : room;
+
+    for (uint32_t i = 0; i < n; ++i)
+        cdc_fifo[(cdc_fifo_head + cdc_fifo_count + i) % sizeof(cdc_fifo)] = p[i];
+    cdc_fifo_count += n;
+
+    host_stats.cdc_writes++;
+    host_stats.cdc_bytes   += n;
+    host_stats.cdc_dropped += bufsize - n;
+
+    if (cdc_fifo_count >= PICO_HOST_CDC_PACKET)
+        cdc_start_packet();
+    return n;
+}
+
+static size_t cdc_in_pos;
+
+uint32_t tud_cdc_available(void)
+{
+    if (!tud_cdc_connected())
+        return 0;
+    return (uint32_t)(host_cfg.cdc_in_len - cdc_in_pos);
+}
+
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize)
+{
+    uint32_t n = tud_cdc_available();
+
+    if (n > bufsize)
+        n = bufsize;
+    memcpy(buffer, &host_cfg.cdc_in[cdc_in_pos], n);
+    cdc_in_pos += n;
+    return n;
+}
+
+uint32_t tud_cdc_write_available(void)
+{
+    return (uint32_t)sizeof(cdc_fifo) - cdc_fifo_count;
+}
+
+uint32_t tud_cdc_write_flush(void)
+{
+    uint32_t before = cdc_fifo_count;
+
+    host_stats.cdc_flushes++;
+    cdc_start_packet();
+    return before - cdc_fifo_count;
+}
+
+// =========================
+// Flash
+// =========================
+
+uint8_t pico_host_flash[PICO_HOST_FLASH_SIZE];
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    memset(&pico_host_flash[flash_offs], 0xFF, count);
+    host_stats.flash_erases += count / FLASH_SECTOR_SIZE;
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    // Programming can only clear bits
+    for (size_t i = 0; i < count; ++i)
+        pico_host_flash[flash_offs + i] &= data[i];
+    host_stats.flash_programs += count / FLASH_PAGE_SIZE;
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms)
+{
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+// =========================
+// Driver interface
+// =========================
+
+int pico_host_run(const pico_host_config_t *cfg)
+{
+    host_cfg = *cfg;
+    memset(&host_stats, 0, sizeof(host_stats));
+    uart_next = uart_fifo_head = 0;
+    uart_fifo_count = 0;
+    cdc_fifo_head = cdc_fifo_count = 0;
+    cdc_busy = false;
+    cdc_in_pos = 0;
+    memset(host_alarm, 0, sizeof(host_alarm));
+
+    if (setjmp(host_exit) == 0)
+        pico_main();
+
+    if (host_cfg.cdc_out)
+        fflush(host_cfg.cdc_out);
+    return 0;
+}
+
+const pico_host_stats_t *pico_host_get_stats(void)
+{
+    return &host_stats;
+}
@@ -0,0 +1,77 @@
+// pico_hal_host.h
+// Host build of the Pico firmware: pico/main_pico.c compiled against the
+// shim headers in this directory instead of the Pico SDK and TinyUSB.
+//
+// Time is virtual. It starts at 0 (power-on) and only moves when the
+// firmware waits: sleep_ms(), blocking I2C transfers (9 bits per byte at
+// the configured baud rate) and one loop_us per tight_loop_contents(), i.e.
+// per main loop iteration. Runs are therefore repeatable, and the real time
+// they take measures the cost of the loop itself.
+//
+// UART RX replays a byte stream with a virtual arrival time per byte into a
+// 32-byte FIFO; bytes arriving while it is full are lost (overrun), as on
+// the RP2350. CDC TX is a CFG_TUD_CDC_TX_BUFSIZE FIFO drained by one bulk IN
+// packet of up to 64 bytes per 1 ms USB frame, started by a flush or by a
+// full packet's worth of data, like TinyUSB; writes that don't fit are lost.
+// CDC RX hands out cdc_in once the host has connected. Alarms fire between
+// main loop iterations, at most loop_us late, as if the IRQ had set a flag. Flash is the RAM
+// array pico_host_flash, erased (0xFF) unless the driver loads an image.
+// Core 1 does not run; csync_get_status() reports the mode it would pick
+// from the csync measurement.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "csync_timing.h"
+
+#define PICO_HOST_UART_FIFO     32u
+#define PICO_HOST_CDC_PACKET    64u
+#define PICO_HOST_USB_FRAME_US  1000u
+#define PICO_HOST_FLASH_SIZE    (64u * 1024u)
+#define PICO_HOST_ALARMS        8u
+#define PICO_HOST_SYS_HZ        150000000u  // RP2350 default clk_sys
+
+extern uint8_t pico_host_flash[PICO_HOST_FLASH_SIZE];
+
+typedef struct {
+    const uint8_t  *rx;             // UART RX byte stream
+    const uint64_t *rx_time_us;     // virtual arrival time of each byte
+    size_t          rx_len;
+    uint32_t        loop_us;        // virtual time per main loop iteration
+    uint64_t        linger_us;      // keep running after the last byte
+    uint64_t        cdc_connect_us; // host opens the CDC port (UINT64_MAX = never)
+    FILE           *cdc_out;        // receives CDC packets, NULL = discard
+    const uint8_t  *cdc_in;         // sent by the host once it has connected
+    size_t          cdc_in_len;
+    const csync_measurement_t *csync; // what core1 measures, NULL = no sync
+} pico_host_config_t;
+
+typedef struct {
+    uint64_t now_us;
+    uint64_t loop_iterations;
+    uint64_t first_loop_us;         // virtual time of the first iteration
+    uint64_t sleep_us;              // spent in sleep_ms()/sleep_us()
+    uint64_t uart_bytes;            // read by the firmware
+    uint64_t uart_overruns;         // lost to a full RX FIFO
+    uint64_t cdc_writes;            // tud_cdc_write() calls
+    uint64_t cdc_flushes;           // tud_cdc_write_flush() calls
+    uint64_t cdc_packets;           // bulk IN packets sent
+    uint64_t cdc_bytes;             // bytes accepted into the TX FIFO
+    uint64_t cdc_dropped;           // bytes that did not fit
+    uint64_t i2c_transfers;
+    uint64_t i2c_bytes;
+    uint64_t i2c_busy_us;           // virtual time blocked in I2C
+    uint64_t flash_erases;          // sectors
+    uint64_t flash_programs;        // pages
+    uint64_t alarms_fired;
+    bool     core1_launched;
+} pico_host_stats_t;
+
+// Run the firmware's main() until the RX stream is consumed and linger_us
+// has passed. Returns 0.
+int pico_host_run(const pico_host_config_t *cfg);
+
+const pico_host_stats_t *pico_host_get_stats(void);
@@ -0,0 +1,311 @@
+// pico_host.c
+// Runs pico/main_pico.c on the host against the HAL shim (pico_hal_host.c),
+// fed from ibus_linux capture segments, and reports what the firmware did
+// in virtual time and what its main loop cost in real time.
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ibus_protocol.h"
+#include "ibus_segment.h"
+#include "pico_hal_host.h"
+
+#define HOST_BYTE_US    1146u   // 11 bits at 9600 baud
+
+static uint8_t  *rx_bytes;
+static uint64_t *rx_times;
+static size_t    rx_len, rx_cap;
+
+static uint64_t get_le(const uint8_t *p, unsigned bytes)
+{
+    uint64_t v = 0;
+    for (unsigned i = 0; i < bytes; ++i)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static int rx_append(uint8_t b, uint64_t t)
+{
+    if (rx_len == rx_cap) {
+        size_t cap = rx_cap ? rx_cap * 2 : 65536;
+        uint8_t  *nb = realloc(rx_bytes, cap);
+        if (!nb)
+            return -ENOMEM;
+        rx_bytes = nb;
+        uint64_t *nt = realloc(rx_times, cap * sizeof(*nt));
+        if (!nt)
+            return -ENOMEM;
+        rx_times = nt;
+        rx_cap   = cap;
+    }
+    rx_bytes[rx_len] = b;
+    rx_times[rx_len] = t;
+    rx_len++;
+    return 0;
+}
+
+// Append the records of one capture segment. Record times are wall clock;
+// the first byte of the first file goes on the wire at `start_us` and every
+// byte takes 11 bit times.
+static int capture_load(const char *path, uint64_t start_us, uint64_t *base_us)
+{
+    ibus_segment_header_t h;
+    char head[IBUS_SEGMENT_HEADER_LEN];
+    uint8_t rec[IBUS_SEGMENT_CAPTURE_HDR], buf[65536];
+    uint64_t t = 0;
+    int res = 0;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return -errno;
+    if (fread(head, 1, sizeof(head), fp) != sizeof(head) ||
+        ibus_segment_header_parse(head, sizeof(head), &h) < 0 ||
+        h.kind != IBUS_SEGMENT_CAPTURE) {
+        fclose(fp);
+        return -EPROTO;
+    }
+
+    while (res == 0 && fread(rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+        uint64_t time_us = get_le(rec, 8);
+        uint16_t len     = (uint16_t)get_le(&rec[8], 2);
+
+        if (fread(buf, 1, len, fp) != len)
+            break;                          // torn last record
+
+        // Records are stamped when their last byte was read
+        uint64_t wire = (uint64_t)len * HOST_BYTE_US;
+        if (*base_us == 0)
+            *base_us = time_us - wire;
+
+        uint64_t first = time_us - wire - *base_us + start_us;
+        if (first > t)
+            t = first;
+        for (uint16_t i = 0; i < len && res == 0; ++i) {
+            t += HOST_BYTE_US;
+            res = rx_append(buf[i], t);
+        }
+    }
+
+    fclose(fp);
+    return res;
+}
+
+// Read a whole file into a malloc'd buffer
+static int file_load(const char *path, uint8_t **data, size_t *len)
+{
+    FILE *fp = fopen(path, "rb");
+    long size;
+
+    if (!fp)
+        return -errno;
+    if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) < 0) {
+        fclose(fp);
+        return -EIO;
+    }
+    *data = malloc(size ? (size_t)size : 1u);
+    if (!*data) {
+        fclose(fp);
+        return -ENOMEM;
+    }
+    *len = fread(*data, 1, (size_t)size, fp);
+    fclose(fp);
+    return 0;
+}
+
+static uint64_t real_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void print_help(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <capture segment>...\n", name);
+    fprintf(stderr, "  --loop-us <us>     Virtual time per main loop iteration (default 5)\n");
+    fprintf(stderr, "  --rx-start <ms>    First byte arrives this long after power-on (default 0)\n");
+    fprintf(stderr, "  --linger <ms>      Keep running after the last byte (default 100)\n");
+    fprintf(stderr, "  --cdc <path>       Write the CDC output to <path> (- = stdout)\n");
+    fprintf(stderr, "  --cdc-connect <ms> The host opens the CDC port at <ms> (default 1000)\n");
+    fprintf(stderr, "  --no-cdc           Run with no USB host connected\n");
+    fprintf(stderr, "  --cdc-in <path>    Send the file to the firmware once CDC is connected\n");
+    fprintf(stderr, "  --flash <path>     Flash image: loaded if it exists, written back after\n");
+    fprintf(stderr, "  --csync <hz>,<hs low>,<hs high>,<vs low>,<vs high>\n");
+    fprintf(stderr, "                     Sync timing core1 measures, in cycles of <hz>\n");
+    fprintf(stderr, "  --max-flushes-per-frame <x>\n");
+    fprintf(stderr, "                     Fail if the firmware flushes CDC more often\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Segments are uncompressed ibus_linux --capture files (or ibus_sim --capture).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    pico_host_config_t cfg = {
+        .loop_us        = 5,
+        .linger_us      = 100000u,
+        .cdc_connect_us = 1000000u,
+    };
+    uint64_t start_us = 0, base_us = 0;
+    uint8_t *cdc_in = NULL;
+    const char *flash_path = NULL;
+    double max_flushes = -1.0;
+    csync_measurement_t csync;
+    int opt, ret = EXIT_SUCCESS;
+
+    enum { OPT_LOOP_US = 0x100, OPT_RX_START, OPT_LINGER, OPT_CDC, OPT_CDC_CONNECT,
+           OPT_NO_CDC, OPT_CDC_IN, OPT_FLASH, OPT_CSYNC,
+           OPT_MAX_FLUSHES };
+    static const struct option long_options[] = {
+        { "loop-us",               required_argument, NULL, OPT_LOOP_US     },
+        { "rx-start",              required_argument, NULL, OPT_RX_START    },
+        { "linger",                required_argument, NULL, OPT_LINGER      },
+        { "cdc",                   required_argument, NULL, OPT_CDC         },
+        { "cdc-connect",           required_argument, NULL, OPT_CDC_CONNECT },
+        { "no-cdc",                no_argument,       NULL, OPT_NO_CDC      },
+        { "cdc-in",                required_argument, NULL, OPT_CDC_IN      },
+        { "flash",                 required_argument, NULL, OPT_FLASH       },
+        { "csync",                 required_argument, NULL, OPT_CSYNC       },
+        { "max-flushes-per-frame", required_argument, NULL, OPT_MAX_FLUSHES },
+        { NULL,                    0,                 NULL, 0               }
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_LOOP_US:
+            cfg.loop_us = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case OPT_RX_START:
+            start_us = strtoull(optarg, NULL, 10) * 1000u;
+            break;
+        case OPT_LINGER:
+            cfg.linger_us = strtoull(optarg, NULL, 10) * 1000u;
+            break;
+        case OPT_CDC:
+            cfg.cdc_out = strcmp(optarg, "-") == 0 ? stdout : fopen(optarg, "w");
+            if (!cfg.cdc_out) {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_CDC_CONNECT:
+            cfg.cdc_connect_us = strtoull(optarg, NULL, 10) * 1000u;
+            break;
+        case OPT_NO_CDC:
+            cfg.cdc_connect_us = UINT64_MAX;
+            break;
+        case OPT_CDC_IN: {
+            int res = file_load(optarg, &cdc_in, &cfg.cdc_in_len);
+            if (res < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(-res));
+                return EXIT_FAILURE;
+            }
+            cfg.cdc_in = cdc_in;
+            break;
+        }
+        case OPT_FLASH:
+            flash_path = optarg;
+            break;
+        case OPT_CSYNC:
+            if (sscanf(optarg, "%u,%u,%u,%u,%u", &csync.sys_hz, &csync.hs_low,
+                       &csync.hs_high, &csync.vs_low, &csync.vs_high) != 5) {
+                fprintf(stderr, "--csync: expected <hz>,<hs low>,<hs high>,<vs low>,<vs high>\n");
+                return EXIT_FAILURE;
+            }
+            cfg.csync = &csync;
+            break;
+        case OPT_MAX_FLUSHES:
+            max_flushes = strtod(optarg, NULL);
+            break;
+        default:
+            print_help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        int res = capture_load(argv[i], start_us, &base_us);
+        if (res < 0) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(-res));
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset(pico_host_flash, 0xFF, sizeof(pico_host_flash));
+    if (flash_path) {
+        FILE *fp = fopen(flash_path, "rb");
+        if (fp) {
+            if (fread(pico_host_flash, 1, sizeof(pico_host_flash), fp) == 0)
+                fprintf(stderr, "%s: empty flash image\n", flash_path);
+            fclose(fp);
+        }
+    }
+
+    cfg.rx         = rx_bytes;
+    cfg.rx_time_us = rx_times;
+    cfg.rx_len     = rx_len;
+
+    uint64_t t0 = real_ns();
+    pico_host_run(&cfg);
+    uint64_t elapsed_ns = real_ns() - t0;
+
+    const pico_host_stats_t *s = pico_host_get_stats();
+    const ibus_stats_t *is = ibus_get_stats();
+    double frames = is->frames ? (double)is->frames : 1.0;
+
+    fprintf(stderr, "pico_host: %llu bytes, %lu frames (%lu checksum errors), "
+            "%llu UART overruns\n",
+            (unsigned long long)s->uart_bytes, (unsigned long)is->frames,
+            (unsigned long)is->checksum_errors,
+            (unsigned long long)s->uart_overruns);
+    fprintf(stderr, "pico_host: %.3f s virtual, main loop entered at %.3f s, "
+            "%.3f s in sleep\n",
+            (double)s->now_us / 1e6, (double)s->first_loop_us / 1e6,
+            (double)s->sleep_us / 1e6);
+    fprintf(stderr, "pico_host: %llu loop iterations in %.3f s real (%.1f ns/iteration)\n",
+            (unsigned long long)s->loop_iterations, (double)elapsed_ns / 1e9,
+            s->loop_iterations ? (double)elapsed_ns / (double)s->loop_iterations : 0.0);
+    fprintf(stderr, "pico_host: CDC %llu writes, %llu flushes (%.1f/frame), "
+            "%llu packets, %llu bytes, %llu dropped\n",
+            (unsigned long long)s->cdc_writes, (unsigned long long)s->cdc_flushes,
+            (double)s->cdc_flushes / frames, (unsigned long long)s->cdc_packets,
+            (unsigned long long)s->cdc_bytes, (unsigned long long)s->cdc_dropped);
+    fprintf(stderr, "pico_host: I2C %llu transfers, %llu bytes, %.3f ms blocked\n",
+            (unsigned long long)s->i2c_transfers, (unsigned long long)s->i2c_bytes,
+            (double)s->i2c_busy_us / 1e3);
+    fprintf(stderr, "pico_host: %lu headunit state changes, %lu suppressed\n",
+            (unsigned long)ibus_get_state_stats()->changes,
+            (unsigned long)ibus_get_state_stats()->suppressed);
+    if (s->alarms_fired)
+        fprintf(stderr, "pico_host: %llu alarms fired\n", (unsigned long long)s->alarms_fired);
+    if (s->flash_erases || s->flash_programs)
+        fprintf(stderr, "pico_host: flash %llu sectors erased, %llu pages programmed\n",
+                (unsigned long long)s->flash_erases, (unsigned long long)s->flash_programs);
+
+    if (flash_path) {
+        FILE *fp = fopen(flash_path, "wb");
+        if (!fp || fwrite(pico_host_flash, 1, sizeof(pico_host_flash), fp) !=
+                   sizeof(pico_host_flash)) {
+            perror(flash_path);
+            ret = EXIT_FAILURE;
+        }
+        if (fp)
+            fclose(fp);
+    }
+
+    if (max_flushes >= 0.0 && (double)s->cdc_flushes / frames > max_flushes) {
+        fprintf(stderr, "pico_host: more than %.1f CDC flushes per frame\n", max_flushes);
+        ret = EXIT_FAILURE;
+    }
+
+    if (cfg.cdc_out && cfg.cdc_out != stdout)
+        fclose(cfg.cdc_out);
+    free(rx_bytes);
+    free(rx_times);
+    free(cdc_in);
+    return ret;
+}
@@ -0,0 +1,19 @@
+// tusb.h (host shim)
+// CDC device side only: a CFG_TUD_CDC_TX_BUFSIZE FIFO drained by one
+// bulk IN packet per USB frame, and RX from pico_host_config_t.cdc_in,
+// see pico_hal_host.h.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tusb_config.h"
+
+bool     tusb_init(void);
+void     tud_task(void);
+bool     tud_cdc_connected(void);
+uint32_t tud_cdc_write(const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_available(void);
+uint32_t tud_cdc_available(void);
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_flush(void);
@@ -6,12 +6,17 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdarg.h>
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
 #include "hardware/i2c.h"
 #include "hardware/uart.h"
 #include "hardware/gpio.h"
@@ -20,10 +25,12 @@
 #include "tusb.h"
 
 #include "ibus_protocol.h"
+#include "ibus_latency.h"
+#include "ibus_keymap.h"
+#include "ibus_input.h"
+#include "ibus_timer.h"
 
-// External CSYNC core entry points
-void csync_init(void);
-void csync_run(void);
+#include "csync.h"
 
 // =========================
 // Compile-time configuration
@@ -56,6 +63,11 @@ void csync_run(void);
 #ifndef IBUS_PICO_I2C_BAUDRATE
 #define IBUS_PICO_I2C_BAUDRATE   100000u
 #endif
+// Upper bound for one queued I2C transfer (a missing or hung device must
+// not stall the I-Bus receive loop).
+#ifndef IBUS_PICO_I2C_TIMEOUT_US
+#define IBUS_PICO_I2C_TIMEOUT_US 2000u
+#endif
 
 // Inter-byte timeout that indicates "end of current I-Bus message burst".
 #ifndef IBUS_PICO_CHAR_TIMEOUT_US
@@ -76,42 +88,104 @@ void csync_run(void);
 #define IBUS_PICO_VIDEO_GPIO_ACTIVE_LEVEL 1
 #endif
 
-// Enable/disable verbose logging over USB CDC.
+// Logging over USB CDC at boot: 1 = all trace categories, 0 = none. Can be
+// changed at runtime with the "trace" command (and saved to flash).
 #ifndef IBUS_PICO_TRACE
 #define IBUS_PICO_TRACE           1
 #endif
 
+// Period of the per-frame latency histogram report over CDC (0 disables).
+#ifndef IBUS_PICO_LATENCY_REPORT_MS
+#define IBUS_PICO_LATENCY_REPORT_MS 60000u
+#endif
+
+// How often core0 picks up CSYNC lock/loss events from core1 to log them.
+#ifndef IBUS_PICO_CSYNC_POLL_MS
+#define IBUS_PICO_CSYNC_POLL_MS   100u
+#endif
+
+// RAM buffer for log output not yet taken by CDC (boot messages and the
+// first frames arrive before the host has opened the port).
+#ifndef IBUS_PICO_LOG_BUFFER
+#define IBUS_PICO_LOG_BUFFER      4096u
+#endif
+
+// Flash sector holding the settings saved with the "save" command.
+#ifndef IBUS_PICO_SETTINGS_OFFSET
+#define IBUS_PICO_SETTINGS_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#endif
+
+// =========================
+// Runtime settings
+// =========================
+
+// Trace categories, selected with the "trace" command. A disabled category
+// costs one test of trace_mask.
+#define TRACE_INFO      (1u << 0)   // boot, first frame, I2C errors, drops
+#define TRACE_FRAMES    (1u << 1)   // hex dump of frames (sender filter)
+#define TRACE_STATE     (1u << 2)   // headunit state changes
+#define TRACE_BUTTONS   (1u << 3)   // buttons and knob
+#define TRACE_LATENCY   (1u << 4)   // periodic latency histograms
+#define TRACE_ALL       (TRACE_INFO | TRACE_FRAMES | TRACE_STATE | \
+                         TRACE_BUTTONS | TRACE_LATENCY)
+
+#define TRACE_ON(cat)   ((settings.trace_mask & (cat)) != 0)
+
+#define SETTINGS_MAGIC   0x49425053u    // "IBPS"
+#define SETTINGS_VERSION 2u
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t trace_mask;
+    uint32_t char_timeout_us;
+    uint32_t sender_filter[8];      // bit set: frames from this sender are traced
+    uint8_t  hijack_state;
+    uint8_t  reserved[3];
+    ibus_state_filter_t state_filter;   // "confirm" and "dwell"
+    uint32_t checksum;              // FNV-1a of everything before it
+} pico_settings_t;
+
+static pico_settings_t settings;
+
+static bool sender_traced(uint8_t sender);
+
 // =========================
 // USB CDC logging helper
 // =========================
 
+// Log lines are queued in log_buf and handed to TinyUSB by cdc_log_task()
+// from the main loop, as much as its TX FIFO takes, with one flush. Nothing
+// is lost while CDC is not connected yet, until the buffer is full; then
+// new output is counted in log_dropped and reported once there is room.
+static char     log_buf[IBUS_PICO_LOG_BUFFER];
+static uint32_t log_head = 0;
+static uint32_t log_count = 0;
+static uint32_t log_dropped = 0;
+
 static void cdc_log_vprintf(const char *fmt, va_list ap)
 {
-#if IBUS_PICO_TRACE
-    if (!tud_cdc_connected()) return;
-
     char buf[256];
     int n = vsnprintf(buf, sizeof(buf), fmt, ap);
     if (n <= 0) return;
-    if (n > (int)sizeof(buf)) n = (int)sizeof(buf);
+    if (n > (int)sizeof(buf) - 1) n = (int)sizeof(buf) - 1;
 
-    tud_cdc_write(buf, (uint32_t)n);
-    tud_cdc_write_flush();
-#else
-    (void)fmt; (void)ap;
-#endif
+    if (log_count + (uint32_t)n > sizeof(log_buf)) {
+        log_dropped += (uint32_t)n;
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        log_buf[(log_head + log_count++) % sizeof(log_buf)] = buf[i];
+    }
 }
 
 static void cdc_log_printf(const char *fmt, ...)
 {
-#if IBUS_PICO_TRACE
     va_list ap;
     va_start(ap, fmt);
     cdc_log_vprintf(fmt, ap);
     va_end(ap);
-#else
-    (void)fmt;
-#endif
 }
 
 // Timestamp for logs (ms since boot, from TinyUSB board helper).
@@ -122,11 +196,138 @@ static uint32_t now_ms(void)
 
 static void log_prefix(void)
 {
-#if IBUS_PICO_TRACE
     cdc_log_printf("%lu.%03lu: ",
                    (unsigned long)(now_ms() / 1000u),
                    (unsigned long)(now_ms() % 1000u));
-#endif
+}
+
+// Move buffered log output to CDC; called once per main loop iteration.
+static void cdc_log_task(void)
+{
+    if (log_count == 0 || !tud_cdc_connected()) return;
+
+    uint32_t room = tud_cdc_write_available();
+    uint32_t sent = 0;
+    while (room > 0 && log_count > 0) {
+        uint32_t chunk = (uint32_t)sizeof(log_buf) - log_head;
+        if (chunk > log_count) chunk = log_count;
+        if (chunk > room) chunk = room;
+
+        uint32_t n = tud_cdc_write(&log_buf[log_head], chunk);
+        if (n == 0) break;
+        log_head   = (log_head + n) % (uint32_t)sizeof(log_buf);
+        log_count -= n;
+        room      -= n;
+        sent      += n;
+    }
+    if (sent > 0) {
+        tud_cdc_write_flush();
+    }
+
+    if (log_dropped > 0 && log_count == 0) {
+        uint32_t dropped = log_dropped;
+        log_dropped = 0;
+        log_prefix();
+        cdc_log_printf("%lu bytes of log output dropped\n", (unsigned long)dropped);
+    }
+}
+
+// =========================
+// Timer wheel (ibus_timer.c)
+// =========================
+
+// The wheel runs from the main loop; one alarm from the SDK's default alarm
+// pool, set for the wheel's next expiry, tells the loop when.
+static ibus_timer_wheel_t timer_wheel;
+static volatile bool timer_due = false;
+static alarm_id_t timer_alarm = 0;
+static uint64_t timer_alarm_us = 0;     // expiry the alarm is set for, 0 = none
+
+static int64_t timer_alarm_cb(alarm_id_t id, void *user_data)
+{
+    (void)id;
+    (void)user_data;
+    timer_due = true;
+    return 0;
+}
+
+static void timer_task(void)
+{
+    if (timer_due) {
+        timer_due = false;
+        timer_alarm_us = 0;
+        ibus_timer_run(&timer_wheel, time_us_64());
+    }
+
+    uint64_t next = ibus_timer_next(&timer_wheel);
+    if (next == timer_alarm_us) return;
+
+    if (timer_alarm_us != 0) {
+        cancel_alarm(timer_alarm);
+        timer_alarm_us = 0;
+    }
+    if (next != 0) {
+        timer_alarm = add_alarm_at(from_us_since_boot(next), timer_alarm_cb, NULL, true);
+        if (timer_alarm > 0) {
+            timer_alarm_us = next;
+        } else if (timer_alarm < 0) {
+            timer_due = true;   // no free alarm: poll from the next iteration
+        }
+    }
+}
+
+// =========================
+// Per-frame latency histograms
+// =========================
+
+static ibus_latency_t frame_latency;
+static uint64_t frame_dispatch_us = 0;  // dispatch time of the current frame
+static uint64_t first_frame_us = 0;     // boot to the first decoded frame
+
+static void latency_report(void)
+{
+    char line[192];
+
+    log_prefix();
+    cdc_log_printf("Boot to first frame: %llu us\n", (unsigned long long)first_frame_us);
+    cdc_log_printf("Frame latency (us):\n");
+    for (unsigned i = 0; i < IBUS_LAT_STAGES; ++i) {
+        ibus_hist_format(&frame_latency.stage[i],
+                         ibus_latency_stage_name((ibus_lat_stage_t)i),
+                         line, sizeof(line));
+        cdc_log_printf("  %s\n", line);
+    }
+}
+
+// =========================
+// CSYNC supervisor events (core1, csync.c)
+// =========================
+
+static uint32_t csync_losses_seen = 0;
+static uint32_t csync_locks_seen = 0;   // locks + relocks
+
+static void csync_task(void)
+{
+    csync_status_t st;
+    char mode[96];
+
+    if (!csync_get_status(&st)) return;
+
+    if (st.losses != csync_losses_seen) {
+        csync_losses_seen = st.losses;
+        if (TRACE_ON(TRACE_INFO)) {
+            log_prefix();
+            cdc_log_printf("CSYNC lost (%lu losses)\n", (unsigned long)st.losses);
+        }
+    }
+    if (st.locks + st.relocks != csync_locks_seen) {
+        csync_locks_seen = st.locks + st.relocks;
+        if (TRACE_ON(TRACE_INFO)) {
+            csync_timing_format(&st.mode, mode, sizeof(mode));
+            log_prefix();
+            cdc_log_printf("CSYNC %s: %s\n", st.losses ? "re-locked" : "locked", mode);
+        }
+    }
 }
 
 // =========================
@@ -148,60 +349,95 @@ static void ibus_video_gpio_set(bool on)
 #endif
 }
 
-void ibus_platform_state_changed(ibus_state_t new_state, ibus_state_t hijack_state)
+void ibus_platform_state_changed(ibus_state_t new_state, ibus_state_t hijack_state,
+                                 const ibus_msg_view_t *msg)
 {
-#if IBUS_PICO_TRACE
-    log_prefix();
-    cdc_log_printf("State changed: %d (hijack=%d)\n", (int)new_state, (int)hijack_state);
-#else
-    (void)new_state; (void)hijack_state;
-#endif
+    if (TRACE_ON(TRACE_STATE)) {
+        log_prefix();
+        cdc_log_printf("State changed: %d (hijack=%d)\n", (int)new_state, (int)hijack_state);
+    }
 
     if (new_state == IBUS_STATE_CD_CHANGER) {
         ibus_i2c_mode_tv();
     } else {
         ibus_i2c_mode_bmw();
     }
+
+    ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us, time_us_64());
 }
 
-void ibus_platform_button_event(uint8_t button_code, uint8_t released, uint8_t long_press)
+void ibus_platform_button_event(uint8_t button_code, uint8_t released, uint8_t long_press,
+                                const ibus_msg_view_t *msg)
 {
-#if IBUS_PICO_TRACE
-    log_prefix();
-    cdc_log_printf("Button code=%u %s %s\n",
-                   (unsigned)button_code,
-                   released ? "RELEASE" : "PRESS",
-                   long_press ? "LONG" : "SHORT");
-#else
-    (void)button_code; (void)released; (void)long_press;
-#endif
+    if (TRACE_ON(TRACE_BUTTONS)) {
+        log_prefix();
+        cdc_log_printf("Button code=%u %s %s\n",
+                       (unsigned)button_code,
+                       released ? "RELEASE" : "PRESS",
+                       long_press ? "LONG" : "SHORT");
+    }
+
+    // Built-in keymap (keymaps/default.keymap), keys only in the hijack state
+    ibus_state_t hijack = ibus_get_hijack_state();
+    int enabled = hijack != IBUS_STATE_UNKNOWN && ibus_get_state() == hijack;
+    ibus_input_button(button_code, released, long_press, hijack, enabled, time_us_64());
+
+    ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us, time_us_64());
 }
 
-void ibus_platform_knob_event(int clockwise, uint8_t steps)
+// Key events from ibus_input.c, also from its timers (autorepeat, long press,
+// auto-release). There is no HID interface yet, so they are only traced.
+void ibus_platform_key_event(uint16_t key, int value)
 {
-#if IBUS_PICO_TRACE
-    log_prefix();
-    cdc_log_printf("Knob %s steps=%u\n",
-                   clockwise ? "CW" : "CCW",
-                   (unsigned)steps);
-#else
-    (void)clockwise; (void)steps;
-#endif
+    if (TRACE_ON(TRACE_BUTTONS)) {
+        log_prefix();
+        cdc_log_printf("Key %u %s\n", (unsigned)key,
+                       value == IBUS_KEY_PRESS ? "press" :
+                       value == IBUS_KEY_REPEAT ? "repeat" : "release");
+    }
 }
 
-void ibus_platform_log_message(const uint8_t *msg, uint8_t len)
+void ibus_platform_knob_event(int clockwise, uint8_t steps, const ibus_msg_view_t *msg)
 {
-#if IBUS_PICO_TRACE
-    // Light-weight hex dump to CDC (can be verbose).
-    log_prefix();
-    cdc_log_printf("IBUS len=%u: ", (unsigned)len);
-    for (uint8_t i = 0; i < len; i++) {
-        cdc_log_printf("%02X ", msg[i]);
+    if (TRACE_ON(TRACE_BUTTONS)) {
+        log_prefix();
+        cdc_log_printf("Knob %s steps=%u\n",
+                       clockwise ? "CW" : "CCW",
+                       (unsigned)steps);
+    }
+
+    ibus_latency_output_done(&frame_latency, msg, frame_dispatch_us, time_us_64());
+}
+
+void ibus_platform_log_message(const ibus_msg_view_t *msg)
+{
+    // First hook for every frame: this is its dispatch time.
+    frame_dispatch_us = time_us_64();
+    ibus_latency_dispatched(&frame_latency, msg, frame_dispatch_us);
+
+    if (first_frame_us == 0) {
+        // The timer starts at 0 on reset, so this is boot to first frame.
+        first_frame_us = frame_dispatch_us;
+        if (TRACE_ON(TRACE_INFO)) {
+            log_prefix();
+            cdc_log_printf("First frame %llu us after boot\n",
+                           (unsigned long long)first_frame_us);
+        }
+    }
+
+    if (TRACE_ON(TRACE_FRAMES) && sender_traced(msg->sender)) {
+        // Light-weight hex dump to CDC (can be verbose), one write per frame.
+        char hex[3 * 64 + 1];
+        size_t pos = 0;
+        for (uint16_t i = 0; i < msg->raw_len && pos + 3 < sizeof(hex); i++) {
+            pos += (size_t)snprintf(&hex[pos], sizeof(hex) - pos, "%02X ", msg->raw[i]);
+        }
+        hex[pos] = '\0';
+
+        log_prefix();
+        cdc_log_printf("IBUS len=%u: %s%s\n", (unsigned)msg->raw_len, hex,
+                       pos / 3 < msg->raw_len ? "..." : "");
     }
-    cdc_log_printf("\n");
-#else
-    (void)msg; (void)len;
-#endif
 }
 
 // =========================
@@ -241,23 +477,62 @@ static void ibus_i2c_init(void)
     gpio_pull_up(IBUS_PICO_I2C_SCL_PIN);
 }
 
+// Mode switches are queued and sent by ibus_i2c_task() from the main loop,
+// one transfer per iteration, so neither boot nor the decoder's state hook
+// waits for the I2C bus.
+#define IBUS_I2C_QUEUE_LEN 8u
+
+typedef struct {
+    uint8_t addr;
+    uint8_t len;
+    uint8_t data[2];
+} ibus_i2c_xfer_t;
+
+static ibus_i2c_xfer_t i2c_queue[IBUS_I2C_QUEUE_LEN];
+static uint8_t i2c_queue_head = 0;
+static uint8_t i2c_queue_count = 0;
+
 static int ibus_i2c_write_bytes(uint8_t addr, const uint8_t *data, size_t len)
 {
-    if (!data || len == 0) return -1;
+    if (!data || len == 0 || len > sizeof(i2c_queue[0].data)) return -1;
+    if (i2c_queue_count == IBUS_I2C_QUEUE_LEN) return -2;
+
+    ibus_i2c_xfer_t *x = &i2c_queue[(i2c_queue_head + i2c_queue_count++) % IBUS_I2C_QUEUE_LEN];
+    x->addr = addr;
+    x->len  = (uint8_t)len;
+    memcpy(x->data, data, len);
+    return 0;
+}
+
+// Send the next queued transfer, if any.
+static void ibus_i2c_task(void)
+{
+    if (i2c_queue_count == 0) return;
 
-    int written = i2c_write_blocking(
+    const ibus_i2c_xfer_t *x = &i2c_queue[i2c_queue_head];
+    int written = i2c_write_timeout_us(
         IBUS_PICO_I2C_PORT,
-        addr,
-        data,
-        len,
-        false // send STOP condition
+        x->addr,
+        x->data,
+        x->len,
+        false, // send STOP condition
+        IBUS_PICO_I2C_TIMEOUT_US
     );
 
-    return (written == (int)len) ? 0 : -2;
+    if (written != (int)x->len && TRACE_ON(TRACE_INFO)) {
+        log_prefix();
+        cdc_log_printf("I2C write to 0x%02X failed (%d)\n", (unsigned)x->addr, written);
+    }
+
+    i2c_queue_head = (uint8_t)((i2c_queue_head + 1u) % IBUS_I2C_QUEUE_LEN);
+    i2c_queue_count--;
 }
 
+// A new mode replaces whatever is still queued for the previous one.
 static void ibus_i2c_mode_bmw(void)
 {
+    i2c_queue_count = 0;
+
     const uint8_t val = 0x0F;
     (void)ibus_i2c_write_bytes(0x39, &val, 1);
 
@@ -266,6 +541,8 @@ static void ibus_i2c_mode_bmw(void)
 
 static void ibus_i2c_mode_tv(void)
 {
+    i2c_queue_count = 0;
+
     const uint8_t val = 0x17;
     (void)ibus_i2c_write_bytes(0x39, &val, 1);
 
@@ -282,38 +559,405 @@ static void ibus_i2c_mode_tv(void)
     ibus_video_gpio_set(true);
 }
 
+// =========================
+// Settings and CDC command channel
+// =========================
+
+// One command per line on the CDC port; the reply ends with "ok" or
+// "error: ...". Changes apply at once and are kept over a reset after "save".
+//
+//   show                       current settings
+//   trace [+|-]<cat>...        info frames state buttons latency all none
+//   filter all|none|+XX|-XX... senders (hex) whose frames are traced
+//   hijack none|fm|tape|aux|cdc
+//   timeout <us>               char timeout that ends a frame
+//   confirm <from>:<to>=<n>... frames needed for a headunit state change
+//   dwell <ms>                 time a headunit state is kept at least
+//   save | defaults
+
+_Static_assert(sizeof(pico_settings_t) <= FLASH_PAGE_SIZE, "settings exceed a flash page");
+
+static const struct { const char *name; uint32_t mask; } trace_names[] = {
+    { "info",    TRACE_INFO    },
+    { "frames",  TRACE_FRAMES  },
+    { "state",   TRACE_STATE   },
+    { "buttons", TRACE_BUTTONS },
+    { "latency", TRACE_LATENCY },
+    { "all",     TRACE_ALL     },
+    { "none",    0             },
+};
+
+static const struct { const char *name; ibus_state_t state; } hijack_names[] = {
+    { "none", IBUS_STATE_UNKNOWN     },
+    { "fm",   IBUS_STATE_FM          },
+    { "tape", IBUS_STATE_TAPE        },
+    { "aux",  IBUS_STATE_AUX         },
+    { "cdc",  IBUS_STATE_CD_CHANGER  },
+};
+
+static char     cmd_line[96];
+static uint32_t cmd_len = 0;
+static bool     cmd_overflow = false;
+
+static uint32_t settings_checksum(const pico_settings_t *s)
+{
+    const uint8_t *p = (const uint8_t *)s;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < offsetof(pico_settings_t, checksum); i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void settings_defaults(pico_settings_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->magic           = SETTINGS_MAGIC;
+    s->version         = SETTINGS_VERSION;
+    s->size            = (uint16_t)sizeof(*s);
+    s->trace_mask      = IBUS_PICO_TRACE ? TRACE_ALL : 0u;
+    s->char_timeout_us = IBUS_PICO_CHAR_TIMEOUT_US;
+    s->hijack_state    = (uint8_t)IBUS_PICO_HIJACK_STATE;
+    memset(s->sender_filter, 0xFF, sizeof(s->sender_filter));
+}
+
+// Settings from the flash sector if "save" ever wrote it, else defaults.
+static void settings_load(void)
+{
+    const pico_settings_t *stored =
+        (const pico_settings_t *)(XIP_BASE + IBUS_PICO_SETTINGS_OFFSET);
+
+    if (stored->magic == SETTINGS_MAGIC &&
+        stored->version == SETTINGS_VERSION &&
+        stored->size == sizeof(pico_settings_t) &&
+        stored->checksum == settings_checksum(stored)) {
+        settings = *stored;
+    } else {
+        settings_defaults(&settings);
+    }
+}
+
+// Runs through flash_safe_execute(): core 1 and interrupts are held off
+// while XIP is unavailable.
+static void settings_flash_write(void *page)
+{
+    flash_range_erase(IBUS_PICO_SETTINGS_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(IBUS_PICO_SETTINGS_OFFSET, page, FLASH_PAGE_SIZE);
+}
+
+static int settings_save(void)
+{
+    static uint8_t page[FLASH_PAGE_SIZE];
+
+    settings.checksum = settings_checksum(&settings);
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &settings, sizeof(settings));
+    return flash_safe_execute(settings_flash_write, page, 100);
+}
+
+static bool sender_traced(uint8_t sender)
+{
+    return (settings.sender_filter[sender >> 5] & (1u << (sender & 31u))) != 0;
+}
+
+static void sender_trace_set(uint8_t sender, bool on)
+{
+    if (on) {
+        settings.sender_filter[sender >> 5] |= 1u << (sender & 31u);
+    } else {
+        settings.sender_filter[sender >> 5] &= ~(1u << (sender & 31u));
+    }
+}
+
+static void cmd_show(void)
+{
+    unsigned traced = 0;
+
+    cdc_log_printf("trace");
+    for (size_t i = 0; i < sizeof(trace_names) / sizeof(trace_names[0]); i++) {
+        uint32_t m = trace_names[i].mask;
+        if (m != TRACE_ALL && m != 0 && (settings.trace_mask & m)) {
+            cdc_log_printf(" %s", trace_names[i].name);
+        }
+    }
+    cdc_log_printf(settings.trace_mask ? "\n" : " none\n");
+
+    // Printed as a command that restores the same filter
+    for (unsigned s = 0; s < 256; s++) {
+        traced += sender_traced((uint8_t)s);
+    }
+    cdc_log_printf("filter %s", traced >= 128 ? "all" : "none");
+    for (unsigned s = 0; s < 256; s++) {
+        if (sender_traced((uint8_t)s) != (traced >= 128)) {
+            cdc_log_printf(" %c%02X", traced >= 128 ? '-' : '+', s);
+        }
+    }
+    cdc_log_printf("\n");
+
+    for (size_t i = 0; i < sizeof(hijack_names) / sizeof(hijack_names[0]); i++) {
+        if (hijack_names[i].state == (ibus_state_t)settings.hijack_state) {
+            cdc_log_printf("hijack %s\n", hijack_names[i].name);
+        }
+    }
+    cdc_log_printf("timeout %lu\n", (unsigned long)settings.char_timeout_us);
+
+    // Also printed as commands: everything at once, then the exceptions
+    cdc_log_printf("confirm *:*=1");
+    for (int from = 0; from < IBUS_STATE_COUNT; from++) {
+        for (int to = 0; to < IBUS_STATE_COUNT; to++) {
+            if (settings.state_filter.confirm[from][to] > 1) {
+                cdc_log_printf(" %s:%s=%u", ibus_state_name((ibus_state_t)from),
+                               ibus_state_name((ibus_state_t)to),
+                               (unsigned)settings.state_filter.confirm[from][to]);
+            }
+        }
+    }
+    cdc_log_printf("\ndwell %lu\n", (unsigned long)(settings.state_filter.min_dwell_us / 1000u));
+    cdc_log_printf("state changes %lu, suppressed %lu\n",
+                   (unsigned long)ibus_get_state_stats()->changes,
+                   (unsigned long)ibus_get_state_stats()->suppressed);
+}
+
+static const char *cmd_trace(int argc, char **argv)
+{
+    uint32_t mask = settings.trace_mask;
+
+    for (int a = 1; a < argc; a++) {
+        const char *name = argv[a];
+        char op = (name[0] == '+' || name[0] == '-') ? *name++ : '=';
+        size_t i;
+
+        for (i = 0; i < sizeof(trace_names) / sizeof(trace_names[0]); i++) {
+            if (strcasecmp(name, trace_names[i].name) == 0) break;
+        }
+        if (i == sizeof(trace_names) / sizeof(trace_names[0])) return "unknown category";
+
+        if (op == '+') {
+            mask |= trace_names[i].mask;
+        } else if (op == '-') {
+            mask &= ~trace_names[i].mask;
+        } else {
+            // A plain list names exactly the categories wanted
+            mask = (a == 1 ? 0u : mask) | trace_names[i].mask;
+        }
+    }
+    settings.trace_mask = mask;
+    return NULL;
+}
+
+static const char *cmd_filter(int argc, char **argv)
+{
+    if (argc < 2) return "missing senders";
+
+    for (int a = 1; a < argc; a++) {
+        const char *arg = argv[a];
+        char *end;
+
+        if (strcasecmp(arg, "all") == 0 || strcasecmp(arg, "none") == 0) {
+            memset(settings.sender_filter, arg[0] == 'a' || arg[0] == 'A' ? 0xFF : 0x00,
+                   sizeof(settings.sender_filter));
+            continue;
+        }
+        if (arg[0] != '+' && arg[0] != '-') return "expected +XX or -XX";
+
+        unsigned long sender = strtoul(&arg[1], &end, 16);
+        if (end == &arg[1] || *end != '\0' || sender > 0xFF) return "bad sender";
+        sender_trace_set((uint8_t)sender, arg[0] == '+');
+    }
+    return NULL;
+}
+
+static const char *cmd_hijack(int argc, char **argv)
+{
+    if (argc != 2) return "usage: hijack none|fm|tape|aux|cdc";
+
+    for (size_t i = 0; i < sizeof(hijack_names) / sizeof(hijack_names[0]); i++) {
+        if (strcasecmp(argv[1], hijack_names[i].name) == 0) {
+            settings.hijack_state = (uint8_t)hijack_names[i].state;
+            ibus_set_hijack_state(hijack_names[i].state);
+            return NULL;
+        }
+    }
+    return "unknown state";
+}
+
+static const char *cmd_timeout(int argc, char **argv)
+{
+    char *end;
+
+    if (argc != 2) return "usage: timeout <us>";
+    unsigned long us = strtoul(argv[1], &end, 10);
+    // At least one byte time at 9600 baud, at most a clearly idle bus
+    if (*end != '\0' || us < 1200u || us > 100000u) return "expected 1200..100000";
+    settings.char_timeout_us = (uint32_t)us;
+    return NULL;
+}
+
+static const char *cmd_confirm(int argc, char **argv)
+{
+    ibus_state_filter_t filter = settings.state_filter;
+
+    if (argc < 2) return "usage: confirm <from>:<to>=<n>...";
+    for (int a = 1; a < argc; a++) {
+        if (ibus_state_filter_parse(&filter, argv[a]) < 0) return "expected <from>:<to>=<n>";
+    }
+    settings.state_filter = filter;
+    ibus_set_state_filter(&settings.state_filter);
+    return NULL;
+}
+
+static const char *cmd_dwell(int argc, char **argv)
+{
+    char *end;
+
+    if (argc != 2) return "usage: dwell <ms>";
+    unsigned long ms = strtoul(argv[1], &end, 10);
+    if (*end != '\0' || ms > 60000u) return "expected 0..60000";
+    settings.state_filter.min_dwell_us = (uint32_t)ms * 1000u;
+    ibus_set_state_filter(&settings.state_filter);
+    return NULL;
+}
+
+static void cmd_csync(void)
+{
+    csync_status_t st;
+    char mode[96];
+
+    if (!csync_get_status(&st)) {
+        cdc_log_printf("csync not started\n");
+        return;
+    }
+    csync_timing_format(&st.mode, mode, sizeof(mode));
+    cdc_log_printf("csync %s %s: %s\n", st.locked ? "locked" : "searching",
+                   st.detected ? "detected" : "built-in", mode);
+    cdc_log_printf("csync hs %lu/%lu vs %lu/%lu cycles at %lu Hz\n",
+                   (unsigned long)st.measured.hs_low, (unsigned long)st.measured.hs_high,
+                   (unsigned long)st.measured.vs_low, (unsigned long)st.measured.vs_high,
+                   (unsigned long)st.measured.sys_hz);
+    cdc_log_printf("csync %lu locks %lu losses %lu relocks %lu loads\n",
+                   (unsigned long)st.locks, (unsigned long)st.losses,
+                   (unsigned long)st.relocks, (unsigned long)st.reloads);
+}
+
+static void cmd_execute(char *line)
+{
+    char *argv[16];
+    int argc = 0;
+    const char *err = NULL;
+
+    for (char *p = strtok(line, " \t"); p && argc < 16; p = strtok(NULL, " \t")) {
+        argv[argc++] = p;
+    }
+    if (argc == 0) return;
+
+    if (strcmp(argv[0], "show") == 0) {
+        cmd_show();
+    } else if (strcmp(argv[0], "trace") == 0) {
+        err = cmd_trace(argc, argv);
+    } else if (strcmp(argv[0], "filter") == 0) {
+        err = cmd_filter(argc, argv);
+    } else if (strcmp(argv[0], "hijack") == 0) {
+        err = cmd_hijack(argc, argv);
+    } else if (strcmp(argv[0], "timeout") == 0) {
+        err = cmd_timeout(argc, argv);
+    } else if (strcmp(argv[0], "confirm") == 0) {
+        err = cmd_confirm(argc, argv);
+    } else if (strcmp(argv[0], "dwell") == 0) {
+        err = cmd_dwell(argc, argv);
+    } else if (strcmp(argv[0], "csync") == 0) {
+        cmd_csync();
+    } else if (strcmp(argv[0], "save") == 0) {
+        int rc = settings_save();
+        if (rc != PICO_OK) {
+            cdc_log_printf("error: flash write failed (%d)\n", rc);
+            return;
+        }
+    } else if (strcmp(argv[0], "defaults") == 0) {
+        settings_defaults(&settings);
+        ibus_set_hijack_state((ibus_state_t)settings.hijack_state);
+        ibus_set_state_filter(&settings.state_filter);
+    } else {
+        err = "commands: show trace filter hijack timeout confirm dwell csync save defaults";
+    }
+
+    if (err) {
+        cdc_log_printf("error: %s\n", err);
+    } else {
+        cdc_log_printf("ok\n");
+    }
+}
+
+// Collect command lines from CDC; called once per main loop iteration.
+static void cdc_cmd_task(void)
+{
+    uint8_t buf[64];
+
+    while (tud_cdc_available() > 0) {
+        uint32_t n = tud_cdc_read(buf, sizeof(buf));
+        if (n == 0) break;
+
+        for (uint32_t i = 0; i < n; i++) {
+            char c = (char)buf[i];
+            if (c == '\r' || c == '\n') {
+                if (cmd_overflow) {
+                    cdc_log_printf("error: line too long\n");
+                } else if (cmd_len > 0) {
+                    cmd_line[cmd_len] = '\0';
+                    cmd_execute(cmd_line);
+                }
+                cmd_len = 0;
+                cmd_overflow = false;
+            } else if (cmd_len < sizeof(cmd_line) - 1) {
+                cmd_line[cmd_len++] = c;
+            } else {
+                cmd_overflow = true;
+            }
+        }
+    }
+}
+
 // Core1 entry point: run CSYNC generator
 static void core1_main(void)
 {
+    // Lets flash_safe_execute() on core 0 pause us while saving settings
+    multicore_lockout_victim_init();
     csync_init();
     csync_run();
 }
 
 int main(void)
 {
-    // TinyUSB board init + stack init.
+    // The bus may already be talking when the car wakes us up: start the
+    // UART and the decoder first. Nothing below waits; log output is
+    // buffered until the host opens the CDC port and the initial I2C mode
+    // is sent from the main loop.
     board_init();
-    tusb_init();
-
+    settings_load();
+    ibus_init((ibus_state_t)settings.hijack_state);
+    ibus_set_state_filter(&settings.state_filter);
+    ibus_latency_reset(&frame_latency);
+    ibus_timer_wheel_init(&timer_wheel, time_us_64());
+    ibus_input_init(&timer_wheel, NULL, &ibus_keymap_default);
     ibus_uart_init();
+
+    tusb_init();
     optional_video_gpio_init();
     multicore_launch_core1(core1_main);
     ibus_i2c_init();
     ibus_i2c_mode_bmw();
 
-    ibus_init(IBUS_PICO_HIJACK_STATE);
-
-#if IBUS_PICO_TRACE
-    // Give host a moment to enumerate CDC before we start logging.
-    sleep_ms(1200);
-    log_prefix();
-    cdc_log_printf("I-Bus CDC bridge started (UART RX pin=%u baud=%u hijack=%d)\n",
-                   (unsigned)IBUS_PICO_UART_RX_PIN,
-                   (unsigned)IBUS_PICO_UART_BAUD,
-                   (int)IBUS_PICO_HIJACK_STATE);
-#endif
+    if (TRACE_ON(TRACE_INFO)) {
+        log_prefix();
+        cdc_log_printf("I-Bus CDC bridge started (UART RX pin=%u baud=%u hijack=%d)\n",
+                       (unsigned)IBUS_PICO_UART_RX_PIN,
+                       (unsigned)IBUS_PICO_UART_BAUD,
+                       (int)settings.hijack_state);
+    }
 
     absolute_time_t last_rx_time = get_absolute_time();
+    bool gap_handled = true;
+    uint32_t last_latency_report_ms = now_ms();
+    uint32_t last_csync_poll_ms = now_ms();
 
     while (true) {
         // USB device task (CDC)
@@ -322,18 +966,46 @@ int main(void)
         // Read any pending UART bytes
         while (uart_is_readable(IBUS_PICO_UART_ID)) {
             uint8_t b = uart_getc(IBUS_PICO_UART_ID);
-            ibus_append_byte(b);
+            ibus_append_byte_ts(b, time_us_64());
             last_rx_time = get_absolute_time();
+            gap_handled  = false;
         }
 
         // If we have buffered data and no new byte has arrived for a bit,
-        // parse buffered messages.
-        if (ibus_has_pending_data()) {
+        // parse buffered messages. A partial frame left over waits for its
+        // remaining bytes.
+        if (ibus_has_pending_data() && !gap_handled) {
             int64_t idle_us = absolute_time_diff_us(last_rx_time, get_absolute_time());
-            if (idle_us > (int64_t)IBUS_PICO_CHAR_TIMEOUT_US) {
+            if (idle_us > (int64_t)settings.char_timeout_us) {
                 ibus_process_messages();
+                gap_handled = true;
+            }
+        }
+
+        // A headunit state change deferred by "dwell"
+        if (ibus_state_deadline() != 0 && time_us_64() >= ibus_state_deadline()) {
+            frame_dispatch_us = time_us_64();
+            ibus_state_poll(frame_dispatch_us);
+        }
+
+#if IBUS_PICO_LATENCY_REPORT_MS > 0
+        if (now_ms() - last_latency_report_ms >= IBUS_PICO_LATENCY_REPORT_MS) {
+            last_latency_report_ms = now_ms();
+            if (TRACE_ON(TRACE_LATENCY)) {
+                latency_report();
             }
         }
+#endif
+
+        if (now_ms() - last_csync_poll_ms >= IBUS_PICO_CSYNC_POLL_MS) {
+            last_csync_poll_ms = now_ms();
+            csync_task();
+        }
+
+        timer_task();
+        ibus_i2c_task();
+        cdc_cmd_task();
+        cdc_log_task();
 
         tight_loop_contents();
     }